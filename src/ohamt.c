@@ -16,10 +16,11 @@
 
 /**************************************************************************/
 
-void INIT_OHAMT_ROOT(struct ohamt_root *root, hash_fun hash, void *hash_ud)
+void INIT_OHAMT_ROOT(struct ohamt_root *root, hash_fun hash, void *hash_ud,
+		     int huge_pages, uint64_t defrag_waste)
 {
 	*root = (struct ohamt_root) {
-		.mem = mem_new(),
+		.mem = mem_new(huge_pages, defrag_waste),
 		.slot = {{0,0,0,0,0}},
 		.hash = hash,
 		.hash_ud = hash_ud};
@@ -472,8 +473,54 @@ void ohamt_erase(struct ohamt_root *root)
 	__ohamt_erase(root, &root->slot);
 }
 
+/* Nodes don't point to their parents, the way down is found with the
+ * hash of any leaf below the node. */
+static void __ohamt_move_node(struct ohamt_root *root, struct ohamt_slot slot)
+{
+	struct ohamt_slot leaf = slot;
+	while (!slot_is_leaf(leaf)) {
+		leaf = slot_to_node(root->mem, leaf)->slots[0];
+	}
+	uint128_t hash = root->hash(root->hash_ud, slot_to_leaf(leaf));
+
+	struct ohamt_slot *ptr = &root->slot;
+	int level = 0;
+	while (memcmp(ptr, &slot, sizeof(struct ohamt_slot)) != 0) {
+		struct ohamt_node *node = slot_to_node(root->mem, *ptr);
+		int slice = slice_get(hash, level);
+		assert(!slot_is_leaf(*ptr) && set_contains(node->mask, slice));
+		ptr = &node->slots[set_slot_number(node->mask, slice)];
+		level += 1;
+	}
+
+	struct ohamt_node *old_node = slot_to_node(root->mem, slot);
+	int size = set_count(old_node->mask);
+	struct ohamt_slot new_slot = slot_alloc(root->mem, size);
+	memcpy(slot_to_node(root->mem, new_slot), old_node,
+	       sizeof(struct ohamt_node) + sizeof(struct ohamt_slot)*size);
+	*ptr = new_slot;
+	__ohamt_free_slot(root, slot);
+}
+
+unsigned ohamt_defrag(struct ohamt_root *root, unsigned budget)
+{
+	unsigned moved = 0;
+	struct ohamt_slot slot;
+	while (moved < budget && mem_defrag_slot(root->mem, &slot)) {
+		__ohamt_move_node(root, slot);
+		moved += 1;
+	}
+	return moved;
+}
+
 void ohamt_allocated(struct ohamt_root *root,
 		     uint64_t *allocated_ptr, uint64_t *wasted_ptr)
 {
 	mem_allocated(root->mem, allocated_ptr, wasted_ptr);
 }
+
+void ohamt_node_counts(struct ohamt_root *root,
+		       uint64_t *allocs_ptr, uint64_t *frees_ptr)
+{
+	mem_counts(root->mem, allocs_ptr, frees_ptr);
+}
@@ -49,7 +49,9 @@ struct ohamt_root {
 };
 
 
-void INIT_OHAMT_ROOT(struct ohamt_root *root, hash_fun hash, void *hash_ud);
+/* 'huge_pages' and 'defrag_waste' as in mem_new(). */
+void INIT_OHAMT_ROOT(struct ohamt_root *root, hash_fun hash, void *hash_ud,
+		     int huge_pages, uint64_t defrag_waste);
 void FREE_OHAMT_ROOT(struct ohamt_root *root);
 
 
@@ -77,6 +79,11 @@ uint64_t ohamt_first(struct ohamt_root *root, struct ohamt_state *s);
 
 void ohamt_allocated(struct ohamt_root *root,
 		     uint64_t *allocated_ptr, uint64_t *wasted_ptr);
+void ohamt_node_counts(struct ohamt_root *root,
+		       uint64_t *allocs_ptr, uint64_t *frees_ptr);
+/* Move at most 'budget' nodes out of sparsely used memory pages, so
+ * the pages can be freed. Returns the number of nodes moved. */
+unsigned ohamt_defrag(struct ohamt_root *root, unsigned budget);
 
 
 #define OHAMT_NOT_FOUND (0)
@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <unistd.h>
+#include <malloc.h>
 #include <sys/mman.h>
 
 #include "config.h"
@@ -13,7 +14,6 @@
 #include "list.h"
 #include "ohamt.h"
 #include "ohamt_mem.h"
-#include "ohamt_bitmap.h"
 
 
 
@@ -30,13 +30,105 @@
 
 
 
+static unsigned page_size(struct mem *mem, unsigned width)
+{
+	unsigned sz = sizeof(struct mem_page) + CHUNK_SIZE(width) * CHUNKS_ON_PAGE + 3;
+	if (mem->huge_pages) {
+		sz = (sz + mem->cache_line_size - 1) & ~(mem->cache_line_size - 1);
+	}
+	return sz;
+}
+
+static unsigned pslot_get(struct mem *mem)
+{
+	if (mem->free_pslots_cnt) {
+		return mem->free_pslots[--mem->free_pslots_cnt];
+	}
+	if (mem->pslots_used == mem->pslots_sz) {
+		unsigned sz = mem->pslots_sz ? mem->pslots_sz * 2 : 256;
+		assert(sz <= PAGE_SLOTS_MAX);
+		mem->pslots = realloc(mem->pslots, sz * sizeof(struct mem_page *));
+		mem->free_pslots = realloc(mem->free_pslots, sz * sizeof(unsigned));
+		mem->pslots_sz = sz;
+	}
+	return mem->pslots_used++;
+}
+
+static void *arena_map(struct mem *mem, uint64_t size)
+{
+	void *ptr;
+	if (mem->huge_pages == MEM_PAGES_HUGETLB) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			return ptr;
+		}
+		/* No huge pages reserved, don't try again. */
+		mem->huge_pages = MEM_PAGES_THP;
+	}
+
+	/* Over-allocate to get a huge page aligned range. */
+	char *raw = mmap(NULL, size + ARENA_ALIGN, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) {
+		abort();
+	}
+	char *aligned = (char *)(((uintptr_t)raw + ARENA_ALIGN - 1) &
+				 ~(ARENA_ALIGN - 1));
+	if (aligned != raw) {
+		munmap(raw, aligned - raw);
+	}
+	munmap(aligned + size, raw + ARENA_ALIGN - aligned);
+	madvise(aligned, size, MADV_HUGEPAGE);
+	return aligned;
+}
+
+static char *arena_carve(struct mem *mem, unsigned sz)
+{
+	if (mem->arena_left < sz) {
+		/* The tail of the previous arena is lost. Arenas double
+		 * in size to keep the loss and the number of mappings
+		 * small. */
+		uint64_t size = mem->arena_next_size;
+		while (size < sz) {
+			size *= 2;
+		}
+		struct mem_arena *arena = malloc(sizeof(struct mem_arena));
+		arena->ptr = arena_map(mem, size);
+		arena->size = size;
+		list_add(&arena->in_list, &mem->list_of_arenas);
+		mem->arena_ptr = arena->ptr;
+		mem->arena_left = size;
+		if (size * 2 <= ARENA_SIZE_MAX) {
+			mem->arena_next_size = size * 2;
+		}
+	}
+	char *ptr = mem->arena_ptr;
+	mem->arena_ptr += sz;
+	mem->arena_left -= sz;
+	return ptr;
+}
+
 static inline struct mem_page *page_alloc(struct mem *mem, unsigned width)
 {
 	unsigned chunk_size = CHUNK_SIZE(width);
-	int sz = sizeof(struct mem_page) + chunk_size * CHUNKS_ON_PAGE + 3;
+	int sz = page_size(mem, width);
 	char *ptr;
-	if (posix_memalign((void*)&ptr, mem->cache_line_size, sz) != 0) {
-		abort();
+	if (mem->huge_pages) {
+		struct list_head *spare = &mem->list_of_spare_pages[width-1];
+		if (!list_empty(spare)) {
+			struct mem_page *page =
+				list_first_entry(spare, struct mem_page, in_list);
+			list_del(&page->in_list);
+			mem->spare -= page->released ? 0 : sz;
+			ptr = (char *)page;
+		} else {
+			ptr = arena_carve(mem, sz);
+		}
+	} else {
+		if (posix_memalign((void*)&ptr, mem->cache_line_size, sz) != 0) {
+			abort();
+		}
 	}
 	mem->pages_allocated ++;
 	mem->allocated += sz;
@@ -45,10 +137,10 @@ static inline struct mem_page *page_alloc(struct mem *mem, unsigned width)
 	INIT_LIST_HEAD(&page->in_list);
 	INIT_QUEUE_ROOT(&page->queue_of_free_chunks);
 	page->free_chunks = CHUNKS_ON_PAGE;
-	page->page_slot = bitmap_find_set(mem->pslots_mask, sizeof(mem->pslots_mask));
-	bitmap_clear(mem->pslots_mask, page->page_slot);
+	page->page_slot = pslot_get(mem);
 	mem->pslots[page->page_slot] = page;
 	page->width = width;
+	memset(page->live, 0, sizeof(page->live));
 
 	char *item = ptr + sizeof(struct mem_page);
 	int i;
@@ -59,17 +151,42 @@ static inline struct mem_page *page_alloc(struct mem *mem, unsigned width)
 	return page;
 }
 
+/* 'release' gives the memory back to the system now, rather than
+ * keeping it around for the next page. */
 static inline void page_free(struct mem *mem, struct mem_page *page,
-			     unsigned width)
+			     unsigned width, int release)
 {
-	int sz = sizeof(struct mem_page) + CHUNK_SIZE(width) * CHUNKS_ON_PAGE + 3;
+	int sz = page_size(mem, width);
 
 	mem->pages_allocated --;
 	mem->allocated -= sz;
-	bitmap_set(mem->pslots_mask, page->page_slot);
+	mem->free_pslots[mem->free_pslots_cnt++] = page->page_slot;
 	mem->pslots[page->page_slot] = NULL;
 	assert(page->free_chunks == CHUNKS_ON_PAGE);
-	free(page);
+	if (mem->huge_pages) {
+		if (release) {
+			/* Keep the header and the address range. */
+			uintptr_t start = ((uintptr_t)(page + 1) + 4095) & ~4095UL;
+			uintptr_t end = ((uintptr_t)page + sz) & ~4095UL;
+			if (start < end) {
+				madvise((void *)start, end - start,
+					MADV_DONTNEED);
+			}
+		}
+		list_add(&page->in_list, &mem->list_of_spare_pages[width-1]);
+		page->released = release;
+		mem->spare += release ? 0 : sz;
+	} else {
+		free(page);
+#ifdef __GLIBC__
+		/* Freed pages are in the middle of the heap. */
+		mem->drained += release ? sz : 0;
+		if (mem->drained >= DEFRAG_TRIM) {
+			malloc_trim(0);
+			mem->drained = 0;
+		}
+#endif
+	}
 }
 
 
@@ -93,6 +210,7 @@ static inline struct ohamt_slot chunk_to_slot(struct mem_page *page,
 struct ohamt_slot slot_alloc(struct mem *mem, unsigned width)
 {
 	mem->used += CHUNK_SIZE(width);
+	mem->allocs ++;
 	struct list_head *free_pages = &mem->list_of_free_pages[width-1];
 	struct mem_page *page;
 	if (!list_empty(free_pages)) {
@@ -107,13 +225,16 @@ struct ohamt_slot slot_alloc(struct mem *mem, unsigned width)
 	struct mem_chunk *chunk = \
 		container_of(qhead, struct mem_chunk, in_queue);
 	page->free_chunks --;
+	struct ohamt_slot slot = chunk_to_slot(page, chunk, width);
+	union item u = {.slot = slot};
+	page->live[u.node.index / 64] |= 1ULL << (u.node.index % 64);
 
 	if (unlikely(page->free_chunks == 0)) {
 		list_del(&page->in_list);
 		list_add(&page->in_list, &mem->list_of_busy_pages);
 	}
 
-	return chunk_to_slot(page, chunk, width);
+	return slot;
 }
 
 void slot_free(struct mem *mem, struct ohamt_slot slot)
@@ -129,7 +250,15 @@ void slot_free(struct mem *mem, struct ohamt_slot slot)
 	queue_put_head(&chunk->in_queue,
 		       &page->queue_of_free_chunks);
 	page->free_chunks ++;
+	page->live[u.node.index / 64] &= ~(1ULL << (u.node.index % 64));
+	mem->frees ++;
 
+	if (unlikely(page == mem->drain)) {
+		if (page->free_chunks == CHUNKS_ON_PAGE) {
+			mem->drain = NULL;
+			page_free(mem, page, U_WIDTH(u), 1);
+		}
+	} else
 	if (unlikely(page->free_chunks == 1)) {
 		list_del(&page->in_list);
 		list_add(&page->in_list, free_pages);
@@ -139,11 +268,74 @@ void slot_free(struct mem *mem, struct ohamt_slot slot)
 			/* Always keep one page hanging to avoid thrashing. */
 		} else {
 			list_del(&page->in_list);
-			page_free(mem, page, U_WIDTH(u));
+			page_free(mem, page, U_WIDTH(u), 0);
 		}
 	}
 }
 
+static struct mem_page *_drain_pick(struct mem *mem)
+{
+	/* Only worth it when a good part of the memory is wasted, and
+	 * not after every write when there is nothing to do. */
+	if (mem->allocated - mem->used < mem->used / 8 + mem->defrag_min_waste ||
+	    mem->frees < mem->drain_retry) {
+		return NULL;
+	}
+	struct mem_page *best = NULL;
+	uint64_t best_waste = 0;
+	unsigned i;
+	for(i=0; i < 64; i++) {
+		struct mem_page *sparse = NULL;
+		uint64_t free_chunks = 0;
+		struct list_head *head;
+		list_for_each(head, &mem->list_of_free_pages[i]) {
+			struct mem_page *page =
+				container_of(head, struct mem_page, in_list);
+			free_chunks += page->free_chunks;
+			if (page->free_chunks < CHUNKS_ON_PAGE &&
+			    (!sparse || page->free_chunks > sparse->free_chunks)) {
+				sparse = page;
+			}
+		}
+		/* Live chunks of the sparsest page must fit in the
+		 * other pages of the width. */
+		if (sparse == NULL || free_chunks < CHUNKS_ON_PAGE) {
+			continue;
+		}
+		uint64_t waste = free_chunks * CHUNK_SIZE(i+1);
+		if (waste > best_waste) {
+			best = sparse;
+			best_waste = waste;
+		}
+	}
+	if (best == NULL) {
+		mem->drain_retry = mem->frees + mem->defrag_retry;
+		return NULL;
+	}
+	list_del(&best->in_list);
+	return best;
+}
+
+int mem_defrag_slot(struct mem *mem, struct ohamt_slot *slot_ptr)
+{
+	if (mem->drain == NULL) {
+		mem->drain = _drain_pick(mem);
+		if (mem->drain == NULL) {
+			return 0;
+		}
+	}
+	struct mem_page *page = mem->drain;
+	unsigned i;
+	for(i=0; page->live[i] == 0; i++) {
+	}
+	unsigned index = i * 64 + __builtin_ctzll(page->live[i]);
+	struct mem_chunk *chunk = (struct mem_chunk *)
+		((char*)page + sizeof(struct mem_page) +
+		 CHUNK_SIZE(page->width) * index);
+	*slot_ptr = chunk_to_slot(page, chunk, page->width);
+	return 1;
+}
+
 static void _mem_do_thrashing(struct mem *mem)
 {
 	unsigned i;
@@ -157,22 +349,20 @@ static void _mem_do_thrashing(struct mem *mem)
 
 			if (page->free_chunks == CHUNKS_ON_PAGE) {
 				list_del(&page->in_list);
-				page_free(mem, page, width);
+				page_free(mem, page, width, 0);
 			}
 		}
 	}
 }
 
-struct mem *mem_new()
+struct mem *mem_new(int huge_pages, uint64_t defrag_waste)
 {
-	struct mem *mem = mmap(NULL, sizeof(struct mem),
-			   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
-			   -1, 0);
-	assert(mem != MAP_FAILED);
+	struct mem *mem = malloc(sizeof(struct mem));
+	memset(mem, 0, sizeof(struct mem));
 
 	mem->pages_allocated = 0;
 	mem->cache_line_size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
-	if (mem->cache_line_size == -1) {
+	if (mem->cache_line_size <= 0) {
 		mem->cache_line_size = 64;
 	}
 	mem->allocated = 0;
@@ -181,8 +371,19 @@ struct mem *mem_new()
 	int i;
 	for(i=0; i < 64; i++) {
 		INIT_LIST_HEAD(&mem->list_of_free_pages[i]);
+		INIT_LIST_HEAD(&mem->list_of_spare_pages[i]);
+	}
+	INIT_LIST_HEAD(&mem->list_of_arenas);
+	mem->huge_pages = huge_pages;
+	mem->arena_next_size = ARENA_ALIGN;
+	/* Small thresholds come with a short retry interval, or a
+	 * small index would hardly ever look for a page to drain. */
+	mem->defrag_min_waste = DEFRAG_MIN_WASTE;
+	mem->defrag_retry = DEFRAG_RETRY;
+	if (defrag_waste) {
+		mem->defrag_min_waste = defrag_waste;
+		mem->defrag_retry = defrag_waste / 64;
 	}
-	memset(mem->pslots_mask, 0xFF, sizeof(mem->pslots_mask));
 	return mem;
 }
 
@@ -192,16 +393,42 @@ void mem_free(struct mem *mem)
 	assert(mem->pages_allocated == 0);
 	assert(mem->allocated == 0);
 	assert(mem->used == 0);
-	munmap(mem, sizeof(struct mem));
+	struct list_head *head, *tmp;
+	/* Pages given back to the system don't count as spare. */
+	uint64_t spare = 0;
+	unsigned i;
+	for (i = 0; i < 64; i++) {
+		list_for_each(head, &mem->list_of_spare_pages[i]) {
+			struct mem_page *page =
+				container_of(head, struct mem_page, in_list);
+			spare += page->released ? 0 : page_size(mem, i+1);
+		}
+	}
+	assert(mem->spare == spare);
+	list_for_each_safe(head, tmp, &mem->list_of_arenas) {
+		struct mem_arena *arena =
+			container_of(head, struct mem_arena, in_list);
+		munmap(arena->ptr, arena->size);
+		free(arena);
+	}
+	free(mem->pslots);
+	free(mem->free_pslots);
+	free(mem);
 }
 
 void mem_allocated(struct mem *mem,
 		   uint64_t *allocated_ptr, uint64_t *wasted_ptr)
 {
 	if (allocated_ptr) {
-		*allocated_ptr = mem->allocated;
+		*allocated_ptr = mem->allocated + mem->spare;
 	}
 	if (wasted_ptr) {
-		*wasted_ptr = mem->allocated - mem->used;
+		*wasted_ptr = mem->allocated + mem->spare - mem->used;
 	}
 }
+
+void mem_counts(struct mem *mem, uint64_t *allocs_ptr, uint64_t *frees_ptr)
+{
+	*allocs_ptr = mem->allocs;
+	*frees_ptr = mem->frees;
+}
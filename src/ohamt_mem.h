@@ -1,13 +1,31 @@
 struct mem;
 
-struct mem *mem_new();
+/* Where ohamt pages come from. The arena modes carve pages out of
+ * 2MB aligned mappings to cut TLB misses on tree walks. */
+enum mem_huge_pages {
+	MEM_PAGES_MALLOC = 0,
+	MEM_PAGES_THP,		/* madvise(MADV_HUGEPAGE) arenas */
+	MEM_PAGES_HUGETLB	/* MAP_HUGETLB arenas, THP if none reserved */
+};
+
+/* Pages are defragmented once 'defrag_waste' bytes on top of an
+ * eighth of the used memory are wasted, 0 picks DEFRAG_MIN_WASTE. */
+struct mem *mem_new(int huge_pages, uint64_t defrag_waste);
 void mem_free(struct mem *mem);
 void mem_allocated(struct mem *mem,
 		   uint64_t *allocated_ptr, uint64_t *wasted_ptr);
+/* Node allocations and frees since mem_new(). */
+void mem_counts(struct mem *mem, uint64_t *allocs_ptr, uint64_t *frees_ptr);
 
 struct ohamt_slot slot_alloc(struct mem *mem, unsigned width);
 void slot_free(struct mem *mem, struct ohamt_slot slot);
 
+/* Defragmentation. Picks a sparse page when enough memory is wasted
+ * and returns its live chunks one by one, the caller moves each to a
+ * new slot. The page is released when the last chunk is freed.
+ * Returns 0 if there is nothing to move. */
+int mem_defrag_slot(struct mem *mem, struct ohamt_slot *slot_ptr);
+
 
 union PACKED item {
 	struct ohamt_slot slot;
@@ -43,6 +61,11 @@ static inline struct ohamt_slot leaf_to_slot(uint64_t leaf)
 
 #define CHUNKS_ON_PAGE 1024
 #define PAGE_SLOTS_MAX (1 << 23)
+#define ARENA_ALIGN (2UL << 20)
+#define ARENA_SIZE_MAX (64UL << 20)
+#define DEFRAG_MIN_WASTE (4UL << 20)
+#define DEFRAG_RETRY 65536
+#define DEFRAG_TRIM (16UL << 20)
 #define CHUNK_SIZE(width) (8 + 5 * (width))
 #define U_WIDTH(u) ((int)(u).node.swidth + 1)
 
@@ -55,8 +78,39 @@ struct mem {
 
 	struct list_head list_of_busy_pages;
 	struct list_head list_of_free_pages[64];
-	uint64_t pslots_mask[PAGE_SLOTS_MAX/sizeof(uint64_t)];
-	struct mem_page *pslots[PAGE_SLOTS_MAX];
+
+	/* Page slot table, grown on demand. Released slots are
+	 * reused first. */
+	struct mem_page **pslots;
+	unsigned pslots_sz;
+	unsigned pslots_used;
+	unsigned *free_pslots;
+	unsigned free_pslots_cnt;
+
+	/* Arena modes only. Empty pages are kept for reuse by the same
+	 * width, arenas are unmapped by mem_free(). */
+	int huge_pages;
+	struct list_head list_of_arenas;
+	struct list_head list_of_spare_pages[64];
+	uint64_t spare;
+	char *arena_ptr;
+	uint64_t arena_left;
+	uint64_t arena_next_size;
+
+	/* Page being emptied by the defragmentation, not on any list. */
+	struct mem_page *drain;
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t drain_retry;	/* Don't look for a page before 'frees' */
+	uint64_t drained;	/* Bytes released since the last trim */
+	uint64_t defrag_min_waste;
+	uint64_t defrag_retry;
+};
+
+struct mem_arena {
+	struct list_head in_list;
+	void *ptr;
+	uint64_t size;
 };
 
 struct mem_page {
@@ -65,6 +119,8 @@ struct mem_page {
 	int free_chunks;
 	int page_slot;
 	unsigned width;
+	int released;		/* Spare page given back to the system */
+	uint64_t live[CHUNKS_ON_PAGE / 64];
 };
 
 struct mem_chunk {
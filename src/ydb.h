@@ -17,6 +17,84 @@ struct ydb_options {
 	unsigned long long log_file_size_limit;
 	unsigned max_open_logs;
 	unsigned long long index_size_limit;
+	/* Keep an in-memory ordered index of all keys, required by
+	 * ydb_range() and ydb_prefix_iterate(). It's rebuilt by
+	 * reading all the logs on open. */
+	int ordered_index;
+	/* Compress values with deflate at this level, 1 (fast) to 9
+	 * (best). 0 disables compression of new values, compressed
+	 * values can always be read. */
+	int compress_level;
+	/* Pack small values written in a batch together into blocks of
+	 * about this many bytes (4KB - 1MB, 16 - 64KB is a good choice),
+	 * compressed with 'compress_level'. Saves the per-record header
+	 * and alignment overhead. 0 disables blocks. */
+	unsigned block_size;
+	/* Keep recently read values in memory, up to this many
+	 * bytes. 0 disables the cache. */
+	unsigned long long value_cache_size;
+	/* Answer most lookups of missing keys from a Bloom filter using
+	 * this many bits per key (10 gives about 1% false positives). The
+	 * filter is rebuilt from the index on open. 0 disables it. */
+	unsigned filter_bits_per_key;
+	/* Create the database with the wide index format, read from
+	 * the database directory when opening an existing one. Narrow
+	 * indexes are limited to 65536 open logs, 8M items per log,
+	 * 4GB logs and 128MB records. Wide indexes allow logs up to 4TB,
+	 * records up to 4GB and split 39 bits between open logs and
+	 * items per log: the default of 4096 'max_open_logs' (up to
+	 * 16M) leaves 128M items per log. The in-memory index entry
+	 * is 40 bits in both formats, wide index files use 28 instead
+	 * of 25 bytes per item. */
+	int wide_index;
+	/* Store values of at least this many bytes in separate blob
+	 * files, keeping only a small reference in the log. Logs
+	 * don't grow with big values and ydb_roll() doesn't copy
+	 * them, see ydb_blob_gc(). 0 disables blobs. */
+	unsigned blob_threshold;
+	/* Background threads for index flushes and asynchronous gets,
+	 * 0 picks the default of 4. */
+	unsigned worker_threads;
+	/* Allocate the in-memory index from huge page arenas, fewer
+	 * TLB misses make lookups in big indexes faster. 1 uses
+	 * transparent huge pages, 2 reserved huge pages (MAP_HUGETLB)
+	 * falling back to transparent ones. Memory freed by deletes
+	 * is kept for reuse by the index. 0 disables it. */
+	int huge_pages;
+	/* Keep only keys of the newest this many frozen logs in the
+	 * in-memory index. Older logs are looked up in per-log tables
+	 * sorted by key hash, kept on disk next to the index files,
+	 * with a Bloom filter and the first hash of every 4KB page in
+	 * memory. Lookups of their keys cost a binary search in an
+	 * mmapped file, usually one page. Tables are written in the
+	 * background when a log is frozen, but its keys are dropped
+	 * from the index by the write that freezes a later log, that
+	 * write stalls for a time proportional to the number of keys
+	 * dropped. 0 keeps all keys in memory. */
+	unsigned resident_logs;
+	/* Read logs with O_DIRECT, so that big scans don't push the
+	 * values hot gets depend on out of the page cache. 1 reads
+	 * directly in ydb_iterate(), ydb_iterate_parallel() and the
+	 * garbage collection, 2 also in gets. Falls back to buffered
+	 * reads on filesystems without direct I/O. 0 disables it. */
+	int direct_io;
+	/* Prefetch at most this many bytes ahead of ydb_iterate(),
+	 * ydb_iterate_parallel() and the garbage collection, whatever
+	 * prefetch size they are given. 0 doesn't limit it. */
+	unsigned long long scan_readahead;
+	/* Drop pages read by ydb_iterate() and ydb_iterate_parallel()
+	 * from the page cache behind the scan, so that full scans don't
+	 * push the working set of gets out. Pages read by the garbage
+	 * collection are always dropped, the log goes away after. */
+	int scan_drop_behind;
+	/* Least important messages written to ydb.log, an enum
+	 * ydb_log_level, see ydb_set_log_level(). 0 picks
+	 * YDB_LOGLEVEL_INFO. */
+	int log_level;
+	/* Defragment the in-memory index once deletes leave this many
+	 * bytes of it unused, on top of an eighth of what is in use.
+	 * 0 picks the default of 4MB. */
+	unsigned long long index_defrag_waste;
 };
 
 
@@ -50,6 +128,123 @@ float ydb_ratio(struct ydb *ydb);
  * 4GB. */
 int ydb_roll(struct ydb *ydb, unsigned gc_size);
 
+/* Reclaim disk space used by blob files: copy the values still in use
+ * from the oldest blob file to the current one and remove it. Keep
+ * calling it periodically when blobs are enabled, much like
+ * ydb_roll().
+ *
+ * Return
+ *     1 a blob file was removed
+ *     0 there are no blob files to collect
+ *     <0 error */
+int ydb_blob_gc(struct ydb *ydb);
+
+/* Compress new values using a dictionary. Values that share content
+ * with the dictionary compress much better, which matters most for
+ * small values. The dictionary (up to 32KB) is saved in the database
+ * directory and must be kept there as long as values compressed with
+ * it exist.
+ *
+ * Return
+ *     0 success
+ *     -2 write error
+ *     -3 dictionary too big or empty */
+int ydb_set_dictionary(struct ydb *ydb, const char *dict, unsigned dict_sz);
+
+/* Build a dictionary of 'dict_sz' bytes by sampling values stored in
+ * the database and start using it, see ydb_set_dictionary().
+ *
+ * Return
+ *     0 success
+ *     -1 database is empty
+ *     -2 read or write error
+ *     -3 dictionary size too big or zero */
+int ydb_train_dictionary(struct ydb *ydb, unsigned dict_sz);
+
+/* Value cache hit and miss counters, both zero if the cache is
+ * disabled. */
+void ydb_cache_stats(struct ydb *ydb,
+		     unsigned long long *hits_ptr,
+		     unsigned long long *misses_ptr);
+
+enum ydb_log_level {
+	YDB_LOGLEVEL_ERROR = 1,
+	YDB_LOGLEVEL_WARN,
+	YDB_LOGLEVEL_INFO
+};
+
+/* Log messages are written to ydb.log in the database directory by a
+ * background thread, logging never waits for the disk. Each place in
+ * the code logs at most 20 messages a second, the ones over that are
+ * suppressed and their count is added to its next message. The level
+ * may be changed at any time. */
+void ydb_set_log_level(struct ydb *ydb, int level);
+/* Pass log lines, without the trailing newline, to 'callback' instead
+ * of writing them to ydb.log, including lines queued but not yet
+ * written. It's called from the logging thread. NULL callback restores
+ * ydb.log. */
+typedef void (*ydb_log_callback)(void *userdata, int level,
+				 const char *line);
+void ydb_set_log_callback(struct ydb *ydb, ydb_log_callback callback,
+			  void *userdata);
+
+/* Latencies of an operation since ydb_open(), in nanoseconds.
+ * Percentiles are accurate to about 6%. */
+struct ydb_latency {
+	unsigned long long count;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long p50_ns;
+	unsigned long long p90_ns;
+	unsigned long long p99_ns;
+	unsigned long long p999_ns;
+};
+
+/* Where the last ydb_open() spent its time, in nanoseconds. Phases
+ * follow each other, except for index_copy which is a part of
+ * index_load. */
+struct ydb_open_phases {
+	unsigned long long total_ns;
+	unsigned long long snapshot_ns;	/* Reading the snapshot file */
+	unsigned long long index_load_ns; /* Index files of logs in the
+					 * snapshot */
+	unsigned long long index_copy_ns; /* Copying them to .idx.dirty */
+	unsigned long long index_build_ns; /* Their keys to the in-memory
+					 * index */
+	unsigned long long replay_ns;	/* Logs newer than the snapshot */
+	unsigned long long cold_ns;	/* See resident_logs */
+	unsigned long long filter_ns;	/* See filter_bits_per_key */
+	unsigned long long ordered_index_ns; /* See ordered_index */
+};
+
+struct ydb_stats {
+	struct ydb_latency get;		/* ydb_get(), ydb_get_h(), ydb_get_to_fd(),
+					 * ydb_get_chunked(), ydb_get_async()
+					 * up to its callback */
+	struct ydb_latency write;	/* ydb_write() */
+	struct ydb_latency fsync;	/* Syncing the log in ydb_write() */
+	struct ydb_latency gc;		/* ydb_roll() */
+	struct ydb_latency snapshot;	/* Starting a snapshot, a fork(2) */
+	struct ydb_latency index_save;	/* Saving index files, in background */
+	struct ydb_latency replay;	/* Reading logs on open */
+	unsigned long long bytes_read;	/* From logs, by gets and scans */
+	unsigned long long bytes_written; /* To logs */
+	unsigned long long cache_hits;	/* Value cache, see ydb_cache_stats() */
+	unsigned long long cache_misses;
+	unsigned long long index_node_allocs;	/* In-memory index */
+	unsigned long long index_node_frees;
+	unsigned long long index_allocated;	/* Bytes */
+	unsigned long long cold_logs;	/* Logs out of the index, see
+					 * resident_logs */
+	struct ydb_open_phases open;
+};
+
+/* Cheap enough to be called often, counters only grow. */
+void ydb_stats(struct ydb *ydb, struct ydb_stats *stats);
+/* Write the stats as text, one "name value" per line, to a
+ * descriptor. Returns 0 or -1 on error. */
+int ydb_stats_dump(struct ydb *ydb, int fd);
+
 
 struct ydb_vec {
 	char *key;
@@ -70,7 +265,9 @@ void ydb_prefetch(struct ydb *ydb,
 enum ydb_errors {
 	YDB_NOT_FOUND = -1,
 	YDB_IO_ERROR = -2,
-	YDB_BUFFER_ERROR = -3
+	YDB_BUFFER_ERROR = -3,
+	YDB_NOT_SUPPORTED = -4,
+	YDB_WRITE_ERROR = -5
 };
 /* Get a value for a key.
  *
@@ -85,8 +282,66 @@ int ydb_get(struct ydb *ydb,
 	    const char *key, unsigned key_sz,
 	    char *buf, unsigned buf_sz);
 
+/* Get a value without a buffer big enough to hold it. Plain values
+ * larger than 64KB and blobs are streamed straight from the files,
+ * anything else is decoded in memory first.
+ *
+ * ydb_get_to_fd() writes the value to 'fd', using sendfile(2) when the
+ * value is streamed from a file. Such data never passes through user
+ * space and its checksum is not verified. The whole value is written
+ * before it returns, a non-blocking 'fd' is waited on when it's full.
+ *
+ * ydb_get_chunked() passes the value to 'callback' in chunks of up to
+ * 64KB, the checksum is verified as the chunks are read and a mismatch
+ * is only reported after the last chunk. A non-zero return from the
+ * callback stops the read.
+ *
+ * Return
+ *    size of the value
+ *    -1 if the item is not found
+ *    -2 read error
+ *    -5 writing to 'fd' failed or the callback returned non-zero */
+typedef int (*ydb_value_callback)(void *userdata,
+				  const char *chunk, unsigned chunk_sz);
+long long ydb_get_to_fd(struct ydb *ydb,
+			const char *key, unsigned key_sz, int fd);
+long long ydb_get_chunked(struct ydb *ydb,
+			  const char *key, unsigned key_sz,
+			  ydb_value_callback callback, void *userdata);
+
+/* Get a value without blocking on disk reads. The index is looked up
+ * right away, the record is read by the background worker and
+ * 'callback' is called from ydb_process_events() with 'r' being the
+ * size of the value, -1 if the item is not found or -2 on read
+ * error. The value is valid only during the callback. Items changed
+ * after ydb_get_async() returns don't affect the result. Outstanding
+ * callbacks are run by ydb_close().
+ *
+ * Returns 0. */
+typedef void (*ydb_get_callback)(void *userdata, int r,
+				 const char *value, unsigned value_sz);
+int ydb_get_async(struct ydb *ydb,
+		  const char *key, unsigned key_sz,
+		  ydb_get_callback callback, void *userdata);
+
+/* Background work (asynchronous gets, index flushes) finishes on
+ * worker threads and is picked up on the database's thread. Call
+ * ydb_process_events() whenever the descriptor returned by ydb_fd()
+ * polls readable, or use ydb_poll(). Without that an idle database
+ * doesn't start its next index flush.
+ *
+ * ydb_process_events() doesn't block and returns the number of events
+ * processed. ydb_poll() waits up to 'timeout' milliseconds (-1 for
+ * ever) for the descriptor first, returns -1 on error. Callbacks of
+ * asynchronous gets are run only from these two. */
+int ydb_fd(struct ydb *ydb);
+int ydb_process_events(struct ydb *ydb);
+int ydb_poll(struct ydb *ydb, int timeout);
+
 
-/* Allocate new batch structure. */
+/* Allocate new batch structure. A batch isn't tied to a database,
+ * records are packed and keys hashed as they are added, so batches
+ * can be filled on other threads than the one calling ydb_write(). */
 struct ydb_batch *ydb_batch();
 
 /* Unconditionally set an item in a database. */
@@ -98,6 +353,28 @@ void ydb_set(struct ydb_batch *batch,
 void ydb_del(struct ydb_batch *batch,
 	     const char *key, unsigned key_sz);
 
+/* Keys are identified by their md5 hash. Callers that use the same
+ * key many times can hash it once with ydb_hash_key() and pass the
+ * hash to the _h variants below, which behave like the plain ones.
+ * The hash must come from ydb_hash_key() for the very same key, the
+ * key itself is still needed to be stored and to detect collisions. */
+struct ydb_key_hash {
+	unsigned char md5[16];
+};
+void ydb_hash_key(const char *key, unsigned key_sz,
+		  struct ydb_key_hash *hash);
+int ydb_get_h(struct ydb *ydb, const struct ydb_key_hash *hash,
+	      const char *key, unsigned key_sz,
+	      char *buf, unsigned buf_sz);
+void ydb_set_h(struct ydb_batch *batch, const struct ydb_key_hash *hash,
+	       const char *key, unsigned key_sz,
+	       const char *value, unsigned value_sz);
+void ydb_del_h(struct ydb_batch *batch, const struct ydb_key_hash *hash,
+	       const char *key, unsigned key_sz);
+/* 'hashes' has an item for every item in 'keysv'. */
+void ydb_prefetch_h(struct ydb *ydb, struct ydb_vec *keysv,
+		    const struct ydb_key_hash *hashes, unsigned keysv_cnt);
+
 
 /* Write batch to disk and release 'ydb_batch' structure.
  *
@@ -118,9 +395,57 @@ typedef int (*ydb_iter_callback)(void *ud,
 				 const char *key, unsigned key_sz,
 				 const char *value, unsigned value_sz);
 
+/* Call 'callback' for every item in the database. Logs are read
+ * sequentially in large chunks, 'key' and 'value' point into the
+ * chunk buffer and are valid only until the callback returns.
+ *
+ * Iteration stops when the callback returns non-zero, that value is
+ * returned. */
 int ydb_iterate(struct ydb *ydb, unsigned prefetch_size,
 		ydb_iter_callback callback, void *userdata);
 
+/* Like ydb_iterate(), but split the work across 'threads' threads,
+ * the calling thread being one of them. Logs are handed out in units
+ * of about 64MB of live data.
+ *
+ * 'userdata' is an array of 'threads' pointers, the n-th thread calls
+ * the callback with userdata[n]. The callback is called concurrently
+ * from different threads, but never concurrently with the same
+ * userdata. 'prefetch_size' is the prefetch budget of every thread.
+ *
+ * Return
+ *     0 if all items were visited
+ *     the first non-zero value returned by a callback otherwise */
+int ydb_iterate_parallel(struct ydb *ydb, unsigned threads,
+			 unsigned prefetch_size,
+			 ydb_iter_callback callback, void **userdata);
+
+/* Iterate over keys in range [start, end) in key order. NULL 'start'
+ * means from the first key, NULL 'end' means up to the last
+ * key. Keys are compared with memcmp(), a shorter key sorts
+ * first. Items are read ahead in batches of about 'prefetch_size'
+ * bytes. The database must not be modified from the callback.
+ *
+ * Requires 'ordered_index' option.
+ *
+ * Return
+ *     0 if all items in range were visited
+ *     the first non-zero value returned by the callback
+ *     -2 read error
+ *     -4 ordered index not enabled */
+int ydb_range(struct ydb *ydb,
+	      const char *start, unsigned start_sz,
+	      const char *end, unsigned end_sz,
+	      unsigned prefetch_size,
+	      ydb_iter_callback callback, void *userdata);
+
+/* Iterate in key order over all keys starting with 'prefix'. Same
+ * rules and return values as ydb_range(). */
+int ydb_prefix_iterate(struct ydb *ydb,
+		       const char *prefix, unsigned prefix_sz,
+		       unsigned prefetch_size,
+		       ydb_iter_callback callback, void *userdata);
+
 
 #ifdef __cplusplus
 }
@@ -22,6 +22,13 @@
 #include "ydb_writer.h"
 #include "ydb_state.h"
 #include "ydb_batch.h"
+#include "ydb_otree.h"
+#include "ydb_db.h"
+#include "ydb_stats.h"
+#include "ydb_codec.h"
+#include "ydb_vcache.h"
+#include "ydb_bloom.h"
+#include "ydb_blob.h"
 
 #include "ydb.h"
 #include "ydb_base.h"
@@ -55,6 +62,9 @@ void base_move_callback(void *base_p, struct log *log,
 			int new_hpos, int old_hpos)
 {
 	struct base *base = (struct base *)base_p;
+	if (log_is_cold(log)) {
+		return;
+	}
 	itree_move_callback(base->itree, log_to_remno(base->logs, log),
 			    new_hpos, old_hpos);
 }
@@ -75,25 +85,97 @@ struct base *base_new(struct db *db, struct dir *log_dir, struct dir *index_dir,
 	base->log_dir = log_dir;
 	base->index_dir = index_dir;
 
-	base->log_file_size_limit = _between(
-		4096,
-		options ? options->log_file_size_limit : 0,
-		1ULL << 32);
+	base->wide_index = base_index_format(db, log_dir,
+					     options ? options->wide_index : 0);
+	if (base->wide_index < 0) {
+		free(base);
+		return NULL;
+	}
+	db_set_wide_index(db, base->wide_index);
+	int log_level = options ? options->log_level : 0;
+	if (log_level >= YDB_LOGLEVEL_ERROR && log_level <= YDB_LOGLEVEL_INFO) {
+		db_set_log_level(db, log_level);
+	}
+	int direct_io = options ? options->direct_io : 0;
+	db_set_direct_io(db, direct_io >= 0 && direct_io <= 2 ? direct_io : 0);
+
+	unsigned remno_bits = 16;
+	if (base->wide_index == 0) {
+		base->log_file_size_limit = _between(
+			4096,
+			options ? options->log_file_size_limit : 0,
+			1ULL << 32);
 
-	base->max_open_logs = _between(
-		2,
-		options ? options->max_open_logs : 0,
-		1 << 16);
+		base->max_open_logs = _between(
+			2,
+			options ? options->max_open_logs : 0,
+			1 << 16);
 
-	base->index_slots_limit = _between(
-		2,
-		options ? options->index_size_limit / 25 : 0,
-		1 << 23);
+		base->index_slots_limit = _between(
+			2,
+			options ? options->index_size_limit / 25 : 0,
+			1 << 23);
+	} else {
+		/* Index entries have 39 bits for log_remno and hpos,
+		 * split according to max_open_logs. */
+		uint64_t size_limit = options ? options->log_file_size_limit : 0;
+		base->log_file_size_limit = _between(
+			4096,
+			size_limit ? size_limit : 1ULL << 32,
+			1ULL << 42);
+
+		unsigned open_logs = options ? options->max_open_logs : 0;
+		base->max_open_logs = _between(
+			2,
+			open_logs ? open_logs : 1 << 12,
+			1 << 24);
+
+		remno_bits = 1;
+		while ((1ULL << remno_bits) < base->max_open_logs) {
+			remno_bits++;
+		}
+		unsigned hpos_bits = ITREE_HPOS_BITS(remno_bits);
+		base->index_slots_limit = _between(
+			2,
+			options ? options->index_size_limit / 28 : 0,
+			hpos_bits < 31 ? 1ULL << hpos_bits : (1ULL << 31) - 1);
+	}
 
 	base->writer = NULL;
+	base->ordered_index = options ? options->ordered_index : 0;
+	if (options && options->block_size) {
+		base->block_size = _between(4096, options->block_size, 1 << 20);
+	}
+	if (options && options->value_cache_size) {
+		base->vcache = vcache_new(options->value_cache_size);
+	}
+	if (options) {
+		base->filter_bits_per_key = options->filter_bits_per_key < 64 ?
+			options->filter_bits_per_key : 64;
+	}
+
+	int level = options ? options->compress_level : 0;
+	base->codec = codec_new(db, log_dir, level >= 0 && level <= 9 ? level : 0);
+	if (base->codec == NULL) {
+		free(base);
+		return NULL;
+	}
+	db_set_codec(db, base->codec);
+
+	/* Blob files are always opened, they may be referenced by
+	 * records written with blobs enabled. */
+	base->blobs = blobs_new(db, log_dir, base->log_file_size_limit);
+	base->blob_threshold = options ? options->blob_threshold : 0;
+	base->resident_logs = options ? options->resident_logs : 0;
+	base->scan_readahead = options ? options->scan_readahead : 0;
+	base->scan_drop_behind = options ? options->scan_drop_behind : 0;
+	base_async_init(base);
 
 	base->db = db;
-	base->itree = itree_new(_get, _add, _del, base);
+	int huge_pages = options ? options->huge_pages : 0;
+	base->itree = itree_new(_get, _add, _del, base, remno_bits,
+				huge_pages >= 0 && huge_pages <= 2 ? huge_pages : 0,
+				options ? options->index_defrag_waste : 0);
 	base->logs = logs_new(base->db, base->max_open_logs);
 	base->frozen_list = frozen_list_new(db);
 	return base;
@@ -110,6 +192,7 @@ static int _save_log(void *base_p, struct log *log)
 
 void base_free(struct base *base)
 {
+	base_async_free(base);
 	logs_iterate(base->logs, _save_log, base);
 
 	while (logs_oldest(base->logs)) {
@@ -118,21 +201,38 @@ void base_free(struct base *base)
 		log_free(log);
 	}
 	frozen_list_free(base->frozen_list);
+	base_cold_free(base);
 
 	if (base->writer) {
 		writer_free(base->writer);
 	}
 	itree_free(base->itree);
+	if (base->otree) {
+		otree_free(base->otree);
+	}
 	logs_free(base->logs);
+	db_set_codec(base->db, NULL);
+	codec_free(base->codec);
+	blobs_free(base->blobs);
+	if (base->vcache) {
+		vcache_free(base->vcache);
+	}
 	free(base);
 }
 
-static int _replay_add_callback(void *base_p, uint128_t key_hash, int hpos)
+struct _load_ctx {
+	struct base *base;
+	struct log *log;
+	int snapshot_logs;	/* Read from the snapshot, not yet indexed */
+};
+
+static int _replay_add_callback(void *ctx_p, uint128_t key_hash, int hpos)
 {
-	struct base *base = (struct base*)base_p;
+	struct _load_ctx *ctx = (struct _load_ctx *)ctx_p;
+	struct base *base = ctx->base;
 	assert(hpos > 0);
 
-	struct log *log = logs_newest(base->logs);
+	struct log *log = ctx->log;
 	struct hashdir_item hdi = log_get(log, hpos);
 	stddev_add(&base->used_size, hdi.size);
 	itree_add_noidx(base->itree,
@@ -142,14 +242,87 @@ static int _replay_add_callback(void *base_p, uint128_t key_hash, int hpos)
 	return 0;
 }
 
+static int _used_add_callback(void *ctx_p, uint128_t key_hash, int hpos)
+{
+	struct _load_ctx *ctx = (struct _load_ctx *)ctx_p;
+	key_hash = key_hash;
+	stddev_add(&ctx->base->used_size, log_get(ctx->log, hpos).size);
+	return 0;
+}
+
+static int _otree_add_callback(void *base_p,
+			       const char *key, unsigned key_sz,
+			       const char *value, unsigned value_sz)
+{
+	struct base *base = (struct base*)base_p;
+	value = value; value_sz = value_sz;
+	otree_insert(base->otree, md5(key, key_sz), key, key_sz);
+	return 0;
+}
+
+static int _base_load_otree(struct base *base)
+{
+	struct timeval tv0, tv1;
+	gettimeofday(&tv0, NULL);
+
+	base->otree = otree_new();
+	int r = base_iterate(base, 4 << 20, _otree_add_callback, base);
+	if (r != 0) {
+		log_error(base->db, "Unable to build ordered index. %s", "");
+		return -1;
+	}
+
+	gettimeofday(&tv1, NULL);
+	log_info(base->db, "Ordered index of %llu keys, %.1f MB, "
+		 "built in %li ms.",
+		 (unsigned long long)otree_count(base->otree),
+		 (float)otree_allocated(base->otree) / (1024*1024.),
+		 TIMEVAL_MSEC_SUBTRACT(tv1, tv0));
+	return 0;
+}
+
+/* Logs from the snapshot are indexed once all are read, all but the
+ * newest 'resident_logs' of them may go cold. */
+static int _load_index_log(void *ctx_p, struct log *log)
+{
+	struct _load_ctx *ctx = (struct _load_ctx *)ctx_p;
+	struct base *base = ctx->base;
+	if (ctx->snapshot_logs == 0) {
+		return 1;
+	}
+	ctx->log = log;
+	if (base->resident_logs &&
+	    (unsigned)ctx->snapshot_logs > base->resident_logs) {
+		if (log_sdx_open(log) == 0) {
+			base_cold_add(base, log);
+			log_iterate(log, _used_add_callback, ctx);
+			ctx->snapshot_logs -= 1;
+			return 0;
+		}
+		log_warn(base->db, "log=%llx can't open sorted index, "
+			 "keeping keys in memory.",
+			 (unsigned long long)log_get_number(log));
+	}
+	log_iterate(log, _replay_add_callback, ctx);
+	ctx->snapshot_logs -= 1;
+	return 0;
+}
+
 int base_load(struct base *base)
 {
 	struct timeval tv0, tv1;
+	struct _load_ctx ctx = {base, NULL, 0};
 
+	struct stats *stats = db_stats(base->db);
 	int r;
 	uint64_t log_number = 0;
+	uint64_t t = stats_now();
 	struct sreader *sreader = sreader_new_load(base->db, base->index_dir,
 						   STATE_FILENAME);
+	stats_phase(stats, STATS_OPEN_SNAPSHOT, t);
+	/* Index files are also copied when logs are frozen, only count
+	 * the ones loaded from the snapshot. */
+	uint64_t copy_ns = stats_counter(stats, STATS_INDEX_COPY_NS);
 	if (sreader == NULL) {
 		log_info(base->db, "No snapshot found. %s", "");
 	} else {
@@ -158,7 +331,9 @@ int base_load(struct base *base)
 		while (1) {
 			gettimeofday(&tv0, NULL);
 			struct sreader_item rec;
+			t = stats_now();
 			r = sreader_read(sreader, &rec);
+			stats_phase(stats, STATS_OPEN_SNAPSHOT, t);
 			if (r != 1) {
 				if (r != 0) { /* ok? */
 					log_warn(base->db, "Error on reading snapshot. I'll "
@@ -169,6 +344,7 @@ int base_load(struct base *base)
 			}
 			assert(rec.log_number > log_number);
 			log_number = rec.log_number;
+			t = stats_now();
 			struct log *log = log_new_fast(base->db, log_number,
 						       base->log_dir,
 						       base->index_dir,
@@ -176,6 +352,7 @@ int base_load(struct base *base)
 						       base_move_callback,
 						       base,
 						       base->frozen_list);
+			stats_phase(stats, STATS_OPEN_INDEX_LOAD, t);
 			if (log == NULL) {
 				/* It's possible that we removed the
 				 * oldest log, and the snapshot is not
@@ -194,7 +371,7 @@ int base_load(struct base *base)
 				 * situation of delayed snapshot. */
 			} else {
 				logs_add(base->logs, log);
-				log_iterate(log, _replay_add_callback, base);
+				ctx.snapshot_logs += 1;
 				stddev_add(&base->disk_size, log_disk_size(log));
 				gettimeofday(&tv1, NULL);
 				log_info(base->db, "log=%llx %6.1f MB committed, "
@@ -209,6 +386,18 @@ int base_load(struct base *base)
 		}
 		sreader_free(sreader);
 	}
+	stats_phase_add(stats, STATS_OPEN_INDEX_COPY,
+			stats_counter(stats, STATS_INDEX_COPY_NS) - copy_ns);
+	if (ctx.snapshot_logs) {
+		gettimeofday(&tv0, NULL);
+		t = stats_now();
+		logs_iterate(base->logs, _load_index_log, &ctx);
+		stats_phase(stats, STATS_OPEN_INDEX_BUILD, t);
+		gettimeofday(&tv1, NULL);
+		log_info(base->db, "Index of snapshot logs built in %li ms, "
+			 "%u cold logs.", TIMEVAL_MSEC_SUBTRACT(tv1, tv0),
+			 base->cold_cnt);
+	}
 
 	uint64_t *logno_list;
 	int logno_list_sz;
@@ -217,6 +406,7 @@ int base_load(struct base *base)
 	int i;
 	for(i = 0; i < logno_list_sz-1; i++) {
 		gettimeofday(&tv0, NULL);
+		t = stats_now();
 		assert(logno_list[i] > log_number);
 		log_number = logno_list[i];
 		struct log *log = log_new_replay(base->db, log_number,
@@ -231,7 +421,9 @@ int base_load(struct base *base)
 		}
 		logs_add(base->logs, log);
 		stddev_add(&base->disk_size, log_disk_size(log));
+		uint64_t t0 = stats_now();
 		int r = log_do_replay(log, base_write_callback, base);
+		stats_time(stats, STATS_REPLAY, t0);
 		if (r != 0) {
 			log_error(base->db, "Can't load log %llx.",
 				  (unsigned long long)log_number);
@@ -243,6 +435,7 @@ int base_load(struct base *base)
 				  (unsigned long long)log_number);
 			return -1;
 		}
+		stats_phase(stats, STATS_OPEN_REPLAY, t);
 
 		gettimeofday(&tv1, NULL);
 		log_info(base->db, "log=%llx %6.1f MB committed, %6.1f MB used, "
@@ -264,6 +457,7 @@ int base_load(struct base *base)
 	free(logno_list);
 
 	gettimeofday(&tv0, NULL);
+	t = stats_now();
 	assert(logno > log_number);
 	log_number = logno;
 
@@ -279,12 +473,15 @@ int base_load(struct base *base)
 	}
 	logs_add(base->logs, log);
 	stddev_add(&base->disk_size, log_disk_size(log));
+	uint64_t t0 = stats_now();
 	r = log_do_replay(log, base_write_callback, base);
+	stats_time(stats, STATS_REPLAY, t0);
 	if (r != 0) {
 		log_error(base->db, "Can't load log %llx.",
 			  (unsigned long long)log_number);
 		return -1;
 	}
+	stats_phase(stats, STATS_OPEN_REPLAY, t);
 
 	gettimeofday(&tv1, NULL);
 	log_info(base->db, "log=%llx %6.1f MB committed, %6.1f MB used, "
@@ -295,11 +492,35 @@ int base_load(struct base *base)
 		 log_sets_count(log),
 		 TIMEVAL_MSEC_SUBTRACT(tv1, tv0));
 
+	if (base->resident_logs) {
+		t = stats_now();
+		base_cold_demote(base);
+		stats_phase(stats, STATS_OPEN_COLD, t);
+	}
+
 	if (logno_list_sz > 1) {
 		int r = base_schedule_snapshot(base);
 		if (r < 0) {
 			log_warn(base->db, "Unable to save snapshot. %s", "");
 		}
 	}
+
+	if (base->filter_bits_per_key) {
+		gettimeofday(&tv0, NULL);
+		t = stats_now();
+		base_build_filter(base);
+		stats_phase(stats, STATS_OPEN_FILTER, t);
+		gettimeofday(&tv1, NULL);
+		log_info(base->db, "Negative lookup filter of %.1f MB "
+			 "built in %li ms.",
+			 (float)itree_filter_allocated(base->itree) / (1024*1024.),
+			 TIMEVAL_MSEC_SUBTRACT(tv1, tv0));
+	}
+	if (base->ordered_index) {
+		t = stats_now();
+		r = _base_load_otree(base);
+		stats_phase(stats, STATS_OPEN_ORDERED, t);
+		return r;
+	}
 	return 0;
 }
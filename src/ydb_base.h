@@ -19,6 +19,31 @@ struct base {
 
 	int snapshot_child_pid;
 	struct frozen_list *frozen_list;
+
+	int ordered_index;
+	struct otree *otree;	/* NULL until loaded */
+
+	struct codec *codec;
+	unsigned block_size;
+
+	struct vcache *vcache;	/* NULL if disabled */
+	unsigned filter_bits_per_key;
+	int filter_rebuilding;
+	uint64_t filter_log_number;	/* Next log to add to the filter */
+	uint64_t filter_log_last;
+	int wide_index;
+
+	struct blobs *blobs;
+	unsigned blob_threshold;	/* 0 if disabled */
+
+	struct async_reads *async_reads;
+
+	unsigned resident_logs;	/* 0 if all keys are in the index */
+	struct log **cold_logs;	/* Oldest first */
+	unsigned cold_cnt;
+
+	uint64_t scan_readahead;	/* 0 if not limited */
+	int scan_drop_behind;
 };
 
 #define STATE_FILENAME "snapshot.bin"
@@ -36,22 +61,82 @@ int base_load(struct base *base);
 int base_roll(struct base *base);
 int base_schedule_snapshot(struct base *base);
 int base_maybe_free_oldest(struct base *base);
+/* Builds the filter at once. */
+void base_build_filter(struct base *base);
+/* A step of a rebuild, started once the filter needs one. */
+void base_rebuild_filter(struct base *base);
 void logs_enumerate(struct dir *log_dir, uint64_t log_number,
 		    uint64_t **logno_list_ptr, int *logno_list_sz_ptr);
+int base_index_format(struct db *db, struct dir *log_dir, int wide);
+int base_value(struct base *base, struct keyvalue *kv);
+/* Prefetch size of a scan, limited by 'scan_readahead'. */
+uint64_t base_readahead(struct base *base, uint64_t prefetch_size);
+
+/* ydb_base_async.c */
+void base_async_init(struct base *base);
+void base_async_free(struct base *base);
+void base_async_wait(struct base *base);
+int base_get_async(struct base *base,
+		   const char *key, unsigned key_sz,
+		   ydb_get_callback callback, void *userdata);
+
+/* ydb_base_cold.c */
+/* Find the live item of a key, in the index or in cold logs. */
+int base_index_get(struct base *base, uint128_t key_hash,
+		   struct log **log_ptr, struct hashdir_item *hi_ptr);
+void base_cold_add(struct base *base, struct log *log);
+void base_cold_demote(struct base *base);
+int base_cold_del(struct base *base, uint128_t key_hash);
+void base_cold_remove(struct base *base, struct log *log);
+void base_cold_free(struct base *base);
+uint64_t base_cold_allocated(struct base *base);
 
 /* ydb_base_pub.c */
-void base_prefetch(struct base *bas, struct ydb_vec *keysv, unsigned keysv_cnt);
+/* 'key_hashes' may be NULL. */
+void base_prefetch(struct base *base, struct ydb_vec *keysv,
+		   const uint128_t *key_hashes, unsigned keysv_cnt);
 int base_get(struct base *base,
 	     const char *key, unsigned key_sz,
 	     char *buf, unsigned buf_sz);
+/* 'key_hash' must be md5 of the key. */
+int base_get_h(struct base *base, uint128_t key_hash,
+	       const char *key, unsigned key_sz,
+	       char *buf, unsigned buf_sz);
+/* Either writes to 'fd' or passes chunks to 'callback'. */
+struct value_sink {
+	int fd;
+	ydb_value_callback callback;
+	void *userdata;
+};
+long long base_get_stream(struct base *base,
+			  const char *key, unsigned key_sz,
+			  struct value_sink *sink);
 int base_write(struct base *base, struct batch *batch, int do_fsync);
 float base_ratio(struct base *base);
+int base_set_dictionary(struct base *base, const char *dict, unsigned dict_sz);
+int base_train_dictionary(struct base *base, unsigned dict_sz);
+int base_range(struct base *base,
+	       const char *start, unsigned start_sz,
+	       const char *end, unsigned end_sz,
+	       const char *prefix, unsigned prefix_sz,
+	       uint64_t prefetch_size,
+	       ydb_iter_callback callback, void *userdata);
 
 void base_write_callback(void *base_p, uint32_t magic,
 			 const char *key, unsigned key_sz,
 			 uint64_t offset, uint64_t size);
 int base_iterate(struct base *base, uint64_t prefetch_size,
 		 ydb_iter_callback callback, void *userdata);
+int base_iterate_parallel(struct base *base, unsigned threads,
+			  uint64_t prefetch_size,
+			  ydb_iter_callback callback, void **userdata);
 
 void base_print_stats(struct base *base);
+void base_stats(struct base *base, struct ydb_stats *stats);
+int base_stats_dump(struct base *base, int fd);
+void base_print_open_phases(struct base *base);
+void base_cache_stats(struct base *base,
+		      unsigned long long *hits_ptr,
+		      unsigned long long *misses_ptr);
 int base_gc(struct base *base, unsigned gc_size);
+int base_blob_gc(struct base *base);
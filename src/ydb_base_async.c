@@ -0,0 +1,217 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "stddev.h"
+#include "bitmap.h"
+
+#include "ydb_common.h"
+#include "ydb_logging.h"
+#include "ydb_file.h"
+#include "ydb_logs.h"
+#include "ydb_hashdir.h"
+#include "ydb_log.h"
+#include "ydb_writer.h"
+#include "ydb_itree.h"
+#include "ydb_batch.h"
+#include "ydb_db.h"
+#include "ydb_worker.h"
+#include "ydb_vcache.h"
+#include "ydb_blob.h"
+#include "ydb_stats.h"
+
+#include "ydb.h"
+#include "ydb_base.h"
+
+/* Asynchronous gets. The index is looked up on the caller's thread,
+ * the record is read and decoded by the worker and the callback is
+ * run as a completion, from ydb_process_events(). Logs and blob files
+ * must not go away under a read in flight, so whoever removes them
+ * calls base_async_wait() first. */
+
+struct async_reads {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	unsigned pending;
+};
+
+struct get_request {
+	struct base *base;
+	uint128_t key_hash;
+	char *key;
+	unsigned key_sz;
+	struct log *log;	/* NULL if served from the value cache */
+	uint64_t log_number;
+	struct hashdir_item hi;
+
+	int r;			/* Value size or an error */
+	char *value;		/* Owned by the request */
+
+	ydb_get_callback callback;
+	void *userdata;
+	uint64_t start;		/* Timed up to the callback */
+};
+
+
+void base_async_init(struct base *base)
+{
+	struct async_reads *ar = malloc(sizeof(struct async_reads));
+	memset(ar, 0, sizeof(struct async_reads));
+	pthread_mutex_init(&ar->lock, NULL);
+	pthread_cond_init(&ar->done, NULL);
+	base->async_reads = ar;
+}
+
+void base_async_free(struct base *base)
+{
+	struct async_reads *ar = base->async_reads;
+	/* Every callback runs exactly once, even on close. */
+	base_async_wait(base);
+	db_do_completions(base->db);
+	pthread_mutex_destroy(&ar->lock);
+	pthread_cond_destroy(&ar->done);
+	free(ar);
+}
+
+void base_async_wait(struct base *base)
+{
+	struct async_reads *ar = base->async_reads;
+	pthread_mutex_lock(&ar->lock);
+	while (ar->pending) {
+		pthread_cond_wait(&ar->done, &ar->lock);
+	}
+	pthread_mutex_unlock(&ar->lock);
+}
+
+/* The value is cached only if the key still points at the item that
+ * was read, a write in the meantime may have replaced it. */
+static int _get_current(struct get_request *req)
+{
+	struct log *log;
+	struct hashdir_item hi;
+	if (req->log == NULL ||
+	    !base_index_get(req->base, req->key_hash, &log, &hi)) {
+		return 0;
+	}
+	return log_get_number(log) == req->log_number &&
+		hi.offset == req->hi.offset;
+}
+
+static void _get_done(void *req_p)
+{
+	struct get_request *req = req_p;
+	struct base *base = req->base;
+	if (req->r >= 0 && base->vcache && _get_current(req)) {
+		vcache_add(base->vcache, req->key_hash, req->value, req->r);
+	}
+	stats_time(db_stats(base->db), STATS_GET, req->start);
+	req->callback(req->userdata, req->r, req->value,
+		      req->r >= 0 ? req->r : 0);
+	free(req->value);
+	free(req->key);
+	free(req);
+}
+
+static int _get_read(struct get_request *req)
+{
+	struct base *base = req->base;
+	char *data = malloc(req->hi.size);
+	struct keyvalue kv;
+	if (log_read_item(req->log, req->hi, data, &kv) < 0) {
+		free(data);
+		return -2;
+	}
+	if (req->key_sz != kv.key_sz ||
+	    memcmp(req->key, kv.key, kv.key_sz) != 0) {
+		log_error(base->db, "Congratulations! You just found a "
+			  "collision! Apparently key %*s has the same md5 hash as %*s!",
+			  req->key_sz, req->key,
+			  kv.key_sz, kv.key);
+		free(data);
+		return -1;
+	}
+	struct blob_ref ref;
+	if (kv.is_blob) {
+		if (blob_ref_parse(kv.value, kv.value_sz, &ref) != 0) {
+			free(data);
+			return -2;
+		}
+		req->value = malloc(ref.value_sz ? ref.value_sz : 1);
+		if (blobs_read(base->blobs, &ref, req->value) != 0) {
+			free(data);
+			return -2;
+		}
+		free(data);
+		return ref.value_sz;
+	}
+	/* Decompressed values and blocks live in per-thread buffers,
+	 * the callback is run on a different thread. */
+	req->value = malloc(kv.value_sz ? kv.value_sz : 1);
+	memcpy(req->value, kv.value, kv.value_sz);
+	free(data);
+	return kv.value_sz;
+}
+
+static void _get_task(void *req_p)
+{
+	struct get_request *req = req_p;
+	struct async_reads *ar = req->base->async_reads;
+	req->r = _get_read(req);
+	/* Queue the completion before the read stops counting as pending,
+	 * base_async_free() relies on that. */
+	db_completion(req->base->db, _get_done, req);
+
+	pthread_mutex_lock(&ar->lock);
+	ar->pending -= 1;
+	if (ar->pending == 0) {
+		pthread_cond_broadcast(&ar->done);
+	}
+	pthread_mutex_unlock(&ar->lock);
+}
+
+int base_get_async(struct base *base,
+		   const char *key, unsigned key_sz,
+		   ydb_get_callback callback, void *userdata)
+{
+	struct get_request *req = malloc(sizeof(struct get_request));
+	memset(req, 0, sizeof(struct get_request));
+	req->base = base;
+	req->start = stats_now();
+	req->key_hash = md5(key, key_sz);
+	req->callback = callback;
+	req->userdata = userdata;
+
+	if (base->vcache) {
+		unsigned value_sz;
+		const char *value = vcache_get(base->vcache, req->key_hash,
+					       &value_sz);
+		if (value) {
+			req->value = malloc(value_sz ? value_sz : 1);
+			memcpy(req->value, value, value_sz);
+			req->r = value_sz;
+			db_completion(base->db, _get_done, req);
+			return 0;
+		}
+	}
+
+	if (base_index_get(base, req->key_hash, &req->log, &req->hi) == 0) {
+		req->r = -1;
+		db_completion(base->db, _get_done, req);
+		return 0;
+	}
+	req->log_number = log_get_number(req->log);
+	req->key = malloc(key_sz ? key_sz : 1);
+	memcpy(req->key, key, key_sz);
+	req->key_sz = key_sz;
+
+	struct async_reads *ar = base->async_reads;
+	pthread_mutex_lock(&ar->lock);
+	ar->pending += 1;
+	pthread_mutex_unlock(&ar->lock);
+	db_task(base->db, TASK_GET, _get_task, req);
+	return 0;
+}
@@ -6,6 +6,8 @@
 #include <string.h>
 #include <sys/uio.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <stdarg.h>
 
 #include "config.h"
 #include "list.h"
@@ -24,6 +26,13 @@
 #include "ydb_sys.h"
 #include "ydb_batch.h"
 #include "ydb_itree.h"
+#include "ydb_otree.h"
+#include "ydb_db.h"
+#include "ydb_stats.h"
+#include "ydb_codec.h"
+#include "ydb_vcache.h"
+#include "ydb_bloom.h"
+#include "ydb_blob.h"
 
 #include "ydb.h"
 #include "ydb_base.h"
@@ -82,6 +91,11 @@ int base_roll(struct base *base)
 		 (float)log_disk_size(newest) / (1024*1024.),
 		 (float)log_used_size(newest) / (1024*1024.),
 		 log_sets_count(newest));
+	if (base->resident_logs) {
+		/* Ready for the log to go cold, later or on the next
+		 * open. */
+		log_sdx_save_async(newest);
+	}
 	/* TODO: */
 	/* int r = log_save(newest); */
 	/* if (r != 0) { */
@@ -89,6 +103,9 @@ int base_roll(struct base *base)
 	/* 		 log_get_number(newest)); */
 	/* } */
 	logs_add(base->logs, log);
+	if (base->resident_logs) {
+		base_cold_demote(base);
+	}
 	return 0;
 }
 
@@ -144,7 +161,7 @@ static void _do_snapshot(void *base_p) {
 	_base_save_state(base);
 }
 
-int base_schedule_snapshot(struct base *base)
+static int _schedule_snapshot(struct base *base)
 {
 	if (base->snapshot_child_pid == -1) {
 		return _base_save_state(base);
@@ -161,6 +178,16 @@ int base_schedule_snapshot(struct base *base)
 	return -2;
 }
 
+int base_schedule_snapshot(struct base *base)
+{
+	uint64_t t0 = stats_now();
+	int r = _schedule_snapshot(base);
+	if (r != -2) {
+		stats_time(db_stats(base->db), STATS_SNAPSHOT, t0);
+	}
+	return r;
+}
+
 int base_maybe_free_oldest(struct base *base)
 {
 	int c = 0;
@@ -172,7 +199,9 @@ int base_maybe_free_oldest(struct base *base)
 			 (unsigned long long)log_get_number(log));
 
 		stddev_remove(&base->disk_size, log_disk_size(log));
+		base_async_wait(base);
 		logs_del(base->logs, log);
+		base_cold_remove(base, log);
 		log_free_remove(log);
 		c += 1;
 	}
@@ -220,6 +249,102 @@ void logs_enumerate(struct dir *log_dir, uint64_t log_number,
 	*logno_list_sz_ptr = pos;
 }
 
+#define FORMAT_FILENAME "ydb.format"
+
+/* The index format is chosen when the database is created and kept
+ * in FORMAT_FILENAME. Databases created before the file existed are
+ * narrow. Returns 1 for wide, 0 for narrow, -1 on error. */
+int base_index_format(struct db *db, struct dir *log_dir, int wide)
+{
+	char buf[16] = {0};
+	struct file *file = NULL;
+	if (dir_file_exists(log_dir, FORMAT_FILENAME)) {
+		file = file_open_read(log_dir, FORMAT_FILENAME);
+	}
+	if (file) {
+		uint64_t size = 0;
+		int r = file_size(file, &size);
+		if (r == 0 && size < sizeof(buf)) {
+			r = file_pread(file, buf, size, 0);
+		}
+		file_close(file);
+		if (r == -1 || size >= sizeof(buf)) {
+			log_error(db, "Can't read \"%s\".", FORMAT_FILENAME);
+			return -1;
+		}
+		if (strcmp(buf, "wide\n") == 0) {
+			return 1;
+		}
+		if (strcmp(buf, "narrow\n") == 0) {
+			return 0;
+		}
+		log_error(db, "Unknown index format in \"%s\".", FORMAT_FILENAME);
+		return -1;
+	}
+
+	uint64_t *logno_list;
+	int logno_list_sz;
+	logs_enumerate(log_dir, 0, &logno_list, &logno_list_sz);
+	free(logno_list);
+	if (logno_list_sz > 0) {
+		wide = 0;
+	}
+
+	/* Renamed into place, so that a crash never leaves a partly
+	 * written format file behind. */
+	const char *tmpname = FORMAT_FILENAME ".new";
+	file = file_open_append_new(log_dir, tmpname);
+	if (file == NULL) {
+		return -1;
+	}
+	snprintf(buf, sizeof(buf), "%s\n", wide ? "wide" : "narrow");
+	struct iovec iov[1] = {{buf, strlen(buf)}};
+	int r = file_appendv(file, iov, 1, 0);
+	if (r >= 0) {
+		r = file_sync(file);
+	}
+	file_close(file);
+	if (r >= 0) {
+		/* Syncs the directory. */
+		r = dir_renameat(log_dir, tmpname, FORMAT_FILENAME, 0);
+	}
+	if (r < 0) {
+		dir_unlink(log_dir, tmpname);
+		return -1;
+	}
+	return wide;
+}
+
+/* Read the value of a blob record into a per-thread buffer, valid
+ * until the next call from the same thread. */
+int base_value(struct base *base, struct keyvalue *kv)
+{
+	if (!kv->is_blob) {
+		return 0;
+	}
+	struct blob_ref ref;
+	if (blob_ref_parse(kv->value, kv->value_sz, &ref) != 0) {
+		log_error(base->db, "Broken blob reference. %s", "");
+		return -1;
+	}
+	const char *value = blobs_read_buffered(base->blobs, &ref);
+	if (value == NULL) {
+		return -1;
+	}
+	kv->value = value;
+	kv->value_sz = ref.value_sz;
+	kv->is_blob = 0;
+	return 0;
+}
+
+uint64_t base_readahead(struct base *base, uint64_t prefetch_size)
+{
+	if (base->scan_readahead && prefetch_size > base->scan_readahead) {
+		return base->scan_readahead;
+	}
+	return prefetch_size;
+}
+
 struct _iter_context {
 	struct base *base;
 	uint64_t prefetch_size;
@@ -227,28 +352,224 @@ struct _iter_context {
 	void *userdata;
 };
 
+static int _iter_callback(void *ic_p, struct keyvalue *kv)
+{
+	struct _iter_context *ic = (struct _iter_context *)ic_p;
+	if (base_value(ic->base, kv) != 0) {
+		return -2;
+	}
+	return ic->callback(ic->userdata, kv->key, kv->key_sz,
+			    kv->value, kv->value_sz);
+}
+
 static int _base_iter(void *ic_p, struct log *log)
 {
 	struct _iter_context *ic = (struct _iter_context *)ic_p;
 	return log_iterate_sorted(log, ic->prefetch_size,
-				  ic->callback, ic->userdata);
+				  ic->base->scan_drop_behind,
+				  _iter_callback, ic);
 }
 
 int base_iterate(struct base *base, uint64_t prefetch_size,
 		 ydb_iter_callback callback, void *userdata)
 {
-	struct _iter_context ic = {base, prefetch_size, callback, userdata};
+	struct _iter_context ic = {base, base_readahead(base, prefetch_size),
+				   callback, userdata};
 	return logs_iterate(base->logs, _base_iter, &ic);
 }
 
+/* Parallel iteration hands out units of roughly PARALLEL_UNIT bytes
+ * of live data, so a single huge log is still shared by all
+ * threads. */
+#define PARALLEL_UNIT (64 << 20)
+
+struct _par_log {
+	struct log *log;
+	struct hashdir *shd;
+	int refs;
+};
+
+struct _par_context {
+	pthread_mutex_t mutex;
+	struct _par_log *logs;
+	int logs_cnt;
+	int log_idx;		/* log currently being split */
+	int hpos;		/* next unscanned hpos in that log */
+	int result;
+
+	struct base *base;
+	uint64_t prefetch_size;
+	ydb_iter_callback callback;
+};
+
+struct _par_thread {
+	pthread_t thread;
+	struct _par_context *pc;
+	void *userdata;
+};
+
+static int _count_log(void *cnt_p, struct log *log)
+{
+	log = log;
+	*(int*)cnt_p += 1;
+	return 0;
+}
+
+static int _collect_log(void *pc_p, struct log *log)
+{
+	struct _par_context *pc = (struct _par_context *)pc_p;
+	pc->logs[pc->logs_cnt++] = (struct _par_log){log, NULL, 0};
+	return 0;
+}
+
+static void _par_put(struct _par_context *pc, struct _par_log *pl)
+{
+	pl->refs -= 1;
+	if (pl->refs == 0 && pl != &pc->logs[pc->log_idx]) {
+		hashdir_free(pl->shd);
+		pl->shd = NULL;
+	}
+}
+
+/* Called with the mutex held. */
+static struct _par_log *_par_get(struct _par_context *pc,
+				 int *start_ptr, int *end_ptr)
+{
+	while (pc->log_idx < pc->logs_cnt && pc->result == 0) {
+		struct _par_log *pl = &pc->logs[pc->log_idx];
+		if (pl->shd == NULL) {
+			pl->shd = log_sorted_index(pl->log);
+			pc->hpos = 1;
+		}
+		int hpos_max = hashdir_size2(pl->shd);
+		if (pc->hpos < hpos_max) {
+			uint64_t size = 0;
+			int i;
+			for (i = pc->hpos; i < hpos_max && size < PARALLEL_UNIT; i++) {
+				size += hashdir_get(pl->shd, i).size;
+			}
+			*start_ptr = pc->hpos;
+			*end_ptr = i;
+			pc->hpos = i;
+			pl->refs += 1;
+			return pl;
+		}
+		/* Log exhausted, move on. */
+		pc->log_idx += 1;
+		pl->refs += 1;
+		_par_put(pc, pl);
+	}
+	return NULL;
+}
+
+struct _par_cb_ctx {
+	struct _par_context *pc;
+	void *userdata;
+};
+
+static int _par_callback(void *ctx_p, struct keyvalue *kv)
+{
+	struct _par_cb_ctx *ctx = (struct _par_cb_ctx *)ctx_p;
+	int r = __atomic_load_n(&ctx->pc->result, __ATOMIC_RELAXED);
+	if (r) {
+		return r;
+	}
+	if (base_value(ctx->pc->base, kv) != 0) {
+		return -2;
+	}
+	return ctx->pc->callback(ctx->userdata, kv->key, kv->key_sz,
+				 kv->value, kv->value_sz);
+}
+
+static void *_par_thread(void *pt_p)
+{
+	struct _par_thread *pt = (struct _par_thread *)pt_p;
+	struct _par_context *pc = pt->pc;
+	struct _par_cb_ctx ctx = {pc, pt->userdata};
+
+	pthread_mutex_lock(&pc->mutex);
+	while (1) {
+		int start, end;
+		struct _par_log *pl = _par_get(pc, &start, &end);
+		if (pl == NULL) {
+			break;
+		}
+		pthread_mutex_unlock(&pc->mutex);
+		int r = log_scan_range(pl->log, pl->shd, start, end,
+				       pc->prefetch_size,
+				       pc->base->scan_drop_behind,
+				       _par_callback, &ctx);
+		pthread_mutex_lock(&pc->mutex);
+		if (r && pc->result == 0) {
+			__atomic_store_n(&pc->result, r, __ATOMIC_RELAXED);
+		}
+		_par_put(pc, pl);
+	}
+	pthread_mutex_unlock(&pc->mutex);
+	return NULL;
+}
+
+int base_iterate_parallel(struct base *base, unsigned threads,
+			  uint64_t prefetch_size,
+			  ydb_iter_callback callback, void **userdata)
+{
+	struct _par_context pc;
+	memset(&pc, 0, sizeof(pc));
+	pthread_mutex_init(&pc.mutex, NULL);
+	pc.base = base;
+	pc.prefetch_size = base_readahead(base, prefetch_size);
+	pc.callback = callback;
+
+	int logs_cnt = 0;
+	logs_iterate(base->logs, _count_log, &logs_cnt);
+	pc.logs = malloc(sizeof(struct _par_log) * logs_cnt);
+	logs_iterate(base->logs, _collect_log, &pc);
+
+	if (threads < 1) {
+		threads = 1;
+	}
+	struct _par_thread *pt = malloc(sizeof(struct _par_thread) * threads);
+	unsigned i;
+	for (i = 0; i < threads; i++) {
+		pt[i] = (struct _par_thread){.pc = &pc,
+					     .userdata = userdata[i]};
+	}
+	/* The calling thread does its share of work as thread zero. */
+	unsigned started;
+	for (started = 1; started < threads; started++) {
+		int r = pthread_create(&pt[started].thread, NULL,
+				       _par_thread, &pt[started]);
+		if (r != 0) {
+			log_warn(base->db, "Unable to start iteration thread "
+				 "%u, continuing with fewer threads.", started);
+			break;
+		}
+	}
+	_par_thread(&pt[0]);
+	for (i = 1; i < started; i++) {
+		pthread_join(pt[i].thread, NULL);
+	}
+
+	for (i = 0; (int)i < pc.logs_cnt; i++) {
+		if (pc.logs[i].shd) {
+			hashdir_free(pc.logs[i].shd);
+		}
+	}
+	free(pt);
+	free(pc.logs);
+	pthread_mutex_destroy(&pc.mutex);
+	return pc.result;
+}
+
 
 void base_print_stats(struct base *base)
 {
 	log_info(base->db, "Stats: %s", "");
-	log_info(base->db, "%u/%u logs in use",
+	log_info(base->db, "%u/%u logs in use, %s index, up to %u items per log",
 		 (unsigned)(log_get_number(logs_newest(base->logs)) -
 			    log_get_number(logs_oldest(base->logs)) + 1),
-		 base->max_open_logs);
+		 base->max_open_logs, base->wide_index ? "wide" : "narrow",
+		 base->index_slots_limit);
 	uint64_t counter;
 	double avg, dev;
 	stddev_get(&base->used_size, &counter, &avg, &dev);
@@ -261,9 +582,338 @@ void base_print_stats(struct base *base)
 		 (float)(allocated) / (1024*1024.),
 		 (float)(allocated - wasted) / (1024*1024.),
 		 (float)allocated / (float)(allocated - wasted));
+	if (base->otree) {
+		log_info(base->db, "Ordered index: %8.1f MB, %llu keys",
+			 (float)otree_allocated(base->otree) / (1024*1024.),
+			 (unsigned long long)otree_count(base->otree));
+	}
+	if (base->cold_cnt) {
+		log_info(base->db, "Cold logs: %u logs, %8.1f MB of fences and "
+			 "filters in memory", base->cold_cnt,
+			 (float)base_cold_allocated(base) / (1024*1024.));
+	}
+	if (itree_filter_allocated(base->itree)) {
+		log_info(base->db, "Lookup filter: %8.1f MB",
+			 (float)itree_filter_allocated(base->itree) /
+			 (1024*1024.));
+	}
+	if (base->vcache) {
+		uint64_t hits, misses, used, count;
+		vcache_stats(base->vcache, &hits, &misses, &used, &count);
+		log_info(base->db, "Value cache: %8.1f MB, %llu values, "
+			 "%llu hits, %llu misses",
+			 (float)used / (1024*1024.),
+			 (unsigned long long)count,
+			 (unsigned long long)hits,
+			 (unsigned long long)misses);
+	}
+	unsigned blob_files;
+	uint64_t blob_size;
+	blobs_stats(base->blobs, &blob_files, &blob_size);
+	if (blob_files) {
+		log_info(base->db, "Blob files: %8.1f MB in %u files",
+			 (float)blob_size / (1024*1024.), blob_files);
+	}
 	log_info(base->db, "Disk space: %9.1f MB committed, %8.1f MB in use, "
 		 "committed/used ratio of %.3f",
 		 (float)base->disk_size.sum / (1024*1024.),
 		 (float)base->used_size.sum / (1024*1024.),
 		 (float)base->disk_size.sum / (float)base->used_size.sum);
 }
+
+void base_stats(struct base *base, struct ydb_stats *ys)
+{
+	struct stats *stats = db_stats(base->db);
+	memset(ys, 0, sizeof(struct ydb_stats));
+	stats_latency(stats, STATS_GET, &ys->get);
+	stats_latency(stats, STATS_WRITE, &ys->write);
+	stats_latency(stats, STATS_FSYNC, &ys->fsync);
+	stats_latency(stats, STATS_GC, &ys->gc);
+	stats_latency(stats, STATS_SNAPSHOT, &ys->snapshot);
+	stats_latency(stats, STATS_INDEX_SAVE, &ys->index_save);
+	stats_latency(stats, STATS_REPLAY, &ys->replay);
+	ys->bytes_read = stats_counter(stats, STATS_BYTES_READ);
+	ys->bytes_written = stats_counter(stats, STATS_BYTES_WRITTEN);
+	base_cache_stats(base, &ys->cache_hits, &ys->cache_misses);
+	uint64_t allocs, frees;
+	itree_node_counts(base->itree, &allocs, &frees);
+	ys->index_node_allocs = allocs;
+	ys->index_node_frees = frees;
+	unsigned long allocated, wasted;
+	itree_mem_stats(base->itree, &allocated, &wasted);
+	ys->index_allocated = allocated;
+	ys->cold_logs = base->cold_cnt;
+
+	unsigned long long *phases[STATS_PHASES] = {
+		[STATS_OPEN_TOTAL] = &ys->open.total_ns,
+		[STATS_OPEN_SNAPSHOT] = &ys->open.snapshot_ns,
+		[STATS_OPEN_INDEX_LOAD] = &ys->open.index_load_ns,
+		[STATS_OPEN_INDEX_COPY] = &ys->open.index_copy_ns,
+		[STATS_OPEN_INDEX_BUILD] = &ys->open.index_build_ns,
+		[STATS_OPEN_REPLAY] = &ys->open.replay_ns,
+		[STATS_OPEN_COLD] = &ys->open.cold_ns,
+		[STATS_OPEN_FILTER] = &ys->open.filter_ns,
+		[STATS_OPEN_ORDERED] = &ys->open.ordered_index_ns,
+	};
+	int i;
+	for (i = 0; i < STATS_PHASES; i++) {
+		*phases[i] = stats_phase_ns(stats, i);
+	}
+}
+
+/* Append to 'buf' at '*len_ptr', output that doesn't fit is cut off
+ * at the end of the buffer. */
+static void _append(char *buf, unsigned buf_sz, unsigned *len_ptr,
+		    const char *fmt, ...)
+	__attribute__ ((format (printf, 4, 5)));
+
+static void _append(char *buf, unsigned buf_sz, unsigned *len_ptr,
+		    const char *fmt, ...)
+{
+	unsigned len = *len_ptr;
+	va_list ap;
+	va_start(ap, fmt);
+	int r = vsnprintf(buf + len, buf_sz - len, fmt, ap);
+	va_end(ap);
+	if (r > 0) {
+		*len_ptr = len + r < buf_sz ? len + r : buf_sz - 1;
+	}
+}
+
+void base_print_open_phases(struct base *base)
+{
+	struct stats *stats = db_stats(base->db);
+	char buf[512];
+	unsigned len = 0;
+	int i;
+	for (i = 0; i < STATS_PHASES; i++) {
+		_append(buf, sizeof(buf), &len, "%s%s %.1f",
+			i ? ", " : "", stats_phase_name(i),
+			stats_phase_ns(stats, i) / 1000000.);
+	}
+	log_info(base->db, "Open phases in ms: %s", buf);
+}
+
+static void _dump_latency(char *buf, unsigned buf_sz, unsigned *len_ptr,
+			  const char *name, struct ydb_latency *l)
+{
+	_append(buf, buf_sz, len_ptr,
+		"%s.count %llu\n%s.total_ns %llu\n%s.max_ns %llu\n"
+		"%s.p50_ns %llu\n%s.p90_ns %llu\n%s.p99_ns %llu\n"
+		"%s.p999_ns %llu\n",
+		name, l->count, name, l->total_ns, name, l->max_ns,
+		name, l->p50_ns, name, l->p90_ns, name, l->p99_ns,
+		name, l->p999_ns);
+}
+
+int base_stats_dump(struct base *base, int fd)
+{
+	struct ydb_stats ys;
+	base_stats(base, &ys);
+	struct ydb_latency *ops[STATS_OPS] = {
+		[STATS_GET] = &ys.get,
+		[STATS_WRITE] = &ys.write,
+		[STATS_FSYNC] = &ys.fsync,
+		[STATS_GC] = &ys.gc,
+		[STATS_SNAPSHOT] = &ys.snapshot,
+		[STATS_INDEX_SAVE] = &ys.index_save,
+		[STATS_REPLAY] = &ys.replay,
+	};
+	char buf[4096];
+	unsigned len = 0;
+	int i;
+	for (i = 0; i < STATS_OPS; i++) {
+		_dump_latency(buf, sizeof(buf), &len, stats_op_name(i), ops[i]);
+	}
+	_append(buf, sizeof(buf), &len,
+		"bytes_read %llu\nbytes_written %llu\n"
+		"cache_hits %llu\ncache_misses %llu\n"
+		"index_node_allocs %llu\nindex_node_frees %llu\n"
+		"index_allocated %llu\ncold_logs %llu\n",
+		ys.bytes_read, ys.bytes_written,
+		ys.cache_hits, ys.cache_misses,
+		ys.index_node_allocs, ys.index_node_frees,
+		ys.index_allocated, ys.cold_logs);
+	struct stats *stats = db_stats(base->db);
+	for (i = 0; i < STATS_PHASES; i++) {
+		_append(buf, sizeof(buf), &len,
+			"open.%s_ns %llu\n", stats_phase_name(i),
+			(unsigned long long)stats_phase_ns(stats, i));
+	}
+	return fd_write(fd, buf, len) == 0 ? 0 : -1;
+}
+
+/* A rebuild adds the keys of one log at a time, after a write it goes
+ * on until at least FILTER_REBUILD_STEP keys were added. Logs are
+ * visited by number, up to the one that was the newest at the start.
+ * Newer logs only have keys written during the rebuild, those went to
+ * both filters already. */
+#define FILTER_REBUILD_STEP 4096
+
+struct _filter_step {
+	struct base *base;
+	struct log *log;	/* Next log to visit */
+	uint64_t keys;
+};
+
+static int _filter_next_log(void *step_p, struct log *log)
+{
+	struct _filter_step *step = (struct _filter_step *)step_p;
+	uint64_t log_number = log_get_number(log);
+	if (log_is_cold(log) ||
+	    log_number < step->base->filter_log_number ||
+	    log_number > step->base->filter_log_last) {
+		return 0;
+	}
+	if (step->log == NULL || log_number < log_get_number(step->log)) {
+		step->log = log;
+	}
+	return 0;
+}
+
+static int _filter_add_callback(void *step_p, uint128_t key_hash, int hpos)
+{
+	struct _filter_step *step = (struct _filter_step *)step_p;
+	hpos = hpos;
+	itree_filter_next_add(step->base->itree, key_hash);
+	step->keys += 1;
+	return 0;
+}
+
+/* Returns 1 once the new filter is swapped in. */
+static int _filter_rebuild_step(struct base *base, uint64_t budget)
+{
+	struct _filter_step step = {base, NULL, 0};
+	while (step.keys < budget) {
+		step.log = NULL;
+		logs_iterate(base->logs, _filter_next_log, &step);
+		if (step.log == NULL) {
+			itree_filter_next_done(base->itree);
+			base->filter_rebuilding = 0;
+			return 1;
+		}
+		log_iterate(step.log, _filter_add_callback, &step);
+		base->filter_log_number = log_get_number(step.log) + 1;
+	}
+	return 0;
+}
+
+/* Sized for twice the current number of keys, so that it's not
+ * rebuilt too often while the database grows. */
+static void _filter_rebuild_start(struct base *base)
+{
+	uint64_t capacity = base->used_size.count * 2 + 4096;
+	struct bloom *bloom = bloom_new(capacity, base->filter_bits_per_key);
+	if (bloom == NULL) {
+		log_warn(base->db, "Unable to allocate negative lookup "
+			 "filter. %s", "");
+		itree_filter_set(base->itree, NULL);
+		return;
+	}
+	struct log *newest = logs_newest(base->logs);
+	itree_filter_next(base->itree, bloom);
+	base->filter_rebuilding = 1;
+	base->filter_log_number = 0;
+	base->filter_log_last = newest ? log_get_number(newest) : 0;
+}
+
+void base_build_filter(struct base *base)
+{
+	if (!base->filter_rebuilding) {
+		_filter_rebuild_start(base);
+	}
+	while (base->filter_rebuilding &&
+	       !_filter_rebuild_step(base, UINT64_MAX)) {
+	}
+}
+
+void base_rebuild_filter(struct base *base)
+{
+	if (!base->filter_rebuilding) {
+		if (!itree_filter_needs_rebuild(base->itree)) {
+			return;
+		}
+		_filter_rebuild_start(base);
+	}
+	if (base->filter_rebuilding) {
+		_filter_rebuild_step(base, FILTER_REBUILD_STEP);
+	}
+}
+
+void base_cache_stats(struct base *base,
+		      unsigned long long *hits_ptr,
+		      unsigned long long *misses_ptr)
+{
+	uint64_t hits = 0, misses = 0, used, count;
+	if (base->vcache) {
+		vcache_stats(base->vcache, &hits, &misses, &used, &count);
+	}
+	*hits_ptr = hits;
+	*misses_ptr = misses;
+}
+
+int base_set_dictionary(struct base *base, const char *dict, unsigned dict_sz)
+{
+	if (dict_sz == 0 || dict_sz > CODEC_MAX_DICTIONARY) {
+		return -3;
+	}
+	if (codec_add_dictionary(base->codec, dict, dict_sz) == 0) {
+		log_error(base->db, "Unable to save compression dictionary. %s",
+			  "");
+		return -2;
+	}
+	return 0;
+}
+
+/* The dictionary is a concatenation of beginnings of values sampled
+ * evenly across the database. */
+#define TRAIN_SAMPLE 256
+
+struct _train_ctx {
+	char *dict;
+	unsigned dict_sz;
+	unsigned used;
+	uint64_t stride;
+	uint64_t cnt;
+};
+
+static int _train_callback(void *ctx_p, const char *key, unsigned key_sz,
+			   const char *value, unsigned value_sz)
+{
+	struct _train_ctx *ctx = (struct _train_ctx *)ctx_p;
+	key = key; key_sz = key_sz;
+	if (ctx->cnt++ % ctx->stride) {
+		return 0;
+	}
+	unsigned sz = value_sz < TRAIN_SAMPLE ? value_sz : TRAIN_SAMPLE;
+	if (sz > ctx->dict_sz - ctx->used) {
+		sz = ctx->dict_sz - ctx->used;
+	}
+	memcpy(ctx->dict + ctx->used, value, sz);
+	ctx->used += sz;
+	return ctx->used == ctx->dict_sz;
+}
+
+int base_train_dictionary(struct base *base, unsigned dict_sz)
+{
+	if (dict_sz == 0 || dict_sz > CODEC_MAX_DICTIONARY) {
+		return -3;
+	}
+	uint64_t samples = dict_sz / TRAIN_SAMPLE + 1;
+	struct _train_ctx ctx = {malloc(dict_sz), dict_sz, 0,
+				 base->used_size.count / samples + 1, 0};
+	int r = base_iterate(base, 4 << 20, _train_callback, &ctx);
+	if (r < 0) {
+		free(ctx.dict);
+		return r;
+	}
+	if (ctx.used == 0) {
+		log_warn(base->db, "Not enough data to train a compression "
+			 "dictionary. %s", "");
+		free(ctx.dict);
+		return -1;
+	}
+	r = base_set_dictionary(base, ctx.dict, ctx.used);
+	free(ctx.dict);
+	return r;
+}
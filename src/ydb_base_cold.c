@@ -0,0 +1,168 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+
+#include "stddev.h"
+#include "bitmap.h"
+
+#include "ydb_common.h"
+#include "ydb_logging.h"
+#include "ydb_file.h"
+#include "ydb_logs.h"
+#include "ydb_hashdir.h"
+#include "ydb_log.h"
+#include "ydb_writer.h"
+#include "ydb_itree.h"
+#include "ydb_batch.h"
+
+#include "ydb.h"
+#include "ydb_base.h"
+
+/* Partial residency. With 'resident_logs' set, keys of the older
+ * frozen logs stay out of the in-memory index, each of these cold
+ * logs is searched in its sorted index instead. Logs read from the
+ * snapshot go cold on open, later ones when they get old enough, see
+ * base_cold_demote(). A key is live in at most one place, so the
+ * index and cold logs can be searched in any order, newest first
+ * finds recently written keys sooner. Cold logs are the oldest ones,
+ * they go away only by base_maybe_free_oldest(). */
+
+int base_index_get(struct base *base, uint128_t key_hash,
+		   struct log **log_ptr, struct hashdir_item *hi_ptr)
+{
+	uint64_t log_remno;
+	int hpos;
+	if (itree_get2(base->itree, key_hash, &log_remno, &hpos)) {
+		*log_ptr = log_by_remno(base->logs, log_remno);
+		*hi_ptr = log_get(*log_ptr, hpos);
+		return 1;
+	}
+	int i;
+	for (i = base->cold_cnt - 1; i >= 0; i--) {
+		if (log_cold_find(base->cold_logs[i], key_hash, hi_ptr)) {
+			*log_ptr = base->cold_logs[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void base_cold_add(struct base *base, struct log *log)
+{
+	assert(log_is_cold(log));
+	base->cold_logs = realloc(base->cold_logs,
+				  sizeof(struct log *) * (base->cold_cnt + 1));
+	base->cold_logs[base->cold_cnt++] = log;
+}
+
+static int _drop_callback(void *base_p, uint128_t key_hash, int hpos)
+{
+	struct base *base = (struct base *)base_p;
+	hpos = hpos;
+	int r = itree_drop(base->itree, key_hash);
+	assert(r == 1);
+	return 0;
+}
+
+struct _demote_ctx {
+	struct log *newest;
+	struct log *oldest_resident;
+	unsigned resident_cnt;	/* Frozen logs neither cold nor broken */
+};
+
+static int _count_resident(void *ctx_p, struct log *log)
+{
+	struct _demote_ctx *ctx = (struct _demote_ctx *)ctx_p;
+	if (log != ctx->newest && !log_is_cold(log) && !log_sdx_broken(log)) {
+		if (ctx->oldest_resident == NULL) {
+			ctx->oldest_resident = log;
+		}
+		ctx->resident_cnt += 1;
+	}
+	return 0;
+}
+
+/* Move keys of the oldest frozen logs out of the index until at most
+ * 'resident_logs' frozen logs are left in it. A log whose sorted index
+ * is still being written stops the demotion until the next roll. One
+ * whose sorted index can't be opened stays resident for good and isn't
+ * counted, the logs after it are demoted. Runs on the roll, within the
+ * write that filled the log; dropping the keys takes time proportional
+ * to their number. */
+void base_cold_demote(struct base *base)
+{
+	while (1) {
+		struct _demote_ctx ctx = {logs_newest(base->logs), NULL, 0};
+		logs_iterate(base->logs, _count_resident, &ctx);
+		if (ctx.resident_cnt <= base->resident_logs) {
+			return;
+		}
+		struct timeval tv0, tv1;
+		gettimeofday(&tv0, NULL);
+		struct log *log = ctx.oldest_resident;
+		if (log_sdx_saving(log)) {
+			return;
+		}
+		if (log_sdx_open(log) != 0) {
+			log_warn(base->db, "log=%llx can't open sorted index, "
+				 "keeping keys in memory.",
+				 (unsigned long long)log_get_number(log));
+			continue;
+		}
+		log_iterate(log, _drop_callback, base);
+		base_cold_add(base, log);
+		gettimeofday(&tv1, NULL);
+		log_info(base->db, "log=%llx %10u items moved out of the "
+			 "index in %li ms.",
+			 (unsigned long long)log_get_number(log),
+			 log_sets_count(log),
+			 TIMEVAL_MSEC_SUBTRACT(tv1, tv0));
+	}
+}
+
+/* Delete the live item of a key not found in the index. Returns 1 if
+ * it was in a cold log. */
+int base_cold_del(struct base *base, uint128_t key_hash)
+{
+	int i;
+	for (i = base->cold_cnt - 1; i >= 0; i--) {
+		struct hashdir_item hi;
+		if (log_cold_find(base->cold_logs[i], key_hash, &hi)) {
+			log_cold_del(base->cold_logs[i], hi);
+			stddev_remove(&base->used_size, hi.size);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void base_cold_remove(struct base *base, struct log *log)
+{
+	if (base->cold_cnt == 0 || base->cold_logs[0] != log) {
+		return;
+	}
+	base->cold_cnt -= 1;
+	memmove(&base->cold_logs[0], &base->cold_logs[1],
+		sizeof(struct log *) * base->cold_cnt);
+}
+
+void base_cold_free(struct base *base)
+{
+	free(base->cold_logs);
+	base->cold_logs = NULL;
+	base->cold_cnt = 0;
+}
+
+uint64_t base_cold_allocated(struct base *base)
+{
+	uint64_t allocated = 0;
+	unsigned i;
+	for (i = 0; i < base->cold_cnt; i++) {
+		allocated += log_cold_allocated(base->cold_logs[i]);
+	}
+	return allocated;
+}
@@ -24,26 +24,32 @@
 #include "ydb_itree.h"
 #include "ydb_record.h"
 #include "ydb_batch.h"
+#include "ydb_otree.h"
+#include "ydb_db.h"
+#include "ydb_codec.h"
+#include "ydb_vcache.h"
+#include "ydb_blob.h"
+#include "ydb_stats.h"
 
 #include "ydb.h"
 #include "ydb_base.h"
 
 
-void base_prefetch(struct base *base, struct ydb_vec *keysv, unsigned keysv_cnt)
+void base_prefetch(struct base *base, struct ydb_vec *keysv,
+		   const uint128_t *key_hashes, unsigned keysv_cnt)
 {
 	unsigned i;
 	for (i=0; i < keysv_cnt; i++) {
 		struct ydb_vec *vec = &keysv[i];
-		uint128_t key_hash = md5(vec->key, vec->key_sz);
+		uint128_t key_hash = key_hashes ? key_hashes[i] :
+			md5(vec->key, vec->key_sz);
 
-		uint64_t log_remno;
-		int hpos;
-		int r = itree_get2(base->itree, key_hash, &log_remno, &hpos);
-		if (r < 0) {
+		struct log *log;
+		struct hashdir_item hi;
+		if (base_index_get(base, key_hash, &log, &hi) == 0) {
 			vec->value_sz = -1;
 		} else {
-			struct log *log = log_by_remno(base->logs, log_remno);
-			vec->value_sz = log_prefetch(log, hpos);
+			vec->value_sz = log_prefetch(log, hi);
 		}
 	}
 }
@@ -52,25 +58,48 @@ int base_get(struct base *base,
 	     const char *key, unsigned key_sz,
 	     char *buf, unsigned buf_sz)
 {
-	uint128_t key_hash = md5(key, key_sz);
+	return base_get_h(base, md5(key, key_sz), key, key_sz, buf, buf_sz);
+}
 
-	uint64_t log_remno;
-	int hpos;
-	int r = itree_get2(base->itree, key_hash, &log_remno, &hpos);
-	if (r < 0) {
+int base_get_h(struct base *base, uint128_t key_hash,
+	       const char *key, unsigned key_sz,
+	       char *buf, unsigned buf_sz)
+{
+
+	if (base->vcache) {
+		unsigned value_sz;
+		const char *value = vcache_get(base->vcache, key_hash,
+					       &value_sz);
+		if (value) {
+			if (value_sz > buf_sz) {
+				return -3;
+			}
+			memcpy(buf, value, value_sz);
+			return value_sz;
+		}
+	}
+
+	struct log *log;
+	struct hashdir_item hi;
+	if (base_index_get(base, key_hash, &log, &hi) == 0) {
 		return -1;
 	}
-	struct log *log = log_by_remno(base->logs, log_remno);
 	/* TODO: get rid of the awful malloc */
-	unsigned data_sz = log_buffer_size(log, hpos);
-	char *data = malloc(data_sz);
+	char *data = malloc(hi.size);
 	struct keyvalue kv;
-	r = log_read(log, hpos, data, data_sz, &kv);
+	int r = log_read_item(log, hi, data, &kv);
 	if (r < 0) {
 		free(data);
 		return -2;
 	}
-	if (kv.value_sz > buf_sz) {
+	/* Blobs are read straight into the user's buffer. */
+	struct blob_ref ref;
+	if (kv.is_blob && blob_ref_parse(kv.value, kv.value_sz, &ref) != 0) {
+		free(data);
+		return -2;
+	}
+	unsigned value_sz = kv.is_blob ? ref.value_sz : kv.value_sz;
+	if (value_sz > buf_sz) {
 		free(data);
 		return -3;
 	}
@@ -82,29 +111,191 @@ int base_get(struct base *base,
 		free(data);
 		return -1;
 	}
-	memcpy(buf, kv.value, kv.value_sz);
+	if (kv.is_blob) {
+		if (blobs_read(base->blobs, &ref, buf) != 0) {
+			free(data);
+			return -2;
+		}
+	} else {
+		memcpy(buf, kv.value, kv.value_sz);
+	}
+	if (base->vcache) {
+		vcache_add(base->vcache, key_hash, buf, value_sz);
+	}
 	free(data);
-	return kv.value_sz;
+	return value_sz;
 }
 
+/* Values are streamed in chunks of this size, the head of a record
+ * is read into a buffer of the same size. */
+#define STREAM_CHUNK (64 << 10)
 
-void base_write_callback(void *base_p, uint32_t magic,
+static int _sink_memory(struct value_sink *sink,
+			const char *value, unsigned value_sz)
+{
+	if (sink->callback == NULL) {
+		return fd_write(sink->fd, value, value_sz) == 0 ? 0 : -5;
+	}
+	unsigned done = 0;
+	do {
+		unsigned chunk = value_sz - done < STREAM_CHUNK ?
+			value_sz - done : STREAM_CHUNK;
+		if (sink->callback(sink->userdata, value + done, chunk) != 0) {
+			return -5;
+		}
+		done += chunk;
+	} while (done < value_sz);
+	return 0;
+}
+
+static int _sink_range(struct value_sink *sink, struct file_range *range)
+{
+	if (sink->callback == NULL) {
+		/* No copy in user space, nothing to verify either. */
+		return file_send(range->file, range->offset, range->size,
+				 sink->fd) == 0 ? 0 : -5;
+	}
+	/* Chunks are cut so that the checksum can be computed in parts. */
+	unsigned chunk_sz = STREAM_CHUNK / ADLER32_CHUNK * ADLER32_CHUNK;
+	char *buf = malloc(chunk_sz);
+	uint32_t sum = 1;
+	uint64_t done = 0;
+	int r = 0;
+	while (r == 0 && done < range->size) {
+		uint64_t chunk = range->size - done < chunk_sz ?
+			range->size - done : chunk_sz;
+		if (file_pread(range->file, buf, chunk,
+			       range->offset + done) == -1) {
+			r = -2;
+			break;
+		}
+		sum = adler32_update(sum, buf, chunk);
+		if (sink->callback(sink->userdata, buf, chunk) != 0) {
+			r = -5;
+		}
+		done += chunk;
+	}
+	free(buf);
+	if (r == 0 && sum != range->sum) {
+		return -2;
+	}
+	return r;
+}
+
+long long base_get_stream(struct base *base,
+			  const char *key, unsigned key_sz,
+			  struct value_sink *sink)
+{
+	uint128_t key_hash = md5(key, key_sz);
+
+	if (base->vcache) {
+		unsigned value_sz;
+		const char *value = vcache_get(base->vcache, key_hash,
+					       &value_sz);
+		if (value) {
+			int r = _sink_memory(sink, value, value_sz);
+			return r < 0 ? r : (long long)value_sz;
+		}
+	}
+
+	struct log *log;
+	struct hashdir_item hi;
+	if (base_index_get(base, key_hash, &log, &hi) == 0) {
+		return -1;
+	}
+
+	/* Plain records bigger than a chunk are streamed from the log,
+	 * blobs from their blob file. Anything else is read whole. */
+	char head[STREAM_CHUNK];
+	char *data = NULL;
+	struct keyvalue kv;
+	struct file_range range;
+	int r = log_value_range(log, hi, head, sizeof(head), &kv, &range);
+	if (r == 0) {
+		data = malloc(hi.size);
+		r = log_read_item(log, hi, data, &kv);
+	}
+	if (r < 0) {
+		free(data);
+		return -2;
+	}
+	if (key_sz != kv.key_sz || memcmp(key, kv.key, key_sz) != 0) {
+		log_error(base->db, "Congratulations! You just found a "
+			  "collision! Apparently key %*s has the same md5 hash as %*s!",
+			  key_sz, key,
+			  kv.key_sz, kv.key);
+		free(data);
+		return -1;
+	}
+	struct blob_ref ref;
+	if (kv.is_blob) {
+		if (blob_ref_parse(kv.value, kv.value_sz, &ref) != 0 ||
+		    blobs_range(base->blobs, &ref, &range) != 0) {
+			free(data);
+			return -2;
+		}
+		r = 1;
+	}
+
+	long long value_sz;
+	if (r == 1) {
+		value_sz = range.size;
+		stats_add(db_stats(base->db), STATS_BYTES_READ, range.size);
+		r = _sink_range(sink, &range);
+	} else {
+		value_sz = kv.value_sz;
+		r = _sink_memory(sink, kv.value, kv.value_sz);
+	}
+	free(data);
+	return r < 0 ? r : value_sz;
+}
+
+
+static void _index_apply(void *base_p, uint32_t magic, uint128_t key_hash,
 			 const char *key, unsigned key_sz,
 			 uint64_t offset, uint64_t size)
 {
 	struct base *base = (struct base *)base_p;
-	uint128_t key_hash = md5(key, key_sz);
-	if (magic == YDB_LOG_SET) {
+	if (base->vcache) {
+		vcache_del(base->vcache, key_hash);
+	}
+	if (base->cold_cnt && itree_del(base->itree, key_hash) == 0) {
+		/* Not in the index, the old item may be in a cold log. */
+		base_cold_del(base, key_hash);
+	}
+	if (magic != YDB_LOG_DEL) {
 		itree_add(base->itree,
 			  (struct hashdir_item){key_hash, offset, size, 0});
 	} else {
 		itree_del(base->itree, key_hash);
 	}
+	if (base->otree) {
+		if (magic != YDB_LOG_DEL) {
+			otree_insert(base->otree, key_hash, key, key_sz);
+		} else {
+			otree_delete(base->otree, key, key_sz);
+		}
+	}
+}
+
+void base_write_callback(void *base_p, uint32_t magic,
+			 const char *key, unsigned key_sz,
+			 uint64_t offset, uint64_t size)
+{
+	_index_apply(base_p, magic, md5(key, key_sz), key, key_sz,
+		     offset, size);
 }
 
 int base_write(struct base *base, struct batch *batch, int do_fsync)
 {
 	int do_snapshot = 0;
+	if (base->blob_threshold &&
+	    batch_store_blobs(batch, base->blobs, base->blob_threshold) != 0) {
+		log_error(base->db, "Unable to write to a blob file. %s", "");
+		return -2;
+	}
+	batch_pack_blocks(batch, base->codec, base->block_size, base->db);
+	batch_compress(batch, base->codec, base->db);
 	if (batch_size(batch) > base->log_file_size_limit ||
 	    batch_sets(batch) >= base->index_slots_limit) {
 		log_error(base->db, "Sorry, unable to write so big batch. %s",
@@ -125,15 +316,25 @@ int base_write(struct base *base, struct batch *batch, int do_fsync)
 	}
 	assert(base->writer);
 
-	int r = batch_write(batch, base->writer, base_write_callback, base);
+	if (do_fsync) {
+		/* Blobs must hit the disk before records pointing to them. */
+		blobs_sync(base->blobs);
+	}
+	int r = batch_write(batch, base->writer, _index_apply, base);
 	if (r < 0) {
 		return -2;
 	}
 	/* square will go out, but at least sum and counter will match */
 	stddev_modify(&base->disk_size, 0, r);
+	itree_defrag(base->itree);
 
+	base_rebuild_filter(base);
+
+	stats_add(db_stats(base->db), STATS_BYTES_WRITTEN, r);
 	if (do_fsync) {
+		uint64_t t0 = stats_now();
 		writer_sync(base->writer);
+		stats_time(db_stats(base->db), STATS_FSYNC, t0);
 	}
 
 	if (base_maybe_free_oldest(base)) {
@@ -156,6 +357,107 @@ float base_ratio(struct base *base)
 	return 0.0;
 }
 
+/* Ordered iteration reads items in batches: first walk the ordered
+ * index and prefetch, then read. */
+#define RANGE_BATCH 256
+
+struct _range_item {
+	struct okey *okey;
+	struct log *log;
+	struct hashdir_item hi;
+};
+
+static int _range_stop(struct okey *okey,
+		       const char *end, unsigned end_sz,
+		       const char *prefix, unsigned prefix_sz)
+{
+	if (end) {
+		int r = memcmp(okey->key, end,
+			       okey->key_sz < end_sz ? okey->key_sz : end_sz);
+		if (r > 0 || (r == 0 && okey->key_sz >= end_sz)) {
+			return 1;
+		}
+	}
+	if (prefix) {
+		if (okey->key_sz < prefix_sz ||
+		    memcmp(okey->key, prefix, prefix_sz) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int base_range(struct base *base,
+	       const char *start, unsigned start_sz,
+	       const char *end, unsigned end_sz,
+	       const char *prefix, unsigned prefix_sz,
+	       uint64_t prefetch_size,
+	       ydb_iter_callback callback, void *userdata)
+{
+	if (base->otree == NULL) {
+		return -4;
+	}
+	struct otree_cursor cursor;
+	otree_seek(base->otree, start, start_sz, &cursor);
+
+	struct _range_item items[RANGE_BATCH];
+	unsigned buf_sz = 4096;
+	char *buf = malloc(buf_sz);
+	int r = 0;
+	int done = 0;
+	while (!done && r == 0) {
+		int items_cnt = 0;
+		uint64_t prefetched = 0;
+		while (items_cnt < RANGE_BATCH &&
+		       (prefetched < prefetch_size || items_cnt == 0)) {
+			struct okey *okey = otree_next(&cursor);
+			if (okey == NULL ||
+			    _range_stop(okey, end, end_sz, prefix, prefix_sz)) {
+				done = 1;
+				break;
+			}
+			struct log *log;
+			struct hashdir_item hi;
+			if (base_index_get(base, okey->key_hash,
+					   &log, &hi) == 0) {
+				continue;
+			}
+			if (prefetch_size) {
+				prefetched += log_prefetch(log, hi);
+			}
+			items[items_cnt++] = (struct _range_item){okey, log, hi};
+		}
+
+		int i;
+		for (i = 0; i < items_cnt && r == 0; i++) {
+			struct _range_item *it = &items[i];
+			if (it->hi.size > buf_sz) {
+				buf_sz = it->hi.size;
+				free(buf);
+				buf = malloc(buf_sz);
+			}
+			struct keyvalue kv;
+			if (log_read_item(it->log, it->hi, buf, &kv) < 0) {
+				r = -2;
+				break;
+			}
+			if (kv.key_sz != it->okey->key_sz ||
+			    memcmp(kv.key, it->okey->key, kv.key_sz) != 0) {
+				/* md5 collision, see base_get(). */
+				continue;
+			}
+			if (base_value(base, &kv) != 0) {
+				r = -2;
+				break;
+			}
+			r = callback(userdata, kv.key, kv.key_sz,
+				     kv.value, kv.value_sz);
+		}
+	}
+	free(buf);
+	return r;
+}
+
 struct _gc_ctx {
 	struct base *base;
 	struct batch *batch;
@@ -163,11 +465,20 @@ struct _gc_ctx {
 	uint64_t written;
 };
 
-static int _base_gc_callback(void *ctx_p, const char *key, unsigned key_sz,
-			     const char *value, unsigned value_sz)
+static int _base_gc_callback(void *ctx_p, struct keyvalue *kv)
 {
 	struct _gc_ctx *ctx = (struct _gc_ctx *)ctx_p;
-	batch_set(ctx->batch, key, key_sz, value, value_sz);
+	struct blob_ref ref;
+	if (kv->is_blob) {
+		/* Only the reference moves, the blob stays in place. */
+		if (blob_ref_parse(kv->value, kv->value_sz, &ref) != 0) {
+			return -2;
+		}
+		batch_set_blob(ctx->batch, kv->key, kv->key_sz, &ref);
+	} else {
+		batch_set(ctx->batch, kv->key, kv->key_sz,
+			  kv->value, kv->value_sz);
+	}
 	ctx->count -= 1;
 	if (ctx->count == 0) {
 		int r = base_write(ctx->base, ctx->batch, 0);
@@ -189,8 +500,10 @@ int base_gc(struct base *base, unsigned gc_size)
 
 	gettimeofday(&tv0, NULL);
 	struct _gc_ctx ctx = {base, batch_new(), 1024, 0};
+	/* The log is deleted once its items are moved, its pages would
+	 * only push out live ones. */
 	int r = log_iterate_sorted(logs_oldest(base->logs),
-				   gc_size,
+				   base_readahead(base, gc_size), 1,
 				   _base_gc_callback, &ctx);
 	if (r < 0) {
 		goto error;
@@ -212,3 +525,103 @@ error:;
 		 r < 0 ? "(error)" : "");
 	return r;
 }
+
+struct _blob_gc_ctx {
+	struct base *base;
+	struct batch *batch;
+	int count;
+	uint64_t moved;
+	unsigned data_sz;
+	char *data;
+};
+
+/* Is the blob still referenced by the newest record of the key? */
+static int _blob_is_live(struct _blob_gc_ctx *ctx,
+			 const char *key, unsigned key_sz,
+			 struct blob_ref *ref)
+{
+	struct base *base = ctx->base;
+	struct log *log;
+	struct hashdir_item hi;
+	if (base_index_get(base, md5(key, key_sz), &log, &hi) == 0) {
+		return 0;
+	}
+	if (hi.size > ctx->data_sz) {
+		free(ctx->data);
+		ctx->data_sz = hi.size;
+		ctx->data = malloc(hi.size);
+	}
+	struct keyvalue kv;
+	if (log_read_item(log, hi, ctx->data, &kv) < 0) {
+		return -2;
+	}
+	struct blob_ref current;
+	if (!kv.is_blob || kv.key_sz != key_sz ||
+	    memcmp(kv.key, key, key_sz) != 0 ||
+	    blob_ref_parse(kv.value, kv.value_sz, &current) != 0) {
+		return 0;
+	}
+	return current.file == ref->file && current.offset == ref->offset;
+}
+
+static int _blob_gc_callback(void *ctx_p, const char *key, unsigned key_sz,
+			     struct blob_ref *ref)
+{
+	struct _blob_gc_ctx *ctx = (struct _blob_gc_ctx *)ctx_p;
+	int r = _blob_is_live(ctx, key, key_sz, ref);
+	if (r <= 0) {
+		return r;
+	}
+	const char *value = blobs_read_buffered(ctx->base->blobs, ref);
+	struct blob_ref new_ref;
+	if (value == NULL ||
+	    blobs_put(ctx->base->blobs, key, key_sz, value, ref->value_sz,
+		      &new_ref) != 0) {
+		return -2;
+	}
+	batch_set_blob(ctx->batch, key, key_sz, &new_ref);
+	ctx->moved += ref->value_sz;
+	ctx->count -= 1;
+	if (ctx->count == 0 ||
+	    batch_size(ctx->batch) >= ctx->base->log_file_size_limit / 2) {
+		r = base_write(ctx->base, ctx->batch, 0);
+		batch_free(ctx->batch);
+		ctx->batch = batch_new();
+		ctx->count = 1024;
+		if (r < 0) {
+			return r;
+		}
+	}
+	return 0;
+}
+
+int base_blob_gc(struct base *base)
+{
+	uint64_t file = blobs_oldest(base->blobs);
+	if (file == 0) {
+		return 0;
+	}
+	struct timeval tv0, tv1;
+	gettimeofday(&tv0, NULL);
+
+	struct _blob_gc_ctx ctx = {base, batch_new(), 1024, 0, 0, NULL};
+	int r = blobs_scan(base->blobs, file, _blob_gc_callback, &ctx);
+	if (r == 0) {
+		/* The old file can go only when the moved references
+		 * are on disk. */
+		r = base_write(base, ctx.batch, 1);
+	}
+	batch_free(ctx.batch);
+	free(ctx.data);
+	if (r >= 0) {
+		base_async_wait(base);
+		r = blobs_remove(base->blobs, file) == 0 ? 1 : -2;
+	}
+
+	gettimeofday(&tv1, NULL);
+	log_info(base->db, "Blob gc moved %3.1f MB took %lu ms%s",
+		 (float)ctx.moved / (1024*1024.),
+		 TIMEVAL_MSEC_SUBTRACT(tv1, tv0),
+		 r < 0 ? " (error)" : "");
+	return r;
+}
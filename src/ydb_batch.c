@@ -11,15 +11,40 @@
 #include "ydb_writer.h"
 #include "ydb_batch.h"
 #include "ydb_record.h"
+#include "ydb_codec.h"
+#include "ydb_block.h"
+#include "ydb_blob.h"
+#include "ydb_db.h"
+#include "ydb_worker.h"
 
 #define BATCH_MIN_SLOTS 1024
 
+/* Batches are built on the caller's thread, so packing records and
+ * hashing keys happen there and different batches can be prepared
+ * in parallel. ydb_write() only compresses, writes and updates the
+ * index. */
 struct batch {
 	struct iovec *iov;
+	uint128_t *hashes;	/* md5 of the key, for every slot in 'iov' */
 	int iov_cnt;
 	int iov_sz;
 	uint64_t total_size;
 	unsigned total_sets;
+	int compressed;
+	int blobs_stored;
+
+	/* Records packed into blocks, 'blocks' is NULL if none. For
+	 * every slot in 'iov' it holds the range of its records in
+	 * 'members', or cnt = 0 if it's not a block. */
+	struct batch_block *blocks;
+	struct iovec *members;
+	uint128_t *member_hashes;
+	int members_cnt;
+};
+
+struct batch_block {
+	int first;
+	int cnt;
 };
 
 struct batch *batch_new()
@@ -27,6 +52,7 @@ struct batch *batch_new()
 	struct batch *batch = malloc(sizeof(struct batch));
 	memset(batch, 0, sizeof(struct batch));
 	batch->iov = malloc(sizeof(struct iovec) * BATCH_MIN_SLOTS);
+	batch->hashes = malloc(sizeof(uint128_t) * BATCH_MIN_SLOTS);
 	batch->iov_sz = BATCH_MIN_SLOTS;
 	return batch;
 }
@@ -37,7 +63,14 @@ void batch_free(struct batch *batch)
 	for (i=0; i < batch->iov_cnt; i++) {
 		free(batch->iov[i].iov_base);
 	}
+	for (i=0; i < batch->members_cnt; i++) {
+		free(batch->members[i].iov_base);
+	}
 	free(batch->iov);
+	free(batch->hashes);
+	free(batch->blocks);
+	free(batch->members);
+	free(batch->member_hashes);
 	free(batch);
 }
 
@@ -46,6 +79,8 @@ static int _batch_alloc_iov(struct batch *batch)
 	if (batch->iov_cnt == batch->iov_sz) {
 		int new_sz = batch->iov_sz * 2;
 		batch->iov = realloc(batch->iov, sizeof(struct iovec) * new_sz);
+		batch->hashes = realloc(batch->hashes,
+					sizeof(uint128_t) * new_sz);
 		batch->iov_sz = new_sz;
 	}
 	return batch->iov_cnt++;
@@ -54,23 +89,269 @@ static int _batch_alloc_iov(struct batch *batch)
 void batch_set(struct batch *batch,
 	       const char *key, unsigned key_sz,
 	       const char *value, unsigned value_sz)
+{
+	batch_set_h(batch, md5(key, key_sz), key, key_sz, value, value_sz);
+}
+
+void batch_set_h(struct batch *batch, uint128_t key_hash,
+		 const char *key, unsigned key_sz,
+		 const char *value, unsigned value_sz)
 {
 	int slot_no = _batch_alloc_iov(batch);
 	batch->iov[slot_no] = record_pack((struct record){YDB_LOG_SET,
 				key, key_sz, value, value_sz});
+	batch->hashes[slot_no] = key_hash;
 	batch->total_size += batch->iov[slot_no].iov_len;
 	batch->total_sets += 1;
 }
 
 void batch_del(struct batch *batch,
 	       char *key, unsigned key_sz)
+{
+	batch_del_h(batch, md5(key, key_sz), key, key_sz);
+}
+
+void batch_del_h(struct batch *batch, uint128_t key_hash,
+		 const char *key, unsigned key_sz)
 {
 	int slot_no = _batch_alloc_iov(batch);
 	batch->iov[slot_no] = record_pack((struct record) {YDB_LOG_DEL,
 				key, key_sz, NULL, 0});
+	batch->hashes[slot_no] = key_hash;
 	batch->total_size += batch->iov[slot_no].iov_len;
 }
 
+void batch_set_blob(struct batch *batch,
+		    const char *key, unsigned key_sz,
+		    struct blob_ref *ref)
+{
+	int slot_no = _batch_alloc_iov(batch);
+	batch->iov[slot_no] = record_pack((struct record){YDB_LOG_BLOB,
+				key, key_sz, (char*)ref, sizeof(*ref)});
+	batch->hashes[slot_no] = md5(key, key_sz);
+	batch->total_size += batch->iov[slot_no].iov_len;
+	batch->total_sets += 1;
+}
+
+int batch_store_blobs(struct batch *batch, struct blobs *blobs,
+		      unsigned threshold)
+{
+	if (batch->blobs_stored || batch->blocks || batch->compressed) {
+		return 0;
+	}
+	batch->blobs_stored = 1;
+	int i;
+	for (i=0; i < batch->iov_cnt; i++) {
+		struct iovec *slot = &batch->iov[i];
+		struct record rec = record_unpack_force(*slot);
+		if (rec.magic != YDB_LOG_SET || rec.value_sz < threshold) {
+			continue;
+		}
+		struct blob_ref ref;
+		if (blobs_put(blobs, rec.key, rec.key_sz,
+			      rec.value, rec.value_sz, &ref) != 0) {
+			return -1;
+		}
+		struct iovec iov = record_pack((struct record){YDB_LOG_BLOB,
+					rec.key, rec.key_sz,
+					(char*)&ref, sizeof(ref)});
+		batch->total_size -= slot->iov_len;
+		batch->total_size += iov.iov_len;
+		free(slot->iov_base);
+		*slot = iov;
+	}
+	return 0;
+}
+
+/* Compressing and packing blocks are split into parts of about this
+ * many bytes, run in parallel on the worker pool. */
+#define BATCH_PART_SIZE (256 << 10)
+
+static unsigned _batch_parts(uint64_t size, unsigned cnt)
+{
+	unsigned parts = (size + BATCH_PART_SIZE - 1) / BATCH_PART_SIZE;
+	return parts < cnt ? parts : cnt;
+}
+
+struct _compress_ctx {
+	struct batch *batch;
+	struct codec *codec;
+	unsigned parts;
+	int64_t *saved;		/* Bytes saved by every part */
+};
+
+static void _compress_part(void *ctx_p, unsigned part)
+{
+	struct _compress_ctx *ctx = ctx_p;
+	struct batch *batch = ctx->batch;
+	int i, end = (uint64_t)batch->iov_cnt * (part + 1) / ctx->parts;
+	for (i = (uint64_t)batch->iov_cnt * part / ctx->parts; i < end; i++) {
+		struct iovec *slot = &batch->iov[i];
+		struct record rec = record_unpack_force(*slot);
+		if (rec.magic != YDB_LOG_SET) {
+			continue;
+		}
+		char *frame;
+		unsigned frame_sz = codec_compress(ctx->codec, rec.value,
+						   rec.value_sz, &frame);
+		if (frame_sz == 0) {
+			continue;
+		}
+		struct iovec iov = record_pack((struct record){YDB_LOG_SETZ,
+					rec.key, rec.key_sz, frame, frame_sz});
+		free(frame);
+		ctx->saved[part] += (int64_t)slot->iov_len - iov.iov_len;
+		free(slot->iov_base);
+		*slot = iov;
+	}
+}
+
+void batch_compress(struct batch *batch, struct codec *codec,
+		    struct db *db)
+{
+	if (batch->compressed) {
+		return;
+	}
+	batch->compressed = 1;
+	unsigned parts = _batch_parts(batch->total_size, batch->iov_cnt);
+	if (parts == 0) {
+		return;
+	}
+	struct _compress_ctx ctx = {batch, codec, parts,
+				    calloc(parts, sizeof(int64_t))};
+	if (db && parts > 1) {
+		db_parallel(db, TASK_WRITE, _compress_part, &ctx, parts);
+	} else {
+		ctx.parts = 1;
+		_compress_part(&ctx, 0);
+	}
+	unsigned i;
+	for (i = 0; i < parts; i++) {
+		batch->total_size -= ctx.saved[i];
+	}
+	free(ctx.saved);
+}
+
+/* A run of records that becomes a single slot, a block if it's
+ * longer than one record. */
+struct _run {
+	int start;
+	int end;
+	struct iovec block;
+};
+
+struct _pack_ctx {
+	struct batch *batch;
+	struct codec *codec;
+	struct _run *runs;
+	int runs_cnt;
+	unsigned parts;
+};
+
+static void _pack_part(void *ctx_p, unsigned part)
+{
+	struct _pack_ctx *ctx = ctx_p;
+	int i, end = (uint64_t)ctx->runs_cnt * (part + 1) / ctx->parts;
+	for (i = (uint64_t)ctx->runs_cnt * part / ctx->parts; i < end; i++) {
+		struct _run *run = &ctx->runs[i];
+		if (run->end - run->start > 1) {
+			run->block = block_pack(ctx->codec,
+						&ctx->batch->iov[run->start],
+						&ctx->batch->hashes[run->start],
+						run->end - run->start);
+		}
+	}
+}
+
+static void _add_run(struct _pack_ctx *ctx, int start, int end)
+{
+	if (start < end) {
+		ctx->runs[ctx->runs_cnt++] = (struct _run){start, end,
+							  {NULL, 0}};
+	}
+}
+
+void batch_pack_blocks(struct batch *batch, struct codec *codec,
+		       unsigned block_size, struct db *db)
+{
+	if (block_size == 0 || batch->blocks || batch->compressed) {
+		return;
+	}
+	struct _pack_ctx ctx = {batch, codec,
+				malloc(sizeof(struct _run) * batch->iov_cnt),
+				0, 0};
+
+	/* Runs of consecutive small SETs become blocks, the order of
+	 * operations is kept. */
+	int i, run_start = 0;
+	uint64_t run_size = 0;
+	for (i=0; i < batch->iov_cnt; i++) {
+		struct iovec *slot = &batch->iov[i];
+		struct record rec = record_unpack_force(*slot);
+		if (rec.magic != YDB_LOG_SET || slot->iov_len > block_size / 4) {
+			_add_run(&ctx, run_start, i);
+			_add_run(&ctx, i, i + 1);
+			run_start = i + 1;
+			run_size = 0;
+			continue;
+		}
+		run_size += slot->iov_len;
+		if (run_size >= block_size) {
+			_add_run(&ctx, run_start, i + 1);
+			run_start = i + 1;
+			run_size = 0;
+		}
+	}
+	_add_run(&ctx, run_start, batch->iov_cnt);
+
+	ctx.parts = _batch_parts(batch->total_size, ctx.runs_cnt);
+	if (db && ctx.parts > 1) {
+		db_parallel(db, TASK_WRITE, _pack_part, &ctx, ctx.parts);
+	} else if (ctx.parts) {
+		ctx.parts = 1;
+		_pack_part(&ctx, 0);
+	}
+
+	struct iovec *iov = malloc(sizeof(struct iovec) * batch->iov_sz);
+	uint128_t *hashes = malloc(sizeof(uint128_t) * batch->iov_sz);
+	struct batch_block *blocks = malloc(sizeof(struct batch_block) *
+					    batch->iov_sz);
+	batch->members = malloc(sizeof(struct iovec) * batch->iov_cnt);
+	batch->member_hashes = malloc(sizeof(uint128_t) * batch->iov_cnt);
+	for (i = 0; i < ctx.runs_cnt; i++) {
+		struct _run *run = &ctx.runs[i];
+		int cnt = run->end - run->start;
+		if (cnt == 1) {
+			blocks[i] = (struct batch_block){0, 0};
+			iov[i] = batch->iov[run->start];
+			hashes[i] = batch->hashes[run->start];
+			continue;
+		}
+		int j;
+		for (j = run->start; j < run->end; j++) {
+			batch->total_size -= batch->iov[j].iov_len;
+		}
+		memcpy(&batch->members[batch->members_cnt],
+		       &batch->iov[run->start], sizeof(struct iovec) * cnt);
+		memcpy(&batch->member_hashes[batch->members_cnt],
+		       &batch->hashes[run->start], sizeof(uint128_t) * cnt);
+		batch->total_size += run->block.iov_len;
+		blocks[i] = (struct batch_block){batch->members_cnt, cnt};
+		iov[i] = run->block;
+		/* Not a key, the members have their own. */
+		hashes[i] = 0;
+		batch->members_cnt += cnt;
+	}
+
+	free(batch->iov);
+	free(batch->hashes);
+	batch->iov = iov;
+	batch->hashes = hashes;
+	batch->iov_cnt = ctx.runs_cnt;
+	batch->blocks = blocks;
+	free(ctx.runs);
+}
+
 int batch_write(struct batch *batch, struct writer *writer,
 		batch_write_cb callback, void *context)
 {
@@ -82,9 +363,22 @@ int batch_write(struct batch *batch, struct writer *writer,
 	int i;
 	for (i=0; i < batch->iov_cnt; i++) {
 		struct iovec *slot = &batch->iov[i];
-		struct record rec = record_unpack_force(*slot);
-		callback(context, rec.magic, rec.key, rec.key_sz,
-			 offset, slot->iov_len);
+		if (batch->blocks && batch->blocks[i].cnt) {
+			struct batch_block *block = &batch->blocks[i];
+			unsigned charge = block_charge(slot->iov_len, block->cnt);
+			int j;
+			for (j = block->first; j < block->first + block->cnt; j++) {
+				struct record rec =
+					record_unpack_force(batch->members[j]);
+				callback(context, rec.magic,
+					 batch->member_hashes[j],
+					 rec.key, rec.key_sz, offset, charge);
+			}
+		} else {
+			struct record rec = record_unpack_force(*slot);
+			callback(context, rec.magic, batch->hashes[i],
+				 rec.key, rec.key_sz, offset, slot->iov_len);
+		}
 		offset += slot->iov_len;
 	}
 	return r;
@@ -1,5 +1,7 @@
 
 struct batch;
+struct codec;
+struct db;
 struct batch *batch_new();
 void batch_free(struct batch *batch);
 void batch_set(struct batch *batch,
@@ -7,9 +9,36 @@ void batch_set(struct batch *batch,
 	       const char *value, unsigned value_sz);
 void batch_del(struct batch *batch,
 	       char *key, unsigned key_sz);
+/* With md5 of the key already known. */
+void batch_set_h(struct batch *batch, uint128_t key_hash,
+		 const char *key, unsigned key_sz,
+		 const char *value, unsigned value_sz);
+void batch_del_h(struct batch *batch, uint128_t key_hash,
+		 const char *key, unsigned key_sz);
+/* Set a key to a value already stored in a blob file. */
+struct blob_ref;
+void batch_set_blob(struct batch *batch,
+		    const char *key, unsigned key_sz,
+		    struct blob_ref *ref);
+
+/* Move values of at least 'threshold' bytes to blob files. Must be
+ * done before batch_pack_blocks(). Returns 0 or -1 on error. */
+struct blobs;
+int batch_store_blobs(struct batch *batch, struct blobs *blobs,
+		      unsigned threshold);
+
+/* Pack runs of small SET records into blocks of about 'block_size'
+ * bytes. Must be done before batch_compress(). Big batches are packed
+ * in parallel on the worker pool of 'db', if given. */
+void batch_pack_blocks(struct batch *batch, struct codec *codec,
+		       unsigned block_size, struct db *db);
+/* Compress values of the batch, where it pays off. Parallel like
+ * batch_pack_blocks(). */
+void batch_compress(struct batch *batch, struct codec *codec,
+		    struct db *db);
 
 typedef void (*batch_write_cb)(void *context,
-			       uint32_t magic,
+			       uint32_t magic, uint128_t key_hash,
 			       const char *key, unsigned key_sz,
 			       uint64_t offset, uint64_t size);
 
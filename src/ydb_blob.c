@@ -0,0 +1,413 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "ydb_common.h"
+#include "ydb_logging.h"
+#include "ydb_file.h"
+#include "ydb_blob.h"
+
+#define BLOB_MAGIC (0xB10BF11E)
+/* A single read or write syscall can't move more than 2GB. */
+#define BLOB_IO_CHUNK (64 << 20)
+
+struct blob_header {
+	uint32_t magic;
+	uint32_t key_sz;
+	uint32_t value_sz;
+	uint32_t value_sum;
+} __attribute__ ((packed));
+
+struct blob_file {
+	uint64_t number;
+	struct file *file;
+	uint64_t size;
+};
+
+struct read_buffer {
+	char *buf;
+	unsigned buf_sz;
+};
+
+struct blobs {
+	struct db *db;
+	struct dir *dir;
+	uint64_t file_size_limit;
+
+	pthread_mutex_t lock;	/* Guards 'files' */
+	struct blob_file *files;	/* Sorted by number */
+	int files_cnt;
+	int files_sz;
+
+	/* Appends to the newest file. The files found on open are never
+	 * appended to, a new one is started on the first write. */
+	struct file *writer;
+
+	pthread_key_t buffer_key;
+};
+
+
+static char *_blob_filename(uint64_t number)
+{
+	static __thread char buf[32];
+	snprintf(buf, sizeof(buf), "%012llx.blob", (unsigned long long)number);
+	return buf;
+}
+
+static int _filter(void *ud, const char *filename)
+{
+	ud = ud;
+	return fnmatch("[0-9a-f]*.blob", filename, FNM_PATHNAME) == 0;
+}
+
+static int _file_cmp(const void *a_p, const void *b_p)
+{
+	const struct blob_file *a = a_p, *b = b_p;
+	return (a->number > b->number) - (a->number < b->number);
+}
+
+static void _read_buffer_free(void *rb_p)
+{
+	struct read_buffer *rb = (struct read_buffer *)rb_p;
+	free(rb->buf);
+	free(rb);
+}
+
+static void _add_file(struct blobs *blobs, struct blob_file bf)
+{
+	pthread_mutex_lock(&blobs->lock);
+	if (blobs->files_cnt == blobs->files_sz) {
+		blobs->files_sz = blobs->files_sz ? blobs->files_sz * 2 : 16;
+		blobs->files = realloc(blobs->files, sizeof(struct blob_file) *
+				       blobs->files_sz);
+	}
+	blobs->files[blobs->files_cnt++] = bf;
+	pthread_mutex_unlock(&blobs->lock);
+}
+
+struct blobs *blobs_new(struct db *db, struct dir *dir,
+			uint64_t file_size_limit)
+{
+	struct blobs *blobs = malloc(sizeof(struct blobs));
+	memset(blobs, 0, sizeof(struct blobs));
+	blobs->db = db;
+	blobs->dir = dir;
+	blobs->file_size_limit = file_size_limit;
+	pthread_mutex_init(&blobs->lock, NULL);
+	pthread_key_create(&blobs->buffer_key, _read_buffer_free);
+
+	char **files_org = dir_list(dir, _filter, NULL);
+	char **files;
+	for (files = files_org; *files != NULL; files++) {
+		uint64_t number = strtoull(*files, NULL, 16);
+		struct file *file = file_open_read(dir, *files);
+		uint64_t size = 0;
+		if (file == NULL || file_size(file, &size) != 0) {
+			log_warn(db, "Can't open blob file \"%s\".", *files);
+			if (file) {
+				file_close(file);
+			}
+		} else {
+			_add_file(blobs, (struct blob_file){number, file, size});
+		}
+		free(*files);
+	}
+	free(files_org);
+	qsort(blobs->files, blobs->files_cnt, sizeof(struct blob_file),
+	      _file_cmp);
+	return blobs;
+}
+
+void blobs_free(struct blobs *blobs)
+{
+	struct read_buffer *rb = pthread_getspecific(blobs->buffer_key);
+	if (rb) {
+		_read_buffer_free(rb);
+	}
+	pthread_key_delete(blobs->buffer_key);
+	if (blobs->writer) {
+		file_close(blobs->writer);
+	}
+	int i;
+	for (i = 0; i < blobs->files_cnt; i++) {
+		file_close(blobs->files[i].file);
+	}
+	free(blobs->files);
+	pthread_mutex_destroy(&blobs->lock);
+	free(blobs);
+}
+
+static int _blobs_roll(struct blobs *blobs)
+{
+	uint64_t number = 1;
+	if (blobs->files_cnt) {
+		number = blobs->files[blobs->files_cnt - 1].number + 1;
+	}
+	char *filename = _blob_filename(number);
+	struct file *writer = file_open_append_new(blobs->dir, filename);
+	if (writer == NULL) {
+		return -1;
+	}
+	struct file *file = file_open_read(blobs->dir, filename);
+	if (file == NULL) {
+		file_close(writer);
+		return -1;
+	}
+	if (blobs->writer) {
+		file_sync(blobs->writer);
+		file_close(blobs->writer);
+	}
+	blobs->writer = writer;
+	_add_file(blobs, (struct blob_file){number, file, 0});
+	log_info(blobs->db, "Opened blob file \"%s\".", filename);
+	return 0;
+}
+
+int blobs_put(struct blobs *blobs, const char *key, unsigned key_sz,
+	      const char *value, unsigned value_sz, struct blob_ref *ref)
+{
+	if (blobs->writer == NULL ||
+	    blobs->files[blobs->files_cnt - 1].size >= blobs->file_size_limit) {
+		if (_blobs_roll(blobs) != 0) {
+			return -1;
+		}
+	}
+	struct blob_file *bf = &blobs->files[blobs->files_cnt - 1];
+	uint64_t start = bf->size;
+
+	struct blob_header header = {BLOB_MAGIC, key_sz, value_sz,
+				     adler32(value, value_sz)};
+	struct iovec iov[2] = {{&header, sizeof(header)},
+			       {(void*)key, key_sz}};
+	if (file_appendv(blobs->writer, iov, 2, start) < 0) {
+		return -1;
+	}
+	uint64_t done = 0;
+	while (done < value_sz) {
+		uint64_t chunk = value_sz - done < BLOB_IO_CHUNK ?
+			value_sz - done : BLOB_IO_CHUNK;
+		iov[0] = (struct iovec){(void*)(value + done), chunk};
+		if (file_appendv(blobs->writer, iov, 1, start) < 0) {
+			return -1;
+		}
+		done += chunk;
+	}
+
+	*ref = (struct blob_ref){bf->number, start + sizeof(header) + key_sz,
+				 value_sz, header.value_sum};
+	pthread_mutex_lock(&blobs->lock);
+	bf->size = start + sizeof(header) + key_sz + value_sz;
+	pthread_mutex_unlock(&blobs->lock);
+	return 0;
+}
+
+int blobs_sync(struct blobs *blobs)
+{
+	if (blobs->writer == NULL) {
+		return 0;
+	}
+	return file_sync(blobs->writer);
+}
+
+int blob_ref_parse(const char *value, unsigned value_sz,
+		   struct blob_ref *ref)
+{
+	if (value_sz != sizeof(struct blob_ref)) {
+		return -1;
+	}
+	memcpy(ref, value, sizeof(struct blob_ref));
+	return 0;
+}
+
+static struct blob_file *_find(struct blobs *blobs, uint64_t number)
+{
+	int lo = 0, hi = blobs->files_cnt;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (blobs->files[mid].number < number) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < blobs->files_cnt && blobs->files[lo].number == number) {
+		return &blobs->files[lo];
+	}
+	return NULL;
+}
+
+static struct file *_find_file(struct blobs *blobs, uint64_t number)
+{
+	pthread_mutex_lock(&blobs->lock);
+	struct blob_file *bf = _find(blobs, number);
+	struct file *file = bf ? bf->file : NULL;
+	pthread_mutex_unlock(&blobs->lock);
+	return file;
+}
+
+static int _pread(struct file *file, char *buf, uint64_t count,
+		  uint64_t offset)
+{
+	uint64_t done = 0;
+	while (done < count) {
+		uint64_t chunk = count - done < BLOB_IO_CHUNK ?
+			count - done : BLOB_IO_CHUNK;
+		if (file_pread(file, buf + done, chunk, offset + done) == -1) {
+			return -1;
+		}
+		done += chunk;
+	}
+	return 0;
+}
+
+int blobs_read(struct blobs *blobs, struct blob_ref *ref, char *buf)
+{
+	struct file *file = _find_file(blobs, ref->file);
+	if (file == NULL) {
+		log_error(blobs->db, "Missing blob file \"%s\".",
+			  _blob_filename(ref->file));
+		return -1;
+	}
+	if (_pread(file, buf, ref->value_sz, ref->offset) != 0) {
+		return -1;
+	}
+	if (adler32(buf, ref->value_sz) != ref->value_sum) {
+		log_error(blobs->db, "%s#%llu can't read blob, checksum error",
+			  _blob_filename(ref->file),
+			  (unsigned long long)ref->offset);
+		return -1;
+	}
+	return 0;
+}
+
+const char *blobs_read_buffered(struct blobs *blobs, struct blob_ref *ref)
+{
+	struct read_buffer *rb = pthread_getspecific(blobs->buffer_key);
+	if (rb == NULL) {
+		rb = malloc(sizeof(struct read_buffer));
+		memset(rb, 0, sizeof(struct read_buffer));
+		pthread_setspecific(blobs->buffer_key, rb);
+	}
+	if (ref->value_sz > rb->buf_sz) {
+		free(rb->buf);
+		rb->buf_sz = ref->value_sz;
+		rb->buf = malloc(rb->buf_sz);
+	}
+	if (blobs_read(blobs, ref, rb->buf) != 0) {
+		return NULL;
+	}
+	return rb->buf;
+}
+
+int blobs_range(struct blobs *blobs, struct blob_ref *ref,
+		struct file_range *range)
+{
+	struct file *file = _find_file(blobs, ref->file);
+	if (file == NULL) {
+		log_error(blobs->db, "Missing blob file \"%s\".",
+			  _blob_filename(ref->file));
+		return -1;
+	}
+	*range = (struct file_range){file, ref->offset, ref->value_sz,
+				     ref->value_sum};
+	return 0;
+}
+
+uint64_t blobs_oldest(struct blobs *blobs)
+{
+	if (blobs->files_cnt == 0 ||
+	    (blobs->writer && blobs->files_cnt == 1)) {
+		return 0;
+	}
+	return blobs->files[0].number;
+}
+
+int blobs_scan(struct blobs *blobs, uint64_t number, blobs_scan_cb callback,
+	       void *ud)
+{
+	pthread_mutex_lock(&blobs->lock);
+	struct blob_file *bf = _find(blobs, number);
+	struct blob_file scanned = bf ? *bf : (struct blob_file){0, NULL, 0};
+	pthread_mutex_unlock(&blobs->lock);
+	if (scanned.file == NULL) {
+		return -1;
+	}
+
+	unsigned key_buf_sz = 256;
+	char *key_buf = malloc(key_buf_sz);
+	uint64_t offset = 0;
+	int r = 0;
+	while (r == 0 && offset + sizeof(struct blob_header) <= scanned.size) {
+		struct blob_header header;
+		r = _pread(scanned.file, (char*)&header, sizeof(header), offset);
+		if (r != 0) {
+			break;
+		}
+		uint64_t end = offset + sizeof(header) + header.key_sz +
+			header.value_sz;
+		if (header.magic != BLOB_MAGIC || end > scanned.size) {
+			/* Only an interrupted write leaves a broken tail. */
+			log_warn(blobs->db, "%s#%llu broken blob, ignoring the "
+				 "rest of the file", _blob_filename(number),
+				 (unsigned long long)offset);
+			break;
+		}
+		if (header.key_sz > key_buf_sz) {
+			key_buf_sz = header.key_sz;
+			free(key_buf);
+			key_buf = malloc(key_buf_sz);
+		}
+		r = _pread(scanned.file, key_buf, header.key_sz,
+			   offset + sizeof(header));
+		if (r != 0) {
+			break;
+		}
+		struct blob_ref ref = {number,
+				       offset + sizeof(header) + header.key_sz,
+				       header.value_sz, header.value_sum};
+		r = callback(ud, key_buf, header.key_sz, &ref);
+		offset = end;
+	}
+	free(key_buf);
+	return r;
+}
+
+int blobs_remove(struct blobs *blobs, uint64_t number)
+{
+	pthread_mutex_lock(&blobs->lock);
+	struct blob_file *bf = _find(blobs, number);
+	if (bf == NULL ||
+	    (blobs->writer && bf == &blobs->files[blobs->files_cnt - 1])) {
+		pthread_mutex_unlock(&blobs->lock);
+		return -1;
+	}
+	file_close(bf->file);
+	memmove(bf, bf + 1, sizeof(struct blob_file) *
+		(&blobs->files[blobs->files_cnt] - (bf + 1)));
+	blobs->files_cnt -= 1;
+	pthread_mutex_unlock(&blobs->lock);
+
+	log_info(blobs->db, "Removing blob file \"%s\".", _blob_filename(number));
+	return dir_unlink(blobs->dir, _blob_filename(number));
+}
+
+void blobs_stats(struct blobs *blobs, unsigned *files_ptr,
+		 uint64_t *size_ptr)
+{
+	pthread_mutex_lock(&blobs->lock);
+	uint64_t size = 0;
+	int i;
+	for (i = 0; i < blobs->files_cnt; i++) {
+		size += blobs->files[i].size;
+	}
+	*files_ptr = blobs->files_cnt;
+	*size_ptr = size;
+	pthread_mutex_unlock(&blobs->lock);
+}
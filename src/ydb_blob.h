@@ -0,0 +1,59 @@
+/* Blob files keep big values out of the logs. A value above the
+ * threshold is appended to the current blob file "%012llx.blob":
+ *
+ *    struct blob_header, key, value
+ *
+ * and the log gets a YDB_LOG_BLOB record with the key and a struct
+ * blob_ref as the value. Blob files are append only, a new one is
+ * started when the current one grows over the size limit. Old blob
+ * files are collected independently from the logs: live values are
+ * copied to the current blob file and the old file is removed. */
+
+struct db;
+struct dir;
+struct blobs;
+
+struct blob_ref {
+	uint64_t file;
+	uint64_t offset;	/* Of the value */
+	uint32_t value_sz;
+	uint32_t value_sum;
+} __attribute__ ((packed));
+
+struct blobs *blobs_new(struct db *db, struct dir *dir,
+			uint64_t file_size_limit);
+void blobs_free(struct blobs *blobs);
+
+/* Append a value to the current blob file. Returns 0 or -1 on error. */
+int blobs_put(struct blobs *blobs, const char *key, unsigned key_sz,
+	      const char *value, unsigned value_sz, struct blob_ref *ref);
+int blobs_sync(struct blobs *blobs);
+
+/* Parse the value of a YDB_LOG_BLOB record. Returns 0 or -1. */
+int blob_ref_parse(const char *value, unsigned value_sz,
+		   struct blob_ref *ref);
+
+/* Read the value into a buffer of at least ref->value_sz bytes and
+ * verify the checksum. Returns 0 or -1 on error. */
+int blobs_read(struct blobs *blobs, struct blob_ref *ref, char *buf);
+/* Thread safe. Like blobs_read() but into a per-thread buffer, valid
+ * until the next call from the same thread. NULL on error. */
+const char *blobs_read_buffered(struct blobs *blobs, struct blob_ref *ref);
+/* Where the value is, to read it in parts. Returns 0 or -1. */
+struct file_range;
+int blobs_range(struct blobs *blobs, struct blob_ref *ref,
+		struct file_range *range);
+
+/* Oldest blob file that isn't written to, 0 if there is none. */
+uint64_t blobs_oldest(struct blobs *blobs);
+
+typedef int (*blobs_scan_cb)(void *ud, const char *key, unsigned key_sz,
+			     struct blob_ref *ref);
+/* Walk all the values in a blob file, stops when the callback returns
+ * non-zero. Returns the callback's result or -1 on read error. */
+int blobs_scan(struct blobs *blobs, uint64_t file, blobs_scan_cb callback,
+	       void *ud);
+int blobs_remove(struct blobs *blobs, uint64_t file);
+
+void blobs_stats(struct blobs *blobs, unsigned *files_ptr,
+		 uint64_t *size_ptr);
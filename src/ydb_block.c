@@ -0,0 +1,256 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "ydb_common.h"
+#include "ydb_record.h"
+#include "ydb_codec.h"
+#include "ydb_block.h"
+
+struct block_table {
+	uint32_t cnt;
+	uint32_t compressed;
+} __attribute__ ((packed));
+
+struct block_entry {
+	uint32_t hash;
+	uint32_t offset;
+} __attribute__ ((packed));
+
+struct block {
+	uint64_t file_id;
+	uint64_t offset;
+	int refs;
+	unsigned cnt;
+	struct block_entry *entries;
+	char *data;
+};
+
+struct block_cache {
+	pthread_mutex_t lock;
+	unsigned slots_cnt;
+	struct block **slots;
+	/* The block last returned to a thread. */
+	pthread_key_t pinned_key;
+};
+
+
+static void _block_unref(void *block_p)
+{
+	struct block *block = (struct block *)block_p;
+	if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(block);
+	}
+}
+
+static void _block_pin(struct block_cache *bc, struct block *block)
+{
+	struct block *pinned = pthread_getspecific(bc->pinned_key);
+	if (pinned == block) {
+		return;
+	}
+	__atomic_add_fetch(&block->refs, 1, __ATOMIC_ACQ_REL);
+	pthread_setspecific(bc->pinned_key, block);
+	if (pinned) {
+		_block_unref(pinned);
+	}
+}
+
+struct block_cache *block_cache_new(unsigned slots)
+{
+	struct block_cache *bc = malloc(sizeof(struct block_cache));
+	memset(bc, 0, sizeof(struct block_cache));
+	pthread_mutex_init(&bc->lock, NULL);
+	bc->slots_cnt = slots;
+	bc->slots = calloc(slots, sizeof(struct block *));
+	pthread_key_create(&bc->pinned_key, _block_unref);
+	return bc;
+}
+
+void block_cache_free(struct block_cache *bc)
+{
+	struct block *pinned = pthread_getspecific(bc->pinned_key);
+	if (pinned) {
+		_block_unref(pinned);
+	}
+	pthread_key_delete(bc->pinned_key);
+	unsigned i;
+	for (i = 0; i < bc->slots_cnt; i++) {
+		if (bc->slots[i]) {
+			_block_unref(bc->slots[i]);
+		}
+	}
+	free(bc->slots);
+	pthread_mutex_destroy(&bc->lock);
+	free(bc);
+}
+
+static unsigned _slot(struct block_cache *bc, uint64_t file_id, uint64_t offset)
+{
+	uint64_t h = (offset >> 5) * 0x9E3779B97F4A7C15ULL + file_id;
+	return (h >> 32) % bc->slots_cnt;
+}
+
+struct block *block_cache_get(struct block_cache *bc,
+			      uint64_t file_id, uint64_t offset)
+{
+	struct block *block = pthread_getspecific(bc->pinned_key);
+	if (block && block->file_id == file_id && block->offset == offset) {
+		return block;
+	}
+
+	pthread_mutex_lock(&bc->lock);
+	block = bc->slots[_slot(bc, file_id, offset)];
+	if (block && (block->file_id != file_id || block->offset != offset)) {
+		block = NULL;
+	}
+	if (block) {
+		_block_pin(bc, block);
+	}
+	pthread_mutex_unlock(&bc->lock);
+	return block;
+}
+
+struct block *block_load(struct block_cache *bc, struct codec *codec,
+			 uint64_t file_id, uint64_t offset,
+			 struct record *rec)
+{
+	struct block_table *table = (struct block_table *)rec->key;
+	if (rec->magic != YDB_LOG_BLOCK ||
+	    rec->key_sz < sizeof(struct block_table) ||
+	    rec->key_sz != sizeof(struct block_table) +
+	    table->cnt * sizeof(struct block_entry)) {
+		return NULL;
+	}
+
+	const char *payload = rec->value;
+	unsigned payload_sz = rec->value_sz;
+	if (table->compressed) {
+		if (codec == NULL) {
+			return NULL;
+		}
+		payload = codec_decompress(codec, rec->value, rec->value_sz);
+		payload_sz = codec_raw_size(rec->value, rec->value_sz);
+		if (payload == NULL) {
+			return NULL;
+		}
+	}
+
+	unsigned entries_sz = table->cnt * sizeof(struct block_entry);
+	struct block *block = malloc(sizeof(struct block) +
+				     entries_sz + payload_sz);
+	*block = (struct block){file_id, offset, 1, table->cnt,
+				(struct block_entry *)(block + 1),
+				(char *)(block + 1) + entries_sz};
+	memcpy(block->entries, table + 1, entries_sz);
+	memcpy(block->data, payload, payload_sz);
+
+	unsigned i;
+	for (i = 0; i < block->cnt; i++) {
+		uint32_t *sizes = (uint32_t *)(block->data +
+					       block->entries[i].offset);
+		if (block->entries[i].offset + 8 > payload_sz ||
+		    block->entries[i].offset + 8 + sizes[0] + sizes[1] >
+		    payload_sz) {
+			free(block);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_lock(&bc->lock);
+	unsigned slot = _slot(bc, file_id, offset);
+	if (bc->slots[slot]) {
+		_block_unref(bc->slots[slot]);
+	}
+	bc->slots[slot] = block;
+	_block_pin(bc, block);
+	pthread_mutex_unlock(&bc->lock);
+	return block;
+}
+
+unsigned block_count(struct block *block)
+{
+	return block->cnt;
+}
+
+void block_entry(struct block *block, unsigned i, struct keyvalue *kv)
+{
+	char *b = block->data + block->entries[i].offset;
+	uint32_t key_sz = ((uint32_t *)b)[0];
+	uint32_t value_sz = ((uint32_t *)b)[1];
+	b += 8;
+	*kv = (struct keyvalue){b, key_sz, b + key_sz, value_sz, 0};
+}
+
+int block_find(struct block *block, uint128_t key_hash, struct keyvalue *kv)
+{
+	/* Later entries overwrite earlier ones. */
+	int i;
+	for (i = block->cnt - 1; i >= 0; i--) {
+		if (block->entries[i].hash != (uint32_t)key_hash) {
+			continue;
+		}
+		block_entry(block, i, kv);
+		if (md5(kv->key, kv->key_sz) == key_hash) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+struct iovec block_pack(struct codec *codec, struct iovec *records,
+			uint128_t *hashes, int records_cnt)
+{
+	unsigned table_sz = sizeof(struct block_table) +
+		records_cnt * sizeof(struct block_entry);
+	unsigned payload_sz = 0;
+	int i;
+	for (i = 0; i < records_cnt; i++) {
+		struct record rec = record_unpack_force(records[i]);
+		payload_sz += 8 + rec.key_sz + rec.value_sz;
+	}
+
+	char *table = malloc(table_sz);
+	char *payload = malloc(payload_sz);
+	struct block_entry *entries =
+		(struct block_entry *)(table + sizeof(struct block_table));
+	char *b = payload;
+	for (i = 0; i < records_cnt; i++) {
+		struct record rec = record_unpack_force(records[i]);
+		entries[i] = (struct block_entry){(uint32_t)hashes[i],
+						  b - payload};
+		((uint32_t *)b)[0] = rec.key_sz;
+		((uint32_t *)b)[1] = rec.value_sz;
+		b += 8;
+		memcpy(b, rec.key, rec.key_sz);
+		b += rec.key_sz;
+		memcpy(b, rec.value, rec.value_sz);
+		b += rec.value_sz;
+	}
+
+	char *frame = NULL;
+	unsigned frame_sz = codec ? codec_compress(codec, payload, payload_sz,
+						   &frame) : 0;
+	*(struct block_table *)table = (struct block_table){
+		records_cnt, frame_sz != 0};
+	struct iovec iov = record_pack((struct record){YDB_LOG_BLOCK,
+				table, table_sz,
+				frame_sz ? frame : payload,
+				frame_sz ? frame_sz : payload_sz});
+	free(frame);
+	free(payload);
+	free(table);
+	return iov;
+}
+
+unsigned block_charge(unsigned block_sz, unsigned cnt)
+{
+	unsigned charge = (block_sz / cnt + 31) & ~31U;
+	return charge ? charge : 32;
+}
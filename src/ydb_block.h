@@ -0,0 +1,43 @@
+/* Block records group many small SET records into a single log record,
+ * compressed with the codec if it pays off:
+ *
+ *    key:    struct block_table, followed by cnt x struct block_entry
+ *    value:  payload, a codec frame if compressed
+ *
+ * The payload is a concatenation of (uint32_t key_sz, uint32_t value_sz,
+ * key, value). Every key in a block gets its own hashdir item pointing
+ * to the block offset, with the size being the key's share of the
+ * block. Readers find the key in the block by its hash.
+ *
+ * Decoded blocks are kept in a small shared cache. A block returned to
+ * a thread stays valid until the thread asks for another block. */
+
+struct block;
+struct block_cache;
+struct codec;
+struct record;
+
+#define BLOCK_CACHE_SLOTS 64
+
+struct block_cache *block_cache_new(unsigned slots);
+void block_cache_free(struct block_cache *bc);
+
+/* Pack SET records into a block record, 'hashes' are md5 of their
+ * keys. Thread safe. */
+struct iovec block_pack(struct codec *codec, struct iovec *records,
+			uint128_t *hashes, int records_cnt);
+/* Share of the block accounted to each of its keys. */
+unsigned block_charge(unsigned block_sz, unsigned cnt);
+
+/* Returns the cached block or NULL. */
+struct block *block_cache_get(struct block_cache *bc,
+			      uint64_t file_id, uint64_t offset);
+/* Decode a block record and put it in the cache. NULL on error. */
+struct block *block_load(struct block_cache *bc, struct codec *codec,
+			 uint64_t file_id, uint64_t offset,
+			 struct record *rec);
+
+unsigned block_count(struct block *block);
+void block_entry(struct block *block, unsigned i, struct keyvalue *kv);
+/* Returns 0 if the key is found, -1 otherwise. */
+int block_find(struct block *block, uint128_t key_hash, struct keyvalue *kv);
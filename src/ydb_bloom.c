@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ydb_common.h"
+#include "ydb_bloom.h"
+
+#define BLOCK_BITS 512
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+
+struct bloom {
+	uint64_t *blocks;
+	uint64_t blocks_cnt;
+	uint64_t capacity;
+	unsigned probes;
+};
+
+struct bloom *bloom_new(uint64_t capacity, unsigned bits_per_key)
+{
+	struct bloom *bloom = malloc(sizeof(struct bloom));
+	memset(bloom, 0, sizeof(struct bloom));
+	bloom->capacity = capacity;
+	bloom->blocks_cnt = (capacity * bits_per_key + BLOCK_BITS - 1) /
+		BLOCK_BITS;
+	if (bloom->blocks_cnt == 0) {
+		bloom->blocks_cnt = 1;
+	}
+	/* Optimal number of probes is ln(2) * bits_per_key. */
+	bloom->probes = (bits_per_key * 69 + 50) / 100;
+	if (bloom->probes < 1) {
+		bloom->probes = 1;
+	}
+	if (bloom->probes > 16) {
+		bloom->probes = 16;
+	}
+	uint64_t size = bloom->blocks_cnt * BLOCK_WORDS * sizeof(uint64_t);
+	if (posix_memalign((void **)&bloom->blocks, 64, size) != 0) {
+		free(bloom);
+		return NULL;
+	}
+	memset(bloom->blocks, 0, size);
+	return bloom;
+}
+
+void bloom_free(struct bloom *bloom)
+{
+	free(bloom->blocks);
+	free(bloom);
+}
+
+static uint64_t *_block(struct bloom *bloom, uint128_t key_hash)
+{
+	uint64_t h = (uint64_t)key_hash;
+	uint64_t idx = ((uint128_t)h * bloom->blocks_cnt) >> 64;
+	return &bloom->blocks[idx * BLOCK_WORDS];
+}
+
+/* Bit positions within a block come from the upper half of the hash,
+ * using double hashing. */
+#define FOR_EACH_PROBE(bloom, key_hash, bit)				\
+	uint32_t _h1 = (uint32_t)(key_hash >> 64);			\
+	uint32_t _h2 = (uint32_t)(key_hash >> 96) | 1;			\
+	unsigned _i;							\
+	for (_i = 0, bit = _h1 % BLOCK_BITS;				\
+	     _i < (bloom)->probes;					\
+	     _i++, _h1 += _h2, bit = _h1 % BLOCK_BITS)
+
+void bloom_add(struct bloom *bloom, uint128_t key_hash)
+{
+	uint64_t *block = _block(bloom, key_hash);
+	unsigned bit;
+	FOR_EACH_PROBE(bloom, key_hash, bit) {
+		block[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+int bloom_may_contain(struct bloom *bloom, uint128_t key_hash)
+{
+	uint64_t *block = _block(bloom, key_hash);
+	unsigned bit;
+	FOR_EACH_PROBE(bloom, key_hash, bit) {
+		if (!(block[bit / 64] & (1ULL << (bit % 64)))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+uint64_t bloom_capacity(struct bloom *bloom)
+{
+	return bloom->capacity;
+}
+
+uint64_t bloom_allocated(struct bloom *bloom)
+{
+	return bloom->blocks_cnt * BLOCK_WORDS * sizeof(uint64_t);
+}
+
+const char *bloom_bits(struct bloom *bloom, unsigned *probes_ptr)
+{
+	*probes_ptr = bloom->probes;
+	return (const char *)bloom->blocks;
+}
+
+struct bloom *bloom_load(const char *bits, uint64_t size, unsigned probes)
+{
+	uint64_t block_sz = BLOCK_WORDS * sizeof(uint64_t);
+	if (size == 0 || size % block_sz != 0 || probes < 1 || probes > 16) {
+		return NULL;
+	}
+	struct bloom *bloom = malloc(sizeof(struct bloom));
+	memset(bloom, 0, sizeof(struct bloom));
+	bloom->blocks_cnt = size / block_sz;
+	bloom->probes = probes;
+	if (posix_memalign((void **)&bloom->blocks, 64, size) != 0) {
+		free(bloom);
+		return NULL;
+	}
+	memcpy(bloom->blocks, bits, size);
+	return bloom;
+}
@@ -0,0 +1,20 @@
+/* Blocked Bloom filter on 128 bit key hashes. All bits of a key live
+ * in a single 64 byte block, so a lookup touches one cache line. Keys
+ * can't be removed, the owner is expected to rebuild the filter once
+ * too many keys are gone or it gets over capacity. */
+
+struct bloom;
+
+struct bloom *bloom_new(uint64_t capacity, unsigned bits_per_key);
+void bloom_free(struct bloom *bloom);
+
+void bloom_add(struct bloom *bloom, uint128_t key_hash);
+int bloom_may_contain(struct bloom *bloom, uint128_t key_hash);
+
+uint64_t bloom_capacity(struct bloom *bloom);
+uint64_t bloom_allocated(struct bloom *bloom);
+
+/* The bits of the filter, bloom_allocated() bytes, to save it. */
+const char *bloom_bits(struct bloom *bloom, unsigned *probes_ptr);
+/* A copy of saved bits. NULL if they don't make sense. */
+struct bloom *bloom_load(const char *bits, uint64_t size, unsigned probes);
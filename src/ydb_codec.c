@@ -0,0 +1,407 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <zlib.h>
+
+/* Don't include ydb_common.h, it clashes with zlib's adler32(). */
+#include "ydb_logging.h"
+#include "ydb_file.h"
+#include "ydb_codec.h"
+
+/* Smaller values aren't worth the effort. */
+#define CODEC_MIN_VALUE 64
+#define CODEC_MAX_DICTIONARIES 64
+#define CURRENT_FILENAME "zdict.current"
+
+struct frame_header {
+	uint32_t raw_sz;
+	uint32_t dict_id;
+} __attribute__ ((packed));
+
+struct dictionary {
+	uint32_t id;
+	char *buf;
+	unsigned buf_sz;
+};
+
+struct codec {
+	struct db *db;
+	struct dir *dir;
+	int level;
+
+	/* Deflate state is per thread as well, kept on a list for
+	 * codec_free(), the threads may outlive the key. */
+	pthread_key_t deflate_key;
+	pthread_mutex_t deflaters_lock;
+	struct deflater *deflaters;
+	struct dictionary *current;
+
+	/* Append only, so readers don't need a lock. */
+	struct dictionary dicts[CODEC_MAX_DICTIONARIES];
+	int dicts_cnt;
+
+	/* Same for the inflate state, used by the pool threads too. */
+	pthread_key_t inflate_key;
+	pthread_mutex_t inflaters_lock;
+	struct inflater *inflaters;
+};
+
+#define DICT_FILENAME_MAX 32
+
+static char *_dict_filename(char *buf, uint32_t id)
+{
+	snprintf(buf, DICT_FILENAME_MAX, "%08x.zdict", id);
+	return buf;
+}
+
+static struct dictionary *_dict_find(struct codec *codec, uint32_t id)
+{
+	int cnt = __atomic_load_n(&codec->dicts_cnt, __ATOMIC_ACQUIRE);
+	int i;
+	for (i = 0; i < cnt; i++) {
+		if (codec->dicts[i].id == id) {
+			return &codec->dicts[i];
+		}
+	}
+	return NULL;
+}
+
+static struct dictionary *_dict_register(struct codec *codec, uint32_t id,
+					 char *buf, unsigned buf_sz)
+{
+	struct dictionary *dict = _dict_find(codec, id);
+	if (dict) {
+		free(buf);
+		return dict;
+	}
+	if (codec->dicts_cnt == CODEC_MAX_DICTIONARIES) {
+		log_error(codec->db, "Too many compression dictionaries. %s", "");
+		free(buf);
+		return NULL;
+	}
+	dict = &codec->dicts[codec->dicts_cnt];
+	*dict = (struct dictionary){id, buf, buf_sz};
+	__atomic_store_n(&codec->dicts_cnt, codec->dicts_cnt + 1,
+			 __ATOMIC_RELEASE);
+	return dict;
+}
+
+static char *_read_file(struct dir *dir, const char *filename,
+			unsigned *size_ptr)
+{
+	struct file *file = file_open_read(dir, filename);
+	if (file == NULL) {
+		return NULL;
+	}
+	uint64_t size;
+	char *buf = NULL;
+	if (file_size(file, &size) == 0 && size > 0 &&
+	    size <= CODEC_MAX_DICTIONARY) {
+		buf = malloc(size);
+		if (file_pread(file, buf, size, 0) == -1) {
+			free(buf);
+			buf = NULL;
+		}
+		*size_ptr = size;
+	}
+	file_close(file);
+	return buf;
+}
+
+static int _write_file(struct dir *dir, const char *filename,
+		       const char *buf, unsigned buf_sz)
+{
+	char tmpname[64];
+	snprintf(tmpname, sizeof(tmpname), "%s.new", filename);
+	struct file *file = file_open_append_new(dir, tmpname);
+	if (file == NULL) {
+		return -1;
+	}
+	struct iovec iov[1] = {{(void*)buf, buf_sz}};
+	int r = file_appendv(file, iov, 1, 0);
+	if (r >= 0) {
+		r = file_sync(file);
+	}
+	file_close(file);
+	if (r >= 0) {
+		r = dir_renameat(dir, tmpname, filename, 0);
+	}
+	if (r < 0) {
+		dir_unlink(dir, tmpname);
+		return -1;
+	}
+	return 0;
+}
+
+static int _filter(void *ud, const char *filename)
+{
+	ud = ud;
+	return fnmatch("[0-9a-f]*.zdict", filename, FNM_PATHNAME) == 0;
+}
+
+static void _load_dictionaries(struct codec *codec)
+{
+	char **files_org = dir_list(codec->dir, _filter, NULL);
+	char **files;
+	for (files = files_org; *files != NULL; files++) {
+		unsigned buf_sz = 0;
+		char *buf = _read_file(codec->dir, *files, &buf_sz);
+		uint32_t id = buf ? crc32(0L, (Bytef*)buf, buf_sz) : 0;
+		char name[DICT_FILENAME_MAX];
+		if (buf == NULL ||
+		    strcmp(*files, _dict_filename(name, id)) != 0) {
+			log_warn(codec->db, "Ignoring broken compression "
+				 "dictionary \"%s\".", *files);
+			free(buf);
+		} else {
+			_dict_register(codec, id, buf, buf_sz);
+		}
+		free(*files);
+	}
+	free(files_org);
+
+	unsigned buf_sz;
+	char *buf = NULL;
+	if (dir_file_exists(codec->dir, CURRENT_FILENAME)) {
+		buf = _read_file(codec->dir, CURRENT_FILENAME, &buf_sz);
+	}
+	if (buf) {
+		char hex[16];
+		snprintf(hex, sizeof(hex), "%.*s",
+			 buf_sz < 8 ? buf_sz : 8, buf);
+		codec->current = _dict_find(codec, strtoul(hex, NULL, 16));
+		free(buf);
+	}
+}
+
+struct deflater {
+	z_stream zs;
+	struct deflater *next;
+};
+
+static struct deflater *_deflater(struct codec *codec)
+{
+	struct deflater *def = pthread_getspecific(codec->deflate_key);
+	if (def) {
+		return def;
+	}
+	def = malloc(sizeof(struct deflater));
+	memset(def, 0, sizeof(struct deflater));
+	int r = deflateInit2(&def->zs, codec->level, Z_DEFLATED,
+			     -15, 8, Z_DEFAULT_STRATEGY);
+	if (r != Z_OK) {
+		log_error(codec->db, "deflateInit2() failed with %i", r);
+		free(def);
+		return NULL;
+	}
+	pthread_mutex_lock(&codec->deflaters_lock);
+	def->next = codec->deflaters;
+	codec->deflaters = def;
+	pthread_mutex_unlock(&codec->deflaters_lock);
+	pthread_setspecific(codec->deflate_key, def);
+	return def;
+}
+
+/* Inflate state and output buffer, one per thread. */
+struct inflater {
+	z_stream zs;
+	char *buf;
+	unsigned buf_sz;
+	struct inflater *next;
+};
+
+static void _inflater_free(struct inflater *inf)
+{
+	inflateEnd(&inf->zs);
+	free(inf->buf);
+	free(inf);
+}
+
+struct codec *codec_new(struct db *db, struct dir *dir, int level)
+{
+	struct codec *codec = malloc(sizeof(struct codec));
+	memset(codec, 0, sizeof(struct codec));
+	codec->db = db;
+	codec->dir = dir;
+	codec->level = level;
+	pthread_key_create(&codec->deflate_key, NULL);
+	pthread_mutex_init(&codec->deflaters_lock, NULL);
+
+	if (level && _deflater(codec) == NULL) {
+		pthread_key_delete(codec->deflate_key);
+		pthread_mutex_destroy(&codec->deflaters_lock);
+		free(codec);
+		return NULL;
+	}
+	pthread_key_create(&codec->inflate_key, NULL);
+	pthread_mutex_init(&codec->inflaters_lock, NULL);
+	_load_dictionaries(codec);
+	if (codec->current) {
+		log_info(db, "Compressing with dictionary %08x, %u bytes.",
+			 codec->current->id, codec->current->buf_sz);
+	}
+	return codec;
+}
+
+void codec_free(struct codec *codec)
+{
+	pthread_key_delete(codec->inflate_key);
+	while (codec->inflaters) {
+		struct inflater *inf = codec->inflaters;
+		codec->inflaters = inf->next;
+		_inflater_free(inf);
+	}
+	pthread_mutex_destroy(&codec->inflaters_lock);
+	pthread_key_delete(codec->deflate_key);
+	while (codec->deflaters) {
+		struct deflater *def = codec->deflaters;
+		codec->deflaters = def->next;
+		deflateEnd(&def->zs);
+		free(def);
+	}
+	pthread_mutex_destroy(&codec->deflaters_lock);
+	int i;
+	for (i = 0; i < codec->dicts_cnt; i++) {
+		free(codec->dicts[i].buf);
+	}
+	free(codec);
+}
+
+uint32_t codec_add_dictionary(struct codec *codec,
+			      const char *dict, unsigned dict_sz)
+{
+	if (dict_sz == 0 || dict_sz > CODEC_MAX_DICTIONARY) {
+		return 0;
+	}
+	uint32_t id = crc32(0L, (const Bytef*)dict, dict_sz);
+	char name[DICT_FILENAME_MAX];
+	if (_write_file(codec->dir, _dict_filename(name, id),
+			dict, dict_sz) != 0) {
+		return 0;
+	}
+	char *buf = malloc(dict_sz);
+	memcpy(buf, dict, dict_sz);
+	struct dictionary *d = _dict_register(codec, id, buf, dict_sz);
+	if (d == NULL) {
+		return 0;
+	}
+
+	char hex[16];
+	snprintf(hex, sizeof(hex), "%08x\n", id);
+	if (_write_file(codec->dir, CURRENT_FILENAME, hex, 9) != 0) {
+		return 0;
+	}
+	codec->current = d;
+	log_info(codec->db, "Compressing with dictionary %08x, %u bytes.",
+		 id, dict_sz);
+	return id;
+}
+
+unsigned codec_compress(struct codec *codec,
+			const char *value, unsigned value_sz,
+			char **frame_ptr)
+{
+	if (codec->level == 0 || value_sz < CODEC_MIN_VALUE) {
+		return 0;
+	}
+	struct deflater *def = _deflater(codec);
+	if (def == NULL) {
+		return 0;
+	}
+	z_stream *zs = &def->zs;
+	deflateReset(zs);
+	if (codec->current) {
+		deflateSetDictionary(zs, (const Bytef*)codec->current->buf,
+				     codec->current->buf_sz);
+	}
+	/* Only keep the result if it saves at least an eighth. */
+	unsigned out_sz = value_sz - value_sz / 8;
+	char *frame = malloc(sizeof(struct frame_header) + out_sz);
+	zs->next_in = (Bytef*)value;
+	zs->avail_in = value_sz;
+	zs->next_out = (Bytef*)frame + sizeof(struct frame_header);
+	zs->avail_out = out_sz;
+	int r = deflate(zs, Z_FINISH);
+	if (r != Z_STREAM_END) {
+		free(frame);
+		return 0;
+	}
+	*(struct frame_header*)frame = (struct frame_header){
+		value_sz, codec->current ? codec->current->id : 0};
+	*frame_ptr = frame;
+	return sizeof(struct frame_header) + zs->total_out;
+}
+
+unsigned codec_raw_size(const char *frame, unsigned frame_sz)
+{
+	if (frame_sz < sizeof(struct frame_header)) {
+		return 0;
+	}
+	return ((struct frame_header*)frame)->raw_sz;
+}
+
+const char *codec_decompress(struct codec *codec,
+			     const char *frame, unsigned frame_sz)
+{
+	struct frame_header *fh = (struct frame_header*)frame;
+	if (frame_sz < sizeof(struct frame_header)) {
+		return NULL;
+	}
+	/* Deflate can't do better than 1032:1, a corrupt header must not
+	 * make us allocate gigabytes. */
+	uint64_t max_raw_sz = (uint64_t)(frame_sz -
+					 sizeof(struct frame_header)) * 1032;
+	if (fh->raw_sz > max_raw_sz) {
+		return NULL;
+	}
+
+	struct inflater *inf = pthread_getspecific(codec->inflate_key);
+	if (inf == NULL) {
+		inf = malloc(sizeof(struct inflater));
+		memset(inf, 0, sizeof(struct inflater));
+		if (inflateInit2(&inf->zs, -15) != Z_OK) {
+			free(inf);
+			return NULL;
+		}
+		pthread_mutex_lock(&codec->inflaters_lock);
+		inf->next = codec->inflaters;
+		codec->inflaters = inf;
+		pthread_mutex_unlock(&codec->inflaters_lock);
+		pthread_setspecific(codec->inflate_key, inf);
+	} else {
+		inflateReset(&inf->zs);
+	}
+	if (fh->raw_sz > inf->buf_sz) {
+		free(inf->buf);
+		inf->buf_sz = fh->raw_sz;
+		inf->buf = malloc(inf->buf_sz);
+	}
+
+	z_stream *zs = &inf->zs;
+	if (fh->dict_id) {
+		struct dictionary *dict = _dict_find(codec, fh->dict_id);
+		if (dict == NULL) {
+			log_error(codec->db, "Value compressed with unknown "
+				  "dictionary %08x.", fh->dict_id);
+			return NULL;
+		}
+		inflateSetDictionary(zs, (const Bytef*)dict->buf,
+				     dict->buf_sz);
+	}
+	zs->next_in = (Bytef*)frame + sizeof(struct frame_header);
+	zs->avail_in = frame_sz - sizeof(struct frame_header);
+	zs->next_out = (Bytef*)inf->buf;
+	zs->avail_out = fh->raw_sz;
+	int r = inflate(zs, Z_FINISH);
+	if (r != Z_STREAM_END || zs->total_out != fh->raw_sz) {
+		return NULL;
+	}
+	return inf->buf;
+}
@@ -0,0 +1,36 @@
+/* Value compression. Values are compressed with raw deflate,
+ * optionally primed with a dictionary. Every compressed value is
+ * stored as a frame:
+ *
+ *    uint32_t raw_sz;
+ *    uint32_t dict_id;   (0 - no dictionary)
+ *    char deflated[];
+ */
+
+struct db;
+struct dir;
+struct codec;
+
+struct codec *codec_new(struct db *db, struct dir *dir, int level);
+void codec_free(struct codec *codec);
+
+/* Persist a new dictionary in the database directory and use it for
+ * all subsequent compression. Returns dictionary id or 0 on error. */
+uint32_t codec_add_dictionary(struct codec *codec,
+			      const char *dict, unsigned dict_sz);
+
+/* Thread safe. Compress a value into a newly allocated frame. Returns
+ * the size of the frame or 0 if the value is not worth compressing. */
+unsigned codec_compress(struct codec *codec,
+			const char *value, unsigned value_sz,
+			char **frame_ptr);
+
+unsigned codec_raw_size(const char *frame, unsigned frame_sz);
+
+/* Thread safe. The value is decompressed into a per-thread buffer,
+ * valid until the next call from the same thread. Returns NULL on
+ * error. */
+const char *codec_decompress(struct codec *codec,
+			     const char *frame, unsigned frame_sz);
+
+#define CODEC_MAX_DICTIONARY (32 << 10)
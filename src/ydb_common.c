@@ -5,7 +5,7 @@
 
 /* Stolen from zlib.h. */
 #define BASE 65521L /* largest prime smaller than 65536 */
-#define NMAX 5552
+#define NMAX ADLER32_CHUNK
 /* NMAX is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
 
 #define DO1(buf,i)  {s1 += buf[i]; s2 += s1;}
@@ -16,7 +16,11 @@
 
 uint32_t adler32(const char *buf, uint32_t len)
 {
-	uint32_t adler = 1;
+	return adler32_update(1, buf, len);
+}
+
+uint32_t adler32_update(uint32_t adler, const char *buf, uint32_t len)
+{
 	uint32_t s1 = adler & 0xffff;
 	uint32_t s2 = (adler >> 16) & 0xffff;
 	int k;
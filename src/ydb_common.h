@@ -4,6 +4,11 @@ typedef __uint128_t uint128_t;
 #endif
 
 uint32_t adler32(const char *buf, uint32_t len);
+/* Continue a checksum, adler32(b, n) == adler32_update(1, b, n). The
+ * bytes are summed as signed chars, so a checksum fed in parts matches
+ * only if all but the last part are multiples of ADLER32_CHUNK. */
+#define ADLER32_CHUNK 5552
+uint32_t adler32_update(uint32_t adler, const char *buf, uint32_t len);
 uint128_t md5(const char *buf, unsigned int buf_sz);
 
 struct keyvalue {
@@ -11,6 +16,7 @@ struct keyvalue {
 	unsigned key_sz;
 	const char *value;
 	unsigned value_sz;
+	int is_blob;		/* The value is a struct blob_ref */
 };
 
 #define TIMEVAL_MSEC_SUBTRACT(a,b) ((((a).tv_sec - (b).tv_sec) * 1000) + ((a).tv_usec - (b).tv_usec) / 1000)
@@ -8,8 +8,12 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include "ydb_common.h"
 #include "ydb_logging.h"
 #include "ydb_file.h"
+#include "ydb_block.h"
+#include "ydb_iobuf.h"
+#include "ydb_stats.h"
 
 #include "ydb_db.h"
 #include "ydb_worker.h"
@@ -17,12 +21,19 @@
 
 struct db {
 	int log_fd;
+	struct logger *logger;	/* NULL if logging synchronously */
 	struct dir *log_dir;
 	struct dir *index_dir;
 	struct worker *worker;
+	struct codec *codec;
+	struct block_cache *block_cache;
+	struct iobufs *iobufs;
+	struct stats *stats;
+	int wide_index;
+	int direct_io;
 };
 
-static struct db *_db_new(const char *directory)
+static struct db *_db_new(const char *directory, unsigned worker_threads)
 {
 	struct db *db = malloc(sizeof(struct db));
 	memset(db, 0, sizeof(struct db));
@@ -33,18 +44,21 @@ static struct db *_db_new(const char *directory)
 		free(db);
 		return NULL;
 	}
-	db->worker = worker_new(db);
+	db->worker = worker_new(db, worker_threads);
 	if (db->worker == NULL) {
 		dir_free(db->log_dir);
 		free(db);
 		return NULL;
 	}
+	db->block_cache = block_cache_new(BLOCK_CACHE_SLOTS);
+	db->iobufs = iobufs_new(IOBUF_MAX_FREE);
+	db->stats = stats_new();
 	return db;
 }
 
-struct db *db_new(const char *directory)
+struct db *db_new(const char *directory, unsigned worker_threads)
 {
-	struct db *db = _db_new(directory);
+	struct db *db = _db_new(directory, worker_threads);
 	struct file *logfile = file_open_append(db->log_dir, "ydb.log");
 	if (logfile == NULL) {
 		goto error;
@@ -55,6 +69,7 @@ struct db *db_new(const char *directory)
 		goto error;
 	}
 	db->log_fd = fd;
+	db->logger = logger_new(fd);
 
 	db->index_dir = dir_openat(db->log_dir, "index");
 	if (db->index_dir == NULL) {
@@ -71,7 +86,7 @@ error:;
 
 struct db *db_new_mock()
 {
-	struct db *db = _db_new(".");
+	struct db *db = _db_new(".", 1);
 	db->index_dir = dir_open(db, ".");
 	assert(db->index_dir);
 
@@ -83,8 +98,14 @@ struct db *db_new_mock()
 void db_free(struct db *db)
 {
 	worker_free(db->worker);
+	block_cache_free(db->block_cache);
+	iobufs_free(db->iobufs);
+	stats_free(db->stats);
 	dir_free(db->log_dir);
 	dir_free(db->index_dir);
+	if (db->logger) {
+		logger_free(db->logger);
+	}
 	close(db->log_fd);
 	free(db);
 }
@@ -94,6 +115,26 @@ int db_log_fd(struct db *db)
 	return db->log_fd;
 }
 
+struct logger *db_logger(struct db *db)
+{
+	return db->logger;
+}
+
+void db_set_log_level(struct db *db, int level)
+{
+	if (db->logger) {
+		logger_set_level(db->logger, level);
+	}
+}
+
+void db_set_log_callback(struct db *db, logger_callback callback,
+			 void *userdata)
+{
+	if (db->logger) {
+		logger_set_callback(db->logger, callback, userdata);
+	}
+}
+
 struct dir *db_log_dir(struct db *db)
 {
 	return db->log_dir;
@@ -104,9 +145,61 @@ struct dir *db_index_dir(struct db *db)
 	return db->index_dir;
 }
 
-void db_task(struct db *db, db_task_callback callback, void *userdata)
+struct codec *db_codec(struct db *db)
+{
+	return db->codec;
+}
+
+void db_set_codec(struct db *db, struct codec *codec)
+{
+	db->codec = codec;
+}
+
+struct block_cache *db_block_cache(struct db *db)
+{
+	return db->block_cache;
+}
+
+int db_wide_index(struct db *db)
+{
+	return db->wide_index;
+}
+
+void db_set_wide_index(struct db *db, int wide_index)
+{
+	db->wide_index = wide_index;
+}
+
+int db_direct_io(struct db *db)
 {
-	worker_new_task(db->worker, callback, userdata);
+	return db->direct_io;
+}
+
+void db_set_direct_io(struct db *db, int direct_io)
+{
+	db->direct_io = direct_io;
+}
+
+struct iobufs *db_iobufs(struct db *db)
+{
+	return db->iobufs;
+}
+
+struct stats *db_stats(struct db *db)
+{
+	return db->stats;
+}
+
+void db_task(struct db *db, int prio,
+	     db_task_callback callback, void *userdata)
+{
+	worker_new_task(db->worker, prio, callback, userdata);
+}
+
+void db_parallel(struct db *db, int prio, db_parallel_callback callback,
+		 void *userdata, unsigned cnt)
+{
+	worker_parallel(db->worker, prio, callback, userdata, cnt);
 }
 
 void db_answer(struct db *db, db_task_callback callback, void *userdata)
@@ -114,6 +207,26 @@ void db_answer(struct db *db, db_task_callback callback, void *userdata)
 	worker_new_answer(db->worker, callback, userdata);
 }
 
+void db_completion(struct db *db, db_task_callback callback, void *userdata)
+{
+	worker_new_completion(db->worker, callback, userdata);
+}
+
+int db_completions_fd(struct db *db)
+{
+	return worker_fd(db->worker);
+}
+
+int db_do_completions(struct db *db)
+{
+	return worker_do_completions(db->worker);
+}
+
+void db_sync(struct db *db)
+{
+	worker_sync(db->worker);
+}
+
 int db_do_answers(struct db *db)
 {
 	return worker_do_answers(db->worker);
@@ -1,14 +1,42 @@
 struct db;
 
-struct db *db_new(const char *directory);
+struct db *db_new(const char *directory, unsigned worker_threads);
 struct db *db_new_mock();
 void db_free(struct db *db);
 int db_log_fd(struct db *db);
+struct logger *db_logger(struct db *db);
+/* See logger_set_level() and logger_set_callback(). */
+void db_set_log_level(struct db *db, int level);
+void db_set_log_callback(struct db *db,
+			 void (*callback)(void *userdata, int level,
+					  const char *line),
+			 void *userdata);
 struct dir *db_log_dir(struct db *db);
 struct dir *db_index_dir(struct db *db);
+struct codec *db_codec(struct db *db);
+void db_set_codec(struct db *db, struct codec *codec);
+struct block_cache *db_block_cache(struct db *db);
+int db_wide_index(struct db *db);
+void db_set_wide_index(struct db *db, int wide_index);
+/* 'direct_io' is an enum direct_io, see ydb_reader.h. */
+int db_direct_io(struct db *db);
+void db_set_direct_io(struct db *db, int direct_io);
+struct iobufs *db_iobufs(struct db *db);
+struct stats *db_stats(struct db *db);
 
 typedef void (*db_task_callback)(void *ud);
 
-void db_task(struct db *db, db_task_callback callback, void *userdata);
+/* 'prio' is an enum task_priority, see ydb_worker.h. */
+void db_task(struct db *db, int prio,
+	     db_task_callback callback, void *userdata);
+typedef void (*db_parallel_callback)(void *ud, unsigned i);
+/* See worker_parallel(). */
+void db_parallel(struct db *db, int prio, db_parallel_callback callback,
+		 void *userdata, unsigned cnt);
 void db_answer(struct db *db, db_task_callback callback, void *userdata);
 int db_do_answers(struct db *db);
+void db_completion(struct db *db, db_task_callback callback, void *userdata);
+int db_completions_fd(struct db *db);
+int db_do_completions(struct db *db);
+/* Wait until the background tasks are done, see worker_sync(). */
+void db_sync(struct db *db);
@@ -5,11 +5,14 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -261,7 +264,11 @@ static struct file *_file_new(struct dir *top_dir, const char *filename,
 
 	file->fd = openat(dirfd(top_dir->dir), filename, flags, 0600);
 
-	FILETRACE(file, file->fd, "openat(\"%s\")", pathname);
+	/* Filesystems without direct I/O refuse it, the caller falls
+	 * back to buffered reads. */
+	if (!(flags & O_DIRECT) || errno != EINVAL) {
+		FILETRACE(file, file->fd, "openat(\"%s\")", pathname);
+	}
 	if (file->fd == -1) {
 		free(file);
 		return NULL;
@@ -297,6 +304,11 @@ struct file *file_open_read(struct dir *top_dir, const char *filename)
 	return _file_new(top_dir, filename, O_RDONLY | O_NOATIME);
 }
 
+struct file *file_open_direct(struct dir *top_dir, const char *filename)
+{
+	return _file_new(top_dir, filename, O_RDONLY | O_NOATIME | O_DIRECT);
+}
+
 
 void file_close(struct file *file)
 {
@@ -355,6 +367,16 @@ int file_pread(struct file *file, void *buf, uint64_t count, uint64_t offset)
 	return r;
 }
 
+int file_pread_direct(struct file *file, void *buf, uint64_t count,
+		      uint64_t offset)
+{
+	assert(((uintptr_t)buf | count | offset) % FILE_DIRECT_ALIGN == 0);
+	int r = pread(file->fd, buf, count, offset);
+	FILETRACE(file, r, "pread(\"%s\", %llu, %llu)", file->pathname,
+		  (unsigned long long)count, (unsigned long long)offset);
+	return r;
+}
+
 int file_write(struct file *file, void *start_buf, uint64_t count)
 {
 	char *buf = start_buf;
@@ -375,19 +397,25 @@ int file_write(struct file *file, void *start_buf, uint64_t count)
 int file_appendv(struct file *file, const struct iovec *iov, int iovcnt,
 		 uint64_t file_size)
 {
-	int i;
 	uint64_t len = 0;
-	for (i=0; i < iovcnt; i++) {
-		len += iov[i].iov_len;
-	}
-
-	int r = writev(file->fd, iov, iovcnt);
-	FILETRACE(file, r, "writev(\"%s\", %llu)", file->pathname,
-		  (unsigned long long)len);
-	/* TODO: are we really sure writev won't write in chunks? */
-	if (r < 0 || (unsigned)r != len) {
-		file_truncate(file, file_size);
-		return -1;
+	int i;
+	/* Big batches don't fit in a single writev(). */
+	for (i = 0; i < iovcnt; i += IOV_MAX) {
+		int cnt = iovcnt - i < IOV_MAX ? iovcnt - i : IOV_MAX;
+		uint64_t part = 0;
+		int j;
+		for (j = i; j < i + cnt; j++) {
+			part += iov[j].iov_len;
+		}
+		int r = writev(file->fd, iov + i, cnt);
+		FILETRACE(file, r, "writev(\"%s\", %llu)", file->pathname,
+			  (unsigned long long)part);
+		/* TODO: are we really sure writev won't write in chunks? */
+		if (r < 0 || (uint64_t)r != part) {
+			file_truncate(file, file_size);
+			return -1;
+		}
+		len += part;
 	}
 	return len;
 }
@@ -399,6 +427,85 @@ void file_prefetch(struct file *file, uint64_t offset, uint64_t size)
 		  (unsigned long long)offset, (unsigned long long)size);
 }
 
+void file_drop_cache(struct file *file, uint64_t offset, uint64_t size)
+{
+	int r = posix_fadvise(file->fd, offset, size, POSIX_FADV_DONTNEED);
+	FILETRACE(file, r, "fadvise(\"%s\", %llu, %llu)", file->pathname,
+		  (unsigned long long)offset, (unsigned long long)size);
+}
+
+
+/* A non-blocking descriptor that is full, wait until it drains a
+ * bit. Returns 0 if the write is worth retrying. */
+static int _fd_wait(int fd)
+{
+	if (errno == EINTR) {
+		return 0;
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		return -1;
+	}
+	struct pollfd pfd = {fd, POLLOUT, 0};
+	while (poll(&pfd, 1, -1) < 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int file_send(struct file *file, uint64_t offset, uint64_t count, int out_fd)
+{
+	while (count > 0) {
+		off_t off = offset;
+		ssize_t r = sendfile(out_fd, file->fd, &off,
+				     count < (1 << 30) ? count : (1 << 30));
+		if (r < 0 && (errno == EINVAL || errno == ENOSYS)) {
+			/* Not supported for this pair of descriptors. */
+			break;
+		}
+		if (r < 0 && _fd_wait(out_fd) == 0) {
+			continue;
+		}
+		FILETRACE(file, (int)r, "sendfile(\"%s\", %llu, %llu)",
+			  file->pathname, (unsigned long long)offset,
+			  (unsigned long long)count);
+		if (r <= 0) {
+			return -1;
+		}
+		offset += r;
+		count -= r;
+	}
+
+	char buf[64 << 10];
+	while (count > 0) {
+		uint64_t chunk = count < sizeof(buf) ? count : sizeof(buf);
+		if (file_pread(file, buf, chunk, offset) == -1 ||
+		    fd_write(out_fd, buf, chunk) != 0) {
+			return -1;
+		}
+		offset += chunk;
+		count -= chunk;
+	}
+	return 0;
+}
+
+int fd_write(int fd, const char *buf, uint64_t count)
+{
+	while (count > 0) {
+		ssize_t r = write(fd, buf, count);
+		if (r < 0 && _fd_wait(fd) == 0) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		buf += r;
+		count -= r;
+	}
+	return 0;
+}
+
 
 /* Try to mmap files above 40' bits boundary. */
 #define MMAP_HIGH_ADDR ((void*)(0x0000010000000000ULL))
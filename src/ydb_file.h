@@ -21,6 +21,9 @@ struct file *file_open_append_new(struct dir *top_dir, const char *filename);
 struct file *file_open_new_rw(struct dir *top_dir, const char *filename);
 struct file *file_open_rw(struct dir *top_dir, const char *filename);
 struct file *file_open_read(struct dir *top_dir, const char *filename);
+/* Read only, bypassing the page cache (O_DIRECT). NULL if the
+ * filesystem doesn't support it. */
+struct file *file_open_direct(struct dir *top_dir, const char *filename);
 void file_close(struct file *file);
 int file_rind(struct file *file);
 
@@ -28,10 +31,33 @@ int file_truncate(struct file *file, uint64_t size);
 int file_sync(struct file *file);
 int file_size(struct file *file, uint64_t *size_ptr);
 int file_pread(struct file *file, void *buf, uint64_t count, uint64_t offset);
+/* pread(2) on a file from file_open_direct(). The buffer, count and
+ * offset must be multiples of FILE_DIRECT_ALIGN. Returns the number of
+ * bytes read, less than count at the end of the file, or -1. */
+#define FILE_DIRECT_ALIGN 4096
+int file_pread_direct(struct file *file, void *buf, uint64_t count,
+		      uint64_t offset);
 int file_write(struct file *file, void *start_buf, uint64_t count);
 int file_appendv(struct file *file, const struct iovec *iov, int iovcnt,
 		 uint64_t file_size);
 void file_prefetch(struct file *file, uint64_t offset, uint64_t size);
+/* Drop clean cached pages fully inside the range, 'size' of 0 means
+ * up to the end of the file. */
+void file_drop_cache(struct file *file, uint64_t offset, uint64_t size);
+/* Copy a part of the file to a descriptor, with sendfile(2) if the
+ * kernel supports it for the descriptor. Returns 0 or -1 on error. */
+int file_send(struct file *file, uint64_t offset, uint64_t count, int out_fd);
+/* Both write all of 'count', on a non-blocking descriptor they wait in
+ * poll(2) whenever it's full. */
+int fd_write(int fd, const char *buf, uint64_t count);
+
+/* Part of a file holding a value, see file_send(). */
+struct file_range {
+	struct file *file;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t sum;		/* adler32 of the data */
+};
 
 /* TODO: remove one */
 void *file_mmap_ro(struct file *file, uint64_t *size_ptr);
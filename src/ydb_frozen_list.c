@@ -17,6 +17,7 @@
 #include "ydb_file.h"
 #include "ydb_hashdir.h"
 #include "ydb_frozen_list.h"
+#include "ydb_worker.h"
 
 #include "ydb_hashdir_internal.h"
 
@@ -61,7 +62,8 @@ void frozen_list_incr(struct frozen_list *fl, struct hashdir *hd)
 		struct list_head *next = hd->in_frozen_list.next;
 		struct hashdir *hdn =
 			container_of(next, struct hashdir, in_frozen_list);
-		if (hdn->deleted_cnt >= hd->deleted_cnt) {
+		if (hdn->deleted_cnt + hdn->lazy_cnt >=
+		    hd->deleted_cnt + hd->lazy_cnt) {
 			break;
 		}
 		list_del(&hd->in_frozen_list);
@@ -122,7 +124,7 @@ int frozen_list_marshall(struct frozen_list *fl)
 	struct hashdir *hd =
 		container_of(last, struct hashdir, in_frozen_list);
 
-	if (hd->deleted_cnt <= 1024) {
+	if (hd->deleted_cnt + hd->lazy_cnt <= 1024) {
 		return 0;
 	}
 	frozen_list_del(fl, hd);
@@ -135,7 +137,7 @@ int frozen_list_marshall(struct frozen_list *fl)
 	struct _task_save_ctx *ctx = malloc(sizeof(struct _task_save_ctx));
 	*ctx = (struct _task_save_ctx){fl->db, strdup(hd->dirtyname),
 				       hd->items, hd->mmap_sz, fl};
-	db_task(fl->db, _task_save, ctx);
+	db_task(fl->db, TASK_FLUSH, _task_save, ctx);
 
 	return 1;
 }
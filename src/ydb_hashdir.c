@@ -12,6 +12,7 @@
 #include "ydb_common.h"
 #include "ydb_logging.h"
 #include "ydb_file.h"
+#include "ydb_db.h"
 #include "ydb_hashdir.h"
 
 #include "ydb_hashdir_internal.h"
@@ -24,6 +25,8 @@ struct hashdir *_hashdir_new(struct db *db,
 	struct hashdir *hd = malloc(sizeof(struct hashdir));
 	memset(hd, 0, sizeof(struct hashdir));
 	hd->db = db;
+	hd->wide = db_wide_index(db);
+	hd->item_sz = hd->wide ? sizeof(struct witem) : sizeof(struct item);
 	hd->move_callback = callback;
 	hd->move_userdata = userdata;
 	return hd;
@@ -57,7 +60,18 @@ static int _hashdir_offset_sort(const void *a_p, const void *b_p)
 	if (a->a_offset > b->a_offset) {
 		return 1;
 	}
-	return 0;
+	/* Keep the empty item zero in front. */
+	return a->a_size - b->a_size;
+}
+
+static int _hashdir_offset_wsort(const void *a_p, const void *b_p)
+{
+	const struct witem *a = a_p;
+	const struct witem *b = b_p;
+	if (a->a_offset != b->a_offset) {
+		return a->a_offset < b->a_offset ? -1 : 1;
+	}
+	return (a->a_size > b->a_size) - (a->a_size < b->a_size);
 }
 
 /* TODO: This function should conserve memory. */
@@ -71,17 +85,17 @@ struct hashdir *hashdir_dup_sorted(struct hashdir *hdo)
 	struct hashdir *hd = _hashdir_new(hdo->db, NULL, NULL);
 	hd->items_cnt = hdo->items_cnt;
 	hd->items_sz = hdo->items_cnt;
-	hd->items = malloc(sizeof(struct item) * hd->items_sz);
-	memcpy(hd->items, hdo->items, sizeof(struct item) * hd->items_sz);
-	qsort(hd->items, hd->items_cnt, sizeof(struct item),
-	      _hashdir_offset_sort);
+	hd->items = malloc((uint64_t)hd->item_sz * hd->items_sz);
+	memcpy(hd->items, hdo->items, (uint64_t)hd->item_sz * hd->items_sz);
+	qsort(hd->items, hd->items_cnt, hd->item_sz,
+	      hd->wide ? _hashdir_offset_wsort : _hashdir_offset_sort);
 	return hd;
 }
 
 struct hashdir_item hashdir_get(struct hashdir *hd, int hdpos)
 {
 	assert(hdpos > 0  && hdpos < hd->items_cnt);
-	return _unpack(hd->items[hdpos]);
+	return _item_get(hd, _item(hd, hdpos));
 }
 
 void *_hashdir_next(struct hashdir *hd,
@@ -89,16 +103,16 @@ void *_hashdir_next(struct hashdir *hd,
 		    struct hashdir_item *hdi,
 		    int *hdpos_ptr)
 {
-	struct item *item = (struct item*)item_ptr;
+	char *item;
 	if (IS_FROZEN(hd)) {
-		item = frozen_next(hd, item);
+		item = frozen_next(hd, item_ptr);
 	} else {
-		item = active_next(hd, item);
+		item = active_next(hd, item_ptr);
 	}
 	if (item != NULL) {
-		*hdi = _unpack(*item);
+		*hdi = _item_get(hd, item);
 		if (hdpos_ptr) {
-			*hdpos_ptr = item - hd->items;
+			*hdpos_ptr = (item - hd->items) / hd->item_sz;
 		}
 	}
 	return item;
@@ -110,7 +124,7 @@ int hashdir_size2(struct hashdir *hd)
 	if (IS_ACTIVE(hd)) {
 		return hd->items_cnt;
 	}
-	if (hd->deleted_cnt) {
+	if (hd->deleted_cnt || hd->lazy_cnt) {
 		log_warn(hd->db, "hashdir_size on frozen. slow. %s", "");
 		hashdir_save(hd, "size");
 	}
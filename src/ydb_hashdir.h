@@ -23,6 +23,12 @@ void hashdir_free(struct hashdir *hd);
 
 struct hashdir_item hashdir_get(struct hashdir *hd, int hdpos);
 struct hashdir_item hashdir_del(struct hashdir *hd, int hdpos);
+/* Delete from a frozen hashdir knowing only the bitmap_pos of the
+ * item. Its position is found on the next hashdir_save(). */
+void hashdir_del_lazy(struct hashdir *hd, uint32_t bitmap_pos);
+/* Items dropped from the dirty file after the bitmap was saved are
+ * still live in the bitmap, mark them deleted. */
+void hashdir_mask_missing(struct hashdir *hd);
 
 int hashdir_add(struct hashdir *hd, struct hashdir_item hi);
 int hashdir_freeze(struct hashdir *hd,
@@ -33,6 +39,22 @@ int hashdir_size2(struct hashdir *hd);
 
 struct bitmap *hashdir_get_bitmap(struct hashdir *hd);
 
+/* ydb_hashdir_sorted.c */
+/* Side index of a frozen hashdir sorted by key hash, see the file. */
+struct sdx;
+int sdx_save(struct hashdir *hd, struct dir *dir, const char *filename);
+/* sdx_save() in two steps. Items are copied on the owner's thread,
+ * sdx_write() may run anywhere and frees them. */
+struct sdx_items;
+struct sdx_items *sdx_items(struct hashdir *hd);
+int sdx_write(struct sdx_items *si, struct dir *dir, const char *filename);
+struct sdx *sdx_load(struct db *db, struct dir *dir, const char *filename,
+		     int wide);
+void sdx_free(struct db *db, struct sdx *sdx);
+/* Returns 1 and the item if the key may be live, check the bitmap. */
+int sdx_find(struct sdx *sdx, uint128_t key_hash, struct hashdir_item *hi);
+uint64_t sdx_allocated(struct sdx *sdx);
+
 
 void *_hashdir_next(struct hashdir *hd,
 		    void *item_ptr,
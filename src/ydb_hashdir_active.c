@@ -23,8 +23,8 @@ struct hashdir *hashdir_new_active(struct db *db,
 				   hashdir_move_cb callback, void *userdata)
 {
 	struct hashdir *hd = _hashdir_new(db, callback, userdata);
-	hd->items = malloc(sizeof(struct item)*HASHDIR_INITIAL_SIZE);
-	hd->items[0] = (struct item){0,0,0,0};
+	hd->items = malloc(hd->item_sz * HASHDIR_INITIAL_SIZE);
+	memset(_item(hd, 0), 0, hd->item_sz);
 	hd->items_cnt = 1;
 	hd->items_sz = HASHDIR_INITIAL_SIZE;
 	return hd;
@@ -40,27 +40,27 @@ int hashdir_add(struct hashdir *hd, struct hashdir_item hi)
 	assert(IS_ACTIVE(hd));
 	if (hd->items_cnt == hd->items_sz) {
 		int sz = hd->items_sz * 2;
-		hd->items = realloc(hd->items, sz * sizeof(struct item));
+		hd->items = realloc(hd->items, (uint64_t)sz * hd->item_sz);
 		hd->items_sz = sz;
 	}
 	int hdpos = hd->items_cnt++;
-	hd->items[hdpos] = _pack(hi);
+	_item_set(hd, _item(hd, hdpos), hi);
 	return hdpos;
 }
 
 struct hashdir_item active_del(struct hashdir *hd, int hdpos)
 {
 	assert(hdpos > 0  && hdpos < hd->items_cnt);
-	struct hashdir_item hdi = _unpack(hd->items[hdpos]);
+	struct hashdir_item hdi = _item_get(hd, _item(hd, hdpos));
 
 	int last_pos = hd->items_cnt - 1;
 	if (hdpos != last_pos) {
-		hd->items[hdpos] = hd->items[last_pos];
+		memcpy(_item(hd, hdpos), _item(hd, last_pos), hd->item_sz);
 		/* At this point, both hdpos and last_point must have
 		 * a valid value. */
 		hd->move_callback(hd->move_userdata, hdpos, last_pos);
 	}
-	hd->items[last_pos] = (struct item){0,0,0,0};
+	memset(_item(hd, last_pos), 0, hd->item_sz);
 	hd->items_cnt -= 1;
 	return hdi;
 }
@@ -77,14 +77,14 @@ int hashdir_freeze(struct hashdir *hd, struct dir *dir, const char *filename)
 	assert(IS_ACTIVE(hd));
 	int i;
 	for (i=1; i < hd->items_cnt; i++) {
-		hd->items[i].bitmap_pos = i;
+		_item_set_bitmap_pos(hd, _item(hd, i), i);
 	}
 
 	char *tmpname = _temp_filename(filename);
 	struct file *file = file_open_append_new(dir, tmpname);
 	if (file == NULL) goto error;
 
-	uint64_t size = sizeof(struct item) * hd->items_cnt;
+	uint64_t size = (uint64_t)hd->item_sz * hd->items_cnt;
 	uint32_t checksum = adler32((void*)hd->items, size);
 	struct iovec iov[2] = {{hd->items, size},
 			       {&checksum, 4}};
@@ -107,15 +107,15 @@ error:;
 	return -1;
 }
 
-struct item *active_next(struct hashdir *hd, struct item *item)
+void *active_next(struct hashdir *hd, void *item)
 {
 	if (item == NULL) {
-		return &hd->items[1];
+		return _item(hd, 1);
 	}
 
-	item ++;
+	item = (char *)item + hd->item_sz;
 
-	if (item <= &hd->items[hd->items_cnt]) {
+	if ((char *)item <= (char *)_item(hd, hd->items_cnt)) {
 		return item;
 	}
 	return NULL;
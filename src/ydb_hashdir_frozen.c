@@ -16,6 +16,8 @@
 #include "ydb_file.h"
 #include "ydb_hashdir.h"
 #include "ydb_frozen_list.h"
+#include "ydb_db.h"
+#include "ydb_stats.h"
 
 #include "ydb_hashdir_internal.h"
 
@@ -29,7 +31,7 @@ static int _verify_buf(struct hashdir *hd, char *buf, uint64_t size,
 		return -1;
 	}
 
-	if (size < 4 || (size - 4) % sizeof(struct item) != 0) {
+	if (size < 4 || (size - 4) % hd->item_sz != 0) {
 		log_warn(hd->db, "Can't load %s: broken size.", filename);
 		return -1;
 	}
@@ -62,13 +64,15 @@ static int _hashdir_try_open_dirty(struct hashdir *hd)
 	}
 
 	hd->mmap_sz = size;
-	hd->items = (struct item*)buf;
-	hd->items_cnt = (size - 4) / sizeof(struct item);
+	hd->items = buf;
+	hd->items_cnt = (size - 4) / hd->item_sz;
 	return 0;
 }
 
 static int _hashdir_new_dirty(struct hashdir *hd, const char *filename)
 {
+	/* Reading and checking the saved index is part of the copy. */
+	uint64_t t0 = stats_now();
 	struct file *file = file_open_read(hd->dir, filename);
 	if (file == NULL) {
 		return -1;
@@ -106,10 +110,11 @@ static int _hashdir_new_dirty(struct hashdir *hd, const char *filename)
 	file_munmap(hd->db, buf, size);
 
 	file_msync(hd->db, dbuf, size, 0);
+	stats_add(db_stats(hd->db), STATS_INDEX_COPY_NS, stats_now() - t0);
 
 	hd->mmap_sz = size;
-	hd->items = (struct item*)dbuf;
-	hd->items_cnt = (size - 4) / sizeof(struct item);
+	hd->items = dbuf;
+	hd->items_cnt = (size - 4) / hd->item_sz;
 	return 0;
 }
 
@@ -156,7 +161,7 @@ struct hashdir *hashdir_new_load(struct db *db,
 	hd->bitmap = mask;
 	int i;
 	for (i=1; i < hd->items_cnt; i++) {
-		int bpos = hd->items[i].bitmap_pos;
+		int bpos = _item_bitmap_pos(hd, _item(hd, i));
 		if (bitmap_get(mask, bpos) == 1) {
 			frozen_del(hd, i, 0, 0);
 		}
@@ -189,16 +194,32 @@ int hashdir_save(struct hashdir *hd, char *reason)
 {
 	struct timeval tv0, tv1;
 	gettimeofday(&tv0, NULL);
+	uint64_t t0 = stats_now();
 
 	int deleted_cnt = hd->deleted_cnt;
 	int items_cnt = hd->items_cnt;
+	int i;
 
 	assert(IS_FROZEN(hd));
+	if (hd->lazy_cnt) {
+		/* Positions of lazily deleted items aren't known, take
+		 * all the deleted ones from the bitmap. */
+		free(hd->deleted);
+		hd->deleted = malloc(sizeof(int) * hd->items_cnt);
+		hd->deleted_cnt = 0;
+		for (i=1; i < hd->items_cnt; i++) {
+			int bpos = _item_bitmap_pos(hd, _item(hd, i));
+			if (bitmap_get(hd->bitmap, bpos) == 1) {
+				hd->deleted[hd->deleted_cnt++] = i;
+			}
+		}
+		hd->lazy_cnt = 0;
+		deleted_cnt = hd->deleted_cnt;
+	}
 	qsort(hd->deleted, hd->deleted_cnt, sizeof(int), _rev_int_cmp);
 
 	/* TODO: I'm sure we can do better than just moving last item
 	 * a lot of times.  */
-	int i;
 	for (i=0; i < hd->deleted_cnt; i++) {
 		active_del(hd, hd->deleted[i]);
 	}
@@ -207,7 +228,7 @@ int hashdir_save(struct hashdir *hd, char *reason)
 	hd->deleted = malloc(sizeof(int) * hd->deleted_sz);
 	hd->deleted_cnt = 0;
 
-	int size = sizeof(struct item) * hd->items_cnt + 4;
+	uint64_t size = (uint64_t)hd->item_sz * hd->items_cnt + 4;
 	hd->items = file_remap(hd->db, hd->items, hd->mmap_sz, size);
 	hd->mmap_sz = size;
 	assert(hd->items);
@@ -224,6 +245,7 @@ int hashdir_save(struct hashdir *hd, char *reason)
 		 deleted_cnt, items_cnt,
 		 reason,
 		 TIMEVAL_MSEC_SUBTRACT(tv1, tv0));
+	stats_time(db_stats(hd->db), STATS_INDEX_SAVE, t0);
 	return r;
 }
 
@@ -231,7 +253,7 @@ struct hashdir_item frozen_del(struct hashdir *hd, int hpos, int in_index,
 			       int may_save)
 {
 	assert(hpos > 0  && hpos < hd->items_cnt);
-	struct hashdir_item hdi = _unpack(hd->items[hpos]);
+	struct hashdir_item hdi = _item_get(hd, _item(hd, hpos));
 
 	if (in_index) {
 		assert(bitmap_get(hd->bitmap, hdi.bitmap_pos) == 0);
@@ -253,23 +275,52 @@ struct hashdir_item frozen_del(struct hashdir *hd, int hpos, int in_index,
 	return hdi;
 }
 
+void hashdir_del_lazy(struct hashdir *hd, uint32_t bitmap_pos)
+{
+	assert(IS_FROZEN(hd));
+	assert(bitmap_get(hd->bitmap, bitmap_pos) == 0);
+	bitmap_set(hd->bitmap, bitmap_pos);
+	hd->lazy_cnt += 1;
+	if (hd->lazy_cnt % 1024 == 0) {
+		frozen_list_incr(hd->frozen_list, hd);
+	}
+}
+
+void hashdir_mask_missing(struct hashdir *hd)
+{
+	assert(IS_FROZEN(hd));
+	int size = bitmap_size(hd->bitmap);
+	struct bitmap *present = bitmap_new(size, 0);
+	int i;
+	for (i=1; i < hd->items_cnt; i++) {
+		bitmap_set(present, _item_bitmap_pos(hd, _item(hd, i)));
+	}
+	for (i=1; i < size; i++) {
+		if (bitmap_get(present, i) == 0) {
+			bitmap_set(hd->bitmap, i);
+		}
+	}
+	bitmap_free(present);
+}
+
 struct bitmap *hashdir_get_bitmap(struct hashdir *hd)
 {
 	assert(IS_FROZEN(hd));
 	return hd->bitmap;
 }
 
-struct item *frozen_next(struct hashdir *hd, struct item *item)
+void *frozen_next(struct hashdir *hd, void *item_ptr)
 {
+	char *item = item_ptr;
 	if (item == NULL) {
-		item = &hd->items[1];
+		item = _item(hd, 1);
 	} else {
-		item ++;
+		item += hd->item_sz;
 	}
 
-	struct item *last = &hd->items[hd->items_cnt];
-	for (;item < last; item++) {
-		if (bitmap_get(hd->bitmap, (unsigned)item->bitmap_pos) == 0) {
+	char *last = _item(hd, hd->items_cnt);
+	for (;item < last; item += hd->item_sz) {
+		if (bitmap_get(hd->bitmap, _item_bitmap_pos(hd, item)) == 0) {
 			return item;
 		}
 	}
@@ -5,9 +5,19 @@ struct item {
 	uint32_t bitmap_pos:23;
 }  __attribute__ ((packed));
 
+/* Wide format: logs up to 4TB, records up to 4GB, 2^32 items. */
+struct witem {
+	uint128_t key_hash;
+	uint64_t a_offset:37;	// align: DATA_ALIGN
+	uint64_t a_size:27;	// align: DATA_ALIGN
+	uint32_t bitmap_pos;
+}  __attribute__ ((packed));
+
 struct hashdir {
 	struct db *db;
-	struct item *items;
+	int wide;
+	unsigned item_sz;
+	char *items;
 	int items_cnt;
 	int items_sz;
 
@@ -21,6 +31,7 @@ struct hashdir {
 	int *deleted;
 	int deleted_cnt;
 	int deleted_sz;
+	int lazy_cnt;		/* Deleted by bitmap_pos, not in 'deleted' */
 
 	struct list_head in_frozen_list;
 	struct frozen_list *frozen_list;
@@ -46,6 +57,66 @@ static inline struct item _pack(struct hashdir_item hdi) {
 			};
 }
 
+static inline struct hashdir_item _wunpack(struct witem item)
+{
+	return (struct hashdir_item) {item.key_hash,
+			(uint64_t)item.a_offset << DATA_ALIGN,
+			(uint64_t)item.a_size << DATA_ALIGN,
+			item.bitmap_pos
+			};
+}
+static inline struct witem _wpack(struct hashdir_item hdi) {
+	assert(hdi.offset % (1 << DATA_ALIGN) == 0);
+	assert(hdi.size % (1 << DATA_ALIGN) == 0);
+	return (struct witem) {hdi.key_hash,
+			(uint64_t)hdi.offset >> DATA_ALIGN,
+			(uint64_t)hdi.size >> DATA_ALIGN,
+			hdi.bitmap_pos
+			};
+}
+
+/* Items are either all narrow or all wide, see hd->wide. */
+static inline void *_item(struct hashdir *hd, int hdpos)
+{
+	return hd->items + (uint64_t)hdpos * hd->item_sz;
+}
+
+static inline struct hashdir_item _item_get(struct hashdir *hd, void *item)
+{
+	if (hd->wide) {
+		return _wunpack(*(struct witem *)item);
+	}
+	return _unpack(*(struct item *)item);
+}
+
+static inline void _item_set(struct hashdir *hd, void *item,
+			     struct hashdir_item hdi)
+{
+	if (hd->wide) {
+		*(struct witem *)item = _wpack(hdi);
+	} else {
+		*(struct item *)item = _pack(hdi);
+	}
+}
+
+static inline uint32_t _item_bitmap_pos(struct hashdir *hd, void *item)
+{
+	if (hd->wide) {
+		return ((struct witem *)item)->bitmap_pos;
+	}
+	return ((struct item *)item)->bitmap_pos;
+}
+
+static inline void _item_set_bitmap_pos(struct hashdir *hd, void *item,
+					uint32_t bitmap_pos)
+{
+	if (hd->wide) {
+		((struct witem *)item)->bitmap_pos = bitmap_pos;
+	} else {
+		((struct item *)item)->bitmap_pos = bitmap_pos;
+	}
+}
+
 #define IS_ACTIVE(hd) (!IS_FROZEN(hd))
 #define IS_FROZEN(hd) ((hd)->dirtyname != NULL)
 
@@ -56,9 +127,9 @@ struct hashdir *_hashdir_new(struct db *db,
 /* ydb_hashdir_active.c */
 void active_free(struct hashdir *hd);
 struct hashdir_item active_del(struct hashdir *hd, int hdpos);
-struct item *active_next(struct hashdir *hd, struct item *item);
+void *active_next(struct hashdir *hd, void *item);
 
 /* ydb_hashdir_frozen.c */
 void frozen_free(struct hashdir *hd);
 struct hashdir_item frozen_del(struct hashdir *hd, int hdpos, int do_mask, int may_save);
-struct item *frozen_next(struct hashdir *hd, struct item *item);
+void *frozen_next(struct hashdir *hd, void *item);
@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "list.h"
+#include "bitmap.h"
+
+#include "ydb_common.h"
+#include "ydb_logging.h"
+#include "ydb_file.h"
+#include "ydb_hashdir.h"
+#include "ydb_bloom.h"
+
+#include "ydb_hashdir_internal.h"
+
+/* Sorted side index of a frozen log, "%012llx.sdx":
+ *
+ *    items, sorted by key hash, in the format of the .idx
+ *    fences, uint64_t upper half of the hash of the first item
+ *            starting in each SDX_PAGE of the items
+ *    bloom filter bits
+ *    struct sdx_footer
+ *
+ * Fences and the filter are kept in memory, items are mmapped. The
+ * fences pick the page holding the key, so a lookup of a key that
+ * isn't cached reads a single page, two if the key hash crosses a
+ * page boundary. Checksums of the items and of the rest are verified
+ * once, when the file is loaded. */
+
+#define SDX_PAGE 4096
+#define SDX_BLOOM_BITS 10
+
+struct sdx_footer {
+	uint64_t items_cnt;
+	uint64_t bloom_sz;
+	uint32_t item_sz;
+	uint32_t page_sz;
+	uint32_t bloom_probes;
+	uint32_t items_checksum;
+	uint32_t checksum;
+} __attribute__ ((packed));
+
+struct sdx {
+	char *mmap;
+	uint64_t mmap_sz;
+	int wide;
+	unsigned item_sz;
+	uint64_t items_cnt;
+	uint64_t *fences;
+	uint64_t fences_cnt;
+	struct bloom *bloom;
+};
+
+
+static uint128_t _key_hash(const void *item)
+{
+	uint128_t key_hash;
+	memcpy(&key_hash, item, sizeof(uint128_t));
+	return key_hash;
+}
+
+static int _key_hash_cmp(const void *a, const void *b)
+{
+	uint128_t ha = _key_hash(a), hb = _key_hash(b);
+	return (ha > hb) - (ha < hb);
+}
+
+/* Index of the first item starting in the page. */
+static uint64_t _page_first(unsigned item_sz, uint64_t page)
+{
+	return (page * SDX_PAGE + item_sz - 1) / item_sz;
+}
+
+static uint64_t _fences_cnt(unsigned item_sz, uint64_t items_cnt)
+{
+	if (items_cnt == 0) {
+		return 0;
+	}
+	return (items_cnt - 1) * item_sz / SDX_PAGE + 1;
+}
+
+struct sdx_items {
+	char *items;
+	uint64_t items_cnt;
+	unsigned item_sz;
+};
+
+struct sdx_items *sdx_items(struct hashdir *hd)
+{
+	/* Item zero is a placeholder. Items known to be deleted are
+	 * left out, lookups check the log's bitmap anyway. */
+	struct sdx_items *si = malloc(sizeof(struct sdx_items));
+	si->items = malloc((uint64_t)hd->item_sz * hd->items_cnt);
+	si->items_cnt = 0;
+	si->item_sz = hd->item_sz;
+	int i;
+	for (i = 1; i < hd->items_cnt; i++) {
+		char *item = _item(hd, i);
+		if (IS_FROZEN(hd) &&
+		    bitmap_get(hd->bitmap, _item_bitmap_pos(hd, item))) {
+			continue;
+		}
+		memcpy(si->items + si->items_cnt * si->item_sz, item,
+		       si->item_sz);
+		si->items_cnt += 1;
+	}
+	return si;
+}
+
+int sdx_write(struct sdx_items *si, struct dir *dir, const char *filename)
+{
+	char *items = si->items;
+	uint64_t items_cnt = si->items_cnt;
+	unsigned item_sz = si->item_sz;
+	free(si);
+	qsort(items, items_cnt, item_sz, _key_hash_cmp);
+
+	struct bloom *bloom = bloom_new(items_cnt, SDX_BLOOM_BITS);
+	if (bloom == NULL) {
+		free(items);
+		return -1;
+	}
+	/* Everything after the items is checksummed in one piece. */
+	struct sdx_footer footer;
+	uint64_t fences_cnt = _fences_cnt(item_sz, items_cnt);
+	uint64_t fences_sz = fences_cnt * sizeof(uint64_t);
+	uint64_t tail_sz = fences_sz + bloom_allocated(bloom) + sizeof(footer);
+	char *tail = malloc(tail_sz);
+	uint64_t *fences = (uint64_t *)tail;
+	uint64_t j;
+	for (j = 0; j < items_cnt; j++) {
+		bloom_add(bloom, _key_hash(items + j * item_sz));
+	}
+	for (j = 0; j < fences_cnt; j++) {
+		uint64_t first = _page_first(item_sz, j);
+		fences[j] = _key_hash(items + first * item_sz) >> 64;
+	}
+
+	unsigned probes;
+	const char *bits = bloom_bits(bloom, &probes);
+	footer.items_cnt = items_cnt;
+	footer.bloom_sz = bloom_allocated(bloom);
+	footer.item_sz = item_sz;
+	footer.page_sz = SDX_PAGE;
+	footer.bloom_probes = probes;
+	footer.items_checksum = adler32(items, items_cnt * item_sz);
+	memcpy(tail + fences_sz, bits, footer.bloom_sz);
+	memcpy(tail + tail_sz - sizeof(footer), &footer, sizeof(footer));
+	footer.checksum = adler32(tail, tail_sz - 4);
+	memcpy(tail + tail_sz - sizeof(footer), &footer, sizeof(footer));
+
+	struct iovec iov[2] = {{items, items_cnt * item_sz},
+			       {tail, tail_sz}};
+	char tmpname[256];
+	snprintf(tmpname, sizeof(tmpname), "%s.new", filename);
+	struct file *file = file_open_append_new(dir, tmpname);
+	int r = -1;
+	if (file != NULL) {
+		r = file_appendv(file, iov, 2, 0);
+		if (r >= 0) {
+			/* The data must be on disk before the name. */
+			r = file_sync(file);
+		}
+		file_close(file);
+	}
+	if (r >= 0) {
+		r = dir_renameat(dir, tmpname, filename, 0);
+	}
+	if (r < 0) {
+		dir_unlink(dir, tmpname);
+	}
+	bloom_free(bloom);
+	free(tail);
+	free(items);
+	return r < 0 ? -1 : 0;
+}
+
+int sdx_save(struct hashdir *hd, struct dir *dir, const char *filename)
+{
+	return sdx_write(sdx_items(hd), dir, filename);
+}
+
+struct sdx *sdx_load(struct db *db, struct dir *dir, const char *filename,
+		     int wide)
+{
+	struct file *file = file_open_read(dir, filename);
+	if (file == NULL) {
+		return NULL;
+	}
+	uint64_t size;
+	char *buf = file_mmap_ro(file, &size);
+	file_close(file);
+	if (buf == NULL) {
+		return NULL;
+	}
+
+	struct sdx_footer footer;
+	unsigned item_sz = wide ? sizeof(struct witem) : sizeof(struct item);
+	if (size < sizeof(footer)) {
+		goto broken;
+	}
+	memcpy(&footer, buf + size - sizeof(footer), sizeof(footer));
+	uint64_t fences_cnt = _fences_cnt(item_sz, footer.items_cnt);
+	uint64_t items_sz = footer.items_cnt * item_sz;
+	if (footer.item_sz != item_sz || footer.page_sz != SDX_PAGE ||
+	    items_sz + fences_cnt * sizeof(uint64_t) + footer.bloom_sz +
+	    sizeof(footer) != size) {
+		goto broken;
+	}
+	if (adler32(buf, items_sz) != footer.items_checksum ||
+	    adler32(buf + items_sz, size - items_sz - 4) != footer.checksum) {
+		goto broken;
+	}
+	struct bloom *bloom = bloom_load(buf + size - sizeof(footer) -
+					 footer.bloom_sz,
+					 footer.bloom_sz, footer.bloom_probes);
+	if (bloom == NULL) {
+		goto broken;
+	}
+
+	struct sdx *sdx = malloc(sizeof(struct sdx));
+	memset(sdx, 0, sizeof(struct sdx));
+	sdx->mmap = buf;
+	sdx->mmap_sz = size;
+	sdx->wide = wide;
+	sdx->item_sz = item_sz;
+	sdx->items_cnt = footer.items_cnt;
+	sdx->fences_cnt = fences_cnt;
+	sdx->fences = malloc(fences_cnt * sizeof(uint64_t) + 1);
+	memcpy(sdx->fences, buf + items_sz, fences_cnt * sizeof(uint64_t));
+	sdx->bloom = bloom;
+	/* Lookups touch single pages, readahead would only waste the
+	 * page cache. */
+	posix_madvise(buf, size, POSIX_MADV_RANDOM);
+	return sdx;
+
+broken:
+	log_warn(db, "Can't load %s: broken file.", filename);
+	file_munmap(db, buf, size);
+	return NULL;
+}
+
+void sdx_free(struct db *db, struct sdx *sdx)
+{
+	file_munmap(db, sdx->mmap, sdx->mmap_sz);
+	bloom_free(sdx->bloom);
+	free(sdx->fences);
+	free(sdx);
+}
+
+static struct hashdir_item _sdx_item(struct sdx *sdx, uint64_t i)
+{
+	char *item = sdx->mmap + i * sdx->item_sz;
+	if (sdx->wide) {
+		return _wunpack(*(struct witem *)item);
+	}
+	return _unpack(*(struct item *)item);
+}
+
+int sdx_find(struct sdx *sdx, uint128_t key_hash, struct hashdir_item *hi)
+{
+	if (!bloom_may_contain(sdx->bloom, key_hash)) {
+		return 0;
+	}
+	/* Pages that may hold the key: from the last fence below it to
+	 * the last fence equal to it. */
+	uint64_t upper = key_hash >> 64;
+	uint64_t a = 0, b = sdx->fences_cnt;
+	while (a < b) {
+		uint64_t m = a + (b - a) / 2;
+		if (sdx->fences[m] < upper) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+	uint64_t lo = a ? _page_first(sdx->item_sz, a - 1) : 0;
+	b = sdx->fences_cnt;
+	while (a < b) {
+		uint64_t m = a + (b - a) / 2;
+		if (sdx->fences[m] <= upper) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+	uint64_t hi_end = a < sdx->fences_cnt ?
+		_page_first(sdx->item_sz, a) : sdx->items_cnt;
+
+	while (lo < hi_end) {
+		uint64_t m = lo + (hi_end - lo) / 2;
+		uint128_t h = _key_hash(sdx->mmap + m * sdx->item_sz);
+		if (h == key_hash) {
+			*hi = _sdx_item(sdx, m);
+			return 1;
+		}
+		if (h < key_hash) {
+			lo = m + 1;
+		} else {
+			hi_end = m;
+		}
+	}
+	return 0;
+}
+
+uint64_t sdx_allocated(struct sdx *sdx)
+{
+	return sdx->fences_cnt * sizeof(uint64_t) + bloom_allocated(sdx->bloom);
+}
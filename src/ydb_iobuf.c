@@ -0,0 +1,77 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "ydb_common.h"
+#include "ydb_logging.h"
+#include "ydb_file.h"
+#include "ydb_iobuf.h"
+
+struct iobufs {
+	pthread_mutex_t lock;
+	unsigned max_free;
+	unsigned free_cnt;
+	char **free;
+};
+
+struct iobufs *iobufs_new(unsigned max_free)
+{
+	struct iobufs *iobufs = malloc(sizeof(struct iobufs));
+	memset(iobufs, 0, sizeof(struct iobufs));
+	pthread_mutex_init(&iobufs->lock, NULL);
+	iobufs->max_free = max_free;
+	iobufs->free = calloc(max_free ? max_free : 1, sizeof(char *));
+	return iobufs;
+}
+
+void iobufs_free(struct iobufs *iobufs)
+{
+	unsigned i;
+	for (i = 0; i < iobufs->free_cnt; i++) {
+		free(iobufs->free[i]);
+	}
+	free(iobufs->free);
+	pthread_mutex_destroy(&iobufs->lock);
+	free(iobufs);
+}
+
+static char *_iobuf_alloc(uint64_t size)
+{
+	void *buf;
+	if (posix_memalign(&buf, FILE_DIRECT_ALIGN, size) != 0) {
+		abort();
+	}
+	return buf;
+}
+
+char *iobuf_get(struct iobufs *iobufs, uint64_t size)
+{
+	if (size > IOBUF_SIZE) {
+		return _iobuf_alloc(size);
+	}
+	char *buf = NULL;
+	pthread_mutex_lock(&iobufs->lock);
+	if (iobufs->free_cnt) {
+		buf = iobufs->free[--iobufs->free_cnt];
+	}
+	pthread_mutex_unlock(&iobufs->lock);
+	return buf ? buf : _iobuf_alloc(IOBUF_SIZE);
+}
+
+void iobuf_put(struct iobufs *iobufs, char *buf, uint64_t size)
+{
+	if (size <= IOBUF_SIZE) {
+		pthread_mutex_lock(&iobufs->lock);
+		if (iobufs->free_cnt < iobufs->max_free) {
+			iobufs->free[iobufs->free_cnt++] = buf;
+			buf = NULL;
+		}
+		pthread_mutex_unlock(&iobufs->lock);
+	}
+	free(buf);
+}
@@ -0,0 +1,14 @@
+/* Pool of buffers aligned for direct reads, see file_pread_direct().
+ * Buffers of up to IOBUF_SIZE bytes are kept for reuse, at most
+ * 'max_free' of them, bigger ones are allocated for a single use.
+ * Thread safe. */
+
+struct iobufs;
+
+#define IOBUF_SIZE ((1 << 20) + 2 * FILE_DIRECT_ALIGN)
+#define IOBUF_MAX_FREE 16
+
+struct iobufs *iobufs_new(unsigned max_free);
+void iobufs_free(struct iobufs *iobufs);
+char *iobuf_get(struct iobufs *iobufs, uint64_t size);
+void iobuf_put(struct iobufs *iobufs, char *buf, uint64_t size);
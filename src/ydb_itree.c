@@ -14,11 +14,22 @@
 #include "ydb_file.h"
 #include "ydb_hashdir.h"
 #include "ydb_itree.h"
+#include "ydb_bloom.h"
 
 #include "ohamt.h"
 
 struct itree {
 	struct ohamt_root tree;
+	unsigned remno_bits;
+	unsigned hpos_bits;
+
+	struct bloom *bloom;	/* NULL if disabled */
+	uint64_t bloom_keys;	/* Added since the filter was built */
+	uint64_t bloom_stale;	/* Deleted since the filter was built */
+	struct bloom *bloom_next;	/* Being rebuilt, NULL if not */
+	uint64_t bloom_next_keys;
+
+	unsigned changes;	/* Since the last itree_defrag() */
 
 	void *rlog_ctx;
 	rlog_get rlog_get;
@@ -32,46 +43,47 @@ struct tree_item {
 	int hpos;
 };
 
-struct _packed_tree_item {
-	uint32_t _reserved2:1;
-	uint32_t a_log_remno:16;
-	uint32_t a_hpos:23;
-	uint32_t _reserved1:20;
-} __attribute__ ((packed));
-
-union _pt_tree_item { 		/* Type-punning. */
-	struct _packed_tree_item pti;
-	uint64_t found;
-} __attribute__ ((packed));
-
+/* Packed into the 40 bits of an ohamt leaf. The lowest bit must be
+ * zero, above it 'remno_bits' of log_remno and hpos in the rest. The
+ * narrow format uses 16 bits for log_remno and 23 bits for hpos. */
+#define ITREE_ITEM_BITS 40
 
-
-static uint64_t _pack(struct tree_item ti)
+static uint64_t _pack(struct itree *itree, struct tree_item ti)
 {
-	union _pt_tree_item u = {.pti = {0, ti.log_remno, ti.hpos, 0}};
-	return u.found;
+	assert(ti.log_remno < (1ULL << itree->remno_bits));
+	assert((uint64_t)ti.hpos < (1ULL << itree->hpos_bits));
+	return (ti.log_remno << 1) |
+		((uint64_t)ti.hpos << (1 + itree->remno_bits));
 }
 
-static struct tree_item _unpack(uint64_t found)
+static struct tree_item _unpack(struct itree *itree, uint64_t found)
 {
-	union _pt_tree_item u = {.found = found};
-	return (struct tree_item){u.pti.a_log_remno, u.pti.a_hpos};
+	return (struct tree_item){
+		(found >> 1) & ((1ULL << itree->remno_bits) - 1),
+		(found >> (1 + itree->remno_bits)) &
+			((1ULL << itree->hpos_bits) - 1)};
 }
 
 static uint128_t _itree_hash(void *itree_p, uint64_t found)
 {
 	struct itree *itree = (struct itree*)itree_p;
-	struct tree_item ti = _unpack(found);
+	struct tree_item ti = _unpack(itree, found);
 	struct hashdir_item hdi = itree->rlog_get(itree->rlog_ctx,
 						  ti.log_remno, ti.hpos);
 	return hdi.key_hash;
 }
 
-struct itree *itree_new(rlog_get get, rlog_add add, rlog_del del, void *ctx)
+struct itree *itree_new(rlog_get get, rlog_add add, rlog_del del, void *ctx,
+			unsigned remno_bits, int huge_pages,
+			uint64_t defrag_waste)
 {
+	assert(remno_bits > 0 && remno_bits < ITREE_ITEM_BITS - 1);
 	struct itree *itree = malloc(sizeof(struct itree));
 	memset(itree, 0, sizeof(struct itree));
-	INIT_OHAMT_ROOT(&itree->tree, _itree_hash, itree);
+	itree->remno_bits = remno_bits;
+	itree->hpos_bits = ITREE_ITEM_BITS - 1 - remno_bits;
+	INIT_OHAMT_ROOT(&itree->tree, _itree_hash, itree, huge_pages,
+			defrag_waste);
 	itree->rlog_ctx = ctx;
 	itree->rlog_get = get;
 	itree->rlog_add = add;
@@ -83,6 +95,12 @@ void itree_free(struct itree *itree)
 {
 	ohamt_erase(&itree->tree);
 	FREE_OHAMT_ROOT(&itree->tree);
+	if (itree->bloom) {
+		bloom_free(itree->bloom);
+	}
+	if (itree->bloom_next) {
+		bloom_free(itree->bloom_next);
+	}
 	free(itree);
 }
 
@@ -93,9 +111,11 @@ void itree_add(struct itree *itree, struct hashdir_item hdi)
 	struct tree_item ti;
 	itree->rlog_add(itree->rlog_ctx, hdi, &ti.log_remno, &ti.hpos);
 
-	uint64_t packed = _pack(ti);
-	uint64_t found = ohamt_insert(&itree->tree, _pack(ti));
+	uint64_t packed = _pack(itree, ti);
+	uint64_t found = ohamt_insert(&itree->tree, _pack(itree, ti));
 	assert(found == packed);
+	itree->changes += 1;
+	itree_filter_add(itree, hdi.key_hash);
 }
 
 void itree_add_noidx(struct itree *itree, uint128_t key_hash,
@@ -103,9 +123,11 @@ void itree_add_noidx(struct itree *itree, uint128_t key_hash,
 {
 	itree_del(itree, key_hash);
 	struct tree_item ti = {log_remno, hpos};
-	uint64_t packed = _pack(ti);
+	uint64_t packed = _pack(itree, ti);
 	uint64_t found = ohamt_insert(&itree->tree, packed);
 	assert(found == packed);
+	itree->changes += 1;
+	itree_filter_add(itree, key_hash);
 }
 
 
@@ -117,19 +139,19 @@ void itree_move_callback(void *itree_p, uint64_t new_log_remno,
 	/* TODO: could be twice as fast - in-place */
 	struct itree *itree = (struct itree*)itree_p;
 
-	uint64_t t = _pack((struct tree_item){new_log_remno, new_hpos});
+	uint64_t t = _pack(itree, (struct tree_item){new_log_remno, new_hpos});
 	uint64_t found = ohamt_replace(&itree->tree, t);
 	assert(found);
-	struct tree_item ti = _unpack(found);
+	struct tree_item ti = _unpack(itree, found);
 	assert(ti.hpos == old_hpos);
 	assert(ti.log_remno == new_log_remno);
 
 	/* uint64_t found = ohamt_delete(&itree->tree, key_hash); */
 	/* assert(found); */
-	/* struct tree_item ti = _unpack(found); */
+	/* struct tree_item ti = _unpack(itree, found); */
 	/* assert(ti.hpos == old_hpos); */
 	/* ti.hpos = new_hpos; */
-	/* uint64_t t = _pack(ti); */
+	/* uint64_t t = _pack(itree, ti); */
 	/* found = ohamt_insert(&itree->tree, t); */
 	/* assert(found == t); */
 }
@@ -138,8 +160,21 @@ int itree_del(struct itree *itree, uint128_t key_hash)
 {
 	uint64_t found = ohamt_delete(&itree->tree, key_hash);
 	if (found) {
-		struct tree_item ti = _unpack(found);
+		struct tree_item ti = _unpack(itree, found);
 		itree->rlog_del(itree->rlog_ctx, ti.log_remno, ti.hpos);
+		itree->bloom_stale += 1;
+		itree->changes += 1;
+		return 1;
+	}
+	return 0;
+}
+
+int itree_drop(struct itree *itree, uint128_t key_hash)
+{
+	uint64_t found = ohamt_delete(&itree->tree, key_hash);
+	if (found) {
+		itree->bloom_stale += 1;
+		itree->changes += 1;
 		return 1;
 	}
 	return 0;
@@ -148,9 +183,12 @@ int itree_del(struct itree *itree, uint128_t key_hash)
 int itree_get2(struct itree *itree, uint128_t key_hash,
 	       uint64_t *log_remno_ptr, int *hpos_ptr)
 {
+	if (itree->bloom && !bloom_may_contain(itree->bloom, key_hash)) {
+		return 0;
+	}
 	uint64_t found = ohamt_search(&itree->tree, key_hash);
 	if (found) {
-		struct tree_item ti = _unpack(found);
+		struct tree_item ti = _unpack(itree, found);
 		*log_remno_ptr = ti.log_remno;
 		*hpos_ptr = ti.hpos;
 		return 1;
@@ -163,3 +201,82 @@ void itree_mem_stats(struct itree *itree,
 {
 	ohamt_allocated(&itree->tree, allocated_ptr, wasted_ptr);
 }
+
+void itree_node_counts(struct itree *itree,
+		       uint64_t *allocs_ptr, uint64_t *frees_ptr)
+{
+	ohamt_node_counts(&itree->tree, allocs_ptr, frees_ptr);
+}
+
+/* Every change frees a node, moving a couple of nodes per change
+ * keeps up with the fragmentation it causes. */
+#define DEFRAG_MOVES_PER_CHANGE 2
+#define DEFRAG_MOVES_MAX 4096
+
+void itree_defrag(struct itree *itree)
+{
+	unsigned budget = DEFRAG_MOVES_MAX;
+	if (itree->changes < DEFRAG_MOVES_MAX / DEFRAG_MOVES_PER_CHANGE) {
+		budget = itree->changes * DEFRAG_MOVES_PER_CHANGE;
+	}
+	itree->changes = 0;
+	ohamt_defrag(&itree->tree, budget);
+}
+
+void itree_filter_set(struct itree *itree, struct bloom *bloom)
+{
+	if (itree->bloom) {
+		bloom_free(itree->bloom);
+	}
+	itree->bloom = bloom;
+	itree->bloom_keys = 0;
+	itree->bloom_stale = 0;
+}
+
+void itree_filter_add(struct itree *itree, uint128_t key_hash)
+{
+	if (itree->bloom) {
+		bloom_add(itree->bloom, key_hash);
+		itree->bloom_keys += 1;
+	}
+	if (itree->bloom_next) {
+		itree_filter_next_add(itree, key_hash);
+	}
+}
+
+void itree_filter_next(struct itree *itree, struct bloom *bloom)
+{
+	assert(itree->bloom_next == NULL);
+	itree->bloom_next = bloom;
+	itree->bloom_next_keys = 0;
+}
+
+void itree_filter_next_add(struct itree *itree, uint128_t key_hash)
+{
+	bloom_add(itree->bloom_next, key_hash);
+	itree->bloom_next_keys += 1;
+}
+
+void itree_filter_next_done(struct itree *itree)
+{
+	uint64_t keys = itree->bloom_next_keys;
+	itree_filter_set(itree, itree->bloom_next);
+	itree->bloom_next = NULL;
+	itree->bloom_keys = keys;
+}
+
+int itree_filter_needs_rebuild(struct itree *itree)
+{
+	if (itree->bloom == NULL || itree->bloom_next) {
+		return 0;
+	}
+	/* Deleted keys only raise the false positive rate. */
+	return itree->bloom_keys > bloom_capacity(itree->bloom) ||
+		itree->bloom_stale > itree->bloom_keys / 2 + 1024;
+}
+
+uint64_t itree_filter_allocated(struct itree *itree)
+{
+	return (itree->bloom ? bloom_allocated(itree->bloom) : 0) +
+		(itree->bloom_next ? bloom_allocated(itree->bloom_next) : 0);
+}
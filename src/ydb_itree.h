@@ -10,7 +10,13 @@ typedef void (*rlog_del)(void *context, uint64_t log_remno, int hpos);
 
 struct itree;
 
-struct itree *itree_new(rlog_get get, rlog_add add, rlog_del del, void *ctx);
+/* Index entries keep 'remno_bits' of log_remno and the remaining
+ * ITREE_HPOS_BITS(remno_bits) bits of hpos. 'huge_pages' is an enum
+ * mem_huge_pages, 'defrag_waste' is passed to mem_new(). */
+struct itree *itree_new(rlog_get get, rlog_add add, rlog_del del, void *ctx,
+			unsigned remno_bits, int huge_pages,
+			uint64_t defrag_waste);
+#define ITREE_HPOS_BITS(remno_bits) (39 - (remno_bits))
 void itree_free(struct itree *itree);
 void itree_add(struct itree *itree, struct hashdir_item hdi);
 void itree_add_noidx(struct itree *itree, uint128_t key_hash,
@@ -19,8 +25,29 @@ void itree_move_callback(void *itree_p, uint64_t new_log_remno,
 			 int new_hpos, int old_hpos);
 
 int itree_del(struct itree *itree, uint128_t key_hash);
+/* Like itree_del() but the item stays in its log. */
+int itree_drop(struct itree *itree, uint128_t key_hash);
 int itree_get2(struct itree *itree, uint128_t key_hash,
 	       uint64_t *log_remno_ptr, int *hpos_ptr);
 
+/* Negative lookup filter, keys are added by itree_add(). The owner
+ * builds a new filter with all the keys when it needs a rebuild. */
+struct bloom;
+void itree_filter_set(struct itree *itree, struct bloom *bloom);
+void itree_filter_add(struct itree *itree, uint128_t key_hash);
+int itree_filter_needs_rebuild(struct itree *itree);
+/* A rebuild may take many steps. Meanwhile lookups use the old filter
+ * and added keys go to both, itree_filter_next_add() adds the keys
+ * already there to the new one. itree_filter_next_done() swaps it in. */
+void itree_filter_next(struct itree *itree, struct bloom *bloom);
+void itree_filter_next_add(struct itree *itree, uint128_t key_hash);
+void itree_filter_next_done(struct itree *itree);
+uint64_t itree_filter_allocated(struct itree *itree);
+
 void itree_mem_stats(struct itree *itree,
 		     unsigned long *allocated_ptr, unsigned long *wasted_ptr);
+void itree_node_counts(struct itree *itree,
+		       uint64_t *allocs_ptr, uint64_t *frees_ptr);
+/* Move a few nodes out of sparsely used memory, in proportion to the
+ * changes since the last call, so deletes don't pin memory forever. */
+void itree_defrag(struct itree *itree);
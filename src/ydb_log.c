@@ -19,6 +19,9 @@
 #include "ydb_log.h"
 #include "ydb_reader.h"
 #include "ydb_record.h"
+#include "ydb_db.h"
+#include "ydb_iobuf.h"
+#include "ydb_worker.h"
 
 
 
@@ -32,6 +35,9 @@ struct log {
 	struct stddev used_size;
 
 	struct hashdir *hashdir;
+	struct sdx *sdx;	/* Not NULL if keys aren't in the index */
+	struct _sdx_task_ctx *sdx_saving;
+	int sdx_broken;		/* log_sdx_open() failed, stays resident */
 	log_move_callback move_callback;
 	void *move_userdata;
 
@@ -65,6 +71,10 @@ static char *_dirty_idx_filename(uint64_t log_number) {
 	return _filename(log_number, "idx.dirty");
 }
 
+static char *sdx_filename(uint64_t log_number) {
+	return _filename(log_number, "sdx");
+}
+
 static struct log *_log_new(struct db *db, uint64_t log_number,
 			    struct dir *log_dir, struct dir *index_dir,
 			    log_move_callback move_callback,
@@ -172,14 +182,19 @@ int log_iterate(struct log *log, log_callback callback, void *userdata)
 #define DIV_ROUND_UP(n,d) (((n) + (d) - 1) / (d))
 #define PREFETCH_PAGE 4096
 
+/* Sequential scans read the log in windows of at least SCAN_WINDOW
+ * bytes. Dead records between live ones are read through (and
+ * skipped) as long as the hole is smaller than SCAN_MAX_GAP. */
+#define SCAN_WINDOW (1 << 20)
+#define SCAN_MAX_GAP (64 << 10)
+
+/* Prefetch about prefetch_size bytes of items from last_hpos on. Adds
+ * the size of prefetched items to *prefetched_ptr and returns the
+ * first hpos not prefetched. */
 static int _iterate_prefetch(struct log *log, struct hashdir *shd,
-			     int last_hpos, uint64_t prefetch_size)
+			     int last_hpos, int hpos_max,
+			     uint64_t prefetch_size, uint64_t *prefetched_ptr)
 {
-	int hpos_max = hashdir_size2(shd);
-	if (prefetch_size < 2) {
-		return hpos_max;
-	}
-
 	uint64_t a = 0;
 	uint64_t b = 0;
 
@@ -191,9 +206,8 @@ static int _iterate_prefetch(struct log *log, struct hashdir *shd,
 		uint64_t c = hi.offset / PREFETCH_PAGE;
 		uint64_t d = DIV_ROUND_UP(hi.offset + hi.size, PREFETCH_PAGE);
 
-		if (c > b) { 	/* TODO: Concatenate if small number
-				 * of pages in the middle are
-				 * unused? */
+		/* Small holes are cheaper to read than to seek over. */
+		if (c > b + SCAN_MAX_GAP / PREFETCH_PAGE) {
 			if (a && b) {
 				reader_prefetch(log->reader,
 						a*PREFETCH_PAGE,
@@ -213,11 +227,34 @@ static int _iterate_prefetch(struct log *log, struct hashdir *shd,
 				(b-a)*PREFETCH_PAGE);
 	}
 
+	*prefetched_ptr += prefetched;
 	return i;
 }
 
-int log_iterate_sorted(struct log *log, uint64_t prefetch_size,
-		       log_iterate_callback callback, void *userdata)
+/* Find the end of a scan window starting at hpos. Returns the first
+ * hpos not covered by the window. */
+static int _scan_window(struct hashdir *shd, int hpos, int hpos_max,
+			uint64_t *start_ptr, uint64_t *end_ptr)
+{
+	struct hashdir_item hi = hashdir_get(shd, hpos);
+	uint64_t start = hi.offset;
+	uint64_t end = hi.offset + hi.size;
+	for (hpos++; hpos < hpos_max; hpos++) {
+		hi = hashdir_get(shd, hpos);
+		if (hi.offset > end + SCAN_MAX_GAP ||
+		    hi.offset + hi.size - start > SCAN_WINDOW) {
+			break;
+		}
+		if (hi.offset + hi.size > end) {
+			end = hi.offset + hi.size;
+		}
+	}
+	*start_ptr = start;
+	*end_ptr = end;
+	return hpos;
+}
+
+struct hashdir *log_sorted_index(struct log *log)
 {
 	struct timeval tv0, tv1;
 	gettimeofday(&tv0, NULL);
@@ -226,57 +263,121 @@ int log_iterate_sorted(struct log *log, uint64_t prefetch_size,
 	log_info(log->db, "Sorting index in log %llx took %5li ms.",
 		 (unsigned long long)log->log_number,
 		 TIMEVAL_MSEC_SUBTRACT(tv1, tv0));
-	int hpos_max = hashdir_size2(shd);
+	return shd;
+}
 
-	int last_hpos = 1;
+int log_scan_range(struct log *log, struct hashdir *shd,
+		   int hpos_start, int hpos_end, uint64_t prefetch_size,
+		   int drop_behind, log_iterate_callback callback,
+		   void *userdata)
+{
+	/* Direct reads fetch each window synchronously, hints would
+	 * only fill the page cache. */
+	if (reader_scans_direct(log->reader)) {
+		prefetch_size = 0;
+		drop_behind = 0;
+	}
+	struct iobufs *iobufs = db_iobufs(log->db);
+	uint64_t buf_sz = READER_SCAN_BUF(SCAN_WINDOW);
+	char *buf = iobuf_get(iobufs, buf_sz);
+
+	/* Up to prefetch_size bytes are prefetched ahead of the scan,
+	 * topped up by a half when less than a half is left. */
+	int last_hpos = hpos_start;
+	uint64_t ahead = 0;
 	int r = 0;
-	int i;
-	for (i=1; i < hpos_max; i++) {
-		if (i == last_hpos) {
-			last_hpos = _iterate_prefetch(log, shd,
-						      last_hpos, prefetch_size);
+	int i = hpos_start;
+	while (i < hpos_end && r == 0) {
+		while (prefetch_size > 1 && last_hpos < hpos_end &&
+		       ahead < prefetch_size / 2) {
+			if (last_hpos < i) {
+				last_hpos = i;
+			}
+			last_hpos = _iterate_prefetch(log, shd, last_hpos,
+						      hpos_end,
+						      prefetch_size - ahead,
+						      &ahead);
 		}
 
-		struct hashdir_item hi = hashdir_get(shd, i);
-		struct keyvalue kv;
-		char *buf = malloc(hi.size);
-		r = reader_read(log->reader, hi.offset, buf, hi.size, &kv);
-		if (r) {
-			free(buf);
-			break;
+		uint64_t start, end;
+		int j = _scan_window(shd, i, hpos_end, &start, &end);
+		if (READER_SCAN_BUF(end - start) > buf_sz) {
+			/* Single record bigger than the window. */
+			iobuf_put(iobufs, buf, buf_sz);
+			buf_sz = READER_SCAN_BUF(end - start);
+			buf = iobuf_get(iobufs, buf_sz);
 		}
-		r = callback(userdata,
-			     kv.key, kv.key_sz,
-			     kv.value, kv.value_sz);
-		free(buf);
-		if (r) {
+		char *data = reader_pread_scan(log->reader, start, end - start,
+					       buf);
+		if (data == NULL) {
+			r = -1;
 			break;
 		}
+		if (drop_behind) {
+			/* The window is in the buffer already. Drop before
+			 * the callbacks, they may free the log: the garbage
+			 * collection writing out its last items. Including
+			 * pages only partly read. */
+			uint64_t a = start / PREFETCH_PAGE * PREFETCH_PAGE;
+			uint64_t b = DIV_ROUND_UP(end, PREFETCH_PAGE) *
+				PREFETCH_PAGE;
+			reader_drop_cache(log->reader, a, b - a);
+		}
+
+		for (; i < j; i++) {
+			struct hashdir_item hi = hashdir_get(shd, i);
+			ahead -= hi.size < ahead ? hi.size : ahead;
+			struct keyvalue kv;
+			r = reader_unpack(log->reader, hi.offset,
+					  data + (hi.offset - start), hi.size,
+					  hi.key_hash, &kv);
+			if (r) {
+				break;
+			}
+			r = callback(userdata, &kv);
+			if (r) {
+				break;
+			}
+		}
 	}
 
+	iobuf_put(iobufs, buf, buf_sz);
+	return r;
+}
+
+int log_iterate_sorted(struct log *log, uint64_t prefetch_size,
+		       int drop_behind, log_iterate_callback callback,
+		       void *userdata)
+{
+	struct hashdir *shd = log_sorted_index(log);
+	int r = log_scan_range(log, shd, 1, hashdir_size2(shd), prefetch_size,
+			       drop_behind, callback, userdata);
 	hashdir_free(shd);
 	return r;
 }
 
-int log_read(struct log *log, int hpos,
-	     char *buffer, unsigned int buffer_sz,
-	     struct keyvalue *kv)
+int log_read_item(struct log *log, struct hashdir_item hi,
+		  char *buffer, struct keyvalue *kv)
 {
-	struct hashdir_item hi = hashdir_get(log->hashdir, hpos);
-	assert(hi.size <= buffer_sz);
-	return reader_read(log->reader, hi.offset, buffer, hi.size, kv);
+	return reader_read(log->reader, hi.offset, buffer, hi.size,
+			   hi.key_hash, kv);
 }
 
-unsigned log_prefetch(struct log *log, int hpos)
+int log_value_range(struct log *log, struct hashdir_item hi,
+		    char *buffer, unsigned buffer_sz,
+		    struct keyvalue *kv, struct file_range *range)
 {
-	struct hashdir_item hi = hashdir_get(log->hashdir, hpos);
-	reader_prefetch(log->reader, hi.offset, hi.size);
-	return hi.size;
+	if (hi.size <= buffer_sz) {
+		return 0;
+	}
+	return reader_value_range(log->reader, hi.offset, buffer, buffer_sz,
+				  kv, range);
 }
 
-unsigned log_buffer_size(struct log *log, int hpos)
+unsigned log_prefetch(struct log *log, struct hashdir_item hi)
 {
-	return hashdir_get(log->hashdir, hpos).size;
+	reader_prefetch(log->reader, hi.offset, hi.size);
+	return hi.size;
 }
 
 struct hashdir_item log_get(struct log *log, int hpos)
@@ -297,6 +398,129 @@ struct hashdir_item log_del(struct log *log, int hpos)
 	return hdi;
 }
 
+int log_sdx_save(struct log *log)
+{
+	int r = sdx_save(log->hashdir, log->index_dir,
+			 sdx_filename(log->log_number));
+	if (r == -1) {
+		log_warn(log->db, "Unable to save sorted index for log %llx.",
+			 (unsigned long long)log->log_number);
+	}
+	return r;
+}
+
+struct _sdx_task_ctx {
+	struct db *db;
+	struct dir *index_dir;
+	char filename[256];
+	struct sdx_items *items;
+	int done;
+};
+
+static void _task_sdx_save(void *ctx_p)
+{
+	struct _sdx_task_ctx *ctx = (struct _sdx_task_ctx *)ctx_p;
+	if (sdx_write(ctx->items, ctx->index_dir, ctx->filename) != 0) {
+		log_warn(ctx->db, "Unable to save sorted index %s.",
+			 ctx->filename);
+	}
+	__atomic_store_n(&ctx->done, 1, __ATOMIC_RELEASE);
+}
+
+/* Only the copy of the items is done here, sorting and writing them
+ * out is left to the worker. The log owns the context and frees it
+ * once the task is done. */
+void log_sdx_save_async(struct log *log)
+{
+	assert(log->sdx_saving == NULL);
+	struct _sdx_task_ctx *ctx = malloc(sizeof(struct _sdx_task_ctx));
+	memset(ctx, 0, sizeof(struct _sdx_task_ctx));
+	ctx->db = log->db;
+	ctx->index_dir = log->index_dir;
+	snprintf(ctx->filename, sizeof(ctx->filename), "%s",
+		 sdx_filename(log->log_number));
+	ctx->items = sdx_items(log->hashdir);
+	log->sdx_saving = ctx;
+	db_task(log->db, TASK_FLUSH, _task_sdx_save, ctx);
+}
+
+int log_sdx_saving(struct log *log)
+{
+	struct _sdx_task_ctx *ctx = log->sdx_saving;
+	if (ctx == NULL) {
+		return 0;
+	}
+	if (!__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE)) {
+		return 1;
+	}
+	free(ctx);
+	log->sdx_saving = NULL;
+	return 0;
+}
+
+/* The task writes files of the log, it must be done before they are
+ * removed. */
+static void _sdx_wait(struct log *log)
+{
+	if (log_sdx_saving(log)) {
+		db_sync(log->db);
+		log_sdx_saving(log);
+		assert(log->sdx_saving == NULL);
+	}
+}
+
+int log_sdx_open(struct log *log)
+{
+	char *sdx_file = sdx_filename(log->log_number);
+	/* Liveness of items found in the sorted index is decided by
+	 * the bitmap alone. */
+	hashdir_mask_missing(log->hashdir);
+	int wide = db_wide_index(log->db);
+	if (dir_file_exists(log->index_dir, sdx_file) ||
+	    log_sdx_save(log) == 0) {
+		log->sdx = sdx_load(log->db, log->index_dir, sdx_file, wide);
+		if (log->sdx == NULL && log_sdx_save(log) == 0) {
+			/* Maybe left by an older version of the log,
+			 * saved once more from the index. */
+			log->sdx = sdx_load(log->db, log->index_dir, sdx_file,
+					    wide);
+		}
+	}
+	log->sdx_broken = log->sdx == NULL;
+	return log->sdx ? 0 : -1;
+}
+
+int log_sdx_broken(struct log *log)
+{
+	return log->sdx_broken;
+}
+
+int log_is_cold(struct log *log)
+{
+	return log->sdx != NULL;
+}
+
+int log_cold_find(struct log *log, uint128_t key_hash,
+		  struct hashdir_item *hi)
+{
+	if (sdx_find(log->sdx, key_hash, hi) == 0) {
+		return 0;
+	}
+	return bitmap_get(hashdir_get_bitmap(log->hashdir),
+			  hi->bitmap_pos) == 0;
+}
+
+void log_cold_del(struct log *log, struct hashdir_item hi)
+{
+	hashdir_del_lazy(log->hashdir, hi.bitmap_pos);
+	stddev_remove(&log->used_size, hi.size);
+}
+
+uint64_t log_cold_allocated(struct log *log)
+{
+	return sdx_allocated(log->sdx);
+}
+
 int log_freeze(struct log *log)
 {
 	int r = hashdir_freeze(log->hashdir, log->index_dir,
@@ -324,6 +548,9 @@ int log_freeze(struct log *log)
 
 void log_free_remove(struct log *log)
 {
+	_sdx_wait(log);
+	/* Pages of an unlinked file stay cached while it's open. */
+	reader_drop_cache(log->reader, 0, 0);
 	reader_free(log->reader);
 	int r = dir_unlink(log->log_dir, log_filename(log->log_number));
 	if (r == -1) {
@@ -340,6 +567,16 @@ void log_free_remove(struct log *log)
 		log_warn(log->db, "Can't unlink unused dirty index file %s.",
 			 _dirty_idx_filename(log->log_number));
 	}
+	if (dir_file_exists(log->index_dir, sdx_filename(log->log_number))) {
+		r = dir_unlink(log->index_dir, sdx_filename(log->log_number));
+		if (r == -1) {
+			log_warn(log->db, "Can't unlink unused sorted index "
+				 "file %s.", sdx_filename(log->log_number));
+		}
+	}
+	if (log->sdx) {
+		sdx_free(log->db, log->sdx);
+	}
 	if (log->hashdir) {
 		hashdir_free(log->hashdir);
 	}
@@ -348,7 +585,11 @@ void log_free_remove(struct log *log)
 
 void log_free(struct log *log)
 {
+	_sdx_wait(log);
 	reader_free(log->reader);
+	if (log->sdx) {
+		sdx_free(log->db, log->sdx);
+	}
 	if (log->hashdir) {
 		hashdir_free(log->hashdir);
 	}
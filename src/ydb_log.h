@@ -26,22 +26,41 @@ int log_do_replay(struct log *log, log_replay_cb callback, void *userdata);
 
 int log_iterate(struct log *log, log_callback callback, void *userdata);
 
-typedef int (*log_iterate_callback)(void *userdata,
-				    const char *key, unsigned key_sz,
-				    const char *value, unsigned value_sz);
+/* Values of blob records are not read, see struct keyvalue. */
+typedef int (*log_iterate_callback)(void *userdata, struct keyvalue *kv);
+/* 'drop_behind' drops the pages from the page cache after reading
+ * them, for logs about to be deleted or scans that would push more
+ * useful pages out. */
 int log_iterate_sorted(struct log *log, uint64_t prefetch_size,
-		       log_iterate_callback callback, void *userdata);
+		       int drop_behind, log_iterate_callback callback,
+		       void *userdata);
+
+/* log_iterate_sorted() in two steps. Building the sorted index touches
+ * the log and must not race with other database operations, scanning
+ * ranges of it is safe from any thread. */
+struct hashdir *log_sorted_index(struct log *log);
+int log_scan_range(struct log *log, struct hashdir *shd,
+		   int hpos_start, int hpos_end, uint64_t prefetch_size,
+		   int drop_behind, log_iterate_callback callback,
+		   void *userdata);
 
 void log_free_remove(struct log *log);
 void log_free(struct log *log);
 
 
-/* TODO: remove this method */
-unsigned log_buffer_size(struct log *log, int hpos);
-int log_read(struct log *log, int hpos,
-	     char *buffer, unsigned int buffer_sz,
-	     struct keyvalue *kv);
-unsigned log_prefetch(struct log *log, int hpos);
+/* Read the record of an item fetched with log_get() or
+ * log_cold_find(), doesn't touch the index so it's safe from any
+ * thread while the log is alive. The buffer must hold hi.size
+ * bytes. */
+int log_read_item(struct log *log, struct hashdir_item hi,
+		  char *buffer, struct keyvalue *kv);
+unsigned log_prefetch(struct log *log, struct hashdir_item hi);
+/* See reader_value_range(). Returns 0 also if the whole record fits in
+ * the buffer, log_read_item() is cheaper then. */
+struct file_range;
+int log_value_range(struct log *log, struct hashdir_item hi,
+		    char *buffer, unsigned buffer_sz,
+		    struct keyvalue *kv, struct file_range *range);
 
 struct hashdir_item log_get(struct log *log, int hpos);
 int log_add(struct log *log, struct hashdir_item hdi);
@@ -49,6 +68,23 @@ struct hashdir_item log_del(struct log *log, int hpos);
 
 
 int log_freeze(struct log *log);
+
+/* Cold logs keep their keys out of the in-memory index, lookups go
+ * to the sorted index saved by log_sdx_save(). log_sdx_open() makes
+ * the log cold, saving the sorted index first if it's missing. */
+int log_sdx_save(struct log *log);
+/* log_sdx_save() on the worker, log_sdx_saving() returns 1 until it's
+ * done. */
+void log_sdx_save_async(struct log *log);
+int log_sdx_saving(struct log *log);
+int log_sdx_open(struct log *log);
+/* log_sdx_open() failed, the log isn't tried again. */
+int log_sdx_broken(struct log *log);
+int log_is_cold(struct log *log);
+int log_cold_find(struct log *log, uint128_t key_hash,
+		  struct hashdir_item *hi);
+void log_cold_del(struct log *log, struct hashdir_item hi);
+uint64_t log_cold_allocated(struct log *log);
 uint64_t log_get_number(struct log *log);
 
 
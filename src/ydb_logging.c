@@ -2,28 +2,82 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 #include "ydb_logging.h"
 #include "ydb_db.h"
 
-void ydb_logger(struct db *db, char *file, int line, const char *type,
-		const char *fmt, ...)
+#define LOG_RING_SLOTS 256
+#define LOG_MESSAGE_MAX 1024
+#define LOG_LINE_MAX 1024
+#define LOG_RATE_SITES 256
+#define LOG_RATE_BURST 20
+
+struct log_slot {
+	uint64_t seq;		/* Free for position seq, full for seq - 1 */
+	int level;
+	int line;
+	const char *file;
+	struct timeval tv;
+	int message_len;
+	char message[LOG_MESSAGE_MAX];
+};
+
+struct rate_site {
+	uint64_t key;
+	uint64_t second;
+	unsigned count;
+	unsigned suppressed;
+};
+
+struct logger {
+	int fd;
+	pid_t pid;
+	int level;
+
+	/* Bounded multi-producer queue, each slot has a sequence
+	 * number telling whose turn it is. */
+	uint64_t head;
+	uint64_t tail;		/* Only used by the thread */
+	uint64_t dropped;
+	struct log_slot *slots;
+	sem_t ready;
+
+	int stop;
+	pthread_t thread;
+
+	pthread_mutex_t callback_lock;
+	logger_callback callback;
+	void *callback_userdata;
+
+	struct rate_site sites[LOG_RATE_SITES];
+};
+
+static const char *_level_name(int level)
 {
-	assert(fmt);
-	char message[1024];
-	va_list ap;
-	va_start(ap, fmt);
-	int message_len = vsnprintf(message, sizeof(message), fmt, ap);
-	va_end(ap);
+	switch (level) {
+	case LOGLEVEL_ERROR: return "ERROR";
+	case LOGLEVEL_WARN: return "WARN";
+	default: return "INFO";
+	}
+}
 
+static int _format_line(char *buf, unsigned buf_sz, struct timeval tv,
+			const char *file, int line, int level,
+			const char *message, int message_len)
+{
 	char location[32];
-	if (type[0] != 'I') {  	/* not info */
+	if (level != LOGLEVEL_INFO) {
 		char tmp_loc[32];
 		snprintf(tmp_loc, sizeof(tmp_loc), "%s:%i", file, line);
 		snprintf(location, sizeof(location), " %-18s", tmp_loc);
@@ -31,27 +85,27 @@ void ydb_logger(struct db *db, char *file, int line, const char *type,
 		location[0] = '\0';
 	}
 
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-
 	struct tm tmp;
 	gmtime_r(&tv.tv_sec, &tmp); // UTC
 
 	char time[32];
 	strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", &tmp);
 
-	char buf[1024];
-	int buf_len = snprintf(buf, sizeof(buf),
-			       "%s.%03li%s %-6s %.800s%s\n",
-			       time, tv.tv_usec/1000,
-			       location,
-			       type,
-			       message,
-			       message_len > 800 ? "..." : "");
+	int len = snprintf(buf, buf_sz,
+			   "%s.%03li%s %-6s %.800s%s\n",
+			   time, tv.tv_usec/1000,
+			   location,
+			   _level_name(level),
+			   message,
+			   message_len > 800 ? "..." : "");
+	return len < (int)buf_sz ? len : (int)buf_sz - 1;
+}
 
+static void _write_all(int fd, const char *buf, int buf_len)
+{
 	int p = 0;
 	while (p < buf_len) {
-		int r = write(db_log_fd(db), &buf[p], buf_len - p);
+		int r = write(fd, &buf[p], buf_len - p);
 		if (r > 0) {
 			p += r;
 		} else {
@@ -60,8 +114,256 @@ void ydb_logger(struct db *db, char *file, int line, const char *type,
 	}
 }
 
+/* Lines of a batch go to the file in a single write(). */
+struct _out {
+	struct logger *logger;
+	char buf[32 * LOG_LINE_MAX];
+	int len;
+};
+
+static void _out_flush(struct _out *out)
+{
+	_write_all(out->logger->fd, out->buf, out->len);
+	out->len = 0;
+}
+
+static void _out_line(struct _out *out, struct timeval tv,
+		      const char *file, int line, int level,
+		      const char *message, int message_len)
+{
+	struct logger *logger = out->logger;
+	if (out->len + LOG_LINE_MAX > (int)sizeof(out->buf)) {
+		_out_flush(out);
+	}
+	char *buf = out->buf + out->len;
+	int len = _format_line(buf, LOG_LINE_MAX, tv, file, line, level,
+			       message, message_len);
+	pthread_mutex_lock(&logger->callback_lock);
+	if (logger->callback) {
+		if (len > 0 && buf[len - 1] == '\n') {
+			buf[len - 1] = '\0';
+		}
+		logger->callback(logger->callback_userdata, level, buf);
+	} else {
+		out->len += len;
+	}
+	pthread_mutex_unlock(&logger->callback_lock);
+}
+
+static int _drain(struct logger *logger, struct _out *out)
+{
+	int cnt = 0;
+	while (1) {
+		uint64_t pos = logger->tail;
+		struct log_slot *slot = &logger->slots[pos % LOG_RING_SLOTS];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+			break;
+		}
+		_out_line(out, slot->tv, slot->file, slot->line, slot->level,
+			  slot->message, slot->message_len);
+		__atomic_store_n(&slot->seq, pos + LOG_RING_SLOTS,
+				 __ATOMIC_RELEASE);
+		logger->tail = pos + 1;
+		cnt += 1;
+	}
+	uint64_t dropped = __atomic_exchange_n(&logger->dropped, 0,
+					       __ATOMIC_RELAXED);
+	if (dropped) {
+		char message[64];
+		int len = snprintf(message, sizeof(message),
+				   "%llu log messages dropped",
+				   (unsigned long long)dropped);
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		_out_line(out, tv, __FILE__, __LINE__, LOGLEVEL_WARN,
+			  message, len);
+	}
+	_out_flush(out);
+	return cnt;
+}
+
+static void *_logger_thread(void *logger_p)
+{
+	struct logger *logger = (struct logger *)logger_p;
+	struct _out *out = malloc(sizeof(struct _out));
+	out->logger = logger;
+	out->len = 0;
+	while (1) {
+		while (sem_wait(&logger->ready) != 0 && errno == EINTR) {
+		}
+		_drain(logger, out);
+		if (__atomic_load_n(&logger->stop, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+	}
+	_drain(logger, out);
+	free(out);
+	return NULL;
+}
+
+struct logger *logger_new(int fd)
+{
+	struct logger *logger = malloc(sizeof(struct logger));
+	memset(logger, 0, sizeof(struct logger));
+	logger->fd = fd;
+	logger->pid = getpid();
+	logger->level = LOGLEVEL_INFO;
+	logger->slots = malloc(sizeof(struct log_slot) * LOG_RING_SLOTS);
+	unsigned i;
+	for (i = 0; i < LOG_RING_SLOTS; i++) {
+		logger->slots[i].seq = i;
+	}
+	sem_init(&logger->ready, 0, 0);
+	pthread_mutex_init(&logger->callback_lock, NULL);
+	if (pthread_create(&logger->thread, NULL, _logger_thread,
+			   logger) != 0) {
+		pthread_mutex_destroy(&logger->callback_lock);
+		sem_destroy(&logger->ready);
+		free(logger->slots);
+		free(logger);
+		return NULL;
+	}
+	return logger;
+}
+
+void logger_free(struct logger *logger)
+{
+	__atomic_store_n(&logger->stop, 1, __ATOMIC_RELEASE);
+	sem_post(&logger->ready);
+	pthread_join(logger->thread, NULL);
+	pthread_mutex_destroy(&logger->callback_lock);
+	sem_destroy(&logger->ready);
+	free(logger->slots);
+	free(logger);
+}
+
+void logger_set_level(struct logger *logger, int level)
+{
+	__atomic_store_n(&logger->level, level, __ATOMIC_RELAXED);
+}
+
+void logger_set_callback(struct logger *logger,
+			 logger_callback callback, void *userdata)
+{
+	pthread_mutex_lock(&logger->callback_lock);
+	logger->callback = callback;
+	logger->callback_userdata = userdata;
+	pthread_mutex_unlock(&logger->callback_lock);
+}
+
+/* Returns 0 if the message should be suppressed, otherwise 1 plus the
+ * number of messages suppressed at the site since the last one. Sites
+ * sharing a slot only reset each other's counts. */
+static unsigned _rate_limit(struct logger *logger, const char *file, int line,
+			    uint64_t second)
+{
+	uint64_t key = (uint64_t)(uintptr_t)file * 0x9E3779B97F4A7C15ULL + line;
+	struct rate_site *site = &logger->sites[(key >> 32) % LOG_RATE_SITES];
+	if (__atomic_load_n(&site->key, __ATOMIC_RELAXED) != key) {
+		__atomic_store_n(&site->key, key, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->second, second, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->count, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+		return 1;
+	}
+	if (__atomic_load_n(&site->second, __ATOMIC_RELAXED) != second) {
+		__atomic_store_n(&site->second, second, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->count, 1, __ATOMIC_RELAXED);
+		return 1 + __atomic_exchange_n(&site->suppressed, 0,
+					       __ATOMIC_RELAXED);
+	}
+	if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) >
+	    LOG_RATE_BURST) {
+		__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	return 1;
+}
+
+static struct log_slot *_slot_claim(struct logger *logger)
+{
+	uint64_t pos = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+	while (1) {
+		struct log_slot *slot = &logger->slots[pos % LOG_RING_SLOTS];
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)(seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&logger->head, &pos,
+							pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				return slot;
+			}
+		} else if (diff < 0) {
+			return NULL;	/* Full */
+		} else {
+			pos = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static int _vformat(char *message, int suppressed, const char *fmt,
+		    va_list ap)
+{
+	int len = vsnprintf(message, LOG_MESSAGE_MAX, fmt, ap);
+	if (suppressed > 1 && len < LOG_MESSAGE_MAX) {
+		len += snprintf(message + len, LOG_MESSAGE_MAX - len,
+				" (%i similar messages suppressed)",
+				suppressed - 1);
+	}
+	return len;
+}
+
+void ydb_logger(struct db *db, const char *file, int line, int level,
+		const char *fmt, ...)
+{
+	assert(fmt);
+	struct logger *logger = db_logger(db);
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	va_list ap;
+
+	if (logger == NULL || getpid() != logger->pid) {
+		if (logger &&
+		    level > __atomic_load_n(&logger->level, __ATOMIC_RELAXED)) {
+			return;
+		}
+		char message[LOG_MESSAGE_MAX];
+		va_start(ap, fmt);
+		int message_len = _vformat(message, 0, fmt, ap);
+		va_end(ap);
+		char buf[LOG_LINE_MAX];
+		int buf_len = _format_line(buf, sizeof(buf), tv, file, line,
+					   level, message, message_len);
+		_write_all(db_log_fd(db), buf, buf_len);
+		return;
+	}
+
+	if (level > __atomic_load_n(&logger->level, __ATOMIC_RELAXED)) {
+		return;
+	}
+	unsigned suppressed = _rate_limit(logger, file, line, tv.tv_sec);
+	if (suppressed == 0) {
+		return;
+	}
+	struct log_slot *slot = _slot_claim(logger);
+	if (slot == NULL) {
+		__atomic_add_fetch(&logger->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	slot->level = level;
+	slot->file = file;
+	slot->line = line;
+	slot->tv = tv;
+	va_start(ap, fmt);
+	slot->message_len = _vformat(slot->message, suppressed, fmt, ap);
+	va_end(ap);
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+	sem_post(&logger->ready);
+}
+
 
-void ydb_logger_perror(struct db *db, char *file, int line,
+void ydb_logger_perror(struct db *db, const char *file, int line,
 		       const char *fmt, ...)
 {
 	assert(fmt);
@@ -73,5 +375,5 @@ void ydb_logger_perror(struct db *db, char *file, int line,
 	vsnprintf(message, sizeof(message), fmt, ap);
 	va_end(ap);
 
-	ydb_logger(db, file, line, "ERROR", "%s: %s", message, error);
+	ydb_logger(db, file, line, LOGLEVEL_ERROR, "%s: %s", message, error);
 }
@@ -3,20 +3,44 @@
 
 struct db;
 
+/* Same values as enum ydb_log_level. */
+enum log_level {
+	LOGLEVEL_ERROR = 1,
+	LOGLEVEL_WARN,
+	LOGLEVEL_INFO
+};
+
 #define log_info(db, format, ...)					\
-	ydb_logger(db, __FILE__, __LINE__, "INFO", format, __VA_ARGS__)
+	ydb_logger(db, __FILE__, __LINE__, LOGLEVEL_INFO, format, __VA_ARGS__)
 #define log_warn(db, format, ...)					\
-	ydb_logger(db, __FILE__, __LINE__, "WARN", format, __VA_ARGS__)
+	ydb_logger(db, __FILE__, __LINE__, LOGLEVEL_WARN, format, __VA_ARGS__)
 #define log_error(db, format, ...)					\
-	ydb_logger(db, __FILE__, __LINE__, "ERROR", format, __VA_ARGS__)
+	ydb_logger(db, __FILE__, __LINE__, LOGLEVEL_ERROR, format, __VA_ARGS__)
 
 #define log_perror(db, format, ...)					\
 	ydb_logger_perror(db, __FILE__, __LINE__, format, __VA_ARGS__)
 
-void ydb_logger(struct db *db, char *file, int line, const char *type,
+void ydb_logger(struct db *db, const char *file, int line, int level,
 		const char *fmt, ...) __attribute__ ((format (printf, 5, 6)));
-void ydb_logger_perror(struct db *db, char *file, int line,
+void ydb_logger_perror(struct db *db, const char *file, int line,
 		       const char *fmt, ...) __attribute__ ((format (printf, 4, 5)));
 
+/* Messages are put in a lock-free ring and written out by a background
+ * thread, callers never wait for the disk. When the ring is full
+ * messages are dropped and counted. Every call site may log at most
+ * LOG_RATE_BURST messages a second, the rest are counted and reported
+ * with the next message that gets through. Processes forked from the
+ * owner, and databases without a logger, write synchronously. */
+struct logger;
+typedef void (*logger_callback)(void *userdata, int level, const char *line);
+
+struct logger *logger_new(int fd);
+/* Writes out the queued messages. */
+void logger_free(struct logger *logger);
+void logger_set_level(struct logger *logger, int level);
+/* Pass lines to the callback instead of writing them to the file,
+ * NULL restores the file. */
+void logger_set_callback(struct logger *logger,
+			 logger_callback callback, void *userdata);
 
 #endif
@@ -0,0 +1,378 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ydb_common.h"
+#include "ydb_otree.h"
+
+/* Plain B+tree. Leaves hold the keys and are linked left to right,
+ * inner nodes hold private copies of the separators. */
+#define OTREE_MAX 64
+#define OTREE_MIN (OTREE_MAX / 2)
+
+struct otree_node {
+	int leaf;
+	int cnt;
+	struct otree_node *next;
+	/* One spare slot, nodes are split after overflowing. */
+	struct okey *keys[OTREE_MAX + 1];
+	struct otree_node *children[];
+};
+
+struct otree {
+	struct otree_node *root;
+	uint64_t count;
+	uint64_t allocated;
+};
+
+static struct otree_node *_node_new(struct otree *otree, int leaf)
+{
+	unsigned size = sizeof(struct otree_node);
+	if (!leaf) {
+		size += sizeof(struct otree_node *) * (OTREE_MAX + 2);
+	}
+	struct otree_node *node = malloc(size);
+	memset(node, 0, size);
+	node->leaf = leaf;
+	otree->allocated += size;
+	return node;
+}
+
+static void _node_free(struct otree *otree, struct otree_node *node)
+{
+	unsigned size = sizeof(struct otree_node);
+	if (!node->leaf) {
+		size += sizeof(struct otree_node *) * (OTREE_MAX + 2);
+	}
+	otree->allocated -= size;
+	free(node);
+}
+
+static struct okey *_okey_new(struct otree *otree, uint128_t key_hash,
+			      const char *key, unsigned key_sz)
+{
+	struct okey *okey = malloc(sizeof(struct okey) + key_sz);
+	okey->key_hash = key_hash;
+	okey->key_sz = key_sz;
+	memcpy(okey->key, key, key_sz);
+	otree->allocated += sizeof(struct okey) + key_sz;
+	return okey;
+}
+
+static struct okey *_okey_dup(struct otree *otree, struct okey *okey)
+{
+	return _okey_new(otree, okey->key_hash, okey->key, okey->key_sz);
+}
+
+static void _okey_free(struct otree *otree, struct okey *okey)
+{
+	otree->allocated -= sizeof(struct okey) + okey->key_sz;
+	free(okey);
+}
+
+static int _cmp(const char *a, unsigned a_sz, struct okey *b)
+{
+	int r = memcmp(a, b->key, a_sz < b->key_sz ? a_sz : b->key_sz);
+	if (r) {
+		return r;
+	}
+	return (a_sz > b->key_sz) - (a_sz < b->key_sz);
+}
+
+/* First position with a key not smaller than 'key'. */
+static int _lower_bound(struct otree_node *node,
+			const char *key, unsigned key_sz)
+{
+	int lo = 0, hi = node->cnt;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (_cmp(key, key_sz, node->keys[mid]) > 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* First position with a key bigger than 'key'. */
+static int _upper_bound(struct otree_node *node,
+			const char *key, unsigned key_sz)
+{
+	int lo = 0, hi = node->cnt;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (_cmp(key, key_sz, node->keys[mid]) >= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+struct otree *otree_new()
+{
+	struct otree *otree = malloc(sizeof(struct otree));
+	memset(otree, 0, sizeof(struct otree));
+	otree->root = _node_new(otree, 1);
+	return otree;
+}
+
+static void _free_recursive(struct otree *otree, struct otree_node *node)
+{
+	int i;
+	for (i = 0; i < node->cnt; i++) {
+		_okey_free(otree, node->keys[i]);
+	}
+	if (!node->leaf) {
+		for (i = 0; i <= node->cnt; i++) {
+			_free_recursive(otree, node->children[i]);
+		}
+	}
+	_node_free(otree, node);
+}
+
+void otree_free(struct otree *otree)
+{
+	_free_recursive(otree, otree->root);
+	free(otree);
+}
+
+/* Returns the new right sibling if the node was split, in which case
+ * the separator is stored in 'sep_ptr'. */
+static struct otree_node *_insert(struct otree *otree, struct otree_node *node,
+				  uint128_t key_hash,
+				  const char *key, unsigned key_sz,
+				  struct okey **sep_ptr)
+{
+	int mid;
+	struct otree_node *right;
+	if (node->leaf) {
+		int i = _lower_bound(node, key, key_sz);
+		if (i < node->cnt && _cmp(key, key_sz, node->keys[i]) == 0) {
+			return NULL;
+		}
+		memmove(&node->keys[i+1], &node->keys[i],
+			sizeof(struct okey *) * (node->cnt - i));
+		node->keys[i] = _okey_new(otree, key_hash, key, key_sz);
+		node->cnt += 1;
+		otree->count += 1;
+		if (node->cnt <= OTREE_MAX) {
+			return NULL;
+		}
+
+		mid = node->cnt / 2;
+		right = _node_new(otree, 1);
+		right->cnt = node->cnt - mid;
+		memcpy(&right->keys[0], &node->keys[mid],
+		       sizeof(struct okey *) * right->cnt);
+		node->cnt = mid;
+		right->next = node->next;
+		node->next = right;
+		*sep_ptr = _okey_dup(otree, right->keys[0]);
+		return right;
+	}
+
+	int i = _upper_bound(node, key, key_sz);
+	struct okey *sep;
+	struct otree_node *child = _insert(otree, node->children[i],
+					   key_hash, key, key_sz, &sep);
+	if (child == NULL) {
+		return NULL;
+	}
+	memmove(&node->keys[i+1], &node->keys[i],
+		sizeof(struct okey *) * (node->cnt - i));
+	memmove(&node->children[i+2], &node->children[i+1],
+		sizeof(struct otree_node *) * (node->cnt - i));
+	node->keys[i] = sep;
+	node->children[i+1] = child;
+	node->cnt += 1;
+	if (node->cnt <= OTREE_MAX) {
+		return NULL;
+	}
+
+	/* The middle separator moves up. */
+	mid = node->cnt / 2;
+	right = _node_new(otree, 0);
+	right->cnt = node->cnt - mid - 1;
+	memcpy(&right->keys[0], &node->keys[mid+1],
+	       sizeof(struct okey *) * right->cnt);
+	memcpy(&right->children[0], &node->children[mid+1],
+	       sizeof(struct otree_node *) * (right->cnt + 1));
+	*sep_ptr = node->keys[mid];
+	node->cnt = mid;
+	return right;
+}
+
+void otree_insert(struct otree *otree, uint128_t key_hash,
+		  const char *key, unsigned key_sz)
+{
+	struct okey *sep;
+	struct otree_node *right = _insert(otree, otree->root,
+					   key_hash, key, key_sz, &sep);
+	if (right) {
+		struct otree_node *root = _node_new(otree, 0);
+		root->cnt = 1;
+		root->keys[0] = sep;
+		root->children[0] = otree->root;
+		root->children[1] = right;
+		otree->root = root;
+	}
+}
+
+static void _borrow_left(struct otree *otree, struct otree_node *parent, int i)
+{
+	struct otree_node *child = parent->children[i];
+	struct otree_node *left = parent->children[i-1];
+	memmove(&child->keys[1], &child->keys[0],
+		sizeof(struct okey *) * child->cnt);
+	if (child->leaf) {
+		child->keys[0] = left->keys[left->cnt-1];
+		_okey_free(otree, parent->keys[i-1]);
+		parent->keys[i-1] = _okey_dup(otree, child->keys[0]);
+	} else {
+		memmove(&child->children[1], &child->children[0],
+			sizeof(struct otree_node *) * (child->cnt + 1));
+		child->keys[0] = parent->keys[i-1];
+		child->children[0] = left->children[left->cnt];
+		parent->keys[i-1] = left->keys[left->cnt-1];
+	}
+	left->cnt -= 1;
+	child->cnt += 1;
+}
+
+static void _borrow_right(struct otree *otree, struct otree_node *parent, int i)
+{
+	struct otree_node *child = parent->children[i];
+	struct otree_node *right = parent->children[i+1];
+	if (child->leaf) {
+		child->keys[child->cnt] = right->keys[0];
+		memmove(&right->keys[0], &right->keys[1],
+			sizeof(struct okey *) * (right->cnt - 1));
+		_okey_free(otree, parent->keys[i]);
+		parent->keys[i] = _okey_dup(otree, right->keys[0]);
+	} else {
+		child->keys[child->cnt] = parent->keys[i];
+		child->children[child->cnt+1] = right->children[0];
+		parent->keys[i] = right->keys[0];
+		memmove(&right->keys[0], &right->keys[1],
+			sizeof(struct okey *) * (right->cnt - 1));
+		memmove(&right->children[0], &right->children[1],
+			sizeof(struct otree_node *) * right->cnt);
+	}
+	right->cnt -= 1;
+	child->cnt += 1;
+}
+
+/* Merge children i and i+1 of the parent. */
+static void _merge(struct otree *otree, struct otree_node *parent, int i)
+{
+	struct otree_node *left = parent->children[i];
+	struct otree_node *right = parent->children[i+1];
+	if (left->leaf) {
+		memcpy(&left->keys[left->cnt], &right->keys[0],
+		       sizeof(struct okey *) * right->cnt);
+		left->cnt += right->cnt;
+		left->next = right->next;
+		_okey_free(otree, parent->keys[i]);
+	} else {
+		left->keys[left->cnt] = parent->keys[i];
+		memcpy(&left->keys[left->cnt+1], &right->keys[0],
+		       sizeof(struct okey *) * right->cnt);
+		memcpy(&left->children[left->cnt+1], &right->children[0],
+		       sizeof(struct otree_node *) * (right->cnt + 1));
+		left->cnt += right->cnt + 1;
+	}
+	_node_free(otree, right);
+
+	memmove(&parent->keys[i], &parent->keys[i+1],
+		sizeof(struct okey *) * (parent->cnt - i - 1));
+	memmove(&parent->children[i+1], &parent->children[i+2],
+		sizeof(struct otree_node *) * (parent->cnt - i - 1));
+	parent->cnt -= 1;
+}
+
+static void _rebalance(struct otree *otree, struct otree_node *parent, int i)
+{
+	if (i > 0 && parent->children[i-1]->cnt > OTREE_MIN) {
+		_borrow_left(otree, parent, i);
+	} else if (i < parent->cnt && parent->children[i+1]->cnt > OTREE_MIN) {
+		_borrow_right(otree, parent, i);
+	} else if (i > 0) {
+		_merge(otree, parent, i-1);
+	} else {
+		_merge(otree, parent, i);
+	}
+}
+
+static int _delete(struct otree *otree, struct otree_node *node,
+		   const char *key, unsigned key_sz)
+{
+	if (node->leaf) {
+		int i = _lower_bound(node, key, key_sz);
+		if (i == node->cnt || _cmp(key, key_sz, node->keys[i]) != 0) {
+			return 0;
+		}
+		_okey_free(otree, node->keys[i]);
+		memmove(&node->keys[i], &node->keys[i+1],
+			sizeof(struct okey *) * (node->cnt - i - 1));
+		node->cnt -= 1;
+		otree->count -= 1;
+		return 1;
+	}
+
+	int i = _upper_bound(node, key, key_sz);
+	int r = _delete(otree, node->children[i], key, key_sz);
+	if (r && node->children[i]->cnt < OTREE_MIN) {
+		_rebalance(otree, node, i);
+	}
+	return r;
+}
+
+int otree_delete(struct otree *otree, const char *key, unsigned key_sz)
+{
+	int r = _delete(otree, otree->root, key, key_sz);
+	struct otree_node *root = otree->root;
+	if (!root->leaf && root->cnt == 0) {
+		otree->root = root->children[0];
+		_node_free(otree, root);
+	}
+	return r;
+}
+
+void otree_seek(struct otree *otree, const char *key, unsigned key_sz,
+		struct otree_cursor *cursor)
+{
+	struct otree_node *node = otree->root;
+	while (!node->leaf) {
+		int i = key ? _upper_bound(node, key, key_sz) : 0;
+		node = node->children[i];
+	}
+	cursor->leaf = node;
+	cursor->pos = key ? _lower_bound(node, key, key_sz) : 0;
+}
+
+struct okey *otree_next(struct otree_cursor *cursor)
+{
+	while (cursor->leaf && cursor->pos >= cursor->leaf->cnt) {
+		cursor->leaf = cursor->leaf->next;
+		cursor->pos = 0;
+	}
+	if (cursor->leaf == NULL) {
+		return NULL;
+	}
+	return cursor->leaf->keys[cursor->pos++];
+}
+
+uint64_t otree_count(struct otree *otree)
+{
+	return otree->count;
+}
+
+uint64_t otree_allocated(struct otree *otree)
+{
+	return otree->allocated;
+}
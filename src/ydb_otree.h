@@ -0,0 +1,32 @@
+/* Ordered index: an in-memory B+tree mapping keys to key hashes. */
+
+struct otree;
+
+struct okey {
+	uint128_t key_hash;
+	unsigned key_sz;
+	char key[];
+};
+
+struct otree_cursor {
+	struct otree_node *leaf;
+	int pos;
+};
+
+struct otree *otree_new();
+void otree_free(struct otree *otree);
+
+void otree_insert(struct otree *otree, uint128_t key_hash,
+		  const char *key, unsigned key_sz);
+int otree_delete(struct otree *otree, const char *key, unsigned key_sz);
+
+/* Position the cursor on the first key not smaller than 'key'. NULL
+ * key means the smallest key in the tree. */
+void otree_seek(struct otree *otree, const char *key, unsigned key_sz,
+		struct otree_cursor *cursor);
+/* Return the key under the cursor and advance, NULL at the end. Any
+ * modification of the tree invalidates cursors. */
+struct okey *otree_next(struct otree_cursor *cursor);
+
+uint64_t otree_count(struct otree *otree);
+uint64_t otree_allocated(struct otree *otree);
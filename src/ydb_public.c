@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <errno.h>
 #include <fnmatch.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,6 +30,7 @@
 #include "ydb_batch.h"
 #include "ydb_db.h"
 #include "ydb_sys.h"
+#include "ydb_stats.h"
 
 #include "ydb.h"
 #include "ydb_base.h"
@@ -58,7 +61,9 @@ static void _ydb_close(struct ydb *ydb, int msg)
 
 struct ydb *ydb_open(const char *directory, struct ydb_options *options)
 {
-	struct db *db = db_new(directory);
+	unsigned threads = options ? options->worker_threads : 0;
+	threads = threads == 0 ? 4 : threads < 64 ? threads : 64;
+	struct db *db = db_new(directory, threads);
 	if (db == NULL) {
 		return NULL;
 	}
@@ -80,6 +85,7 @@ struct ydb *ydb_open(const char *directory, struct ydb_options *options)
 
 	struct timeval tv0, tv1;
 	gettimeofday(&tv0, NULL);
+	uint64_t t0 = stats_now();
 
 	int r = base_load(ydb->base);
 	if (r != 0) {
@@ -87,10 +93,12 @@ struct ydb *ydb_open(const char *directory, struct ydb_options *options)
 		return NULL;
 	}
 	base_print_stats(ydb->base);
+	stats_phase(db_stats(db), STATS_OPEN_TOTAL, t0);
 	gettimeofday(&tv1, NULL);
 	log_info(db, "YDB loaded %llu items in %.3f seconds.",
 		 (unsigned long long)base->used_size.count,
 		 (float)TIMEVAL_MSEC_SUBTRACT(tv1, tv0) / 1000.);
+	base_print_open_phases(ydb->base);
 	return ydb;
 }
 
@@ -105,17 +113,146 @@ float ydb_ratio(struct ydb *ydb)
 	return base_ratio(ydb->base);
 }
 
+int ydb_set_dictionary(struct ydb *ydb, const char *dict, unsigned dict_sz)
+{
+	return base_set_dictionary(ydb->base, dict, dict_sz);
+}
+
+int ydb_train_dictionary(struct ydb *ydb, unsigned dict_sz)
+{
+	return base_train_dictionary(ydb->base, dict_sz);
+}
+
+void ydb_cache_stats(struct ydb *ydb,
+		     unsigned long long *hits_ptr,
+		     unsigned long long *misses_ptr)
+{
+	base_cache_stats(ydb->base, hits_ptr, misses_ptr);
+}
+
+void ydb_set_log_level(struct ydb *ydb, int level)
+{
+	if (level >= YDB_LOGLEVEL_ERROR && level <= YDB_LOGLEVEL_INFO) {
+		db_set_log_level(ydb->db, level);
+	}
+}
+
+void ydb_set_log_callback(struct ydb *ydb, ydb_log_callback callback,
+			  void *userdata)
+{
+	db_set_log_callback(ydb->db, callback, userdata);
+}
+
+void ydb_stats(struct ydb *ydb, struct ydb_stats *stats)
+{
+	base_stats(ydb->base, stats);
+}
+
+int ydb_stats_dump(struct ydb *ydb, int fd)
+{
+	return base_stats_dump(ydb->base, fd);
+}
+
 void ydb_prefetch(struct ydb *ydb,
 		  struct ydb_vec *keysv, unsigned keysv_cnt)
 {
-	base_prefetch(ydb->base, keysv, keysv_cnt);
+	base_prefetch(ydb->base, keysv, NULL, keysv_cnt);
+}
+
+static uint128_t _key_hash(const struct ydb_key_hash *hash)
+{
+	uint128_t key_hash;
+	memcpy(&key_hash, hash->md5, sizeof(key_hash));
+	return key_hash;
+}
+
+void ydb_hash_key(const char *key, unsigned key_sz,
+		  struct ydb_key_hash *hash)
+{
+	uint128_t key_hash = md5(key, key_sz);
+	memcpy(hash->md5, &key_hash, sizeof(hash->md5));
+}
+
+void ydb_prefetch_h(struct ydb *ydb, struct ydb_vec *keysv,
+		    const struct ydb_key_hash *hashes, unsigned keysv_cnt)
+{
+	uint128_t *key_hashes = malloc(sizeof(uint128_t) * keysv_cnt);
+	unsigned i;
+	for (i = 0; i < keysv_cnt; i++) {
+		key_hashes[i] = _key_hash(&hashes[i]);
+	}
+	base_prefetch(ydb->base, keysv, key_hashes, keysv_cnt);
+	free(key_hashes);
 }
 
 int ydb_get(struct ydb *ydb,
 	    const char *key, unsigned key_sz,
 	    char *buf, unsigned buf_sz)
 {
-	return base_get(ydb->base, key, key_sz, buf, buf_sz);
+	uint64_t t0 = stats_now();
+	int r = base_get(ydb->base, key, key_sz, buf, buf_sz);
+	stats_time(db_stats(ydb->db), STATS_GET, t0);
+	return r;
+}
+
+int ydb_get_h(struct ydb *ydb, const struct ydb_key_hash *hash,
+	      const char *key, unsigned key_sz,
+	      char *buf, unsigned buf_sz)
+{
+	uint64_t t0 = stats_now();
+	int r = base_get_h(ydb->base, _key_hash(hash), key, key_sz,
+			   buf, buf_sz);
+	stats_time(db_stats(ydb->db), STATS_GET, t0);
+	return r;
+}
+
+long long ydb_get_to_fd(struct ydb *ydb,
+			const char *key, unsigned key_sz, int fd)
+{
+	uint64_t t0 = stats_now();
+	struct value_sink sink = {fd, NULL, NULL};
+	long long r = base_get_stream(ydb->base, key, key_sz, &sink);
+	stats_time(db_stats(ydb->db), STATS_GET, t0);
+	return r;
+}
+
+long long ydb_get_chunked(struct ydb *ydb,
+			  const char *key, unsigned key_sz,
+			  ydb_value_callback callback, void *userdata)
+{
+	uint64_t t0 = stats_now();
+	struct value_sink sink = {-1, callback, userdata};
+	long long r = base_get_stream(ydb->base, key, key_sz, &sink);
+	stats_time(db_stats(ydb->db), STATS_GET, t0);
+	return r;
+}
+
+int ydb_get_async(struct ydb *ydb,
+		  const char *key, unsigned key_sz,
+		  ydb_get_callback callback, void *userdata)
+{
+	return base_get_async(ydb->base, key, key_sz, callback, userdata);
+}
+
+int ydb_fd(struct ydb *ydb)
+{
+	return db_completions_fd(ydb->db);
+}
+
+int ydb_process_events(struct ydb *ydb)
+{
+	return db_do_completions(ydb->db);
+}
+
+int ydb_poll(struct ydb *ydb, int timeout)
+{
+	struct pollfd pfd = {db_completions_fd(ydb->db), POLLIN, 0};
+	int r = poll(&pfd, 1, timeout);
+	if (r == -1 && errno != EINTR) {
+		log_perror(ydb->db, "poll()%s", "");
+		return -1;
+	}
+	return r > 0 ? db_do_completions(ydb->db) : 0;
 }
 
 
@@ -147,10 +284,28 @@ void ydb_del(struct ydb_batch *ybatch,
 	batch_del(batch, (char*)key, key_sz);
 }
 
+void ydb_set_h(struct ydb_batch *ybatch, const struct ydb_key_hash *hash,
+	       const char *key, unsigned key_sz,
+	       const char *value, unsigned value_sz)
+{
+	struct batch *batch = (struct batch *)ybatch;
+	batch_set_h(batch, _key_hash(hash), key, key_sz, value, value_sz);
+}
+
+void ydb_del_h(struct ydb_batch *ybatch, const struct ydb_key_hash *hash,
+	       const char *key, unsigned key_sz)
+{
+	struct batch *batch = (struct batch *)ybatch;
+	batch_del_h(batch, _key_hash(hash), key, key_sz);
+}
+
 int ydb_write(struct ydb *ydb, struct ydb_batch *ybatch, int do_fsync)
 {
+	uint64_t t0 = stats_now();
 	struct batch *batch = (struct batch *)ybatch;
-	return base_write(ydb->base, batch, do_fsync);
+	int r = base_write(ydb->base, batch, do_fsync);
+	stats_time(db_stats(ydb->db), STATS_WRITE, t0);
+	return r;
 }
 
 
@@ -160,8 +315,44 @@ int ydb_iterate(struct ydb *ydb, unsigned prefetch_size,
 	return base_iterate(ydb->base, prefetch_size, callback, userdata);
 }
 
+int ydb_range(struct ydb *ydb,
+	      const char *start, unsigned start_sz,
+	      const char *end, unsigned end_sz,
+	      unsigned prefetch_size,
+	      ydb_iter_callback callback, void *userdata)
+{
+	return base_range(ydb->base, start, start_sz, end, end_sz, NULL, 0,
+			  prefetch_size, callback, userdata);
+}
+
+int ydb_prefix_iterate(struct ydb *ydb,
+		       const char *prefix, unsigned prefix_sz,
+		       unsigned prefetch_size,
+		       ydb_iter_callback callback, void *userdata)
+{
+	return base_range(ydb->base, prefix, prefix_sz, NULL, 0,
+			  prefix, prefix_sz,
+			  prefetch_size, callback, userdata);
+}
+
+int ydb_iterate_parallel(struct ydb *ydb, unsigned threads,
+			 unsigned prefetch_size,
+			 ydb_iter_callback callback, void **userdata)
+{
+	return base_iterate_parallel(ydb->base, threads, prefetch_size,
+				     callback, userdata);
+}
+
 
 int ydb_roll(struct ydb *ydb, unsigned gc_size)
 {
-	return base_gc(ydb->base, gc_size);
+	uint64_t t0 = stats_now();
+	int r = base_gc(ydb->base, gc_size);
+	stats_time(db_stats(ydb->db), STATS_GC, t0);
+	return r;
+}
+
+int ydb_blob_gc(struct ydb *ydb)
+{
+	return base_blob_gc(ydb->base);
 }
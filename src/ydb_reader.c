@@ -9,15 +9,25 @@
 #include "ydb_common.h"
 #include "ydb_logging.h"
 #include "ydb_file.h"
+#include "ydb_db.h"
+#include "ydb_codec.h"
 #include "ydb_record.h"
+#include "ydb_block.h"
+#include "ydb_iobuf.h"
+#include "ydb_stats.h"
 #include "ydb_reader.h"
 
 struct reader {
 	struct db *db;
 	struct file *file;
+	struct file *direct;	/* NULL if direct reads are disabled */
+	int direct_gets;
 	char *filename;
+	uint64_t id;		/* Unique, identifies cached blocks */
 };
 
+static uint64_t reader_last_id;
+
 struct reader *reader_new(struct db *db, struct dir *dir, const char *filename)
 {
 	struct file *file = file_open_read(dir, filename);
@@ -29,13 +39,22 @@ struct reader *reader_new(struct db *db, struct dir *dir, const char *filename)
 	memset(reader, 0, sizeof(struct reader));
 	reader->db = db;
 	reader->file = file;
+	if (db_direct_io(db) != DIRECT_IO_OFF) {
+		reader->direct = file_open_direct(dir, filename);
+		reader->direct_gets = reader->direct &&
+			db_direct_io(db) == DIRECT_IO_ALL;
+	}
 	reader->filename = strdup(filename);
+	reader->id = __atomic_add_fetch(&reader_last_id, 1, __ATOMIC_RELAXED);
 	return reader;
 }
 
 void reader_free(struct reader *reader)
 {
 	file_close(reader->file);
+	if (reader->direct) {
+		file_close(reader->direct);
+	}
 	free(reader->filename);
 	free(reader);
 }
@@ -58,37 +77,238 @@ void _reader_log_error(struct reader *reader, int r, uint64_t offset)
 	};
 }
 
-int reader_read(struct reader *reader,
-		uint64_t offset,
-		char *buffer, unsigned buffer_sz,
-		struct keyvalue *kv)
+/* Read the aligned pages covering the range, 'buffer' needs to have
+ * READER_SCAN_BUF(size) bytes. */
+static char *_reader_pread_direct(struct reader *reader, uint64_t offset,
+				  uint64_t size, char *buffer)
+{
+	uint64_t start = offset & ~(uint64_t)(FILE_DIRECT_ALIGN - 1);
+	uint64_t end = (offset + size + FILE_DIRECT_ALIGN - 1) &
+		~(uint64_t)(FILE_DIRECT_ALIGN - 1);
+	int r = file_pread_direct(reader->direct, buffer, end - start, start);
+	if (r < 0 || (uint64_t)r < offset + size - start) {
+		if (r >= 0) {
+			log_error(reader->db, "%s#%llu short direct read",
+				  reader->filename,
+				  (unsigned long long)offset);
+		}
+		return NULL;
+	}
+	return buffer + (offset - start);
+}
+
+int reader_pread(struct reader *reader,
+		 uint64_t offset, char *buffer, unsigned buffer_sz)
 {
+	stats_add(db_stats(reader->db), STATS_BYTES_READ, buffer_sz);
+	if (reader->direct_gets) {
+		struct iobufs *iobufs = db_iobufs(reader->db);
+		uint64_t buf_sz = READER_SCAN_BUF((uint64_t)buffer_sz);
+		char *buf = iobuf_get(iobufs, buf_sz);
+		char *data = _reader_pread_direct(reader, offset, buffer_sz,
+						  buf);
+		if (data) {
+			memcpy(buffer, data, buffer_sz);
+		}
+		iobuf_put(iobufs, buf, buf_sz);
+		return data ? 0 : -1;
+	}
 	int r = file_pread(reader->file, buffer, buffer_sz, offset);
 	if (r == -1) {
 		return -1;
 	}
+	return 0;
+}
+
+char *reader_pread_scan(struct reader *reader, uint64_t offset,
+			uint64_t size, char *buffer)
+{
+	stats_add(db_stats(reader->db), STATS_BYTES_READ, size);
+	if (reader->direct) {
+		return _reader_pread_direct(reader, offset, size, buffer);
+	}
+	if (file_pread(reader->file, buffer, size, offset) == -1) {
+		return NULL;
+	}
+	return buffer;
+}
+
+int reader_scans_direct(struct reader *reader)
+{
+	return reader->direct != NULL;
+}
+
+static int _reader_block_find(struct reader *reader, uint64_t offset,
+			      struct block *block, uint128_t key_hash,
+			      struct keyvalue *kv)
+{
+	if (block_find(block, key_hash, kv) != 0) {
+		log_error(reader->db, "%s#%llu can't find key in the block",
+			  reader->filename, (unsigned long long)offset);
+		return -1;
+	}
+	return 0;
+}
+
+/* The buffer holds the beginning of the block record. */
+static int _reader_block(struct reader *reader,
+			 uint64_t offset, char *buffer, unsigned buffer_sz,
+			 uint128_t key_hash, struct keyvalue *kv)
+{
+	struct block_cache *bc = db_block_cache(reader->db);
+	struct block *block = block_cache_get(bc, reader->id, offset);
+	if (block) {
+		return _reader_block_find(reader, offset, block, key_hash, kv);
+	}
+
+	char *buf = NULL;
+	unsigned size = record_size(buffer, buffer_sz);
+	if (size > buffer_sz) {
+		/* The header isn't checked yet, it must not make us
+		 * allocate more than the file holds. */
+		uint64_t file_sz;
+		if (file_size(reader->file, &file_sz) != 0 ||
+		    offset + size > file_sz) {
+			_reader_log_error(reader, -2, offset);
+			return -1;
+		}
+		buf = malloc(size);
+		if (reader_pread(reader, offset, buf, size) != 0) {
+			free(buf);
+			return -1;
+		}
+		buffer = buf;
+		buffer_sz = size;
+	}
 	struct record rec;
-	r = record_unpack(buffer, buffer_sz, &rec);
+	int r = record_unpack(buffer, buffer_sz, &rec);
 	if (r < 0) {
 		_reader_log_error(reader, r, offset);
+		free(buf);
 		return -1;
 	}
+	block = block_load(bc, db_codec(reader->db), reader->id, offset, &rec);
+	free(buf);
+	if (block == NULL) {
+		log_error(reader->db, "%s#%llu can't decode the block",
+			  reader->filename, (unsigned long long)offset);
+		return -1;
+	}
+	return _reader_block_find(reader, offset, block, key_hash, kv);
+}
 
-	if (rec.magic != YDB_LOG_SET) {
+int reader_unpack(struct reader *reader,
+		  uint64_t offset, char *buffer, unsigned buffer_sz,
+		  uint128_t key_hash, struct keyvalue *kv)
+{
+	if (buffer_sz >= sizeof(uint32_t) &&
+	    *(uint32_t *)buffer == YDB_LOG_BLOCK) {
+		return _reader_block(reader, offset, buffer, buffer_sz,
+				     key_hash, kv);
+	}
+
+	struct record rec;
+	int r = record_unpack(buffer, buffer_sz, &rec);
+	if (r < 0) {
+		_reader_log_error(reader, r, offset);
+		return -1;
+	}
+
+	if (rec.magic == YDB_LOG_SETZ) {
+		struct codec *codec = db_codec(reader->db);
+		const char *value = codec ? codec_decompress(codec, rec.value,
+							     rec.value_sz) : NULL;
+		if (value == NULL) {
+			log_error(reader->db, "%s#%llu can't decompress value",
+				  reader->filename, (unsigned long long)offset);
+			return -1;
+		}
+		rec.value_sz = codec_raw_size(rec.value, rec.value_sz);
+		rec.value = value;
+	} else if (rec.magic != YDB_LOG_SET && rec.magic != YDB_LOG_BLOB) {
 		log_error(reader->db, "%s#%llu can't read record, it's not of type SET",
 			  reader->filename, (unsigned long long)offset);
 		return -1;
 	}
 	*kv = (struct keyvalue) {rec.key, rec.key_sz,
-				 rec.value, rec.value_sz};
+				 rec.value, rec.value_sz,
+				 rec.magic == YDB_LOG_BLOB};
 	return 0;
 }
 
+int reader_read(struct reader *reader,
+		uint64_t offset,
+		char *buffer, unsigned buffer_sz,
+		uint128_t key_hash, struct keyvalue *kv)
+{
+	struct block *block = block_cache_get(db_block_cache(reader->db),
+					      reader->id, offset);
+	if (block) {
+		return _reader_block_find(reader, offset, block, key_hash, kv);
+	}
+	int r = reader_pread(reader, offset, buffer, buffer_sz);
+	if (r == -1) {
+		return -1;
+	}
+	return reader_unpack(reader, offset, buffer, buffer_sz, key_hash, kv);
+}
+
+int reader_value_range(struct reader *reader,
+		       uint64_t offset, char *buffer, unsigned buffer_sz,
+		       struct keyvalue *kv, struct file_range *range)
+{
+	if (reader_pread(reader, offset, buffer, buffer_sz) != 0) {
+		return -1;
+	}
+	if (*(uint32_t *)buffer != YDB_LOG_SET) {
+		return 0;
+	}
+	struct record rec;
+	uint32_t value_sum;
+	int r = record_unpack_head(buffer, buffer_sz, &rec, &value_sum);
+	if (r < 0) {
+		_reader_log_error(reader, r, offset);
+		return -1;
+	}
+	*kv = (struct keyvalue){rec.key, rec.key_sz, NULL, rec.value_sz, 0};
+	*range = (struct file_range){reader->file, offset + r,
+				     rec.value_sz, value_sum};
+	return 1;
+}
+
 void reader_prefetch(struct reader *reader, uint64_t offset, uint64_t size)
 {
 	file_prefetch(reader->file, offset, size);
 }
 
+void reader_drop_cache(struct reader *reader, uint64_t offset, uint64_t size)
+{
+	file_drop_cache(reader->file, offset, size);
+}
+
+static int _reader_replay_block(struct reader *reader, struct record *rec,
+				uint64_t offset, unsigned size,
+				reader_replay_cb callback, void *context)
+{
+	struct block *block = block_load(db_block_cache(reader->db),
+					 db_codec(reader->db),
+					 reader->id, offset, rec);
+	if (block == NULL) {
+		log_error(reader->db, "%s#%llu can't decode the block",
+			  reader->filename, (unsigned long long)offset);
+		return -1;
+	}
+	unsigned i, cnt = block_count(block);
+	unsigned charge = block_charge(size, cnt);
+	for (i = 0; i < cnt; i++) {
+		struct keyvalue kv;
+		block_entry(block, i, &kv);
+		callback(context, YDB_LOG_SET, kv.key, kv.key_sz,
+			 offset, charge);
+	}
+	return 0;
+}
+
 int reader_replay(struct reader *reader, reader_replay_cb callback, void *context)
 {
 	uint64_t size = 0;
@@ -113,8 +333,16 @@ int reader_replay(struct reader *reader, reader_replay_cb callback, void *contex
 				  (float)(buf_end - buf) / (1024*1024.));
 			return -1;
 		}
-		callback(context, rec.magic, rec.key, rec.key_sz,
-			 buf - buf_start, r);
+		if (rec.magic == YDB_LOG_BLOCK) {
+			if (_reader_replay_block(reader, &rec, buf - buf_start,
+						 r, callback, context) != 0) {
+				file_munmap(reader->db, buf_start, size);
+				return -1;
+			}
+		} else {
+			callback(context, rec.magic, rec.key, rec.key_sz,
+				 buf - buf_start, r);
+		}
 		buf += r;
 		buf_last_good = buf;
 	}
@@ -1,12 +1,46 @@
 struct reader;
 
+/* Logs may be read bypassing the page cache, so that big scans don't
+ * evict the pages hot gets depend on. */
+enum direct_io {
+	DIRECT_IO_OFF = 0,
+	DIRECT_IO_SCANS,	/* Iteration and GC */
+	DIRECT_IO_ALL		/* Also gets */
+};
+
 struct reader *reader_new(struct db *db, struct dir *dir, const char *filename);
 void reader_free(struct reader *reader);
 int reader_read(struct reader *reader,
 		uint64_t offset,
 		char *buffer, unsigned buffer_sz,
-		struct keyvalue *kv);
+		uint128_t key_hash, struct keyvalue *kv);
+int reader_pread(struct reader *reader,
+		 uint64_t offset, char *buffer, unsigned buffer_sz);
+/* Read a part of the file for a scan into a buffer from iobuf_get()
+ * of at least READER_SCAN_BUF(size) bytes, directly if enabled.
+ * Returns a pointer to the data in the buffer or NULL on error. */
+#define READER_SCAN_BUF(size) ((size) + 2 * FILE_DIRECT_ALIGN)
+char *reader_pread_scan(struct reader *reader, uint64_t offset,
+			uint64_t size, char *buffer);
+/* Scans read directly, page cache hints would be wasted. */
+int reader_scans_direct(struct reader *reader);
+/* Compressed values are unpacked into a per-thread buffer and block
+ * records into the block cache, in such case kv is valid until the
+ * next call from the same thread. 'key_hash' selects the item from a
+ * block, the buffer needs to hold only the beginning of a block. */
+int reader_unpack(struct reader *reader,
+		  uint64_t offset, char *buffer, unsigned buffer_sz,
+		  uint128_t key_hash, struct keyvalue *kv);
+/* Read the head of a plain SET record into the buffer and find where
+ * its value is in the file. Returns 1 if the range is found, 0 if the
+ * record isn't a plain SET, negative on error. Only the key is set in
+ * kv. */
+struct file_range;
+int reader_value_range(struct reader *reader,
+		       uint64_t offset, char *buffer, unsigned buffer_sz,
+		       struct keyvalue *kv, struct file_range *range);
 void reader_prefetch(struct reader *reader, uint64_t offset, uint64_t size);
+void reader_drop_cache(struct reader *reader, uint64_t offset, uint64_t size);
 
 typedef void (*reader_replay_cb)(void *context,
 				 uint32_t magic,
@@ -74,7 +74,9 @@ int record_unpack(char *buffer, unsigned buffer_sz, struct record *record_ptr)
 	if (buffer_sz < sizeof(uint32_t)) {
 		return -2;
 	}
-	if (header->magic != YDB_LOG_SET && header->magic != YDB_LOG_DEL) {
+	if (header->magic != YDB_LOG_SET && header->magic != YDB_LOG_DEL &&
+	    header->magic != YDB_LOG_SETZ && header->magic != YDB_LOG_BLOCK &&
+	    header->magic != YDB_LOG_BLOB) {
 		return -1;
 	}
 
@@ -110,3 +112,38 @@ int record_unpack(char *buffer, unsigned buffer_sz, struct record *record_ptr)
 	__builtin_prefetch(b);
 	return b - buffer;
 }
+
+/* Size of the record on disk, 0 if the header is incomplete. */
+unsigned record_size(char *buffer, unsigned buffer_sz)
+{
+	struct _header *header = (struct _header *)buffer;
+	if (buffer_sz < sizeof(struct _header)) {
+		return 0;
+	}
+	unsigned sz = sizeof(struct _header) + header->key_sz + header->value_sz;
+	return sz + LOG_PADDING(sz);
+}
+
+int record_unpack_head(char *buffer, unsigned buffer_sz,
+		       struct record *record_ptr, uint32_t *value_sum_ptr)
+{
+	struct _header *header = (struct _header *)buffer;
+	if (buffer_sz < sizeof(struct _header) ||
+	    buffer_sz < sizeof(struct _header) + header->key_sz) {
+		return -2;
+	}
+	if (header->magic != YDB_LOG_SET && header->magic != YDB_LOG_DEL &&
+	    header->magic != YDB_LOG_SETZ && header->magic != YDB_LOG_BLOCK &&
+	    header->magic != YDB_LOG_BLOB) {
+		return -1;
+	}
+	char *key = buffer + sizeof(struct _header);
+	if (adler32(key, header->key_sz) != header->key_sum) {
+		return -3;
+	}
+	*record_ptr = (struct record) {header->magic,
+				       key, header->key_sz,
+				       NULL, header->value_sz};
+	*value_sum_ptr = header->value_sum;
+	return sizeof(struct _header) + header->key_sz;
+}
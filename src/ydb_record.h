@@ -1,5 +1,11 @@
 #define YDB_LOG_SET (0xADD0BEEF)
 #define YDB_LOG_DEL (0xDE70BEEF)
+/* Like SET, but the value is a compressed frame, see ydb_codec.h */
+#define YDB_LOG_SETZ (0xADD1BEEF)
+/* Many SET records packed together, see ydb_block.h */
+#define YDB_LOG_BLOCK (0xB10CBEEF)
+/* Like SET, but the value is a struct blob_ref, see ydb_blob.h */
+#define YDB_LOG_BLOB (0xB10BBEEF)
 
 struct record {
 	uint32_t magic;
@@ -12,3 +18,10 @@ struct record {
 struct iovec record_pack(struct record record);
 struct record record_unpack_force(struct iovec slot);
 int record_unpack(char *buffer, unsigned buffer_sz, struct record *record_ptr);
+unsigned record_size(char *buffer, unsigned buffer_sz);
+/* Like record_unpack(), but only the header and the key need to be in
+ * the buffer. The value isn't verified, record_ptr->value is NULL and
+ * its checksum is stored in 'value_sum_ptr'. Returns the offset of
+ * the value in the record. */
+int record_unpack_head(char *buffer, unsigned buffer_sz,
+		       struct record *record_ptr, uint32_t *value_sum_ptr);
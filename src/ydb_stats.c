@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ydb.h"
+#include "ydb_stats.h"
+
+/* Values below 2 * SUB get a bucket each, above every power of two
+ * is split into SUB buckets. */
+#define SUB_BITS 4
+#define SUB (1 << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB)
+
+struct hist {
+	uint64_t total;
+	uint64_t max;
+	uint64_t buckets[BUCKETS];
+};
+
+struct stats {
+	struct hist hist[STATS_OPS];
+	uint64_t counters[STATS_COUNTERS];
+	uint64_t phases[STATS_PHASES];
+};
+
+static const char *op_names[STATS_OPS] = {
+	[STATS_GET] = "get",
+	[STATS_WRITE] = "write",
+	[STATS_FSYNC] = "fsync",
+	[STATS_GC] = "gc",
+	[STATS_SNAPSHOT] = "snapshot",
+	[STATS_INDEX_SAVE] = "index_save",
+	[STATS_REPLAY] = "replay",
+};
+
+static const char *phase_names[STATS_PHASES] = {
+	[STATS_OPEN_TOTAL] = "total",
+	[STATS_OPEN_SNAPSHOT] = "snapshot",
+	[STATS_OPEN_INDEX_LOAD] = "index_load",
+	[STATS_OPEN_INDEX_COPY] = "index_copy",
+	[STATS_OPEN_INDEX_BUILD] = "index_build",
+	[STATS_OPEN_REPLAY] = "replay",
+	[STATS_OPEN_COLD] = "cold",
+	[STATS_OPEN_FILTER] = "filter",
+	[STATS_OPEN_ORDERED] = "ordered_index",
+};
+
+struct stats *stats_new()
+{
+	struct stats *stats = malloc(sizeof(struct stats));
+	memset(stats, 0, sizeof(struct stats));
+	return stats;
+}
+
+void stats_free(struct stats *stats)
+{
+	free(stats);
+}
+
+uint64_t stats_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned _bucket(uint64_t v)
+{
+	if (v < 2 * SUB) {
+		return v;
+	}
+	unsigned shift = 63 - __builtin_clzll(v) - SUB_BITS;
+	return shift * SUB + (v >> shift);
+}
+
+/* Highest value that goes to the bucket. */
+static uint64_t _bucket_high(unsigned b)
+{
+	if (b < 2 * SUB) {
+		return b;
+	}
+	unsigned shift = b / SUB - 1;
+	uint64_t m = b - shift * SUB;
+	return ((m + 1) << shift) - 1;
+}
+
+void stats_time(struct stats *stats, enum stats_op op, uint64_t start)
+{
+	uint64_t now = stats_now();
+	uint64_t v = now > start ? now - start : 0;
+	struct hist *hist = &stats->hist[op];
+	__atomic_add_fetch(&hist->buckets[_bucket(v)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->total, v, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	while (v > max &&
+	       !__atomic_compare_exchange_n(&hist->max, &max, v, 1,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED)) {
+	}
+}
+
+void stats_add(struct stats *stats, enum stats_counter counter,
+	       uint64_t value)
+{
+	__atomic_add_fetch(&stats->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void stats_phase_add(struct stats *stats, enum stats_phase phase,
+		     uint64_t ns)
+{
+	__atomic_add_fetch(&stats->phases[phase], ns, __ATOMIC_RELAXED);
+}
+
+void stats_phase(struct stats *stats, enum stats_phase phase, uint64_t start)
+{
+	uint64_t now = stats_now();
+	stats_phase_add(stats, phase, now > start ? now - start : 0);
+}
+
+void stats_latency(struct stats *stats, enum stats_op op,
+		   struct ydb_latency *latency)
+{
+	struct hist *hist = &stats->hist[op];
+	static const double q[4] = {0.5, 0.9, 0.99, 0.999};
+	unsigned long long *p[4] = {&latency->p50_ns, &latency->p90_ns,
+				    &latency->p99_ns, &latency->p999_ns};
+	uint64_t buckets[BUCKETS];
+	uint64_t count = 0;
+	unsigned b;
+	for (b = 0; b < BUCKETS; b++) {
+		buckets[b] = __atomic_load_n(&hist->buckets[b],
+					     __ATOMIC_RELAXED);
+		count += buckets[b];
+	}
+	memset(latency, 0, sizeof(struct ydb_latency));
+	latency->count = count;
+	latency->total_ns = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+	latency->max_ns = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+	uint64_t seen = 0;
+	unsigned i = 0;
+	for (b = 0; b < BUCKETS && i < 4; b++) {
+		seen += buckets[b];
+		while (i < 4 && seen && seen >= q[i] * count) {
+			uint64_t high = _bucket_high(b);
+			*p[i++] = high < latency->max_ns ? high : latency->max_ns;
+		}
+	}
+}
+
+uint64_t stats_counter(struct stats *stats, enum stats_counter counter)
+{
+	return __atomic_load_n(&stats->counters[counter], __ATOMIC_RELAXED);
+}
+
+const char *stats_op_name(enum stats_op op)
+{
+	return op_names[op];
+}
+
+uint64_t stats_phase_ns(struct stats *stats, enum stats_phase phase)
+{
+	return __atomic_load_n(&stats->phases[phase], __ATOMIC_RELAXED);
+}
+
+const char *stats_phase_name(enum stats_phase phase)
+{
+	return phase_names[phase];
+}
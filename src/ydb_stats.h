@@ -0,0 +1,61 @@
+/* Operation latencies and counters, cheap enough to be always on and
+ * safe to update from any thread. Latencies go to log-linear
+ * histograms: 16 buckets for every power of two of nanoseconds, so
+ * percentiles are within about 6% of the recorded values. */
+
+struct stats;
+struct ydb_latency;
+
+enum stats_op {
+	STATS_GET = 0,
+	STATS_WRITE,
+	STATS_FSYNC,
+	STATS_GC,
+	STATS_SNAPSHOT,
+	STATS_INDEX_SAVE,
+	STATS_REPLAY,
+	STATS_OPS
+};
+
+/* Phases of opening a database, accumulated in nanoseconds. */
+enum stats_phase {
+	STATS_OPEN_TOTAL = 0,
+	STATS_OPEN_SNAPSHOT,
+	STATS_OPEN_INDEX_LOAD,
+	STATS_OPEN_INDEX_COPY,
+	STATS_OPEN_INDEX_BUILD,
+	STATS_OPEN_REPLAY,
+	STATS_OPEN_COLD,
+	STATS_OPEN_FILTER,
+	STATS_OPEN_ORDERED,
+	STATS_PHASES
+};
+
+enum stats_counter {
+	STATS_BYTES_READ = 0,
+	STATS_BYTES_WRITTEN,
+	STATS_INDEX_COPY_NS,	/* Copying index files to .idx.dirty */
+	STATS_COUNTERS
+};
+
+struct stats *stats_new();
+void stats_free(struct stats *stats);
+
+/* Monotonic clock in nanoseconds. */
+uint64_t stats_now();
+/* Record an operation of type 'op' started at 'start', a value from
+ * stats_now(). */
+void stats_time(struct stats *stats, enum stats_op op, uint64_t start);
+void stats_add(struct stats *stats, enum stats_counter counter,
+	       uint64_t value);
+/* Add the time since 'start' to a phase. */
+void stats_phase(struct stats *stats, enum stats_phase phase, uint64_t start);
+void stats_phase_add(struct stats *stats, enum stats_phase phase,
+		     uint64_t ns);
+
+void stats_latency(struct stats *stats, enum stats_op op,
+		   struct ydb_latency *latency);
+uint64_t stats_counter(struct stats *stats, enum stats_counter counter);
+const char *stats_op_name(enum stats_op op);
+uint64_t stats_phase_ns(struct stats *stats, enum stats_phase phase);
+const char *stats_phase_name(enum stats_phase phase);
@@ -0,0 +1,188 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ydb_common.h"
+#include "ydb_vcache.h"
+
+/* Accounted on top of the value size. */
+#define ENTRY_OVERHEAD (sizeof(struct ventry) + 2 * sizeof(void *))
+
+struct ventry {
+	uint128_t key_hash;
+	struct ventry *next;	/* Bucket chain */
+	unsigned clock_pos;
+	unsigned value_sz;
+	int referenced;
+	char value[];
+};
+
+struct vcache {
+	uint64_t budget;
+	uint64_t used;
+
+	struct ventry **buckets;
+	unsigned buckets_cnt;	/* Power of two */
+
+	struct ventry **clock;
+	unsigned clock_cnt;
+	unsigned clock_sz;
+	unsigned hand;
+
+	uint64_t hits;
+	uint64_t misses;
+};
+
+struct vcache *vcache_new(uint64_t budget)
+{
+	struct vcache *vc = malloc(sizeof(struct vcache));
+	memset(vc, 0, sizeof(struct vcache));
+	vc->budget = budget;
+	vc->buckets_cnt = 1024;
+	vc->buckets = calloc(vc->buckets_cnt, sizeof(struct ventry *));
+	vc->clock_sz = 1024;
+	vc->clock = malloc(sizeof(struct ventry *) * vc->clock_sz);
+	return vc;
+}
+
+void vcache_free(struct vcache *vc)
+{
+	unsigned i;
+	for (i = 0; i < vc->clock_cnt; i++) {
+		free(vc->clock[i]);
+	}
+	free(vc->clock);
+	free(vc->buckets);
+	free(vc);
+}
+
+static struct ventry **_bucket(struct vcache *vc, uint128_t key_hash)
+{
+	return &vc->buckets[(uint64_t)key_hash & (vc->buckets_cnt - 1)];
+}
+
+static struct ventry **_find(struct vcache *vc, uint128_t key_hash)
+{
+	struct ventry **e = _bucket(vc, key_hash);
+	while (*e && (*e)->key_hash != key_hash) {
+		e = &(*e)->next;
+	}
+	return e;
+}
+
+static void _grow_buckets(struct vcache *vc)
+{
+	unsigned old_cnt = vc->buckets_cnt;
+	struct ventry **old = vc->buckets;
+	vc->buckets_cnt *= 2;
+	vc->buckets = calloc(vc->buckets_cnt, sizeof(struct ventry *));
+	unsigned i;
+	for (i = 0; i < old_cnt; i++) {
+		struct ventry *e = old[i];
+		while (e) {
+			struct ventry *next = e->next;
+			struct ventry **b = _bucket(vc, e->key_hash);
+			e->next = *b;
+			*b = e;
+			e = next;
+		}
+	}
+	free(old);
+}
+
+/* Unlink from the bucket chain 'link' points into and from the clock. */
+static void _remove(struct vcache *vc, struct ventry **link)
+{
+	struct ventry *e = *link;
+	*link = e->next;
+
+	struct ventry *last = vc->clock[--vc->clock_cnt];
+	vc->clock[e->clock_pos] = last;
+	last->clock_pos = e->clock_pos;
+	if (vc->hand >= vc->clock_cnt) {
+		vc->hand = 0;
+	}
+	vc->used -= e->value_sz + ENTRY_OVERHEAD;
+	free(e);
+}
+
+static void _evict_one(struct vcache *vc)
+{
+	while (1) {
+		struct ventry *e = vc->clock[vc->hand];
+		if (!e->referenced) {
+			_remove(vc, _find(vc, e->key_hash));
+			return;
+		}
+		e->referenced = 0;
+		vc->hand = (vc->hand + 1) % vc->clock_cnt;
+	}
+}
+
+const char *vcache_get(struct vcache *vc, uint128_t key_hash,
+		       unsigned *value_sz_ptr)
+{
+	struct ventry *e = *_find(vc, key_hash);
+	if (e == NULL) {
+		vc->misses += 1;
+		return NULL;
+	}
+	vc->hits += 1;
+	e->referenced = 1;
+	*value_sz_ptr = e->value_sz;
+	return e->value;
+}
+
+void vcache_add(struct vcache *vc, uint128_t key_hash,
+		const char *value, unsigned value_sz)
+{
+	uint64_t need = value_sz + ENTRY_OVERHEAD;
+	/* Don't let a single value flush a big part of the cache. */
+	if (need > vc->budget / 8) {
+		return;
+	}
+	vcache_del(vc, key_hash);
+	while (vc->used + need > vc->budget) {
+		_evict_one(vc);
+	}
+
+	struct ventry *e = malloc(sizeof(struct ventry) + value_sz);
+	e->key_hash = key_hash;
+	e->value_sz = value_sz;
+	e->referenced = 0;
+	memcpy(e->value, value, value_sz);
+
+	if (vc->clock_cnt == vc->clock_sz) {
+		vc->clock_sz *= 2;
+		vc->clock = realloc(vc->clock,
+				    sizeof(struct ventry *) * vc->clock_sz);
+	}
+	if (vc->clock_cnt >= vc->buckets_cnt) {
+		_grow_buckets(vc);
+	}
+	e->clock_pos = vc->clock_cnt;
+	vc->clock[vc->clock_cnt++] = e;
+	struct ventry **b = _bucket(vc, key_hash);
+	e->next = *b;
+	*b = e;
+	vc->used += need;
+}
+
+void vcache_del(struct vcache *vc, uint128_t key_hash)
+{
+	struct ventry **link = _find(vc, key_hash);
+	if (*link) {
+		_remove(vc, link);
+	}
+}
+
+void vcache_stats(struct vcache *vc, uint64_t *hits_ptr, uint64_t *misses_ptr,
+		  uint64_t *used_ptr, uint64_t *count_ptr)
+{
+	*hits_ptr = vc->hits;
+	*misses_ptr = vc->misses;
+	*used_ptr = vc->used;
+	*count_ptr = vc->clock_cnt;
+}
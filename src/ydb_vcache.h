@@ -0,0 +1,19 @@
+/* Value cache: recently read values keyed by key hash, evicted with
+ * CLOCK once the byte budget is exceeded. Values don't change when
+ * items move between hashdir positions or logs, so only writes and
+ * deletes need to invalidate entries. Single threaded. */
+
+struct vcache;
+
+struct vcache *vcache_new(uint64_t budget);
+void vcache_free(struct vcache *vc);
+
+/* Returns the cached value or NULL, counts hits and misses. */
+const char *vcache_get(struct vcache *vc, uint128_t key_hash,
+		       unsigned *value_sz_ptr);
+void vcache_add(struct vcache *vc, uint128_t key_hash,
+		const char *value, unsigned value_sz);
+void vcache_del(struct vcache *vc, uint128_t key_hash);
+
+void vcache_stats(struct vcache *vc, uint64_t *hits_ptr, uint64_t *misses_ptr,
+		  uint64_t *used_ptr, uint64_t *count_ptr);
@@ -5,7 +5,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "queue.h"
@@ -14,6 +16,10 @@
 #include "ydb_logging.h"
 #include "ydb_worker.h"
 
+/* A pool of threads. Tasks are spread over per-thread queues, one per
+ * priority, an idle thread steals from the others. A thread always
+ * takes the most urgent task it can find, so a long index flush keeps
+ * one thread busy but doesn't hold back the reads queued behind it. */
 
 struct task {
 	struct queue_head head;
@@ -21,117 +27,326 @@ struct task {
 	void *userdata;
 };
 
+struct worker_thread {
+	struct worker *worker;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	struct queue_root tasks[TASK_PRIORITIES];
+};
+
 struct worker {
 	struct db *db;
-	pthread_t thread;
+	unsigned threads_cnt;
+	struct worker_thread *threads;
+	unsigned next_thread;	/* Round robin for new tasks */
 
+	/* Protects everything below. */
 	pthread_mutex_t mutex;
-	pthread_cond_t empty_cond;
 	pthread_cond_t full_cond;
+	pthread_cond_t empty_cond;
+	unsigned queued;
+	unsigned running;
+	int stop;
 
-	struct queue_root tasks;
+	struct queue_root free_tasks;
+	unsigned free_tasks_cnt;
+
+	/* Internal answers and completions of the user's requests. */
 	struct queue_root answers;
+	struct queue_root completions;
+	int answers_fd;		/* Readable when there's either */
 };
 
+/* Spare tasks kept for reuse. */
+#define FREE_TASKS_MAX 1024
+
+
+static struct task *_task_get(struct worker *worker,
+			      task_callback callback, void *userdata)
+{
+	pthread_mutex_lock(&worker->mutex);
+	struct queue_head *head = queue_get(&worker->free_tasks);
+	if (head) {
+		worker->free_tasks_cnt -= 1;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	struct task *task = head ? container_of(head, struct task, head) :
+		malloc(sizeof(struct task));
+	memset(task, 0, sizeof(struct task));
+	task->callback = callback;
+	task->userdata = userdata;
+	return task;
+}
+
+/* Called with worker->mutex held. */
+static void _task_put(struct worker *worker, struct task *task)
+{
+	if (worker->free_tasks_cnt < FREE_TASKS_MAX) {
+		queue_put(&task->head, &worker->free_tasks);
+		worker->free_tasks_cnt += 1;
+	} else {
+		free(task);
+	}
+}
+
+static struct task *_task_steal(struct worker *worker, unsigned self)
+{
+	int prio;
+	for (prio = 0; prio < TASK_PRIORITIES; prio++) {
+		unsigned i;
+		for (i = 0; i < worker->threads_cnt; i++) {
+			struct worker_thread *wt =
+				&worker->threads[(self + i) % worker->threads_cnt];
+			if (queue_empty(&wt->tasks[prio])) {
+				continue; /* Racy peek, rechecked below. */
+			}
+			pthread_mutex_lock(&wt->mutex);
+			struct queue_head *head = queue_get(&wt->tasks[prio]);
+			pthread_mutex_unlock(&wt->mutex);
+			if (head) {
+				return container_of(head, struct task, head);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void _worker_thread(struct worker_thread *wt)
+{
+	struct worker *worker = wt->worker;
+	unsigned self = wt - worker->threads;
+	while (1) {
+		struct task *task = _task_steal(worker, self);
+
+		pthread_mutex_lock(&worker->mutex);
+		if (task == NULL) {
+			if (worker->queued == 0) {
+				if (worker->stop) {
+					pthread_mutex_unlock(&worker->mutex);
+					return;
+				}
+				pthread_cond_wait(&worker->full_cond,
+						  &worker->mutex);
+			}
+			/* Or a task is being queued right now. */
+			pthread_mutex_unlock(&worker->mutex);
+			continue;
+		}
+		worker->queued -= 1;
+		worker->running += 1;
+		pthread_mutex_unlock(&worker->mutex);
 
-static void _worker_thread(struct worker *worker);
+		task->callback(task->userdata);
 
-static void *_thread(void *worker_p) {
-	struct worker *worker = worker_p;
-	_worker_thread(worker);
+		pthread_mutex_lock(&worker->mutex);
+		worker->running -= 1;
+		_task_put(worker, task);
+		if (worker->queued == 0 && worker->running == 0) {
+			pthread_cond_broadcast(&worker->empty_cond);
+		}
+		pthread_mutex_unlock(&worker->mutex);
+	}
+}
+
+static void *_thread(void *wt_p) {
+	struct worker_thread *wt = wt_p;
+	_worker_thread(wt);
 	return NULL;
 }
 
-struct worker *worker_new(struct db *db)
+static void _worker_stop(struct worker *worker, unsigned started)
+{
+	pthread_mutex_lock(&worker->mutex);
+	worker->stop = 1;
+	pthread_cond_broadcast(&worker->full_cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	unsigned i;
+	for (i = 0; i < started; i++) {
+		int r = pthread_join(worker->threads[i].thread, NULL);
+		if (r) {
+			errno = r;
+			log_perror(worker->db, "pthread_join()%s", "");
+		}
+	}
+	for (i = 0; i < worker->threads_cnt; i++) {
+		pthread_mutex_destroy(&worker->threads[i].mutex);
+	}
+	queue_splice(&worker->answers, &worker->free_tasks);
+	queue_splice(&worker->completions, &worker->free_tasks);
+	while (!queue_empty(&worker->free_tasks)) {
+		free(container_of(queue_get(&worker->free_tasks),
+				  struct task, head));
+	}
+	pthread_mutex_destroy(&worker->mutex);
+	pthread_cond_destroy(&worker->full_cond);
+	pthread_cond_destroy(&worker->empty_cond);
+	close(worker->answers_fd);
+	free(worker->threads);
+	free(worker);
+}
+
+struct worker *worker_new(struct db *db, unsigned threads)
 {
 	struct worker *worker = malloc(sizeof(struct worker));
 	memset(worker, 0, sizeof(struct worker));
 	worker->db = db;
-	INIT_QUEUE_ROOT(&worker->tasks);
+	INIT_QUEUE_ROOT(&worker->free_tasks);
 	INIT_QUEUE_ROOT(&worker->answers);
+	INIT_QUEUE_ROOT(&worker->completions);
+
+	worker->answers_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (worker->answers_fd == -1) {
+		log_perror(worker->db, "eventfd()%s", "");
+		free(worker);
+		return NULL;
+	}
 
 	pthread_mutex_init(&worker->mutex, NULL);
 	pthread_cond_init(&worker->full_cond, NULL);
 	pthread_cond_init(&worker->empty_cond, NULL);
 
+	worker->threads_cnt = threads ? threads : 1;
+	worker->threads = calloc(worker->threads_cnt,
+				 sizeof(struct worker_thread));
+	unsigned i;
+	for (i = 0; i < worker->threads_cnt; i++) {
+		struct worker_thread *wt = &worker->threads[i];
+		wt->worker = worker;
+		pthread_mutex_init(&wt->mutex, NULL);
+		int prio;
+		for (prio = 0; prio < TASK_PRIORITIES; prio++) {
+			INIT_QUEUE_ROOT(&wt->tasks[prio]);
+		}
+	}
+
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-	int r = pthread_create(&worker->thread, &attr, _thread, worker);
-	pthread_attr_destroy(&attr);
-	if (r != 0) {
-		errno = r;
-		log_perror(worker->db, "pthread_create()%s", "");
-		pthread_mutex_destroy(&worker->mutex);
-		pthread_cond_destroy(&worker->full_cond);
-		pthread_cond_destroy(&worker->empty_cond);
-		free(worker);
-		return NULL;
+	for (i = 0; i < worker->threads_cnt; i++) {
+		int r = pthread_create(&worker->threads[i].thread, &attr,
+				       _thread, &worker->threads[i]);
+		if (r != 0) {
+			errno = r;
+			log_perror(worker->db, "pthread_create()%s", "");
+			pthread_attr_destroy(&attr);
+			_worker_stop(worker, i);
+			return NULL;
+		}
 	}
+	pthread_attr_destroy(&attr);
 	return worker;
 }
 
-void worker_new_task(struct worker *worker,
+void worker_new_task(struct worker *worker, enum task_priority prio,
 		     task_callback callback, void *userdata)
 {
-	struct task *task = malloc(sizeof(struct task));
-	memset(task, 0, sizeof(struct task));
-	task->callback = callback;
-	task->userdata = userdata;
+	assert(prio < TASK_PRIORITIES);
+	struct task *task = _task_get(worker, callback, userdata);
+
+	unsigned n = __atomic_fetch_add(&worker->next_thread, 1,
+					__ATOMIC_RELAXED);
+	struct worker_thread *wt = &worker->threads[n % worker->threads_cnt];
+	pthread_mutex_lock(&wt->mutex);
+	queue_put(&task->head, &wt->tasks[prio]);
+	pthread_mutex_unlock(&wt->mutex);
 
 	pthread_mutex_lock(&worker->mutex);
-	int r = queue_put(&task->head, &worker->tasks);
-	if (r) {		/* was empty */
-		pthread_cond_signal(&worker->full_cond);
-	}
+	worker->queued += 1;
+	pthread_cond_signal(&worker->full_cond);
 	pthread_mutex_unlock(&worker->mutex);
 }
 
-static void _worker_thread(struct worker *worker)
+struct parallel {
+	parallel_callback callback;
+	void *userdata;
+	unsigned cnt;
+	unsigned next;
+	int refs;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t done_cond;
+	unsigned done;
+};
+
+static void _parallel_unref(struct parallel *p)
+{
+	if (__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		pthread_mutex_destroy(&p->mutex);
+		pthread_cond_destroy(&p->done_cond);
+		free(p);
+	}
+}
+
+static void _parallel_run(struct parallel *p)
 {
 	while (1) {
-		pthread_mutex_lock(&worker->mutex);
-		if (queue_empty(&worker->tasks)) {
-			pthread_cond_signal(&worker->empty_cond);
-			pthread_cond_wait(&worker->full_cond,
-					  &worker->mutex);
+		unsigned i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED);
+		if (i >= p->cnt) {
+			break;
 		}
-		struct queue_head *head = queue_get(&worker->tasks);
-		pthread_mutex_unlock(&worker->mutex);
-		if (head == NULL) {
-			continue;
+		p->callback(p->userdata, i);
+
+		pthread_mutex_lock(&p->mutex);
+		p->done += 1;
+		if (p->done == p->cnt) {
+			pthread_cond_signal(&p->done_cond);
 		}
-		struct task *task = container_of(head, struct task, head);
-		struct task t = *task;
-		free(task);
-		t.callback(t.userdata);
+		pthread_mutex_unlock(&p->mutex);
 	}
 }
 
-static void _thread_exit_job(void *ud)
+static void _parallel_task(void *p_p)
 {
-	ud = ud;
-	pthread_exit(NULL);
+	struct parallel *p = p_p;
+	_parallel_run(p);
+	_parallel_unref(p);
 }
 
-void worker_free(struct worker *worker)
+void worker_parallel(struct worker *worker, enum task_priority prio,
+		     parallel_callback callback, void *userdata,
+		     unsigned cnt)
 {
-	worker_new_task(worker, _thread_exit_job, NULL);
-	int r = pthread_join(worker->thread, NULL);
-	if (r) {
-		errno = r;
-		log_perror(worker->db, "pthread_join()%s", "");
+	if (cnt == 0) {
+		return;
 	}
-	pthread_mutex_destroy(&worker->mutex);
-	pthread_cond_destroy(&worker->full_cond);
-	pthread_cond_destroy(&worker->empty_cond);
-	free(worker);
+	/* Helpers that start late find nothing to do, they only hold a
+	 * reference to 'p', never to the caller's data. */
+	unsigned helpers = cnt - 1 < worker->threads_cnt ?
+		cnt - 1 : worker->threads_cnt;
+	struct parallel *p = malloc(sizeof(struct parallel));
+	memset(p, 0, sizeof(struct parallel));
+	p->callback = callback;
+	p->userdata = userdata;
+	p->cnt = cnt;
+	p->refs = 1 + helpers;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+
+	unsigned i;
+	for (i = 0; i < helpers; i++) {
+		worker_new_task(worker, prio, _parallel_task, p);
+	}
+	_parallel_run(p);
+
+	pthread_mutex_lock(&p->mutex);
+	while (p->done < p->cnt) {
+		pthread_cond_wait(&p->done_cond, &p->mutex);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	_parallel_unref(p);
+}
+
+void worker_free(struct worker *worker)
+{
+	_worker_stop(worker, worker->threads_cnt);
 }
 
 void worker_sync(struct worker *worker)
 {
 	pthread_mutex_lock(&worker->mutex);
-	if(!queue_empty(&worker->tasks)) {
+	while (worker->queued || worker->running) {
 		pthread_cond_wait(&worker->empty_cond,
 				  &worker->mutex);
 	}
@@ -139,37 +354,75 @@ void worker_sync(struct worker *worker)
 }
 
 
-void worker_new_answer(struct worker *worker,
-		       task_callback callback, void *userdata)
+static void _answer_put(struct worker *worker, struct queue_root *queue,
+			task_callback callback, void *userdata)
 {
-	struct task *answer = malloc(sizeof(struct task));
-	memset(answer, 0, sizeof(struct task));
-	answer->callback = callback;
-	answer->userdata = userdata;
+	struct task *answer = _task_get(worker, callback, userdata);
 
 	pthread_mutex_lock(&worker->mutex);
-	int r = queue_put(&answer->head, &worker->answers);
+	int r = queue_put(&answer->head, queue);
+	pthread_mutex_unlock(&worker->mutex);
 	if (r) {		/* was empty */
-		pthread_cond_signal(&worker->full_cond);
+		uint64_t one = 1;
+		if (write(worker->answers_fd, &one, sizeof(one)) == -1) {
+			log_perror(worker->db, "write(eventfd)%s", "");
+		}
 	}
-	pthread_mutex_unlock(&worker->mutex);
 }
 
-int worker_do_answers(struct worker *worker)
+void worker_new_answer(struct worker *worker,
+		       task_callback callback, void *userdata)
+{
+	_answer_put(worker, &worker->answers, callback, userdata);
+}
+
+void worker_new_completion(struct worker *worker,
+			   task_callback callback, void *userdata)
+{
+	_answer_put(worker, &worker->completions, callback, userdata);
+}
+
+int worker_fd(struct worker *worker)
+{
+	return worker->answers_fd;
+}
+
+static int _answers_run(struct worker *worker, struct queue_root *queue)
 {
 	int i = 0;
 	while (1) {
 		pthread_mutex_lock(&worker->mutex);
-		struct queue_head *head = queue_get(&worker->answers);
+		struct queue_head *head = queue_get(queue);
 		pthread_mutex_unlock(&worker->mutex);
 		if (head == NULL) {
 			break;
 		}
 		struct task *answer = container_of(head, struct task, head);
 		struct task a = *answer;
-		free(answer);
+		pthread_mutex_lock(&worker->mutex);
+		_task_put(worker, answer);
+		pthread_mutex_unlock(&worker->mutex);
 		a.callback(a.userdata);
 		i++;
 	}
 	return i;
 }
+
+int worker_do_answers(struct worker *worker)
+{
+	/* The descriptor stays readable, there may be completions. */
+	return _answers_run(worker, &worker->answers);
+}
+
+int worker_do_completions(struct worker *worker)
+{
+	/* Reset the descriptor first, anything queued while we're busy
+	 * makes it readable again. */
+	uint64_t cnt;
+	if (read(worker->answers_fd, &cnt, sizeof(cnt)) == -1 &&
+	    errno != EAGAIN) {
+		log_perror(worker->db, "read(eventfd)%s", "");
+	}
+	int i = _answers_run(worker, &worker->answers);
+	return i + _answers_run(worker, &worker->completions);
+}
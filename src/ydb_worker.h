@@ -1,13 +1,38 @@
-struct worker *worker_new(struct db *db);
+struct worker *worker_new(struct db *db, unsigned threads);
 void worker_free(struct worker *worker);
 
+/* Most urgent first. */
+enum task_priority {
+	TASK_GET,		/* Asynchronous reads, someone is waiting */
+	TASK_WRITE,		/* Parts of a write, the writer is waiting */
+	TASK_FLUSH,		/* Writing out indexes */
+	TASK_PRIORITIES
+};
+
 typedef void (*task_callback)(void *ud);
-void worker_new_task(struct worker *worker,
+void worker_new_task(struct worker *worker, enum task_priority prio,
 		     task_callback callback, void *userdata);
+/* Answers are run on the owner's thread whenever it looks at the
+ * worker. Completions carry the user's callbacks and are run only by
+ * worker_do_completions(), never in the middle of another operation. */
 void worker_new_answer(struct worker *worker,
 		       task_callback callback, void *userdata);
+void worker_new_completion(struct worker *worker,
+			   task_callback callback, void *userdata);
+
 
+/* Run callback(userdata, i) for every i below 'cnt' on the pool and
+ * the calling thread, return when all are done. */
+typedef void (*parallel_callback)(void *ud, unsigned i);
+void worker_parallel(struct worker *worker, enum task_priority prio,
+		     parallel_callback callback, void *userdata,
+		     unsigned cnt);
 
+/* Wait until all the tasks are done. */
 void worker_sync(struct worker *worker);
 
+/* Pollable, readable when worker_do_completions() has work to do. */
+int worker_fd(struct worker *worker);
 int worker_do_answers(struct worker *worker);
+/* Answers and completions, returns how many were run. */
+int worker_do_completions(struct worker *worker);
@@ -15,6 +15,70 @@ test-%(n)s: %(n)s-mock.out %(n)s-ydb.out
 	@diff $^ > /dev/null && \\
 		echo " [+] Test %(n)s: ok!" || \\
 		(echo " [!] Test %(n)s: FAILED: diff $^"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/%(n)s-db |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (parallel): ok!" || \\
+		(echo " [!] Test %(n)s (parallel): FAILED"; exit 1;)
+	@YDB_TEST_ORDERED=1 ./src_tests/test_ydb_read /tmp/%(n)s-db |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (ordered): ok!" || \\
+		(echo " [!] Test %(n)s (ordered): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/%(n)s-db |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (get): ok!" || \\
+		(echo " [!] Test %(n)s (get): FAILED"; exit 1;)
+	@rm -rf /tmp/%(n)s-dbz
+	@cat %(basename)s %(testname)s | YDB_TEST_COMPRESS=6 YDB_TEST_DEFRAG_WASTE=1 \\
+		YDB_TEST_HUGE_PAGES=1 ./src_tests/test_ydb_write /tmp/%(n)s-dbz
+	@./src_tests/test_ydb_read /tmp/%(n)s-dbz |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (compressed): ok!" || \\
+		(echo " [!] Test %(n)s (compressed): FAILED"; exit 1;)
+	@rm -rf /tmp/%(n)s-dbb
+	@cat %(basename)s %(testname)s | YDB_TEST_COMPRESS=1 YDB_TEST_BLOCK_SIZE=16384 \\
+		YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_write /tmp/%(n)s-dbb
+	@./src_tests/test_ydb_read /tmp/%(n)s-dbb |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (blocks): ok!" || \\
+		(echo " [!] Test %(n)s (blocks): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_read /tmp/%(n)s-dbb |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (blocks, parallel): ok!" || \\
+		(echo " [!] Test %(n)s (blocks, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/%(n)s-dbp
+	@cat %(basename)s %(testname)s | YDB_TEST_COMPRESS=6 YDB_TEST_WRITE_EVERY=64 \\
+		./src_tests/test_ydb_write /tmp/%(n)s-dbp
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/%(n)s-dbp |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (compressed, parallel): ok!" || \\
+		(echo " [!] Test %(n)s (compressed, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/%(n)s-dbw
+	@cat %(basename)s %(testname)s | YDB_TEST_WIDE=1 YDB_TEST_RESIDENT_LOGS=2 YDB_TEST_HASHED=1 \\
+		./src_tests/test_ydb_write /tmp/%(n)s-dbw
+	@./src_tests/test_ydb_read /tmp/%(n)s-dbw |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (wide): ok!" || \\
+		(echo " [!] Test %(n)s (wide): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 YDB_TEST_DIRECT_IO=2 YDB_TEST_BROKEN_SDX=1 \\
+		./src_tests/test_ydb_read /tmp/%(n)s-dbw |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (wide, get): ok!" || \\
+		(echo " [!] Test %(n)s (wide, get): FAILED"; exit 1;)
+	@rm -rf /tmp/%(n)s-dbl
+	@cat %(basename)s %(testname)s | YDB_TEST_BLOB_THRESHOLD=5 YDB_TEST_FILTER=10 \\
+		./src_tests/test_ydb_write /tmp/%(n)s-dbl
+	@./src_tests/test_ydb_read /tmp/%(n)s-dbl |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (blobs): ok!" || \\
+		(echo " [!] Test %(n)s (blobs): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/%(n)s-dbl |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (blobs, parallel): ok!" || \\
+		(echo " [!] Test %(n)s (blobs, parallel): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/%(n)s-dbl |sort | \\
+		diff %(n)s-mock.out - > /dev/null && \\
+		echo " [+] Test %(n)s (blobs, get): ok!" || \\
+		(echo " [!] Test %(n)s (blobs, get): FAILED"; exit 1;)
 
 %(n)s-mock.out: %(basename)s %(testname)s
 	python src_tests/mockdb.py $^ |sort > $@
@@ -26,7 +90,7 @@ test-%(n)s: %(n)s-mock.out %(n)s-ydb.out
 	./src_tests/test_ydb_read /tmp/%(n)s-db |sort > $@
 
 clean_tests::
-	rm -rf /tmp/%(n)s-db
+	rm -rf /tmp/%(n)s-db /tmp/%(n)s-dbz /tmp/%(n)s-dbb /tmp/%(n)s-dbp /tmp/%(n)s-dbw /tmp/%(n)s-dbl
 
 """ % {'n': base + '-' + test,
        'base': base,
@@ -78,7 +78,7 @@ struct ydb *test_ydb_open(int argc, char **argv, struct ydb_options opt)
 
 char *hex_md5(void *key_hash)
 {
-	static char buf[42];
+	static __thread char buf[42];
 	unsigned char *h = key_hash;
 	char *b = buf;
 	int i;
@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ydb.h"
+
+/* Log callback and rate limiting. A batch too big for a log file is
+ * refused with an error logged from a single site, writing it many
+ * times in a row floods that site. */
+
+#define WRITES 100
+#define MESSAGE "unable to write so big batch"
+
+struct lines {
+	unsigned cnt;		/* Lines of the flooded site */
+	unsigned suppressed;	/* As reported by these lines */
+	unsigned other;
+};
+
+static void log_callback(void *lines_p, int level, const char *line)
+{
+	struct lines *lines = lines_p;
+	assert(strchr(line, '\n') == NULL);
+	assert(level == YDB_LOGLEVEL_ERROR);
+	if (strstr(line, MESSAGE) == NULL) {
+		lines->other += 1;
+		return;
+	}
+	lines->cnt += 1;
+	const char *s = strstr(line, " (");
+	unsigned suppressed;
+	if (s && sscanf(s, " (%u similar messages suppressed)",
+			&suppressed) == 1) {
+		lines->suppressed += suppressed;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <database path>\n", argv[0]);
+		return 1;
+	}
+	struct ydb_options opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.log_file_size_limit = 1 << 20;
+	opt.log_level = YDB_LOGLEVEL_ERROR;
+	struct ydb *ydb = ydb_open(argv[1], &opt);
+	assert(ydb);
+
+	struct lines lines;
+	memset(&lines, 0, sizeof(lines));
+	ydb_set_log_callback(ydb, log_callback, &lines);
+
+	unsigned value_sz = 2 << 20;
+	char *value = malloc(value_sz);
+	memset(value, 'x', value_sz);
+	struct ydb_batch *batch = ydb_batch();
+	ydb_set(batch, "key", 3, value, value_sz);
+	int i;
+	for (i = 0; i < WRITES; i++) {
+		int r = ydb_write(ydb, batch, 0);
+		assert(r < 0);
+	}
+	/* Counts of the suppressed messages come with the first message
+	 * of the site in a later second. */
+	sleep(1);
+	int r = ydb_write(ydb, batch, 0);
+	assert(r < 0);
+	ydb_batch_free(batch);
+	free(value);
+
+	/* Queued lines still go to the callback. */
+	ydb_close(ydb);
+
+	assert(lines.cnt + lines.suppressed == WRITES + 1);
+	/* At most two seconds of the burst, the rest suppressed. */
+	assert(lines.cnt <= 2 * 20 + 1);
+	assert(lines.suppressed > 0);
+	assert(lines.other == 0);
+	return 0;
+}
@@ -1,8 +1,15 @@
+#define _XOPEN_SOURCE 500
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "ydb.h"
 #include "test_common.h"
@@ -20,10 +27,249 @@ int callback(void *ud,
 }
 
 
+static char last_key[1024];
+static unsigned last_key_sz;
+
+int ordered_callback(void *ud,
+		     const char *key, unsigned key_sz,
+		     const char *value, unsigned value_sz)
+{
+	unsigned sz = key_sz < last_key_sz ? key_sz : last_key_sz;
+	int r = memcmp(last_key, key, sz);
+	assert(r < 0 || (r == 0 && last_key_sz < key_sz));
+	assert(key_sz <= sizeof(last_key));
+	memcpy(last_key, key, key_sz);
+	last_key_sz = key_sz;
+	return callback(ud, key, key_sz, value, value_sz);
+}
+
+struct chunks {
+	char *buf;
+	unsigned buf_sz;
+};
+
+int chunk_callback(void *ud, const char *chunk, unsigned chunk_sz)
+{
+	struct chunks *chunks = ud;
+	memcpy(chunks->buf + chunks->buf_sz, chunk, chunk_sz);
+	chunks->buf_sz += chunk_sz;
+	return 0;
+}
+
+struct drain {
+	int fd;
+	char *buf;
+	unsigned buf_sz;
+	unsigned size;
+};
+
+static void *drain_pipe(void *drain_p)
+{
+	struct drain *drain = drain_p;
+	/* Let the writer find the pipe full. */
+	usleep(10000);
+	ssize_t r;
+	while ((r = read(drain->fd, drain->buf + drain->size,
+			 drain->buf_sz - drain->size)) > 0) {
+		drain->size += r;
+	}
+	return NULL;
+}
+
+/* ydb_get_to_fd() to a full non-blocking pipe waits for the reader. */
+static void get_to_pipe(struct ydb *ydb,
+			const char *key, unsigned key_sz,
+			const char *value, unsigned value_sz)
+{
+	int fds[2];
+	assert(pipe(fds) == 0);
+	assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+	char fill[4096];
+	memset(fill, 'x', sizeof(fill));
+	unsigned filled = 0;
+	ssize_t r;
+	while ((r = write(fds[1], fill, sizeof(fill))) > 0) {
+		filled += r;
+	}
+	assert(errno == EAGAIN);
+
+	struct drain drain = {fds[0], malloc(filled + value_sz + 1),
+			      filled + value_sz + 1, 0};
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, drain_pipe, &drain) == 0);
+	long long l = ydb_get_to_fd(ydb, key, key_sz, fds[1]);
+	assert(l == value_sz);
+	close(fds[1]);
+	pthread_join(thread, NULL);
+	close(fds[0]);
+	assert(drain.size == filled + value_sz);
+	assert(memcmp(drain.buf + filled, value, value_sz) == 0);
+	free(drain.buf);
+}
+
+/* Stream every item with ydb_get_chunked() and ydb_get_to_fd(), these
+ * miss the value cache. Then read it with ydb_get() and ydb_get_h(),
+ * the second read should come from the value cache. */
+int get_callback(void *ud,
+		 const char *key, unsigned key_sz,
+		 const char *value, unsigned value_sz)
+{
+	struct ydb *ydb = ud;
+	static char buf[1 << 16];
+	static FILE *tmp;
+	if (tmp == NULL) {
+		tmp = tmpfile();
+	}
+
+	struct chunks chunks = {buf, 0};
+	long long l = ydb_get_chunked(ydb, key, key_sz, chunk_callback,
+				      &chunks);
+	assert(l == value_sz && chunks.buf_sz == value_sz);
+	assert(memcmp(buf, value, value_sz) == 0);
+
+	assert(ftruncate(fileno(tmp), 0) == 0);
+	assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+	l = ydb_get_to_fd(ydb, key, key_sz, fileno(tmp));
+	assert(l == value_sz);
+	assert(pread(fileno(tmp), buf, sizeof(buf), 0) == (int)value_sz);
+	assert(memcmp(buf, value, value_sz) == 0);
+	static int piped;
+	if (!piped++) {
+		get_to_pipe(ydb, key, key_sz, value, value_sz);
+	}
+
+	struct ydb_key_hash hash;
+	ydb_hash_key(key, key_sz, &hash);
+	int i;
+	for (i = 0; i < 2; i++) {
+		int r = i == 0 ? ydb_get(ydb, key, key_sz, buf, sizeof(buf)) :
+			ydb_get_h(ydb, &hash, key, key_sz, buf, sizeof(buf));
+		assert(r == (int)value_sz);
+		assert(memcmp(buf, value, value_sz) == 0);
+	}
+	return callback(NULL, key, key_sz, value, value_sz);
+}
+
+/* Read every item again with ydb_get_async(), the values are
+ * checked as the completions arrive. */
+static unsigned outstanding;
+
+void async_get_callback(void *ud, int r, const char *value, unsigned value_sz)
+{
+	struct chunks *expected = ud;
+	if (expected) {
+		assert(r == (int)expected->buf_sz && value_sz == (unsigned)r);
+		assert(memcmp(value, expected->buf, value_sz) == 0);
+		free(expected->buf);
+		free(expected);
+	} else {
+		assert(r == YDB_NOT_FOUND);
+	}
+	outstanding -= 1;
+}
+
+int async_callback(void *ud,
+		   const char *key, unsigned key_sz,
+		   const char *value, unsigned value_sz)
+{
+	struct ydb *ydb = ud;
+	struct chunks *expected = malloc(sizeof(struct chunks));
+	expected->buf = malloc(value_sz ? value_sz : 1);
+	memcpy(expected->buf, value, value_sz);
+	expected->buf_sz = value_sz;
+	assert(ydb_get_async(ydb, key, key_sz, async_get_callback,
+			     expected) == 0);
+	outstanding += 1;
+	return callback(NULL, key, key_sz, value, value_sz);
+}
+
+/* Number of logs and the number of the oldest one. */
+static unsigned count_logs(const char *path, unsigned long long *oldest_ptr)
+{
+	DIR *dir = opendir(path);
+	assert(dir);
+	unsigned cnt = 0;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		const char *ext = strrchr(de->d_name, '.');
+		if (ext && strcmp(ext, ".ydb") == 0) {
+			unsigned long long log_number =
+				strtoull(de->d_name, NULL, 16);
+			if (cnt == 0 || log_number < *oldest_ptr) {
+				*oldest_ptr = log_number;
+			}
+			cnt += 1;
+		}
+	}
+	closedir(dir);
+	return cnt;
+}
+
+static void write_key(struct ydb *ydb, const char *key, const char *value)
+{
+	struct ydb_batch *batch = ydb_batch();
+	if (value) {
+		ydb_set(batch, key, strlen(key), value, strlen(value));
+	} else {
+		ydb_del(batch, key, strlen(key));
+	}
+	assert(ydb_write(ydb, batch, 0) >= 0);
+	ydb_batch_free(batch);
+}
+
+/* A key overwritten while ydb_get_async() reads it must not leave
+ * the old value in the value cache. The key is gone afterwards. */
+static void stale_async_get(struct ydb *ydb)
+{
+	const char *key = "async key";
+	write_key(ydb, key, "old");
+	struct chunks *expected = malloc(sizeof(struct chunks));
+	expected->buf = strdup("old");
+	expected->buf_sz = 3;
+	assert(ydb_get_async(ydb, key, strlen(key), async_get_callback,
+			     expected) == 0);
+	outstanding += 1;
+	write_key(ydb, key, "new");
+	while (outstanding) {
+		assert(ydb_poll(ydb, -1) >= 0);
+	}
+	char buf[16];
+	assert(ydb_get(ydb, key, strlen(key), buf, sizeof(buf)) == 3);
+	assert(memcmp(buf, "new", 3) == 0);
+	write_key(ydb, key, NULL);
+}
+
 int main(int argc, char **argv)
 {
+	int ordered = getenv("YDB_TEST_ORDERED") != NULL;
+	int get = getenv("YDB_TEST_GET") != NULL;
+	char *direct_io_str = getenv("YDB_TEST_DIRECT_IO");
+	char *threads_str = getenv("YDB_TEST_THREADS");
+	unsigned long long oldest = 0;
+	unsigned logs = count_logs(argv[1], &oldest);
+	/* A directory in place of the sorted index of the oldest log, it
+	 * can't be loaded nor saved. The log stays in the index and the
+	 * newer ones are moved out of it past it. */
+	char broken_sdx[1024] = "";
+	if (getenv("YDB_TEST_BROKEN_SDX")) {
+		snprintf(broken_sdx, sizeof(broken_sdx), "%s/index/%012llx.sdx",
+			 argv[1], oldest);
+		unlink(broken_sdx);
+		assert(mkdir(broken_sdx, 0700) == 0);
+	}
 	struct ydb *ydb = test_ydb_open(argc, argv,
-					(struct ydb_options){4 << 20,0,0});
+					(struct ydb_options){4 << 20,0,0,
+							ordered, 0, 0,
+							get ? 1 << 20 : 0,
+							get ? 10 : 0, 0, 0, 0,
+							get ? 1 : 0,
+							get ? 1 : 0,
+							direct_io_str ?
+							atoi(direct_io_str) : 0,
+							256 << 10,
+							threads_str != NULL,
+							get ? YDB_LOGLEVEL_WARN : 0,
+							0});
 
 	/* int i; */
 	/* for (i=0; i< 3; i++) { */
@@ -31,8 +277,64 @@ int main(int argc, char **argv)
 	/* 	int r = ydb_roll(ydb, 128 << 10); */
 	/* 	assert(r >= 0); */
 	/* } */
-	ydb_iterate(ydb, 512 << 10, callback, NULL);
+	if (ordered) {
+		int r = ydb_range(ydb, NULL, 0, NULL, 0, 512 << 10,
+				  ordered_callback, NULL);
+		assert(r == 0);
+	} else if (threads_str) {
+		unsigned threads = atoi(threads_str);
+		void **userdata = calloc(threads ? threads : 1, sizeof(void*));
+		int r = ydb_iterate_parallel(ydb, threads, 512 << 10,
+					     callback, userdata);
+		assert(r == 0);
+		free(userdata);
+	} else if (get) {
+		ydb_iterate(ydb, 512 << 10, get_callback, ydb);
+		unsigned long long hits, misses;
+		ydb_cache_stats(ydb, &hits, &misses);
+		assert(hits * 3 == misses - 1);
+
+		char buf[16];
+		int i;
+		for (i = 0; i < 1000; i++) {
+			int sz = sprintf(buf, "missing %i", i);
+			assert(ydb_get(ydb, buf, sz, buf, sizeof(buf)) ==
+			       YDB_NOT_FOUND);
+			assert(ydb_get_to_fd(ydb, buf, sz, 1) ==
+			       YDB_NOT_FOUND);
+		}
+		stale_async_get(ydb);
+
+		struct ydb_stats stats;
+		ydb_stats(ydb, &stats);
+		assert(stats.get.count >= 2000);
+		/* All but the newest log and one resident log are cold,
+		 * the gets above went through their sorted indexes. */
+		unsigned resident = broken_sdx[0] && logs > 2 ? 2 : 1;
+		assert(stats.cold_logs ==
+		       (logs > resident + 1 ? logs - resident - 1 : 0));
+		assert(stats.get.p50_ns <= stats.get.p99_ns &&
+		       stats.get.p99_ns <= stats.get.max_ns);
+		assert(stats.cache_hits == hits);
+		assert(stats.open.total_ns >= stats.open.index_load_ns +
+		       stats.open.index_build_ns + stats.open.replay_ns);
+		assert(stats.open.index_load_ns >= stats.open.index_copy_ns);
+		int null_fd = open("/dev/null", O_WRONLY);
+		assert(ydb_stats_dump(ydb, null_fd) == 0);
+		close(null_fd);
+	} else {
+		ydb_iterate(ydb, 512 << 10, async_callback, ydb);
+		assert(ydb_get_async(ydb, "missing", 7, async_get_callback,
+				     NULL) == 0);
+		outstanding += 1;
+		while (outstanding) {
+			assert(ydb_poll(ydb, -1) >= 0);
+		}
+	}
 
 	ydb_close(ydb);
+	if (broken_sdx[0]) {
+		rmdir(broken_sdx);
+	}
 	return 0;
 }
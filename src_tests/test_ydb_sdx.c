@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+
+#include "ydb_common.h"
+#include "ydb_logging.h"
+#include "ydb_file.h"
+#include "ydb_db.h"
+#include "ydb_hashdir.h"
+
+/* Sorted side indexes: save, load and find every item back. Many
+ * pages of items, so that lookups go through the fences. A file that
+ * doesn't load, or that loads with a byte flipped, fails the test. */
+
+#define ITEMS 100000
+#define MISSING 1000
+#define FILENAME "test.sdx"
+
+static uint128_t key_hash(const char *prefix, unsigned i)
+{
+	char key[32];
+	int key_sz = sprintf(key, "%s%u", prefix, i);
+	return md5(key, key_sz);
+}
+
+static struct hashdir_item make_item(unsigned i)
+{
+	return (struct hashdir_item){key_hash("key", i),
+			(uint64_t)i * 32, 32 * (1 + i % 100), i};
+}
+
+static void flip_byte(uint64_t offset)
+{
+	FILE *f = fopen(FILENAME, "r+b");
+	assert(f);
+	assert(fseek(f, offset, SEEK_SET) == 0);
+	int c = fgetc(f);
+	assert(c != EOF);
+	assert(fseek(f, offset, SEEK_SET) == 0);
+	fputc(c ^ 0x01, f);
+	fclose(f);
+}
+
+static void round_trip(struct db *db, int wide, unsigned items)
+{
+	db_set_wide_index(db, wide);
+	struct hashdir *hd = hashdir_new_active(db, NULL, NULL);
+	unsigned i;
+	for (i = 0; i < items; i++) {
+		hashdir_add(hd, make_item(i));
+	}
+	struct dir *dir = db_index_dir(db);
+	assert(sdx_save(hd, dir, FILENAME) == 0);
+	hashdir_free(hd);
+
+	struct sdx *sdx = sdx_load(db, dir, FILENAME, wide);
+	assert(sdx);
+	for (i = 0; i < items; i++) {
+		struct hashdir_item expected = make_item(i);
+		struct hashdir_item hi;
+		assert(sdx_find(sdx, expected.key_hash, &hi) == 1);
+		assert(hi.key_hash == expected.key_hash);
+		assert(hi.offset == expected.offset);
+		assert(hi.size == expected.size);
+		assert(hi.bitmap_pos == expected.bitmap_pos);
+	}
+	for (i = 0; i < MISSING; i++) {
+		struct hashdir_item hi;
+		assert(sdx_find(sdx, key_hash("missing", i), &hi) == 0);
+	}
+	/* Neither the smallest nor the biggest hash is there. */
+	struct hashdir_item hi;
+	assert(sdx_find(sdx, 0, &hi) == 0);
+	assert(sdx_find(sdx, ~(uint128_t)0, &hi) == 0);
+	sdx_free(db, sdx);
+
+	/* A byte flipped in the first item, then in the footer. */
+	struct stat st;
+	assert(stat(FILENAME, &st) == 0);
+	uint64_t offsets[2] = {0, st.st_size - 1};
+	for (i = 0; i < 2; i++) {
+		flip_byte(offsets[i]);
+		assert(sdx_load(db, dir, FILENAME, wide) == NULL);
+		flip_byte(offsets[i]);
+		sdx = sdx_load(db, dir, FILENAME, wide);
+		assert(sdx);
+		sdx_free(db, sdx);
+	}
+	/* Loaded with the other index format. */
+	assert(sdx_load(db, dir, FILENAME, !wide) == NULL);
+	assert(unlink(FILENAME) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <directory>\n", argv[0]);
+		return 1;
+	}
+	assert(mkdir(argv[1], 0700) == 0);
+	assert(chdir(argv[1]) == 0);
+	/* The mock logs to a copy of stderr, broken files are expected
+	 * and their warnings go to /dev/null instead. */
+	int err_fd = dup(2);
+	int null_fd = open("/dev/null", O_WRONLY);
+	assert(dup2(null_fd, 2) == 2);
+	struct db *db = db_new_mock();
+	assert(dup2(err_fd, 2) == 2);
+	close(null_fd);
+	close(err_fd);
+
+	int wide;
+	for (wide = 0; wide < 2; wide++) {
+		round_trip(db, wide, ITEMS);
+		round_trip(db, wide, 1);
+		round_trip(db, wide, 0);
+	}
+	db_free(db);
+	return 0;
+}
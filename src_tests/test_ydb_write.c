@@ -13,42 +13,175 @@ struct ydb *ydb = NULL;
 struct ydb_batch *batch = NULL;
 
 float gc_ratio = 4.0;
-struct ydb_options opt = {16 << 20,0,0};
+struct ydb_options opt = {16 << 20,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+int dictionary_trained = 0;
 
 unsigned gc_sz = 1 << 20;
+/* Merge batches, so that big ones are compressed in parallel. Merged
+ * batches are kept below the log file size limit. */
+unsigned write_every = 1;
+unsigned writes_skipped = 0;
+unsigned long long batch_sz = 0;
+/* Set and delete through ydb_set_h() and ydb_del_h(), the keys
+ * written are checked with ydb_prefetch_h(). */
+int hashed = 0;
+struct written {
+	struct ydb_vec *keysv;
+	struct ydb_key_hash *hashes;
+	unsigned *value_szs;	/* -1 if deleted */
+	unsigned cnt;
+	unsigned sz;
+} written;
+
+static void add_written(const char *key, const struct ydb_key_hash *hash,
+			unsigned value_sz)
+{
+	if (written.cnt == written.sz) {
+		written.sz = written.sz ? written.sz * 2 : 64;
+		written.keysv = realloc(written.keysv,
+					sizeof(struct ydb_vec) * written.sz);
+		written.hashes = realloc(written.hashes,
+					 sizeof(struct ydb_key_hash) * written.sz);
+		written.value_szs = realloc(written.value_szs,
+					    sizeof(unsigned) * written.sz);
+	}
+	unsigned key_sz = strlen(key);
+	struct ydb_vec *v = &written.keysv[written.cnt];
+	v->key = malloc(key_sz + 1);
+	memcpy(v->key, key, key_sz + 1);
+	v->key_sz = key_sz;
+	written.hashes[written.cnt] = *hash;
+	written.value_szs[written.cnt] = value_sz;
+	written.cnt += 1;
+}
+
+static void check_written(void)
+{
+	ydb_prefetch_h(ydb, written.keysv, written.hashes, written.cnt);
+	unsigned i, j;
+	for (i = 0; i < written.cnt; i++) {
+		/* Only the last write of a key counts. */
+		for (j = i + 1; j < written.cnt; j++) {
+			if (strcmp(written.keysv[i].key,
+				   written.keysv[j].key) == 0) {
+				break;
+			}
+		}
+		/* Prefetch gives the record size, -1 if not found. */
+		unsigned value_sz = written.keysv[i].value_sz;
+		if (j == written.cnt && written.value_szs[i] == -1U) {
+			assert(value_sz == -1U);
+		} else if (j == written.cnt) {
+			assert(value_sz != -1U &&
+			       value_sz >= written.value_szs[i]);
+		}
+		free(written.keysv[i].key);
+	}
+	written.cnt = 0;
+}
+
+/* The negative lookup filter is rebuilt over several writes, it must
+ * let every key through all along. */
+static int check_get(void *ud, const char *key, unsigned key_sz,
+		     const char *value, unsigned value_sz)
+{
+	char *buf = malloc(value_sz + 1);
+	int r = ydb_get(ydb, key, key_sz, buf, value_sz + 1);
+	assert(r == (int)value_sz);
+	assert(memcmp(buf, value, value_sz) == 0);
+	free(buf);
+	ud = ud;
+	return 0;
+}
+
+static void write_batch(int do_fsync)
+{
+	int r = ydb_write(ydb, batch, do_fsync);
+	assert(r >= 0);
+	ydb_batch_free(batch);
+	batch = ydb_batch();
+	batch_sz = 0;
+	writes_skipped = 0;
+	if (hashed) {
+		check_written();
+	}
+
+	if (opt.compress_level && !dictionary_trained) {
+		dictionary_trained = ydb_train_dictionary(ydb, 4096) == 0;
+	}
+
+	while (ydb_ratio(ydb) > gc_ratio && gc_sz > 4) {
+		int j = ydb_roll(ydb, gc_sz);
+		if (j < 0) {
+			fprintf(stderr, "gc failed\n");
+			gc_sz /= 2;
+			break;
+		}
+	}
+	if (opt.blob_threshold) {
+		int j = ydb_blob_gc(ydb);
+		assert(j >= 0);
+	}
+	/* Pick up finished index flushes. */
+	ydb_poll(ydb, 0);
+
+	if (opt.filter_bits_per_key) {
+		ydb_iterate(ydb, 512 << 10, check_get, NULL);
+	}
+}
 
 int do_line(char *action, int tokc, char **tokv)
 {
 	if (streq(action, "set") && tokc == 2) {
-		ydb_set(batch,
-			(const char*)tokv[0], strlen(tokv[0]),
-			(const char*)tokv[1], strlen(tokv[1]));
+		/* Record headers are less than 64 bytes. */
+		unsigned sz = strlen(tokv[0]) + strlen(tokv[1]) + 64;
+		if (write_every > 1 &&
+		    batch_sz + sz > opt.log_file_size_limit) {
+			write_batch(0);
+		}
+		batch_sz += sz;
+		if (hashed) {
+			struct ydb_key_hash hash;
+			ydb_hash_key(tokv[0], strlen(tokv[0]), &hash);
+			ydb_set_h(batch, &hash,
+				  (const char*)tokv[0], strlen(tokv[0]),
+				  (const char*)tokv[1], strlen(tokv[1]));
+			add_written(tokv[0], &hash, strlen(tokv[1]));
+		} else {
+			ydb_set(batch,
+				(const char*)tokv[0], strlen(tokv[0]),
+				(const char*)tokv[1], strlen(tokv[1]));
+		}
 		return 0;
 	} else if (streq(action, "del") && tokc == 1) {
-		ydb_del(batch, tokv[0], strlen(tokv[0]));
+		if (hashed) {
+			struct ydb_key_hash hash;
+			ydb_hash_key(tokv[0], strlen(tokv[0]), &hash);
+			ydb_del_h(batch, &hash, tokv[0], strlen(tokv[0]));
+			add_written(tokv[0], &hash, -1U);
+		} else {
+			ydb_del(batch, tokv[0], strlen(tokv[0]));
+		}
+		batch_sz += strlen(tokv[0]) + 64;
 		return 0;
 	} else if (streq(action, "write")) {
+		if (++writes_skipped < write_every) {
+			return 0;
+		}
 		int do_fsync = 0;
 		if (tokc >= 1) {
 			do_fsync = atoi(tokv[0]);
 		}
-		int r = ydb_write(ydb, batch, do_fsync);
-		assert(r >= 0);
-		ydb_batch_free(batch);
-		batch = ydb_batch();
-
-		while (ydb_ratio(ydb) > gc_ratio && gc_sz > 4) {
-			int j = ydb_roll(ydb, gc_sz);
-			if (j < 0) {
-				fprintf(stderr, "gc failed\n");
-				gc_sz /= 2;
-				break;
-			}
-		}
+		write_batch(do_fsync);
 		return 0;
 	} else if (streq(action, "reopen")) {
 		if (tokc >= 1) {
 			opt.log_file_size_limit = atoi(tokv[0]) * 1024; // KiB
+			/* Blob references are bigger than the test values. */
+			if (opt.blob_threshold &&
+			    opt.log_file_size_limit < 64 * 1024) {
+				opt.log_file_size_limit = 64 * 1024;
+			}
 		}
 		if (tokc >= 2) {
 			opt.max_open_logs = atoi(tokv[1]);
@@ -71,6 +204,44 @@ int do_line(char *action, int tokc, char **tokv)
 int main(int argc, char **argv)
 {
 	database_path = argv[1];
+	char *compress_str = getenv("YDB_TEST_COMPRESS");
+	if (compress_str) {
+		opt.compress_level = atoi(compress_str);
+	}
+	char *block_size_str = getenv("YDB_TEST_BLOCK_SIZE");
+	if (block_size_str) {
+		opt.block_size = atoi(block_size_str);
+	}
+	opt.wide_index = getenv("YDB_TEST_WIDE") != NULL;
+	char *resident_logs_str = getenv("YDB_TEST_RESIDENT_LOGS");
+	if (resident_logs_str) {
+		opt.resident_logs = atoi(resident_logs_str);
+	}
+	char *direct_io_str = getenv("YDB_TEST_DIRECT_IO");
+	if (direct_io_str) {
+		opt.direct_io = atoi(direct_io_str);
+	}
+	char *defrag_waste_str = getenv("YDB_TEST_DEFRAG_WASTE");
+	if (defrag_waste_str) {
+		opt.index_defrag_waste = atoll(defrag_waste_str);
+	}
+	char *huge_pages_str = getenv("YDB_TEST_HUGE_PAGES");
+	if (huge_pages_str) {
+		opt.huge_pages = atoi(huge_pages_str);
+	}
+	char *blob_threshold_str = getenv("YDB_TEST_BLOB_THRESHOLD");
+	if (blob_threshold_str) {
+		opt.blob_threshold = atoi(blob_threshold_str);
+	}
+	char *filter_str = getenv("YDB_TEST_FILTER");
+	if (filter_str) {
+		opt.filter_bits_per_key = atoi(filter_str);
+	}
+	hashed = getenv("YDB_TEST_HASHED") != NULL;
+	char *write_every_str = getenv("YDB_TEST_WRITE_EVERY");
+	if (write_every_str) {
+		write_every = atoi(write_every_str);
+	}
 	ydb = test_ydb_open(argc, argv, opt);
 	batch = ydb_batch();
 
@@ -79,6 +250,12 @@ int main(int argc, char **argv)
 	int r = ydb_write(ydb, batch, 0);
 	assert(r >= 0);
 	ydb_batch_free(batch);
+	if (hashed) {
+		check_written();
+	}
+	free(written.keysv);
+	free(written.hashes);
+	free(written.value_szs);
 	ydb_close(ydb);
 	return ret;
 }
@@ -0,0 +1,847 @@
+#define _XOPEN_SOURCE 700	/* getopt(3), nftw(3) */
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <ftw.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ydb.h"
+
+/* YCSB-like workloads against a single database directory. Workloads
+ * run in the order given, fill-seq and fill-random start from an empty
+ * database, the others use what is there. Latency is measured per
+ * operation: a get, or a ydb_write() of a batch. */
+
+static const char *all_workloads =
+	"fill-seq,read-random,read-miss,read-hot,mixed,overwrite,"
+	"iterate,reopen,reopen-cold,replay,fill-random,read-random";
+
+struct config {
+	const char *directory;
+	unsigned long long keys;
+	unsigned long long ops;		/* For reads, mixed and overwrite */
+	unsigned key_sz;
+	unsigned value_sz;
+	unsigned batch;
+	unsigned threads;
+	double zipf_theta;
+	double read_fraction;
+	double gc_ratio;
+	int do_fsync;
+	int json;
+	struct ydb_options opt;
+};
+
+struct result {
+	const char *name;
+	unsigned long long ops;
+	unsigned long long bytes;
+	unsigned long long errors;
+	unsigned long long gc_runs;
+	double seconds;
+	double ratio;
+	uint64_t *lat;
+	unsigned long long lat_cnt;
+	unsigned long long lat_max_cnt;
+	int has_open;		/* Open workloads report phases */
+	struct ydb_open_phases open;
+};
+
+struct bench {
+	struct config *cfg;
+	struct ydb *ydb;
+	char *values;		/* Pool values are sliced out of */
+	unsigned values_sz;
+	uint64_t rand;
+
+	/* Zipfian generator over [0, keys), set up on first use */
+	int zipf_ready;
+	double zipf_zetan;
+	double zipf_alpha;
+	double zipf_eta;
+
+	/* fill-random walks the keys with a step coprime with their
+	 * number */
+	unsigned long long perm_step;
+	unsigned long long perm_cur;
+
+	/* Outstanding asynchronous gets */
+	unsigned outstanding;
+	struct result *result;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rand64(struct bench *b)
+{
+	/* xorshift64* */
+	b->rand ^= b->rand >> 12;
+	b->rand ^= b->rand << 25;
+	b->rand ^= b->rand >> 27;
+	return b->rand * 0x2545F4914F6CDD1DULL;
+}
+
+static double rand_double(struct bench *b)
+{
+	return (rand64(b) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* FNV-1a, spreads the popular Zipfian items over the key space. */
+static uint64_t scramble(uint64_t v)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	int i;
+	for (i = 0; i < 8; i++) {
+		h ^= v & 0xff;
+		h *= 0x100000001B3ULL;
+		v >>= 8;
+	}
+	return h;
+}
+
+static void zipf_init(struct bench *b)
+{
+	double theta = b->cfg->zipf_theta;
+	unsigned long long n = b->cfg->keys;
+	double zetan = 0.0;
+	unsigned long long i;
+	for (i = 1; i <= n; i++) {
+		zetan += 1.0 / pow((double)i, theta);
+	}
+	double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+	b->zipf_zetan = zetan;
+	b->zipf_alpha = 1.0 / (1.0 - theta);
+	b->zipf_eta = (1.0 - pow(2.0 / n, 1.0 - theta)) /
+		(1.0 - zeta2 / zetan);
+	b->zipf_ready = 1;
+}
+
+static unsigned long long _gcd(unsigned long long a, unsigned long long b)
+{
+	while (b) {
+		unsigned long long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static void perm_init(struct bench *b)
+{
+	unsigned long long n = b->cfg->keys;
+	b->perm_step = (unsigned long long)(n * 0.6180339887) | 1;
+	while (_gcd(b->perm_step, n) != 1) {
+		b->perm_step += 1;
+	}
+}
+
+/* Gray et al., "Quickly Generating Billion-Record Synthetic
+ * Databases", as in YCSB's ScrambledZipfianGenerator. */
+static unsigned long long zipf_next(struct bench *b)
+{
+	if (b->zipf_ready == 0) {
+		zipf_init(b);
+	}
+	double theta = b->cfg->zipf_theta;
+	unsigned long long n = b->cfg->keys;
+	double u = rand_double(b);
+	double uz = u * b->zipf_zetan;
+	unsigned long long v;
+	if (uz < 1.0) {
+		v = 0;
+	} else if (uz < 1.0 + pow(0.5, theta)) {
+		v = 1;
+	} else {
+		v = n * pow(b->zipf_eta * u - b->zipf_eta + 1.0,
+			    b->zipf_alpha);
+	}
+	if (v >= n) {
+		v = n - 1;
+	}
+	return scramble(v) % n;
+}
+
+static unsigned make_key(struct bench *b, char *buf, unsigned long long id)
+{
+	unsigned key_sz = b->cfg->key_sz;
+	char tmp[32];
+	int len = snprintf(tmp, sizeof(tmp), "%016llx", id);
+	memset(buf, 'k', key_sz);
+	unsigned sz = (unsigned)len < key_sz ? (unsigned)len : key_sz;
+	memcpy(buf + key_sz - sz, tmp + len - sz, sz);
+	return key_sz;
+}
+
+static const char *make_value(struct bench *b, unsigned long long id)
+{
+	return &b->values[(scramble(id) % (b->values_sz - b->cfg->value_sz))];
+}
+
+static void lat_record(struct result *res, uint64_t start)
+{
+	if (res->lat_cnt < res->lat_max_cnt) {
+		res->lat[res->lat_cnt++] = now_ns() - start;
+	}
+}
+
+static void result_start(struct result *res, const char *name,
+			 unsigned long long max_ops)
+{
+	memset(res, 0, sizeof(struct result));
+	res->name = name;
+	res->lat_max_cnt = max_ops ? max_ops : 1;
+	res->lat = malloc(sizeof(uint64_t) * res->lat_max_cnt);
+}
+
+static int _cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double percentile_us(struct result *res, double q)
+{
+	if (res->lat_cnt == 0) {
+		return 0.0;
+	}
+	unsigned long long i = q * res->lat_cnt;
+	if (i >= res->lat_cnt) {
+		i = res->lat_cnt - 1;
+	}
+	return res->lat[i] / 1000.0;
+}
+
+static void result_print(struct config *cfg, struct result *res, int first)
+{
+	qsort(res->lat, res->lat_cnt, sizeof(uint64_t), _cmp_u64);
+	double sum = 0.0;
+	unsigned long long i;
+	for (i = 0; i < res->lat_cnt; i++) {
+		sum += res->lat[i];
+	}
+	double mean = res->lat_cnt ? sum / res->lat_cnt / 1000.0 : 0.0;
+	double seconds = res->seconds > 0.0 ? res->seconds : 1e-9;
+	double ops_s = res->ops / seconds;
+	double mb_s = res->bytes / seconds / (1 << 20);
+
+	if (cfg->json) {
+		printf("%s\n    {\"workload\": \"%s\", \"ops\": %llu, "
+		       "\"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+		       "\"mb_per_sec\": %.2f, \"errors\": %llu, "
+		       "\"gc_runs\": %llu, \"disk_ratio\": %.3f,\n"
+		       "     \"latency_us\": {\"mean\": %.2f, "
+		       "\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, "
+		       "\"p999\": %.2f, \"max\": %.2f}",
+		       first ? "" : ",", res->name, res->ops, res->seconds,
+		       ops_s, mb_s, res->errors, res->gc_runs, res->ratio,
+		       mean, percentile_us(res, 0.5), percentile_us(res, 0.9),
+		       percentile_us(res, 0.99), percentile_us(res, 0.999),
+		       percentile_us(res, 1.0));
+		if (res->has_open) {
+			struct ydb_open_phases *o = &res->open;
+			printf(",\n     \"open_ms\": {\"total\": %.2f, "
+			       "\"snapshot\": %.2f, \"index_load\": %.2f, "
+			       "\"index_copy\": %.2f, \"index_build\": %.2f, "
+			       "\"replay\": %.2f, \"cold\": %.2f, "
+			       "\"filter\": %.2f, \"ordered_index\": %.2f}",
+			       o->total_ns / 1e6, o->snapshot_ns / 1e6,
+			       o->index_load_ns / 1e6, o->index_copy_ns / 1e6,
+			       o->index_build_ns / 1e6, o->replay_ns / 1e6,
+			       o->cold_ns / 1e6, o->filter_ns / 1e6,
+			       o->ordered_index_ns / 1e6);
+		}
+		printf("}");
+	} else {
+		if (first) {
+			printf("%-12s %10s %8s %11s %8s %9s %9s %9s %9s\n",
+			       "workload", "ops", "seconds", "ops/s", "MB/s",
+			       "p50 us", "p99 us", "p999 us", "max us");
+		}
+		printf("%-12s %10llu %8.3f %11.1f %8.2f %9.2f %9.2f %9.2f "
+		       "%9.2f%s\n", res->name, res->ops, res->seconds, ops_s,
+		       mb_s, percentile_us(res, 0.5), percentile_us(res, 0.99),
+		       percentile_us(res, 0.999), percentile_us(res, 1.0),
+		       res->errors ? "  ERRORS" : "");
+		if (res->has_open) {
+			struct ydb_open_phases *o = &res->open;
+			printf("  phases ms: snapshot %.1f, index load %.1f "
+			       "(copy %.1f), index build %.1f, replay %.1f, "
+			       "cold %.1f, filter %.1f, ordered index %.1f\n",
+			       o->snapshot_ns / 1e6, o->index_load_ns / 1e6,
+			       o->index_copy_ns / 1e6, o->index_build_ns / 1e6,
+			       o->replay_ns / 1e6, o->cold_ns / 1e6,
+			       o->filter_ns / 1e6, o->ordered_index_ns / 1e6);
+		}
+	}
+	fflush(stdout);
+	free(res->lat);
+	res->lat = NULL;
+}
+
+
+/* Files a database is made of, next to the "index" directory. */
+static int is_ydb_file(const char *filename)
+{
+	return fnmatch("[0-9a-f]*.ydb", filename, FNM_PATHNAME) == 0 ||
+		fnmatch("[0-9a-f]*.blob", filename, FNM_PATHNAME) == 0 ||
+		fnmatch("ydb.format*", filename, FNM_PATHNAME) == 0 ||
+		strcmp(filename, "ydb.log") == 0;
+}
+
+/* A directory that doesn't exist, is empty or holds a database. Other
+ * directories are not benchmarked, their files would be mixed with
+ * the database's ones. */
+static int check_directory(const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return errno == ENOENT ? 0 : -1;
+	}
+	int other = 0, ydb = 0;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0) {
+			continue;
+		}
+		if (is_ydb_file(de->d_name)) {
+			ydb = 1;
+		} else {
+			other = 1;
+		}
+	}
+	closedir(dir);
+	return other && !ydb ? -1 : 0;
+}
+
+/* Remove the files of the database, anything else is left alone. With
+ * 'all' every file goes, for the "index" directory. */
+static void remove_files(const char *path, int all)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return;
+	}
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (all ? de->d_name[0] != '.' : is_ydb_file(de->d_name)) {
+			unlinkat(dirfd(dir), de->d_name, 0);
+		}
+	}
+	closedir(dir);
+	if (!all) {
+		char index_path[4096];
+		snprintf(index_path, sizeof(index_path), "%s/index", path);
+		remove_files(index_path, 1);
+		rmdir(index_path);
+	}
+}
+
+static int _drop_cb(const char *path, const struct stat *st, int flag,
+		    struct FTW *ftw)
+{
+	st = st; ftw = ftw;
+	if (flag == FTW_F) {
+		int fd = open(path, O_RDONLY);
+		if (fd != -1) {
+			/* Dirty pages can't be dropped. */
+			fdatasync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+	return 0;
+}
+
+/* Evict the database from the page cache, without needing root for
+ * /proc/sys/vm/drop_caches. */
+static void drop_caches(const char *path)
+{
+	nftw(path, _drop_cb, 16, FTW_PHYS);
+}
+
+static void bench_open(struct bench *b)
+{
+	b->ydb = ydb_open(b->cfg->directory, &b->cfg->opt);
+	if (b->ydb == NULL) {
+		fprintf(stderr, "Can't open database %s\n",
+			b->cfg->directory);
+		exit(1);
+	}
+}
+
+static void bench_close(struct bench *b)
+{
+	ydb_close(b->ydb);
+	b->ydb = NULL;
+}
+
+static void do_gc(struct bench *b, struct result *res)
+{
+	while (ydb_ratio(b->ydb) > b->cfg->gc_ratio) {
+		if (ydb_roll(b->ydb, 4 << 20) < 0) {
+			res->errors += 1;
+			break;
+		}
+		res->gc_runs += 1;
+	}
+}
+
+/* Writes 'count' items picked by 'next_id', a batch per ydb_write(). */
+static void run_writes(struct bench *b, struct result *res,
+		       unsigned long long count, int gc,
+		       unsigned long long (*next_id)(struct bench *b,
+						     unsigned long long i))
+{
+	struct config *cfg = b->cfg;
+	char key[cfg->key_sz];
+	unsigned long long i = 0;
+	uint64_t t0 = now_ns();
+	while (i < count) {
+		uint64_t start = now_ns();
+		struct ydb_batch *batch = ydb_batch();
+		unsigned j;
+		for (j = 0; j < cfg->batch && i < count; j++, i++) {
+			unsigned long long id = next_id(b, i);
+			unsigned key_sz = make_key(b, key, id);
+			ydb_set(batch, key, key_sz, make_value(b, id),
+				cfg->value_sz);
+		}
+		if (ydb_write(b->ydb, batch, cfg->do_fsync) < 0) {
+			res->errors += 1;
+		}
+		ydb_batch_free(batch);
+		lat_record(res, start);
+		if (gc) {
+			do_gc(b, res);
+		}
+		ydb_poll(b->ydb, 0);
+	}
+	res->seconds = (now_ns() - t0) / 1e9;
+	res->ops = count;
+	res->bytes = count * (cfg->key_sz + cfg->value_sz);
+}
+
+static unsigned long long _id_seq(struct bench *b, unsigned long long i)
+{
+	b = b;
+	return i;
+}
+
+/* A fixed permutation of [0, keys), every key is written once. */
+static unsigned long long _id_perm(struct bench *b, unsigned long long i)
+{
+	if (i == 0) {
+		b->perm_cur = 0;
+	}
+	unsigned long long id = b->perm_cur;
+	b->perm_cur = (b->perm_cur + b->perm_step) % b->cfg->keys;
+	return id;
+}
+
+static unsigned long long _id_random(struct bench *b, unsigned long long i)
+{
+	i = i;
+	return rand64(b) % b->cfg->keys;
+}
+
+static unsigned long long _id_zipf(struct bench *b, unsigned long long i)
+{
+	i = i;
+	return zipf_next(b);
+}
+
+static unsigned long long _id_miss(struct bench *b, unsigned long long i)
+{
+	i = i;
+	return b->cfg->keys + rand64(b) % b->cfg->keys;
+}
+
+/* Every write of a key stores the same value, found ones must match
+ * it. */
+static int check_get(struct bench *b, unsigned long long id, int r,
+		     const char *value)
+{
+	if (id >= b->cfg->keys) {
+		return r == YDB_NOT_FOUND;
+	}
+	return r == (int)b->cfg->value_sz &&
+		memcmp(value, make_value(b, id), b->cfg->value_sz) == 0;
+}
+
+struct pending {
+	struct bench *b;
+	uint64_t start;
+	unsigned long long id;
+};
+
+static void _async_cb(void *ud, int r, const char *value, unsigned value_sz)
+{
+	struct pending *p = ud;
+	struct bench *b = p->b;
+	lat_record(b->result, p->start);
+	value_sz = value_sz;
+	if (!check_get(b, p->id, r, value)) {
+		b->result->errors += 1;
+	}
+	b->outstanding -= 1;
+	free(p);
+}
+
+static void get_one(struct bench *b, struct result *res, char *buf,
+		    unsigned long long id)
+{
+	struct config *cfg = b->cfg;
+	char key[cfg->key_sz];
+	unsigned key_sz = make_key(b, key, id);
+	if (cfg->threads > 1) {
+		/* Keep the workers busy, a few gets queued each. */
+		while (b->outstanding >= cfg->threads * 4) {
+			ydb_poll(b->ydb, -1);
+		}
+		struct pending *p = malloc(sizeof(struct pending));
+		p->b = b;
+		p->start = now_ns();
+		p->id = id;
+		b->outstanding += 1;
+		ydb_get_async(b->ydb, key, key_sz, _async_cb, p);
+		return;
+	}
+	uint64_t start = now_ns();
+	int r = ydb_get(b->ydb, key, key_sz, buf, cfg->value_sz);
+	lat_record(res, start);
+	if (!check_get(b, id, r, buf)) {
+		res->errors += 1;
+	}
+}
+
+static void drain(struct bench *b)
+{
+	while (b->outstanding) {
+		ydb_poll(b->ydb, -1);
+	}
+}
+
+static void run_gets(struct bench *b, struct result *res,
+		     unsigned long long (*next_id)(struct bench *b,
+						   unsigned long long i))
+{
+	struct config *cfg = b->cfg;
+	char buf[cfg->value_sz + 1];
+	unsigned long long i;
+	b->result = res;
+	uint64_t t0 = now_ns();
+	for (i = 0; i < cfg->ops; i++) {
+		get_one(b, res, buf, next_id(b, i));
+	}
+	drain(b);
+	res->seconds = (now_ns() - t0) / 1e9;
+	res->ops = cfg->ops;
+	res->bytes = cfg->ops * cfg->value_sz;
+}
+
+/* Zipfian keys, each operation a get or an update of a single key. */
+static void run_mixed(struct bench *b, struct result *res)
+{
+	struct config *cfg = b->cfg;
+	char buf[cfg->value_sz + 1];
+	char key[cfg->key_sz];
+	unsigned long long i;
+	b->result = res;
+	uint64_t t0 = now_ns();
+	for (i = 0; i < cfg->ops; i++) {
+		unsigned long long id = zipf_next(b);
+		if (rand_double(b) < cfg->read_fraction) {
+			get_one(b, res, buf, id);
+			continue;
+		}
+		uint64_t start = now_ns();
+		unsigned key_sz = make_key(b, key, id);
+		struct ydb_batch *batch = ydb_batch();
+		ydb_set(batch, key, key_sz, make_value(b, id), cfg->value_sz);
+		if (ydb_write(b->ydb, batch, cfg->do_fsync) < 0) {
+			res->errors += 1;
+		}
+		ydb_batch_free(batch);
+		lat_record(res, start);
+	}
+	drain(b);
+	res->seconds = (now_ns() - t0) / 1e9;
+	res->ops = cfg->ops;
+	res->bytes = cfg->ops * cfg->value_sz;
+}
+
+struct iter_state {
+	unsigned long long items;
+	unsigned long long bytes;
+};
+
+static int _iter_cb(void *ud, const char *key, unsigned key_sz,
+		    const char *value, unsigned value_sz)
+{
+	struct iter_state *st = ud;
+	key = key; value = value;
+	st->items += 1;
+	st->bytes += key_sz + value_sz;
+	return 0;
+}
+
+static void run_iterate(struct bench *b, struct result *res)
+{
+	unsigned threads = b->cfg->threads ? b->cfg->threads : 1;
+	struct iter_state st[threads];
+	void *userdata[threads];
+	unsigned i;
+	memset(st, 0, sizeof(st));
+	for (i = 0; i < threads; i++) {
+		userdata[i] = &st[i];
+	}
+	uint64_t start = now_ns();
+	int r;
+	if (threads > 1) {
+		r = ydb_iterate_parallel(b->ydb, threads, 4 << 20, _iter_cb,
+					 userdata);
+	} else {
+		r = ydb_iterate(b->ydb, 4 << 20, _iter_cb, &st[0]);
+	}
+	lat_record(res, start);
+	res->seconds = (now_ns() - start) / 1e9;
+	if (r != 0) {
+		res->errors += 1;
+	}
+	for (i = 0; i < threads; i++) {
+		res->ops += st[i].items;
+		res->bytes += st[i].bytes;
+	}
+}
+
+/* Time to open the database. With 'replay' the index is removed first
+ * and the logs are read back, with 'cold' files are read from the
+ * disk. */
+static void run_reopen(struct bench *b, struct result *res, int replay,
+		       int cold)
+{
+	bench_close(b);
+	if (replay) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/index", b->cfg->directory);
+		remove_files(path, 1);
+	}
+	if (cold) {
+		drop_caches(b->cfg->directory);
+	}
+	uint64_t start = now_ns();
+	bench_open(b);
+	lat_record(res, start);
+	res->seconds = (now_ns() - start) / 1e9;
+	res->ops = 1;
+
+	struct ydb_stats stats;
+	ydb_stats(b->ydb, &stats);
+	res->has_open = 1;
+	res->open = stats.open;
+}
+
+static int run_workload(struct bench *b, const char *name, int first)
+{
+	struct config *cfg = b->cfg;
+	struct result res;
+	if (strcmp(name, "fill-seq") == 0 ||
+	    strcmp(name, "fill-random") == 0) {
+		bench_close(b);
+		remove_files(cfg->directory, 0);
+		bench_open(b);
+		result_start(&res, name, cfg->keys / cfg->batch + 1);
+		run_writes(b, &res, cfg->keys, 0,
+			   name[5] == 's' ? _id_seq : _id_perm);
+	} else if (strcmp(name, "read-random") == 0) {
+		result_start(&res, name, cfg->ops);
+		run_gets(b, &res, _id_random);
+	} else if (strcmp(name, "read-miss") == 0) {
+		result_start(&res, name, cfg->ops);
+		run_gets(b, &res, _id_miss);
+	} else if (strcmp(name, "read-hot") == 0) {
+		result_start(&res, name, cfg->ops);
+		run_gets(b, &res, _id_zipf);
+	} else if (strcmp(name, "mixed") == 0) {
+		result_start(&res, name, cfg->ops);
+		run_mixed(b, &res);
+	} else if (strcmp(name, "overwrite") == 0) {
+		result_start(&res, name, cfg->ops / cfg->batch + 1);
+		run_writes(b, &res, cfg->ops, 1, _id_random);
+	} else if (strcmp(name, "iterate") == 0) {
+		result_start(&res, name, 1);
+		run_iterate(b, &res);
+	} else if (strcmp(name, "reopen") == 0) {
+		result_start(&res, name, 1);
+		run_reopen(b, &res, 0, 0);
+	} else if (strcmp(name, "reopen-cold") == 0) {
+		result_start(&res, name, 1);
+		run_reopen(b, &res, 0, 1);
+	} else if (strcmp(name, "replay") == 0) {
+		result_start(&res, name, 1);
+		run_reopen(b, &res, 1, 1);
+	} else {
+		fprintf(stderr, "Unknown workload \"%s\"\n", name);
+		return -1;
+	}
+	res.ratio = ydb_ratio(b->ydb);
+	result_print(cfg, &res, first);
+	return res.errors ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+"Usage: %s [options] <directory>\n"
+"\n"
+"Runs workloads against the database in <directory>, removing the one\n"
+"that was there. A non-empty directory without a database is refused.\n"
+"Options:\n"
+"  -w LIST   comma separated workloads, default:\n"
+"            %s\n"
+"            fill-seq, fill-random   write every key once, to an empty db\n"
+"            read-random, read-miss  gets of existing, missing keys\n"
+"            read-hot                gets of Zipfian distributed keys\n"
+"            mixed                   Zipfian gets and single key updates\n"
+"            overwrite               random updates with garbage collection\n"
+"            iterate                 ydb_iterate() or ydb_iterate_parallel()\n"
+"            reopen, reopen-cold     open time, with a warm or cold page cache\n"
+"            replay                  cold open time without the index\n"
+"  -n N      number of keys (100000)\n"
+"  -o N      operations of read, mixed and overwrite workloads (keys)\n"
+"  -k N      key size (16)\n"
+"  -v N      value size (100)\n"
+"  -b N      items per ydb_write() when filling and overwriting (100)\n"
+"  -t N      threads: asynchronous gets and parallel iteration (1)\n"
+"  -z F      Zipfian constant (0.99)\n"
+"  -r F      fraction of gets in mixed (0.5)\n"
+"  -g F      disk ratio above which overwrite runs ydb_roll() (2.0)\n"
+"  -c N      compression level (0)\n"
+"  -l N      log file size limit in MB (64)\n"
+"  -s N      random seed (1)\n"
+"  -f        fsync every write\n"
+"  -j        print results as JSON\n",
+		prog, all_workloads);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct config cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.keys = 100000;
+	cfg.key_sz = 16;
+	cfg.value_sz = 100;
+	cfg.batch = 100;
+	cfg.threads = 1;
+	cfg.zipf_theta = 0.99;
+	cfg.read_fraction = 0.5;
+	cfg.gc_ratio = 2.0;
+	cfg.opt.log_file_size_limit = 64 << 20;
+	const char *workloads = all_workloads;
+	unsigned long long seed = 1;
+
+	int c;
+	while ((c = getopt(argc, argv, "w:n:o:k:v:b:t:z:r:g:c:l:s:fjh")) != -1) {
+		switch (c) {
+		case 'w': workloads = optarg; break;
+		case 'n': cfg.keys = strtoull(optarg, NULL, 10); break;
+		case 'o': cfg.ops = strtoull(optarg, NULL, 10); break;
+		case 'k': cfg.key_sz = atoi(optarg); break;
+		case 'v': cfg.value_sz = atoi(optarg); break;
+		case 'b': cfg.batch = atoi(optarg); break;
+		case 't': cfg.threads = atoi(optarg); break;
+		case 'z': cfg.zipf_theta = atof(optarg); break;
+		case 'r': cfg.read_fraction = atof(optarg); break;
+		case 'g': cfg.gc_ratio = atof(optarg); break;
+		case 'c': cfg.opt.compress_level = atoi(optarg); break;
+		case 'l': cfg.opt.log_file_size_limit =
+				strtoull(optarg, NULL, 10) << 20; break;
+		case 's': seed = strtoull(optarg, NULL, 10); break;
+		case 'f': cfg.do_fsync = 1; break;
+		case 'j': cfg.json = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc || cfg.keys < 2 || cfg.key_sz < 8 ||
+	    cfg.value_sz < 1 || cfg.batch < 1 || cfg.threads < 1 ||
+	    cfg.zipf_theta <= 0.0 || cfg.zipf_theta >= 1.0) {
+		usage(argv[0]);
+	}
+	cfg.directory = argv[optind];
+	if (check_directory(cfg.directory) < 0) {
+		fprintf(stderr, "%s: not a database directory: \"%s\"\n",
+			argv[0], cfg.directory);
+		return 2;
+	}
+	if (cfg.ops == 0) {
+		cfg.ops = cfg.keys;
+	}
+	if (cfg.threads > 1) {
+		cfg.opt.worker_threads = cfg.threads;
+	}
+
+	struct bench b;
+	memset(&b, 0, sizeof(b));
+	b.cfg = &cfg;
+	b.rand = seed * 0x9E3779B97F4A7C15ULL + 1;
+	b.values_sz = cfg.value_sz + (1 << 20);
+	b.values = malloc(b.values_sz);
+	unsigned i;
+	for (i = 0; i < b.values_sz; i++) {
+		/* Compressible about in half, like db_bench does. */
+		b.values[i] = i % 2 ? 'a' + rand64(&b) % 26 : ' ';
+	}
+	perm_init(&b);
+
+	if (cfg.json) {
+		printf("{\"config\": {\"keys\": %llu, \"ops\": %llu, "
+		       "\"key_size\": %u, \"value_size\": %u, "
+		       "\"batch\": %u, \"threads\": %u, \"zipf\": %.3f, "
+		       "\"read_fraction\": %.3f, \"gc_ratio\": %.3f, "
+		       "\"compress_level\": %i, \"fsync\": %i},\n"
+		       " \"results\": [",
+		       cfg.keys, cfg.ops, cfg.key_sz, cfg.value_sz, cfg.batch,
+		       cfg.threads, cfg.zipf_theta, cfg.read_fraction,
+		       cfg.gc_ratio, cfg.opt.compress_level, cfg.do_fsync);
+	}
+
+	remove_files(cfg.directory, 0);
+	bench_open(&b);
+
+	int ret = 0;
+	char *list = strdup(workloads);
+	char *saveptr;
+	char *name = strtok_r(list, ",", &saveptr);
+	int first = 1;
+	while (name) {
+		if (run_workload(&b, name, first) < 0) {
+			ret = 1;
+		}
+		first = 0;
+		name = strtok_r(NULL, ",", &saveptr);
+	}
+	free(list);
+
+	if (cfg.json) {
+		printf("\n]}\n");
+	}
+	bench_close(&b);
+	free(b.values);
+	return ret;
+}
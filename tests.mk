@@ -0,0 +1,509 @@
+
+.PHONY: test-normal-defrag
+test-normal-defrag: normal-defrag-mock.out normal-defrag-ydb.out
+	@diff $^ > /dev/null && \
+		echo " [+] Test normal-defrag: ok!" || \
+		(echo " [!] Test normal-defrag: FAILED: diff $^"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-defrag-db |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (parallel): ok!" || \
+		(echo " [!] Test normal-defrag (parallel): FAILED"; exit 1;)
+	@YDB_TEST_ORDERED=1 ./src_tests/test_ydb_read /tmp/normal-defrag-db |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (ordered): ok!" || \
+		(echo " [!] Test normal-defrag (ordered): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/normal-defrag-db |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (get): ok!" || \
+		(echo " [!] Test normal-defrag (get): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-defrag-dbz
+	@cat tests/base-normal.in tests/test-defrag.in | YDB_TEST_COMPRESS=6 YDB_TEST_DEFRAG_WASTE=1 \
+		YDB_TEST_HUGE_PAGES=1 ./src_tests/test_ydb_write /tmp/normal-defrag-dbz
+	@./src_tests/test_ydb_read /tmp/normal-defrag-dbz |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (compressed): ok!" || \
+		(echo " [!] Test normal-defrag (compressed): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-defrag-dbb
+	@cat tests/base-normal.in tests/test-defrag.in | YDB_TEST_COMPRESS=1 YDB_TEST_BLOCK_SIZE=16384 \
+		YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_write /tmp/normal-defrag-dbb
+	@./src_tests/test_ydb_read /tmp/normal-defrag-dbb |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (blocks): ok!" || \
+		(echo " [!] Test normal-defrag (blocks): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_read /tmp/normal-defrag-dbb |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (blocks, parallel): ok!" || \
+		(echo " [!] Test normal-defrag (blocks, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-defrag-dbp
+	@cat tests/base-normal.in tests/test-defrag.in | YDB_TEST_COMPRESS=6 YDB_TEST_WRITE_EVERY=64 \
+		./src_tests/test_ydb_write /tmp/normal-defrag-dbp
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-defrag-dbp |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (compressed, parallel): ok!" || \
+		(echo " [!] Test normal-defrag (compressed, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-defrag-dbw
+	@cat tests/base-normal.in tests/test-defrag.in | YDB_TEST_WIDE=1 YDB_TEST_RESIDENT_LOGS=2 YDB_TEST_HASHED=1 \
+		./src_tests/test_ydb_write /tmp/normal-defrag-dbw
+	@./src_tests/test_ydb_read /tmp/normal-defrag-dbw |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (wide): ok!" || \
+		(echo " [!] Test normal-defrag (wide): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 YDB_TEST_DIRECT_IO=2 YDB_TEST_BROKEN_SDX=1 \
+		./src_tests/test_ydb_read /tmp/normal-defrag-dbw |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (wide, get): ok!" || \
+		(echo " [!] Test normal-defrag (wide, get): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-defrag-dbl
+	@cat tests/base-normal.in tests/test-defrag.in | YDB_TEST_BLOB_THRESHOLD=5 YDB_TEST_FILTER=10 \
+		./src_tests/test_ydb_write /tmp/normal-defrag-dbl
+	@./src_tests/test_ydb_read /tmp/normal-defrag-dbl |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (blobs): ok!" || \
+		(echo " [!] Test normal-defrag (blobs): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-defrag-dbl |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (blobs, parallel): ok!" || \
+		(echo " [!] Test normal-defrag (blobs, parallel): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/normal-defrag-dbl |sort | \
+		diff normal-defrag-mock.out - > /dev/null && \
+		echo " [+] Test normal-defrag (blobs, get): ok!" || \
+		(echo " [!] Test normal-defrag (blobs, get): FAILED"; exit 1;)
+
+normal-defrag-mock.out: tests/base-normal.in tests/test-defrag.in
+	python src_tests/mockdb.py $^ |sort > $@
+
+.PHONY: normal-defrag-ydb.out
+normal-defrag-ydb.out: tests/base-normal.in tests/test-defrag.in
+	@rm -rf /tmp/normal-defrag-db
+	cat $^ | ./src_tests/test_ydb_write /tmp/normal-defrag-db
+	./src_tests/test_ydb_read /tmp/normal-defrag-db |sort > $@
+
+clean_tests::
+	rm -rf /tmp/normal-defrag-db /tmp/normal-defrag-dbz /tmp/normal-defrag-dbb /tmp/normal-defrag-dbp /tmp/normal-defrag-dbw /tmp/normal-defrag-dbl
+
+
+
+.PHONY: test-normal-stress-gc
+test-normal-stress-gc: normal-stress-gc-mock.out normal-stress-gc-ydb.out
+	@diff $^ > /dev/null && \
+		echo " [+] Test normal-stress-gc: ok!" || \
+		(echo " [!] Test normal-stress-gc: FAILED: diff $^"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-stress-gc-db |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (parallel): ok!" || \
+		(echo " [!] Test normal-stress-gc (parallel): FAILED"; exit 1;)
+	@YDB_TEST_ORDERED=1 ./src_tests/test_ydb_read /tmp/normal-stress-gc-db |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (ordered): ok!" || \
+		(echo " [!] Test normal-stress-gc (ordered): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/normal-stress-gc-db |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (get): ok!" || \
+		(echo " [!] Test normal-stress-gc (get): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-stress-gc-dbz
+	@cat tests/base-normal.in tests/test-stress-gc.in | YDB_TEST_COMPRESS=6 YDB_TEST_DEFRAG_WASTE=1 \
+		YDB_TEST_HUGE_PAGES=1 ./src_tests/test_ydb_write /tmp/normal-stress-gc-dbz
+	@./src_tests/test_ydb_read /tmp/normal-stress-gc-dbz |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (compressed): ok!" || \
+		(echo " [!] Test normal-stress-gc (compressed): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-stress-gc-dbb
+	@cat tests/base-normal.in tests/test-stress-gc.in | YDB_TEST_COMPRESS=1 YDB_TEST_BLOCK_SIZE=16384 \
+		YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_write /tmp/normal-stress-gc-dbb
+	@./src_tests/test_ydb_read /tmp/normal-stress-gc-dbb |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (blocks): ok!" || \
+		(echo " [!] Test normal-stress-gc (blocks): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_read /tmp/normal-stress-gc-dbb |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (blocks, parallel): ok!" || \
+		(echo " [!] Test normal-stress-gc (blocks, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-stress-gc-dbp
+	@cat tests/base-normal.in tests/test-stress-gc.in | YDB_TEST_COMPRESS=6 YDB_TEST_WRITE_EVERY=64 \
+		./src_tests/test_ydb_write /tmp/normal-stress-gc-dbp
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-stress-gc-dbp |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (compressed, parallel): ok!" || \
+		(echo " [!] Test normal-stress-gc (compressed, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-stress-gc-dbw
+	@cat tests/base-normal.in tests/test-stress-gc.in | YDB_TEST_WIDE=1 YDB_TEST_RESIDENT_LOGS=2 YDB_TEST_HASHED=1 \
+		./src_tests/test_ydb_write /tmp/normal-stress-gc-dbw
+	@./src_tests/test_ydb_read /tmp/normal-stress-gc-dbw |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (wide): ok!" || \
+		(echo " [!] Test normal-stress-gc (wide): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 YDB_TEST_DIRECT_IO=2 YDB_TEST_BROKEN_SDX=1 \
+		./src_tests/test_ydb_read /tmp/normal-stress-gc-dbw |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (wide, get): ok!" || \
+		(echo " [!] Test normal-stress-gc (wide, get): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-stress-gc-dbl
+	@cat tests/base-normal.in tests/test-stress-gc.in | YDB_TEST_BLOB_THRESHOLD=5 YDB_TEST_FILTER=10 \
+		./src_tests/test_ydb_write /tmp/normal-stress-gc-dbl
+	@./src_tests/test_ydb_read /tmp/normal-stress-gc-dbl |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (blobs): ok!" || \
+		(echo " [!] Test normal-stress-gc (blobs): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-stress-gc-dbl |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (blobs, parallel): ok!" || \
+		(echo " [!] Test normal-stress-gc (blobs, parallel): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/normal-stress-gc-dbl |sort | \
+		diff normal-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test normal-stress-gc (blobs, get): ok!" || \
+		(echo " [!] Test normal-stress-gc (blobs, get): FAILED"; exit 1;)
+
+normal-stress-gc-mock.out: tests/base-normal.in tests/test-stress-gc.in
+	python src_tests/mockdb.py $^ |sort > $@
+
+.PHONY: normal-stress-gc-ydb.out
+normal-stress-gc-ydb.out: tests/base-normal.in tests/test-stress-gc.in
+	@rm -rf /tmp/normal-stress-gc-db
+	cat $^ | ./src_tests/test_ydb_write /tmp/normal-stress-gc-db
+	./src_tests/test_ydb_read /tmp/normal-stress-gc-db |sort > $@
+
+clean_tests::
+	rm -rf /tmp/normal-stress-gc-db /tmp/normal-stress-gc-dbz /tmp/normal-stress-gc-dbb /tmp/normal-stress-gc-dbp /tmp/normal-stress-gc-dbw /tmp/normal-stress-gc-dbl
+
+
+
+.PHONY: test-normal-overwrites
+test-normal-overwrites: normal-overwrites-mock.out normal-overwrites-ydb.out
+	@diff $^ > /dev/null && \
+		echo " [+] Test normal-overwrites: ok!" || \
+		(echo " [!] Test normal-overwrites: FAILED: diff $^"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-overwrites-db |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (parallel): ok!" || \
+		(echo " [!] Test normal-overwrites (parallel): FAILED"; exit 1;)
+	@YDB_TEST_ORDERED=1 ./src_tests/test_ydb_read /tmp/normal-overwrites-db |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (ordered): ok!" || \
+		(echo " [!] Test normal-overwrites (ordered): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/normal-overwrites-db |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (get): ok!" || \
+		(echo " [!] Test normal-overwrites (get): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-overwrites-dbz
+	@cat tests/base-normal.in tests/test-overwrites.in | YDB_TEST_COMPRESS=6 YDB_TEST_DEFRAG_WASTE=1 \
+		YDB_TEST_HUGE_PAGES=1 ./src_tests/test_ydb_write /tmp/normal-overwrites-dbz
+	@./src_tests/test_ydb_read /tmp/normal-overwrites-dbz |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (compressed): ok!" || \
+		(echo " [!] Test normal-overwrites (compressed): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-overwrites-dbb
+	@cat tests/base-normal.in tests/test-overwrites.in | YDB_TEST_COMPRESS=1 YDB_TEST_BLOCK_SIZE=16384 \
+		YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_write /tmp/normal-overwrites-dbb
+	@./src_tests/test_ydb_read /tmp/normal-overwrites-dbb |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (blocks): ok!" || \
+		(echo " [!] Test normal-overwrites (blocks): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_read /tmp/normal-overwrites-dbb |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (blocks, parallel): ok!" || \
+		(echo " [!] Test normal-overwrites (blocks, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-overwrites-dbp
+	@cat tests/base-normal.in tests/test-overwrites.in | YDB_TEST_COMPRESS=6 YDB_TEST_WRITE_EVERY=64 \
+		./src_tests/test_ydb_write /tmp/normal-overwrites-dbp
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-overwrites-dbp |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (compressed, parallel): ok!" || \
+		(echo " [!] Test normal-overwrites (compressed, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-overwrites-dbw
+	@cat tests/base-normal.in tests/test-overwrites.in | YDB_TEST_WIDE=1 YDB_TEST_RESIDENT_LOGS=2 YDB_TEST_HASHED=1 \
+		./src_tests/test_ydb_write /tmp/normal-overwrites-dbw
+	@./src_tests/test_ydb_read /tmp/normal-overwrites-dbw |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (wide): ok!" || \
+		(echo " [!] Test normal-overwrites (wide): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 YDB_TEST_DIRECT_IO=2 YDB_TEST_BROKEN_SDX=1 \
+		./src_tests/test_ydb_read /tmp/normal-overwrites-dbw |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (wide, get): ok!" || \
+		(echo " [!] Test normal-overwrites (wide, get): FAILED"; exit 1;)
+	@rm -rf /tmp/normal-overwrites-dbl
+	@cat tests/base-normal.in tests/test-overwrites.in | YDB_TEST_BLOB_THRESHOLD=5 YDB_TEST_FILTER=10 \
+		./src_tests/test_ydb_write /tmp/normal-overwrites-dbl
+	@./src_tests/test_ydb_read /tmp/normal-overwrites-dbl |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (blobs): ok!" || \
+		(echo " [!] Test normal-overwrites (blobs): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/normal-overwrites-dbl |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (blobs, parallel): ok!" || \
+		(echo " [!] Test normal-overwrites (blobs, parallel): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/normal-overwrites-dbl |sort | \
+		diff normal-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test normal-overwrites (blobs, get): ok!" || \
+		(echo " [!] Test normal-overwrites (blobs, get): FAILED"; exit 1;)
+
+normal-overwrites-mock.out: tests/base-normal.in tests/test-overwrites.in
+	python src_tests/mockdb.py $^ |sort > $@
+
+.PHONY: normal-overwrites-ydb.out
+normal-overwrites-ydb.out: tests/base-normal.in tests/test-overwrites.in
+	@rm -rf /tmp/normal-overwrites-db
+	cat $^ | ./src_tests/test_ydb_write /tmp/normal-overwrites-db
+	./src_tests/test_ydb_read /tmp/normal-overwrites-db |sort > $@
+
+clean_tests::
+	rm -rf /tmp/normal-overwrites-db /tmp/normal-overwrites-dbz /tmp/normal-overwrites-dbb /tmp/normal-overwrites-dbp /tmp/normal-overwrites-dbw /tmp/normal-overwrites-dbl
+
+
+
+.PHONY: test-aggresive-defrag
+test-aggresive-defrag: aggresive-defrag-mock.out aggresive-defrag-ydb.out
+	@diff $^ > /dev/null && \
+		echo " [+] Test aggresive-defrag: ok!" || \
+		(echo " [!] Test aggresive-defrag: FAILED: diff $^"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-defrag-db |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (parallel): ok!" || \
+		(echo " [!] Test aggresive-defrag (parallel): FAILED"; exit 1;)
+	@YDB_TEST_ORDERED=1 ./src_tests/test_ydb_read /tmp/aggresive-defrag-db |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (ordered): ok!" || \
+		(echo " [!] Test aggresive-defrag (ordered): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/aggresive-defrag-db |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (get): ok!" || \
+		(echo " [!] Test aggresive-defrag (get): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-defrag-dbz
+	@cat tests/base-aggresive.in tests/test-defrag.in | YDB_TEST_COMPRESS=6 YDB_TEST_DEFRAG_WASTE=1 \
+		YDB_TEST_HUGE_PAGES=1 ./src_tests/test_ydb_write /tmp/aggresive-defrag-dbz
+	@./src_tests/test_ydb_read /tmp/aggresive-defrag-dbz |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (compressed): ok!" || \
+		(echo " [!] Test aggresive-defrag (compressed): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-defrag-dbb
+	@cat tests/base-aggresive.in tests/test-defrag.in | YDB_TEST_COMPRESS=1 YDB_TEST_BLOCK_SIZE=16384 \
+		YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_write /tmp/aggresive-defrag-dbb
+	@./src_tests/test_ydb_read /tmp/aggresive-defrag-dbb |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (blocks): ok!" || \
+		(echo " [!] Test aggresive-defrag (blocks): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_read /tmp/aggresive-defrag-dbb |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (blocks, parallel): ok!" || \
+		(echo " [!] Test aggresive-defrag (blocks, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-defrag-dbp
+	@cat tests/base-aggresive.in tests/test-defrag.in | YDB_TEST_COMPRESS=6 YDB_TEST_WRITE_EVERY=64 \
+		./src_tests/test_ydb_write /tmp/aggresive-defrag-dbp
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-defrag-dbp |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (compressed, parallel): ok!" || \
+		(echo " [!] Test aggresive-defrag (compressed, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-defrag-dbw
+	@cat tests/base-aggresive.in tests/test-defrag.in | YDB_TEST_WIDE=1 YDB_TEST_RESIDENT_LOGS=2 YDB_TEST_HASHED=1 \
+		./src_tests/test_ydb_write /tmp/aggresive-defrag-dbw
+	@./src_tests/test_ydb_read /tmp/aggresive-defrag-dbw |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (wide): ok!" || \
+		(echo " [!] Test aggresive-defrag (wide): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 YDB_TEST_DIRECT_IO=2 YDB_TEST_BROKEN_SDX=1 \
+		./src_tests/test_ydb_read /tmp/aggresive-defrag-dbw |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (wide, get): ok!" || \
+		(echo " [!] Test aggresive-defrag (wide, get): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-defrag-dbl
+	@cat tests/base-aggresive.in tests/test-defrag.in | YDB_TEST_BLOB_THRESHOLD=5 YDB_TEST_FILTER=10 \
+		./src_tests/test_ydb_write /tmp/aggresive-defrag-dbl
+	@./src_tests/test_ydb_read /tmp/aggresive-defrag-dbl |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (blobs): ok!" || \
+		(echo " [!] Test aggresive-defrag (blobs): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-defrag-dbl |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (blobs, parallel): ok!" || \
+		(echo " [!] Test aggresive-defrag (blobs, parallel): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/aggresive-defrag-dbl |sort | \
+		diff aggresive-defrag-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-defrag (blobs, get): ok!" || \
+		(echo " [!] Test aggresive-defrag (blobs, get): FAILED"; exit 1;)
+
+aggresive-defrag-mock.out: tests/base-aggresive.in tests/test-defrag.in
+	python src_tests/mockdb.py $^ |sort > $@
+
+.PHONY: aggresive-defrag-ydb.out
+aggresive-defrag-ydb.out: tests/base-aggresive.in tests/test-defrag.in
+	@rm -rf /tmp/aggresive-defrag-db
+	cat $^ | ./src_tests/test_ydb_write /tmp/aggresive-defrag-db
+	./src_tests/test_ydb_read /tmp/aggresive-defrag-db |sort > $@
+
+clean_tests::
+	rm -rf /tmp/aggresive-defrag-db /tmp/aggresive-defrag-dbz /tmp/aggresive-defrag-dbb /tmp/aggresive-defrag-dbp /tmp/aggresive-defrag-dbw /tmp/aggresive-defrag-dbl
+
+
+
+.PHONY: test-aggresive-stress-gc
+test-aggresive-stress-gc: aggresive-stress-gc-mock.out aggresive-stress-gc-ydb.out
+	@diff $^ > /dev/null && \
+		echo " [+] Test aggresive-stress-gc: ok!" || \
+		(echo " [!] Test aggresive-stress-gc: FAILED: diff $^"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-stress-gc-db |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (parallel): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (parallel): FAILED"; exit 1;)
+	@YDB_TEST_ORDERED=1 ./src_tests/test_ydb_read /tmp/aggresive-stress-gc-db |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (ordered): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (ordered): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/aggresive-stress-gc-db |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (get): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (get): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-stress-gc-dbz
+	@cat tests/base-aggresive.in tests/test-stress-gc.in | YDB_TEST_COMPRESS=6 YDB_TEST_DEFRAG_WASTE=1 \
+		YDB_TEST_HUGE_PAGES=1 ./src_tests/test_ydb_write /tmp/aggresive-stress-gc-dbz
+	@./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbz |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (compressed): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (compressed): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-stress-gc-dbb
+	@cat tests/base-aggresive.in tests/test-stress-gc.in | YDB_TEST_COMPRESS=1 YDB_TEST_BLOCK_SIZE=16384 \
+		YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_write /tmp/aggresive-stress-gc-dbb
+	@./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbb |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (blocks): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (blocks): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbb |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (blocks, parallel): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (blocks, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-stress-gc-dbp
+	@cat tests/base-aggresive.in tests/test-stress-gc.in | YDB_TEST_COMPRESS=6 YDB_TEST_WRITE_EVERY=64 \
+		./src_tests/test_ydb_write /tmp/aggresive-stress-gc-dbp
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbp |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (compressed, parallel): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (compressed, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-stress-gc-dbw
+	@cat tests/base-aggresive.in tests/test-stress-gc.in | YDB_TEST_WIDE=1 YDB_TEST_RESIDENT_LOGS=2 YDB_TEST_HASHED=1 \
+		./src_tests/test_ydb_write /tmp/aggresive-stress-gc-dbw
+	@./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbw |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (wide): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (wide): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 YDB_TEST_DIRECT_IO=2 YDB_TEST_BROKEN_SDX=1 \
+		./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbw |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (wide, get): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (wide, get): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-stress-gc-dbl
+	@cat tests/base-aggresive.in tests/test-stress-gc.in | YDB_TEST_BLOB_THRESHOLD=5 YDB_TEST_FILTER=10 \
+		./src_tests/test_ydb_write /tmp/aggresive-stress-gc-dbl
+	@./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbl |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (blobs): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (blobs): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbl |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (blobs, parallel): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (blobs, parallel): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/aggresive-stress-gc-dbl |sort | \
+		diff aggresive-stress-gc-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-stress-gc (blobs, get): ok!" || \
+		(echo " [!] Test aggresive-stress-gc (blobs, get): FAILED"; exit 1;)
+
+aggresive-stress-gc-mock.out: tests/base-aggresive.in tests/test-stress-gc.in
+	python src_tests/mockdb.py $^ |sort > $@
+
+.PHONY: aggresive-stress-gc-ydb.out
+aggresive-stress-gc-ydb.out: tests/base-aggresive.in tests/test-stress-gc.in
+	@rm -rf /tmp/aggresive-stress-gc-db
+	cat $^ | ./src_tests/test_ydb_write /tmp/aggresive-stress-gc-db
+	./src_tests/test_ydb_read /tmp/aggresive-stress-gc-db |sort > $@
+
+clean_tests::
+	rm -rf /tmp/aggresive-stress-gc-db /tmp/aggresive-stress-gc-dbz /tmp/aggresive-stress-gc-dbb /tmp/aggresive-stress-gc-dbp /tmp/aggresive-stress-gc-dbw /tmp/aggresive-stress-gc-dbl
+
+
+
+.PHONY: test-aggresive-overwrites
+test-aggresive-overwrites: aggresive-overwrites-mock.out aggresive-overwrites-ydb.out
+	@diff $^ > /dev/null && \
+		echo " [+] Test aggresive-overwrites: ok!" || \
+		(echo " [!] Test aggresive-overwrites: FAILED: diff $^"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-overwrites-db |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (parallel): ok!" || \
+		(echo " [!] Test aggresive-overwrites (parallel): FAILED"; exit 1;)
+	@YDB_TEST_ORDERED=1 ./src_tests/test_ydb_read /tmp/aggresive-overwrites-db |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (ordered): ok!" || \
+		(echo " [!] Test aggresive-overwrites (ordered): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/aggresive-overwrites-db |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (get): ok!" || \
+		(echo " [!] Test aggresive-overwrites (get): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-overwrites-dbz
+	@cat tests/base-aggresive.in tests/test-overwrites.in | YDB_TEST_COMPRESS=6 YDB_TEST_DEFRAG_WASTE=1 \
+		YDB_TEST_HUGE_PAGES=1 ./src_tests/test_ydb_write /tmp/aggresive-overwrites-dbz
+	@./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbz |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (compressed): ok!" || \
+		(echo " [!] Test aggresive-overwrites (compressed): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-overwrites-dbb
+	@cat tests/base-aggresive.in tests/test-overwrites.in | YDB_TEST_COMPRESS=1 YDB_TEST_BLOCK_SIZE=16384 \
+		YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_write /tmp/aggresive-overwrites-dbb
+	@./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbb |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (blocks): ok!" || \
+		(echo " [!] Test aggresive-overwrites (blocks): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 YDB_TEST_DIRECT_IO=1 ./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbb |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (blocks, parallel): ok!" || \
+		(echo " [!] Test aggresive-overwrites (blocks, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-overwrites-dbp
+	@cat tests/base-aggresive.in tests/test-overwrites.in | YDB_TEST_COMPRESS=6 YDB_TEST_WRITE_EVERY=64 \
+		./src_tests/test_ydb_write /tmp/aggresive-overwrites-dbp
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbp |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (compressed, parallel): ok!" || \
+		(echo " [!] Test aggresive-overwrites (compressed, parallel): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-overwrites-dbw
+	@cat tests/base-aggresive.in tests/test-overwrites.in | YDB_TEST_WIDE=1 YDB_TEST_RESIDENT_LOGS=2 YDB_TEST_HASHED=1 \
+		./src_tests/test_ydb_write /tmp/aggresive-overwrites-dbw
+	@./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbw |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (wide): ok!" || \
+		(echo " [!] Test aggresive-overwrites (wide): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 YDB_TEST_DIRECT_IO=2 YDB_TEST_BROKEN_SDX=1 \
+		./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbw |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (wide, get): ok!" || \
+		(echo " [!] Test aggresive-overwrites (wide, get): FAILED"; exit 1;)
+	@rm -rf /tmp/aggresive-overwrites-dbl
+	@cat tests/base-aggresive.in tests/test-overwrites.in | YDB_TEST_BLOB_THRESHOLD=5 YDB_TEST_FILTER=10 \
+		./src_tests/test_ydb_write /tmp/aggresive-overwrites-dbl
+	@./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbl |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (blobs): ok!" || \
+		(echo " [!] Test aggresive-overwrites (blobs): FAILED"; exit 1;)
+	@YDB_TEST_THREADS=4 ./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbl |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (blobs, parallel): ok!" || \
+		(echo " [!] Test aggresive-overwrites (blobs, parallel): FAILED"; exit 1;)
+	@YDB_TEST_GET=1 ./src_tests/test_ydb_read /tmp/aggresive-overwrites-dbl |sort | \
+		diff aggresive-overwrites-mock.out - > /dev/null && \
+		echo " [+] Test aggresive-overwrites (blobs, get): ok!" || \
+		(echo " [!] Test aggresive-overwrites (blobs, get): FAILED"; exit 1;)
+
+aggresive-overwrites-mock.out: tests/base-aggresive.in tests/test-overwrites.in
+	python src_tests/mockdb.py $^ |sort > $@
+
+.PHONY: aggresive-overwrites-ydb.out
+aggresive-overwrites-ydb.out: tests/base-aggresive.in tests/test-overwrites.in
+	@rm -rf /tmp/aggresive-overwrites-db
+	cat $^ | ./src_tests/test_ydb_write /tmp/aggresive-overwrites-db
+	./src_tests/test_ydb_read /tmp/aggresive-overwrites-db |sort > $@
+
+clean_tests::
+	rm -rf /tmp/aggresive-overwrites-db /tmp/aggresive-overwrites-dbz /tmp/aggresive-overwrites-dbb /tmp/aggresive-overwrites-dbp /tmp/aggresive-overwrites-dbw /tmp/aggresive-overwrites-dbl
+
+
+
+clean:: clean_tests
+
+.PHONY: tests
+tests:: test-normal-defrag test-normal-stress-gc test-normal-overwrites test-aggresive-defrag test-aggresive-stress-gc test-aggresive-overwrites